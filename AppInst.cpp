@@ -1,8 +1,75 @@
 #include "AppInst.h"
 
+// std
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
 // d3d
 #include <directxcolors.h>
 
+//
+#include "MeshFile.h"
+
+namespace
+{
+	// maps the binary mesh next to a CSV capture, converting the capture the first time. contentHash identifies the
+	// mesh for the BVH cache, 0 when it came from the text loader
+	MeshData LoadMesh(const std::string& csvPath, std::uint64_t& contentHash)
+	{
+		contentHash = 0;
+
+		const std::string meshPath = csvPath.substr(0, csvPath.rfind('.')) + ".mesh";
+
+		MeshFile file;
+		MeshFile::Status status = file.Open(meshPath);
+
+		if (status != MeshFile::Status::Loaded)
+		{
+			std::vector<MeshFile::Vertex> vertices;
+			std::vector<MeshFile::Index> indices;
+
+			if (MeshFile::ImportCsv(csvPath, vertices, indices) && MeshFile::Write(meshPath, vertices.data(), vertices.size(), indices.data(), indices.size()))
+			{
+				status = file.Open(meshPath);
+			}
+
+			std::stringstream ss;
+			ss << "Mesh: " << meshPath << " converted from " << csvPath << ", " << MeshFile::GetStatusName(status) << "\n";
+			OutputDebugStringA(ss.str().c_str());
+		}
+
+		// the text loader is the last resort
+		if (status != MeshFile::Status::Loaded)
+		{
+			return MeshManager::LoadModel(csvPath);
+		}
+
+		static_assert(sizeof(VertexData) == sizeof(MeshFile::Vertex), "MeshFile::Vertex must match VertexData");
+
+		// bulk copies out of the mapping, MeshManager owns its vertices and indices
+		MeshData mesh;
+		mesh.vertices.assign(reinterpret_cast<const VertexData*>(file.GetVertices()), reinterpret_cast<const VertexData*>(file.GetVertices()) + file.GetVertexCount());
+		mesh.indices.assign(file.GetIndices(), file.GetIndices() + file.GetIndexCount());
+		mesh.indexCount = UINT(file.GetIndexCount());
+
+		contentHash = file.GetContentHash();
+
+		return mesh;
+	}
+
+	// true on the update the key goes down, bWasDown keeps its state between the calls
+	bool IsKeyPressed(const int key, bool& bWasDown)
+	{
+		const bool bDown = (GetAsyncKeyState(key) & 0x8000) != 0;
+		const bool bPressed = bDown && !bWasDown;
+		bWasDown = bDown;
+
+		return bPressed;
+	}
+}
+
 AppInst::AppInst(HINSTANCE instance)
 	: AppBase(instance)
 {}
@@ -50,10 +117,15 @@ bool AppInst::Init()
 	{
 		Object object;
 
-		MeshData mesh = MeshManager::LoadModel("models/bridge_ib_order.csv");
-		//MeshData mesh = MeshManager::LoadModel("models/bridge_vb_order.csv");
+		std::uint64_t contentHash = 0;
+
+		MeshData mesh = LoadMesh("models/bridge_ib_order.csv", contentHash);
+		//MeshData mesh = LoadMesh("models/bridge_vb_order.csv", contentHash);
 		object.mesh = mMeshManager.AddMesh("bridge", mesh);
 
+		// the BVH cache is keyed by the hash in the file instead of the vertices
+		mBVH.SetMeshKey(object.mesh, contentHash);
+
 		Material material;
 		XMStoreFloat4(&material.diffuse, DirectX::Colors::White);
 		material.fresnel = XMFLOAT3(0.1f, 0.1f, 0.1f);
@@ -98,7 +170,7 @@ bool AppInst::Init()
 		MeshData mesh = MeshManager::CreateGrid(50, 50, 2, 2);
 		object.mesh = mMeshManager.AddMesh("grid", mesh);
 
-		XMStoreFloat4x4(&object.world, XMMatrixTranslation(1, -3, 1));
+		XMStoreFloat4x4(&object.world, XMMatrixTranslation(1, kGridHeight, 1));
 
 		Material material;
 		XMStoreFloat4(&material.diffuse, DirectX::Colors::DarkSlateGray);
@@ -171,10 +243,40 @@ bool AppInst::Init()
 	//mTextureManager.LoadTexturesIntoTexture2DArray("DiffuseTextureArray", paths);
 
 	mBVH.Init(mDevice, mContext);
+	mBVH.SetCachePath("bvh.cache");
 	mBVH.BuildBVH(mObjectManager.GetObjects(), mMeshManager, mMaterialManager);
 
 	mRayTraced.Init(mDevice, mContext);
 
+#if RAYTRACED_TILES
+	mRayTracedTiles.Init(mDevice, mContext);
+	mRayTracedCompute.Init(mDevice, mContext);
+#endif // RAYTRACED_TILES
+
+#if RAYTRACED_DEFERRED
+	mRayTracedHits.Init(mDevice, mContext);
+#endif // RAYTRACED_DEFERRED
+
+#if RAYTRACED_SSPR || RAYTRACED_HIZ
+	mFrameHistory.Init(mDevice, mContext);
+#endif // RAYTRACED_SSPR || RAYTRACED_HIZ
+
+#if RAYTRACED_SSPR
+	mSSPR.Init(mDevice, mContext, kGridHeight);
+#endif // RAYTRACED_SSPR
+
+#if RAYTRACED_HIZ
+	mHiZ.Init(mDevice, mContext);
+#endif // RAYTRACED_HIZ
+
+#if RAYTRACED_REDUCED
+	mReducedReflections.Init(mDevice, mContext);
+#endif // RAYTRACED_REDUCED
+
+#if BVH_COUNTERS
+	mTraversalCounters.Init(mDevice, mContext);
+#endif // BVH_COUNTERS
+
 	mWavesNormalMapOffset0 = XMFLOAT2(0, 0);
 	mWavesNormalMapOffset1 = XMFLOAT2(0, 0);
 
@@ -207,6 +309,95 @@ void AppInst::Update(const Timer& timer)
 						 mLighting.GetLightDirection(0),
 						 mCamera.GetPositionF());
 
+#if RAYTRACED_TILES
+	// C switches the raytraced passes between the pixel and the compute shaders
+	if (IsKeyPressed('C', mbComputeKeyDown))
+	{
+		mbRayTracedCompute = !mbRayTracedCompute;
+
+		OutputDebugStringA(mbRayTracedCompute ? "raytraced passes: compute\n" : "raytraced passes: pixel\n");
+	}
+#endif // RAYTRACED_TILES
+
+#if RAYTRACED_SSPR || RAYTRACED_HIZ
+	mFrameHistory.Update(mCamera.GetViewProjInvF(), mCamera.GetPositionF());
+#endif // RAYTRACED_SSPR || RAYTRACED_HIZ
+
+#if RAYTRACED_SSPR
+	// reflective pixels left to the raytraced reflections once per second
+	mSSPRTotalsTime += timer.GetDeltaTime();
+
+	if (mSSPRTotalsTime >= 1.0f)
+	{
+		mSSPRTotalsTime = 0.0f;
+
+		const SSPR::Totals& totals = mSSPR.GetTotals();
+
+		std::stringstream ss;
+		ss << "SSPR: " << totals.fallbackPixels << " of " << totals.reflectivePixels << " reflective pixels raytraced\n";
+
+		OutputDebugStringA(ss.str().c_str());
+	}
+#endif // RAYTRACED_SSPR
+
+#if RAYTRACED_REDUCED
+	mReducedReflections.Update(mCamera.GetViewProjInvF(), mCamera.GetPositionF());
+
+	// M traces the next frame at full resolution as well and measures the reduced one against it
+	if (IsKeyPressed('M', mbMeasureKeyDown))
+	{
+		mbMeasureReducedReflections = true;
+	}
+
+	// rays per reflective pixel once per second, with the error of the last measurement
+	mReducedTotalsTime += timer.GetDeltaTime();
+
+	if (mReducedTotalsTime >= 1.0f)
+	{
+		mReducedTotalsTime = 0.0f;
+
+		const ReducedReflections::Totals& totals = mReducedReflections.GetTotals();
+
+		std::stringstream ss;
+		ss << "Reduced reflections: " << totals.tracedPixels << " of " << totals.reflectivePixels << " reflective pixels traced, ";
+
+		if (totals.comparedPixels > 0)
+		{
+			ss << "RMSE " << mReducedReflections.GetRMSE() << " against full resolution\n";
+		}
+		else
+		{
+			ss << "press M to measure the RMSE against full resolution\n";
+		}
+
+		OutputDebugStringA(ss.str().c_str());
+	}
+#endif // RAYTRACED_REDUCED
+
+#if BVH_COUNTERS
+	// traversal totals once per second, per traced pixel
+	mTraversalTotalsTime += timer.GetDeltaTime();
+
+	if (mTraversalTotalsTime >= 1.0f)
+	{
+		mTraversalTotalsTime = 0.0f;
+
+		std::stringstream ss;
+
+		for (const TraversalCounters::Pass pass : { TraversalCounters::Pass::Shadows, TraversalCounters::Pass::Reflections })
+		{
+			const TraversalCounters::Totals& totals = mTraversalCounters.GetTotals(pass);
+			const float rays = float(std::max(totals.rays, 1u));
+
+			ss << ((pass == TraversalCounters::Pass::Shadows) ? "Shadows" : "Reflections") << ": " << totals.rays << " rays, "
+			   << totals.boxTests / rays << " box tests, " << totals.triangleTests / rays << " triangle tests, "
+			   << totals.iterations / rays << " iterations per ray\n";
+		}
+
+		OutputDebugStringA(ss.str().c_str());
+	}
+#endif // BVH_COUNTERS
+
 	// update waves constant buffer
 	{
 		WavesCB buffer;
@@ -373,6 +564,29 @@ void AppInst::Draw(const Timer& timer)
 	// shadows map
 	// (shadows resolve)
 	
+#if BVH_COUNTERS
+	mTraversalCounters.Clear(UINT(mViewport.Width), UINT(mViewport.Height));
+#endif // BVH_COUNTERS
+
+#if RAYTRACED_TILES
+	// raytraced tile classification
+	{
+		mUserDefinedAnnotation->BeginEvent(L"raytraced tile classification");
+
+		// unbind the depth buffer and the gbuffer of the prepass before the classification reads them
+		mContext->OMSetRenderTargets(0, nullptr, nullptr);
+
+		mRayTracedTiles.Classify(UINT(mViewport.Width),
+								 UINT(mViewport.Height),
+								 mLighting.GetLightDirection(0),
+								 mDepthBufferSRV.Get(),
+								 mGBufferSRV.Get(),
+								 mMaterialManager.GetBufferSRV());
+
+		mUserDefinedAnnotation->EndEvent();
+	}
+#endif // RAYTRACED_TILES
+
 	// raytraced shadows
 	{
 		mUserDefinedAnnotation->BeginEvent(L"raytraced shadows");
@@ -384,15 +598,37 @@ void AppInst::Draw(const Timer& timer)
 		mContext->ClearRenderTargetView(mShadowsResolveRTV.Get(), DirectX::Colors::White);
 
 		// set shadow render target
-		mContext->OMSetRenderTargets(1,
-									 mShadowsResolveRTV.GetAddressOf(),
-									 nullptr);
+#if RAYTRACED_TILES
+		if (mbRayTracedCompute)
+		{
+			// the compute pass writes a copy of it
+			mContext->OMSetRenderTargets(0, nullptr, nullptr);
+		}
+		else
+#endif // RAYTRACED_TILES
+		{
+#if BVH_COUNTERS
+			mContext->OMSetRenderTargetsAndUnorderedAccessViews(1,
+																mShadowsResolveRTV.GetAddressOf(),
+																nullptr,
+																1,
+																1,
+																mTraversalCounters.GetAddressOfUAV(),
+																nullptr);
+#else
+			mContext->OMSetRenderTargets(1,
+										 mShadowsResolveRTV.GetAddressOf(),
+										 nullptr);
+#endif // BVH_COUNTERS
+		}
 
 		// set input layout
 		mContext->IASetInputLayout(nullptr);
 
+#if !RAYTRACED_TILES
 		// set vertex shader
 		mContext->VSSetShader(mFullscreenVS.Get(), nullptr, 0);
+#endif // !RAYTRACED_TILES
 
 		// set shader resource views
 		ID3D11ShaderResourceView* SRVs[] =
@@ -404,14 +640,39 @@ void AppInst::Draw(const Timer& timer)
 		mContext->PSSetShaderResources(5, sizeof(SRVs) / sizeof(SRVs[0]), SRVs);
 
 		// set pixel shader
+#if BVH_COUNTERS
+		mContext->PSSetShader(mRayTraced.GetShadowsCountersPS(), nullptr, 0);
+#else
 		mContext->PSSetShader(mRayTraced.GetShadowsPS(), nullptr, 0);
+#endif // BVH_COUNTERS
 
 		// set constant buffer
 		ID3D11Buffer* buffer = mRayTraced.GetShadowsCB();
 		mContext->PSSetConstantBuffers(1, 1, &buffer);
 
 		// draw
+#if RAYTRACED_TILES
+		if (mbRayTracedCompute)
+		{
+			mRayTracedCompute.Dispatch(mRayTracedTiles,
+									   RayTracedTiles::Pass::Shadows,
+									   mRayTraced.GetShadowsCS(),
+									   RAYTRACED_PERSISTENT,
+									   mShadowsResolveSRV.Get(),
+									   DirectX::Colors::White,
+#if BVH_COUNTERS
+									   *mTraversalCounters.GetAddressOfUAV());
+#else
+									   nullptr);
+#endif // BVH_COUNTERS
+		}
+		else
+		{
+			mRayTracedTiles.Draw(RayTracedTiles::Pass::Shadows);
+		}
+#else
 		mContext->Draw(3, 0);
+#endif // RAYTRACED_TILES
 
 		// set shader resource views
 		ID3D11ShaderResourceView* pNullSRVs[] =
@@ -429,9 +690,39 @@ void AppInst::Draw(const Timer& timer)
 	}
 	
 	// SSPR
+#if RAYTRACED_SSPR
+	{
+		mUserDefinedAnnotation->BeginEvent(L"SSPR");
+
+		mContext->OMSetRenderTargets(0, nullptr, nullptr);
+
+		mSSPR.Resolve(UINT(mViewport.Width),
+					  UINT(mViewport.Height),
+					  mDepthBufferSRV.Get(),
+					  mGBufferSRV.Get(),
+					  mRayTracedTiles.GetStencilSRV(),
+					  mMaterialManager.GetBufferSRV(),
+					  mFrameHistory);
+
+		mUserDefinedAnnotation->EndEvent();
+	}
+#endif // RAYTRACED_SSPR
+
+	// hi-z
+#if RAYTRACED_HIZ
 	{
-		// unimplemented
+		mUserDefinedAnnotation->BeginEvent(L"hi-z");
+
+		mContext->OMSetRenderTargets(0, nullptr, nullptr);
+
+		mHiZ.Build(UINT(mViewport.Width),
+				   UINT(mViewport.Height),
+				   mDepthBufferSRV.Get(),
+				   mFrameHistory);
+
+		mUserDefinedAnnotation->EndEvent();
 	}
+#endif // RAYTRACED_HIZ
 	
 	// raytraced reflections
 	{
@@ -440,55 +731,41 @@ void AppInst::Draw(const Timer& timer)
 		GPUProfilerTimestamp(TimestampQueryType::RayTracedReflectionsBegin);
 #endif // IMGUI
 
-		// clear reflections render target
-		mContext->ClearRenderTargetView(mReflectionsResolveRTV.Get(), DirectX::Colors::Transparent);
-
-		// set reflections render target
-		mContext->OMSetRenderTargets(1,
-									 mReflectionsResolveRTV.GetAddressOf(),
-									 mDepthStencilBufferReadOnlyDSV.Get());
-
-		// set input layout
-		mContext->IASetInputLayout(nullptr);
+#if RAYTRACED_REDUCED
+		if (mbMeasureReducedReflections)
+		{
+			// every pixel traced first, the reference of the quality metric
+			mReducedReflections.SetReduced(false);
 
-		// set vertex shader
-		mContext->VSSetShader(mFullscreenVS.Get(), nullptr, 0);
+			TraceReflections();
 
-		// set shader resource views
-		ID3D11ShaderResourceView* pSRVs[] =
-		{
-			mShadowsResolveSRV.Get(),
-			nullptr,
-			mDepthBufferSRV.Get(),
-			mGBufferSRV.Get(),
-			mBVH.GetTreeBufferSRV(),
-			mBVH.GetVertexBufferSRV(),
-		};
-		mContext->PSSetShaderResources(3, sizeof(pSRVs) / sizeof(pSRVs[0]), pSRVs);
+			mReducedReflections.StoreReference(mReflectionsResolveSRV.Get());
+			mReducedReflections.SetReduced(true);
+		}
+#endif // RAYTRACED_REDUCED
 
-		// set pixel shader
-		//mContext->PSSetShader(mRayTraced.GetReflectionsPS(), nullptr, 0);
-		mContext->PSSetShader(mRayTraced.GetReflectionsUnpackNormalPS(), nullptr, 0);
+		TraceReflections();
 
-		// set depth stencil state
-		mContext->OMSetDepthStencilState(mRayTraced.GetReflectionsDSS(), 0);
+#if RAYTRACED_REDUCED
+		// the reflective pixels the reduced trace skipped, from the traced ones around them
+		mContext->OMSetRenderTargets(0, nullptr, nullptr);
 
-		// draw
-		mContext->Draw(3, 0);
+		mReducedReflections.Upsample(UINT(mViewport.Width),
+									 UINT(mViewport.Height),
+									 mDepthBufferSRV.Get(),
+									 mGBufferSRV.Get(),
+									 mRayTracedTiles.GetStencilSRV(),
+									 mMaterialManager.GetBufferSRV(),
+									 mReflectionsResolveSRV.Get(),
+									 mbMeasureReducedReflections);
 
-		mContext->OMSetDepthStencilState(nullptr, 0);
+		mbMeasureReducedReflections = false;
+#endif // RAYTRACED_REDUCED
 
-		// set shader resource views
-		ID3D11ShaderResourceView* pNullSRVs[] =
-		{
-			nullptr,
-			nullptr,
-			nullptr,
-			nullptr,
-			nullptr,
-			nullptr,
-		};
-		mContext->PSSetShaderResources(3, sizeof(pNullSRVs) / sizeof(pNullSRVs[0]), pNullSRVs);
+#if BVH_COUNTERS
+		// unbind the counters before the reduction reads them
+		mContext->OMSetRenderTargets(0, nullptr, nullptr);
+#endif // BVH_COUNTERS
 
 #if IMGUI
 		GPUProfilerTimestamp(TimestampQueryType::RayTracedReflectionsEnd);
@@ -496,6 +773,17 @@ void AppInst::Draw(const Timer& timer)
 		mUserDefinedAnnotation->EndEvent();
 	}
 
+#if BVH_COUNTERS
+	// traversal totals
+	{
+		mUserDefinedAnnotation->BeginEvent(L"traversal totals");
+
+		mTraversalCounters.Reduce();
+
+		mUserDefinedAnnotation->EndEvent();
+	}
+#endif // BVH_COUNTERS
+
 	// main pass
 	{
 		mUserDefinedAnnotation->BeginEvent(L"main pass");
@@ -601,4 +889,200 @@ void AppInst::Draw(const Timer& timer)
 #endif // IMGUI
 		mUserDefinedAnnotation->EndEvent();
 	}
+
+#if RAYTRACED_SSPR || RAYTRACED_HIZ
+	// before the heatmap, the next frame reflects the lit scene
+	mFrameHistory.Store(mBackBufferRTV.Get());
+#endif // RAYTRACED_SSPR || RAYTRACED_HIZ
+
+#if BVH_COUNTERS
+	// traversal heatmap
+	{
+		mUserDefinedAnnotation->BeginEvent(L"traversal heatmap");
+
+		mContext->OMSetRenderTargets(1, mBackBufferRTV.GetAddressOf(), nullptr);
+		mContext->VSSetShader(mFullscreenVS.Get(), nullptr, 0);
+
+		mTraversalCounters.DrawHeatmap(mHeatmapPass, mHeatmapCounter, mHeatmapMaxCount);
+
+		mUserDefinedAnnotation->EndEvent();
+	}
+#endif // BVH_COUNTERS
+}
+
+// the reflections resolve target cleared and traced, the pixel shader resources of the pass are left unbound
+void AppInst::TraceReflections()
+{
+	// clear reflections render target
+	mContext->ClearRenderTargetView(mReflectionsResolveRTV.Get(), DirectX::Colors::Transparent);
+
+#if RAYTRACED_DEFERRED
+	mRayTracedHits.Begin(UINT(mViewport.Width), UINT(mViewport.Height));
+
+	// u3 the hit records, u4 their counts
+	ID3D11UnorderedAccessView* pHitUAVs[] =
+	{
+		mRayTracedHits.GetHitsUAV(),
+		mRayTracedHits.GetCountsUAV(),
+	};
+#endif // RAYTRACED_DEFERRED
+
+	// set reflections render target
+#if RAYTRACED_TILES
+	if (mbRayTracedCompute)
+	{
+		// the compute pass writes a copy of it and tests the stencil itself
+		mContext->OMSetRenderTargets(0, nullptr, nullptr);
+
+#if RAYTRACED_DEFERRED
+		mContext->CSSetUnorderedAccessViews(3, sizeof(pHitUAVs) / sizeof(pHitUAVs[0]), pHitUAVs, nullptr);
+#endif // RAYTRACED_DEFERRED
+	}
+	else
+#endif // RAYTRACED_TILES
+	{
+#if RAYTRACED_DEFERRED
+		ID3D11UnorderedAccessView* pUAVs[] =
+		{
+#if BVH_COUNTERS
+			*mTraversalCounters.GetAddressOfUAV(),
+#else
+			nullptr,
+#endif // BVH_COUNTERS
+			nullptr,
+			pHitUAVs[0],
+			pHitUAVs[1],
+		};
+
+		mContext->OMSetRenderTargetsAndUnorderedAccessViews(1,
+															mReflectionsResolveRTV.GetAddressOf(),
+															mDepthStencilBufferReadOnlyDSV.Get(),
+															1,
+															sizeof(pUAVs) / sizeof(pUAVs[0]),
+															pUAVs,
+															nullptr);
+#elif BVH_COUNTERS
+		mContext->OMSetRenderTargetsAndUnorderedAccessViews(1,
+															mReflectionsResolveRTV.GetAddressOf(),
+															mDepthStencilBufferReadOnlyDSV.Get(),
+															1,
+															1,
+															mTraversalCounters.GetAddressOfUAV(),
+															nullptr);
+#else
+		mContext->OMSetRenderTargets(1,
+									 mReflectionsResolveRTV.GetAddressOf(),
+									 mDepthStencilBufferReadOnlyDSV.Get());
+#endif // RAYTRACED_DEFERRED + BVH_COUNTERS
+	}
+
+	// set input layout
+	mContext->IASetInputLayout(nullptr);
+
+#if !RAYTRACED_TILES
+	// set vertex shader
+	mContext->VSSetShader(mFullscreenVS.Get(), nullptr, 0);
+#endif // !RAYTRACED_TILES
+
+	// set shader resource views
+	ID3D11ShaderResourceView* pSRVs[] =
+	{
+		mShadowsResolveSRV.Get(),
+#if RAYTRACED_SSPR
+		mSSPR.GetReflectionsSRV(),
+#else
+		nullptr,
+#endif // RAYTRACED_SSPR
+		mDepthBufferSRV.Get(),
+		mGBufferSRV.Get(),
+		mBVH.GetTreeBufferSRV(),
+		mBVH.GetVertexBufferSRV(),
+	};
+	mContext->PSSetShaderResources(3, sizeof(pSRVs) / sizeof(pSRVs[0]), pSRVs);
+
+#if RAYTRACED_HIZ
+	// the screen-space march ahead of the BVH
+	ID3D11ShaderResourceView* pHiZSRVs[] =
+	{
+		mHiZ.GetSRV(),
+		mFrameHistory.GetSRV(),
+	};
+	mContext->PSSetShaderResources(14, sizeof(pHiZSRVs) / sizeof(pHiZSRVs[0]), pHiZSRVs);
+
+	ID3D11Buffer* pHiZCB = mHiZ.GetCB();
+	mContext->PSSetConstantBuffers(4, 1, &pHiZCB);
+#endif // RAYTRACED_HIZ
+
+#if RAYTRACED_REDUCED
+	// the pixels of rough surfaces that are traced
+	ID3D11Buffer* pReducedCB = mReducedReflections.GetCB();
+	mContext->PSSetConstantBuffers(5, 1, &pReducedCB);
+#endif // RAYTRACED_REDUCED
+
+	// set pixel shader
+	//mContext->PSSetShader(mRayTraced.GetReflectionsPS(), nullptr, 0);
+#if BVH_COUNTERS
+	mContext->PSSetShader(mRayTraced.GetReflectionsUnpackNormalCountersPS(), nullptr, 0);
+#else
+	mContext->PSSetShader(mRayTraced.GetReflectionsUnpackNormalPS(), nullptr, 0);
+#endif // BVH_COUNTERS
+
+	// set depth stencil state
+	mContext->OMSetDepthStencilState(mRayTraced.GetReflectionsDSS(), 0);
+
+	// draw
+#if RAYTRACED_TILES
+	if (mbRayTracedCompute)
+	{
+		mRayTracedCompute.Dispatch(mRayTracedTiles,
+								   RayTracedTiles::Pass::Reflections,
+								   mRayTraced.GetReflectionsUnpackNormalCS(),
+								   RAYTRACED_PERSISTENT,
+								   mReflectionsResolveSRV.Get(),
+								   DirectX::Colors::Transparent,
+#if BVH_COUNTERS
+								   *mTraversalCounters.GetAddressOfUAV());
+#else
+								   nullptr);
+#endif // BVH_COUNTERS
+	}
+	else
+	{
+		mRayTracedTiles.Draw(RayTracedTiles::Pass::Reflections);
+	}
+#else
+	mContext->Draw(3, 0);
+#endif // RAYTRACED_TILES
+
+	mContext->OMSetDepthStencilState(nullptr, 0);
+
+#if RAYTRACED_DEFERRED
+	// the hits of the trace grouped by material and shaded into the reflections resolve target
+	ID3D11UnorderedAccessView* pNullHitUAVs[] = { nullptr, nullptr };
+	mContext->CSSetUnorderedAccessViews(3, sizeof(pNullHitUAVs) / sizeof(pNullHitUAVs[0]), pNullHitUAVs, nullptr);
+	mContext->OMSetRenderTargets(0, nullptr, nullptr);
+
+	mRayTracedHits.Shade(mRayTraced.GetShadeHitsUnpackNormalCS(), mReflectionsResolveSRV.Get());
+#endif // RAYTRACED_DEFERRED
+
+	// set shader resource views
+	ID3D11ShaderResourceView* pNullSRVs[] =
+	{
+		nullptr,
+		nullptr,
+		nullptr,
+		nullptr,
+		nullptr,
+		nullptr,
+	};
+	mContext->PSSetShaderResources(3, sizeof(pNullSRVs) / sizeof(pNullSRVs[0]), pNullSRVs);
+
+#if RAYTRACED_HIZ
+	ID3D11ShaderResourceView* pNullHiZSRVs[] =
+	{
+		nullptr,
+		nullptr,
+	};
+	mContext->PSSetShaderResources(14, sizeof(pNullHiZSRVs) / sizeof(pNullHiZSRVs[0]), pNullHiZSRVs);
+#endif // RAYTRACED_HIZ
 }
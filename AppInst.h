@@ -7,7 +7,15 @@
 
 //
 #include "BVH.h"
+#include "FrameHistory.h"
+#include "HiZ.h"
 #include "RayTraced.h"
+#include "RayTracedCompute.h"
+#include "RayTracedHits.h"
+#include "RayTracedTiles.h"
+#include "ReducedReflections.h"
+#include "SSPR.h"
+#include "TraversalCounters.h"
 
 class AppInst : public AppBase
 {
@@ -23,9 +31,64 @@ public:
 
 private:
 
+    // clears and traces the reflections resolve target
+    void TraceReflections();
+
     BVH mBVH;
     RayTraced mRayTraced;
 
+#if RAYTRACED_TILES
+    RayTracedTiles mRayTracedTiles;
+    RayTracedCompute mRayTracedCompute;
+
+    // the listed tiles are traced by the compute shaders instead of drawn with the pixel shaders, C switches it
+    bool mbRayTracedCompute = RAYTRACED_COMPUTE != 0;
+    bool mbComputeKeyDown = false;
+#endif // RAYTRACED_TILES
+
+#if RAYTRACED_DEFERRED
+    RayTracedHits mRayTracedHits;
+#endif // RAYTRACED_DEFERRED
+
+    // height of the reflective grid, the plane of the screen-space planar reflections
+    static constexpr float kGridHeight = -3.0f;
+
+#if RAYTRACED_SSPR || RAYTRACED_HIZ
+    FrameHistory mFrameHistory;
+#endif // RAYTRACED_SSPR || RAYTRACED_HIZ
+
+#if RAYTRACED_SSPR
+    SSPR mSSPR;
+
+    float mSSPRTotalsTime = 0.0f;
+#endif // RAYTRACED_SSPR
+
+#if RAYTRACED_HIZ
+    HiZ mHiZ;
+#endif // RAYTRACED_HIZ
+
+#if RAYTRACED_REDUCED
+    ReducedReflections mReducedReflections;
+
+    float mReducedTotalsTime = 0.0f;
+
+    // traces the reflections of the next frame twice, at full resolution as the reference of the quality metric. set
+    // on request only, the measured frame costs a second trace
+    bool mbMeasureReducedReflections = false;
+    bool mbMeasureKeyDown = false;
+#endif // RAYTRACED_REDUCED
+
+#if BVH_COUNTERS
+    TraversalCounters mTraversalCounters;
+
+    // shown over the frame, counts of maxCount and above are red
+    TraversalCounters::Pass mHeatmapPass = TraversalCounters::Pass::Reflections;
+    TraversalCounters::Counter mHeatmapCounter = TraversalCounters::Counter::BoxTests;
+    float mHeatmapMaxCount = 256.0f;
+
+    float mTraversalTotalsTime = 0.0f;
+#endif // BVH_COUNTERS
+
     XMFLOAT2 mWavesNormalMapOffset0;
     XMFLOAT2 mWavesNormalMapOffset1;
 
@@ -2,6 +2,9 @@
 
 // std
 #include <cassert>
+#include <chrono>
+#include <sstream>
+#include <string>
 
 // d3d
 #include <d3d11.h>
@@ -9,16 +12,32 @@
 using namespace DirectX;
 
 //
+#include "BVHBuilder.h"
+#include "BVHCache.h"
+#include "BVHHitAttributes.h"
+#include "BVHTreeStats.h"
+#include "BVHTwoLevel.h"
 #include "MaterialManager.h"
 #include "MeshManager.h"
 #include "ObjectManager.h"
 #include "RayTraced.h"
 #include "Utility.h"
 
+// gathers the scene triangles for BVHBuilder and uploads the flattened tree and the hit attributes to the GPU
 class BVH
 {
 public:
 
+	BVH()
+		: mTriangles(&mBuilder.GetMemoryTracker())
+		, mAttributes(&mBuilder.GetMemoryTracker())
+	{
+		// the stream format the shaders are compiled for
+		mSettings.width = BVH_WIDTH;
+		mSettings.quantization = BVH_QUANTIZATION;
+		mSettings.leafFormat = LeafFormat(BVH_LEAF_FORMAT);
+	}
+
 	void Init(const ComPtr<ID3D11Device>& pDevice,
 			  const ComPtr<ID3D11DeviceContext>& pContext)
 	{
@@ -26,496 +45,588 @@ public:
 		mContext = pContext;
 	}
 
-	struct AABB
-	{
-		XMVECTOR min;
-		XMVECTOR max;
-		XMVECTOR mid;
-
-		AABB()
-			: mid(XMVectorZero())
-			//, min(XMVectorSet(-FLT_MAX, -FLT_MAX, -FLT_MAX, 0.0f))
-			//, max(XMVectorSet(+FLT_MAX, +FLT_MAX, +FLT_MAX, 0.0f))
-		{
-			min = XMVectorSet(+FLT_MAX, +FLT_MAX, +FLT_MAX, 0.0f);
-			max = XMVectorSet(-FLT_MAX, -FLT_MAX, -FLT_MAX, 0.0f);
-		}
-
-		void Expand(const XMVECTOR& point)
-		{
-			min = XMVectorMin(min, point);
-			max = XMVectorMax(max, point);
-			mid = 0.5f * (min + max);
-		}
+	using BuildMode = BVHBuilder::BuildMode;
+	using LeafFormat = BVHBuilder::LeafFormat;
+	using BuildSettings = BVHBuilder::BuildSettings;
+	using BuildStats = BVHBuilder::BuildStats;
 
-		void Expand(const AABB& aabb)
-		{
-			min = XMVectorMin(min, aabb.min);
-			max = XMVectorMax(max, aabb.max);
-			mid = 0.5f * (min + max);
-		}
-	};
+	template <typename T>
+	using BuildVector = BVHBuilder::BuildVector<T>;
 
-	struct Node
+	void SetBuildSettings(const BuildSettings& settings)
 	{
-		XMFLOAT4 min; // min.w = bIsNode
-		XMFLOAT4 max;
-	};
+		assert(settings.binCount >= 2 && settings.binCount <= BVHBuilder::kMaxBinCount);
+		assert(settings.maxLeafSize >= 1 && settings.maxLeafSize <= BVHBuilder::kMaxLeafSize);
+		assert(settings.width == BVH_WIDTH);
+		assert(settings.quantization == BVH_QUANTIZATION);
+		assert(settings.leafFormat == LeafFormat(BVH_LEAF_FORMAT));
+		mSettings = settings;
+	}
 
-	struct Leaf
+	// false once BuildBVH uploaded the streams from the cache: the triangles and the builders are empty until the next
+	// build, the build stats, the refit stats and the tree queries assert on it
+	bool HasBuildState() const
 	{
-		XMFLOAT4 v0;
-		XMFLOAT4 e1; // v1 - v0
-		XMFLOAT4 e2; // v2 - v0
-	};
+		return !mbCachedTree;
+	}
 
-	struct TriangleData
+	const BuildStats& GetBuildStats() const
 	{
-		AABB aabb;
-
-		XMVECTOR v0;
-		XMVECTOR v1;
-		XMVECTOR v2;
-
-		std::size_t offset;
-		std::size_t material;
-
-		float surfaceAreaLeft;
-		float surfaceAreaRight;
-	};
+		assert(HasBuildState());
+		return mBuilder.GetStats();
+	}
 
-	struct TreeNode
+	const BVHTwoLevel::Stats& GetTwoLevelStats() const
 	{
-		TriangleData data;
+		assert(HasBuildState());
+		return mTwoLevel.GetStats();
+	}
 
-		bool bIsNode; // otherwise leaf
+	// BuildBVH loads the tree from this file when it was written for the same scene and settings, and writes it
+	// after building otherwise. empty disables the cache
+	void SetCachePath(const std::string& path)
+	{
+		mCachePath = path;
+	}
 
-		float splitCost;
+	// identifies the contents of a mesh in the cache key, e.g. MeshFile::GetContentHash. the meshes without one are
+	// hashed vertex by vertex on every BuildBVH
+	void SetMeshKey(const std::size_t mesh, const std::uint64_t key)
+	{
+		if (mesh >= mMeshKeys.size())
+		{
+			mMeshKeys.resize(mesh + 1, 0);
+		}
 
-		TreeNode* left;
-		TreeNode* right;
-	};
+		mMeshKeys[mesh] = key;
+	}
 
 	void BuildBVH(const std::vector<Object>& objects,
 				  const MeshManager& meshManager,
 				  const MaterialManager& materialManager)
 	{
-		std::vector<TriangleData> triangles;
-		std::size_t offset = 0; // triangle offset in vertex buffer
+		std::uint64_t cacheKey = 0;
 
-		std::vector<XMFLOAT4> vertices;
-
-		for (std::size_t j = 0; j < objects.size() - 1; ++j)
+		if (!mCachePath.empty())
 		{
-			const Object& object = objects[j];
-			const MeshData& mesh = meshManager.GetMesh(object.mesh);
-			const XMMATRIX world = XMLoadFloat4x4(&object.world);
-			const Material& material = materialManager.GetMaterial(object.material);
-			const XMMATRIX uvTransform = XMLoadFloat4x4(&object.uvTransform) * XMLoadFloat4x4(&material.uvTransform);
+			cacheKey = GetCacheKey(objects, meshManager);
 
-			const std::size_t indexCount = mesh.indexCount ? mesh.indexCount : mesh.vertices.size();
+			if (LoadCache(cacheKey))
+			{
+				return;
+			}
+		}
 
-			vertices.reserve(vertices.size() + indexCount * 2);
-			triangles.reserve(triangles.size() + (indexCount / 3));
+		Build(objects, meshManager, materialManager);
 
-			for (std::size_t i = 0; i < indexCount; i += 3)
-			{
-				const MeshData::IndexType i0 = mesh.indexCount ? mesh.indices[i + 0] : MeshData::IndexType(i + 0);
-				const MeshData::IndexType i1 = mesh.indexCount ? mesh.indices[i + 1] : MeshData::IndexType(i + 1);
-				const MeshData::IndexType i2 = mesh.indexCount ? mesh.indices[i + 2] : MeshData::IndexType(i + 2);
+		if (!mCachePath.empty())
+		{
+			SaveCache(cacheKey);
+		}
+	}
 
-				// the w member of the returned XMVECTOR is initialized to 0
-				XMVECTOR v0 = XMLoadFloat3(&mesh.vertices[i0].position);
-				XMVECTOR v1 = XMLoadFloat3(&mesh.vertices[i1].position);
-				XMVECTOR v2 = XMLoadFloat3(&mesh.vertices[i2].position);
+	// call after changing the world matrix of some objects, their triangles are moved and the tree is refitted,
+	// only the rewritten ranges of the GPU buffers are updated. falls back to a full build when the tree degraded too much
+	void RefitBVH(const std::vector<Object>& objects,
+				  const MeshManager& meshManager,
+				  const MaterialManager& materialManager,
+				  const std::vector<std::size_t>& changedObjects)
+	{
+		// a tree loaded from the cache has no build state to refit
+		if (mbCachedTree)
+		{
+			Build(objects, meshManager, materialManager);
+			return;
+		}
 
-				// XMVector3Transform ignores the w component of the input vector, and uses a value of 1 instead
-				v0 = XMVector3Transform(v0, world);
-				v1 = XMVector3Transform(v1, world);
-				v2 = XMVector3Transform(v2, world);
+#if BVH_TWO_LEVEL
+		RefitTwoLevel(objects, changedObjects);
+		return;
+#endif
 
-				TriangleData triangle;
+		BVHBuilder::MemoryTracker& tracker = mBuilder.GetMemoryTracker();
 
-				triangle.offset = offset;
-				offset += 3 * 2;
+		BuildVector<std::uint32_t> changed(&tracker);
 
-				triangle.material = object.material;
+		for (const std::size_t j : changedObjects)
+		{
+			assert(j < mObjectRanges.size());
 
-				triangle.aabb.Expand(v0);
-				triangle.aabb.Expand(v1);
-				triangle.aabb.Expand(v2);
+			const ObjectRange& range = mObjectRanges[j];
 
-				triangle.aabb.min *= XMVectorSet(1, 1, 1, 0);
-				triangle.aabb.max *= XMVectorSet(1, 1, 1, 0);
+			// the same vertices are found again, only their transformed attributes change
+			const BVHBuilder::StreamRange vertices = GatherObject(objects[j], meshManager, materialManager, range.first, &mTriangles[range.first], mAttributes, range.vertices.begin);
+			assert(vertices.end == range.vertices.end);
 
-				triangle.v0 = v0;
-				triangle.v1 = v1;
-				triangle.v2 = v2;
+			for (std::size_t i = 0; i < range.count; ++i)
+			{
+				changed.push_back(std::uint32_t(range.first + i));
+			}
 
-				triangles.push_back(triangle);
+			// hit attributes of the object
+			UpdateBufferRange(mVertexBuffer.Get(), mAttributes.GetRecords().data() + vertices.begin, vertices.begin, vertices.end - vertices.begin, sizeof(BVHHitAttributes::Record));
+		}
 
-				// vertex buffer
-				{
-					XMVECTOR n0 = XMLoadFloat3(&mesh.vertices[i0].normal);
-					XMVECTOR n1 = XMLoadFloat3(&mesh.vertices[i1].normal);
-					XMVECTOR n2 = XMLoadFloat3(&mesh.vertices[i2].normal);
+		if (!mBuilder.Refit(mTriangles.data(), changed.data(), changed.size()))
+		{
+			BuildSingleLevel(objects, meshManager, materialManager);
+			return;
+		}
+
+		const Float4* stream = mBuilder.GetStream().data();
 
-					n0 = XMVector3TransformNormal(n0, world);
-					n1 = XMVector3TransformNormal(n1, world);
-					n2 = XMVector3TransformNormal(n2, world);
+		for (const BVHBuilder::StreamRange& range : mBuilder.GetDirtyRanges())
+		{
+			UpdateBufferRange(mTreeBuffer.Get(), stream + range.begin, range.begin, range.end - range.begin);
+		}
+	}
 
-					XMVECTOR u0 = XMLoadFloat2(&mesh.vertices[i0].uv);
-					XMVECTOR u1 = XMLoadFloat2(&mesh.vertices[i1].uv);
-					XMVECTOR u2 = XMLoadFloat2(&mesh.vertices[i2].uv);
+	const BVHBuilder::RefitStats& GetRefitStats() const
+	{
+		assert(HasBuildState());
+		return mBuilder.GetRefitStats();
+	}
 
-					//u0 = XMVector2Transform(u0, uvTransform);
-					//u1 = XMVector2Transform(u1, uvTransform);
-					//u2 = XMVector2Transform(u2, uvTransform);
+	void PrintTreeNode(const BuildVector<BVHBuilder::Triangle>& triangles)
+	{
+		if (!HasBuildState())
+		{
+			OutputDebugStringA("BVH: loaded from the cache, no tree to print\n");
+			return;
+		}
 
-					XMVECTOR t0 = XMLoadFloat3(&mesh.vertices[i0].tangent);
-					XMVECTOR t1 = XMLoadFloat3(&mesh.vertices[i1].tangent);
-					XMVECTOR t2 = XMLoadFloat3(&mesh.vertices[i2].tangent);
+		std::stringstream ss;
+		mBuilder.Print(ss, triangles.data());
 
-					t0 = XMVector3TransformNormal(t0, world);
-					t1 = XMVector3TransformNormal(t1, world);
-					t2 = XMVector3TransformNormal(t2, world);
+		OutputDebugStringA(ss.str().c_str());
+	}
 
-					XMFLOAT4 a, b;
+	// cost metrics, histograms and per level footprint of the single-level tree, PrintTreeNode lists every node instead
+	BVHTreeStats GetTreeStats() const
+	{
+		assert(HasBuildState());
+		return BVHTreeStats::Compute(mBuilder, mTriangles.data());
+	}
 
-					XMStoreFloat4(&a, n0);
-					a.w = XMVectorGetX(u0);
-					vertices.push_back(a);
+	void PrintTreeStats() const
+	{
+		if (!HasBuildState())
+		{
+			OutputDebugStringA("BVH: loaded from the cache, no tree statistics\n");
+			return;
+		}
 
-					XMStoreFloat4(&b, t0);
-					b.w = XMVectorGetY(u0);
-					vertices.push_back(b);
+		std::stringstream ss;
+		GetTreeStats().WriteSummary(ss);
 
-					XMStoreFloat4(&a, n1);
-					a.w = XMVectorGetX(u1);
-					vertices.push_back(a);
+		OutputDebugStringA(ss.str().c_str());
+	}
 
-					XMStoreFloat4(&b, t1);
-					b.w = XMVectorGetY(u1);
-					vertices.push_back(b);
+	ID3D11ShaderResourceView* GetTreeBufferSRV()
+	{
+		return mTreeBufferSRV.Get();
+	}
 
-					XMStoreFloat4(&a, n2);
-					a.w = XMVectorGetX(u2);
-					vertices.push_back(a);
+	ID3D11ShaderResourceView* GetVertexBufferSRV()
+	{
+		return mVertexBufferSRV.Get();
+	}
 
-					XMStoreFloat4(&b, t2);
-					b.w = XMVectorGetY(u2);
-					vertices.push_back(b);
-				}
-			}
-		}
+	// bytes of the indexed hit attributes, 96 per triangle before they were indexed and packed
+	std::size_t GetHitAttributesSize() const
+	{
+		return mHitAttributesSize;
+	}
 
-		// vertex buffer
-		WriteVertexBuffer(vertices);
+private:
 
-		TreeNode* root = CreateTreeNode(triangles, 0, int(triangles.size() - 1));
+	void Build(const std::vector<Object>& objects,
+			   const MeshManager& meshManager,
+			   const MaterialManager& materialManager)
+	{
+		mbCachedTree = false;
 
-		//PrintTreeNode(root);
+#if BVH_TWO_LEVEL
+		BuildTwoLevel(objects, meshManager, materialManager);
+#else
+		BuildSingleLevel(objects, meshManager, materialManager);
+#endif
+	}
 
-		const int kMaxNodeCount = 1000000;
-		uint8_t* data = new uint8_t[kMaxNodeCount * sizeof(Leaf)];
+	// everything the streams are built from: the traced objects, their meshes, the settings and the stream format
+	std::uint64_t GetCacheKey(const std::vector<Object>& objects, const MeshManager& meshManager) const
+	{
+		BVHCache::Hasher hasher;
+		hasher.Add(mSettings);
+		hasher.Add(int(BVH_TWO_LEVEL));
+
+		// the last object (reflective surface) is not traced
+		for (std::size_t j = 0; j < objects.size() - 1; ++j)
+		{
+			const Object& object = objects[j];
 
-		int dataOffset = 0;
-		WriteNode(root, root, data, dataOffset);
+			hasher.Add(object.world);
+			hasher.Add(object.material);
 
-		// terminate tree
-		Node* node = reinterpret_cast<Node*>(data + dataOffset);
-		node->min.w = 0;
+			const std::size_t meshIndex = std::size_t(object.mesh);
 
-		dataOffset += sizeof(Node);
+			if (meshIndex < mMeshKeys.size() && mMeshKeys[meshIndex] != 0)
+			{
+				hasher.Add(mMeshKeys[meshIndex]);
+				continue;
+			}
 
-		assert(dataOffset <= kMaxNodeCount);
+			const MeshData& mesh = meshManager.GetMesh(object.mesh);
 
-		WriteTreeToBuffer(data, dataOffset);
+			hasher.Add(mesh.vertices.size());
+			hasher.Add(mesh.vertices.data(), mesh.vertices.size() * sizeof(mesh.vertices[0]));
+			hasher.Add(mesh.indexCount);
+			hasher.Add(mesh.indices.data(), mesh.indexCount * sizeof(MeshData::IndexType));
+		}
 
-		delete[] data;
-		DeleteTreeNode(root);
+		return hasher.GetHash();
 	}
 
-	void PrintTreeNode(TreeNode* node, int level = 0)
+	// uploads the mapped file as it is, no build
+	bool LoadCache(const std::uint64_t key)
 	{
-		auto Float3ToStr = [](const XMFLOAT3& f3)
+		const auto loadBegin = std::chrono::steady_clock::now();
+
+		BVHCache cache;
+		const BVHCache::Status status = cache.Open(mCachePath, key);
+
+		if (status != BVHCache::Status::Loaded)
 		{
 			std::stringstream ss;
-			ss << "(" << f3.x << "," << f3.y << "," << f3.z << ")";
-			return ss.str();
-		};
+			ss << "BVH: cache " << mCachePath << " " << BVHCache::GetStatusName(status) << ", building\n";
+			OutputDebugStringA(ss.str().c_str());
 
-		if (node)
-		{
-			XMFLOAT3 min, max;
-			XMStoreFloat3(&min, node->data.aabb.min);
-			XMStoreFloat3(&max, node->data.aabb.max);
+			return false;
+		}
 
-			std::stringstream ss;
+		// no build state from an earlier build outlives the streams it described
+		mBuilder.Clear();
+		mTwoLevel.Clear();
+		mTriangles = BuildVector<BVHBuilder::Triangle>(&mBuilder.GetMemoryTracker());
+		mObjectRanges.clear();
+		mAttributes.Reset(0);
 
-			ss << !node->bIsNode << " " << std::string(level, '.') << " AABB min=" << Float3ToStr(min) << " max=" << Float3ToStr(max) << "\n";
-			
-			if (!node->bIsNode)
-			{
-				XMFLOAT3 v0, v1, v2;
-				XMStoreFloat3(&v0, node->data.v0);
-				XMStoreFloat3(&v1, node->data.v1);
-				XMStoreFloat3(&v2, node->data.v2);
+		WriteVertexBuffer(static_cast<const BVHHitAttributes::Record*>(cache.GetAttributes()), cache.GetAttributesSize() / sizeof(BVHHitAttributes::Record));
+		WriteTreeToBuffer(reinterpret_cast<const uint8_t*>(cache.GetTree()), int(cache.GetTreeSize()));
 
-				ss << "  " << std::string(level, '.') << " v0=" << Float3ToStr(v0) << " v1=" << Float3ToStr(v1) << " v2=" << Float3ToStr(v2) << "\n";
-			}
+		mbCachedTree = true;
 
-			OutputDebugStringA(ss.str().c_str());
+		const std::chrono::duration<double, std::milli> loadTime = std::chrono::steady_clock::now() - loadBegin;
 
-			PrintTreeNode(node->left, level + 1);
-			PrintTreeNode(node->right, level + 1);
-		}
+		std::stringstream ss;
+		ss << "BVH: loaded " << cache.GetTreeSize() << " bytes of tree and " << cache.GetAttributesSize() << " bytes of hit attributes from "
+		   << mCachePath << " in " << loadTime.count() << " ms\n";
+		OutputDebugStringA(ss.str().c_str());
+
+		return true;
 	}
 
-	ID3D11ShaderResourceView* GetTreeBufferSRV()
+	void SaveCache(const std::uint64_t key)
 	{
-		return mTreeBufferSRV.Get();
+#if BVH_TWO_LEVEL
+		const BuildVector<Float4>& stream = mTwoLevel.GetStream();
+#else
+		const BuildVector<Float4>& stream = mBuilder.GetStream();
+#endif
+
+		if (!BVHCache::Write(mCachePath, key, stream.data(), stream.size() * sizeof(Float4), mAttributes.GetRecords().data(), GetHitAttributesSize()))
+		{
+			OutputDebugStringA(("BVH: could not write the cache " + mCachePath + "\n").c_str());
+		}
 	}
 
-	ID3D11ShaderResourceView* GetVertexBufferSRV()
+	void BuildSingleLevel(const std::vector<Object>& objects,
+						  const MeshManager& meshManager,
+						  const MaterialManager& materialManager)
 	{
-		return mVertexBufferSRV.Get();
-	}
+		// the build stats cover the gather containers as well
+		mBuilder.Clear();
 
-private:
+		BVHBuilder::MemoryTracker& tracker = mBuilder.GetMemoryTracker();
+		tracker.Reset();
 
-	TreeNode* CreateTreeNode(std::vector<TriangleData>& triangles, const int begin, const int end)
-	{
-		int count = end - begin + 1;
-		assert(count > 0);
+		// size the containers once for the whole scene, the last object (reflective surface) is not traced
+		mObjectRanges.clear();
 
-		TreeNode* node = new TreeNode();
+		std::size_t triangleCount = 0;
 
-		for (std::size_t i = begin; i <= end; ++i)
+		for (std::size_t j = 0; j < objects.size() - 1; ++j)
 		{
-			node->data.aabb.Expand(triangles[i].aabb);
+			const MeshData& mesh = meshManager.GetMesh(objects[j].mesh);
+			const std::size_t objectTriangleCount = (mesh.indexCount ? mesh.indexCount : mesh.vertices.size()) / 3;
+
+			mObjectRanges.push_back({ triangleCount, objectTriangleCount, {} });
+			triangleCount += objectTriangleCount;
 		}
 
-		if (count == 1) // leaf
-		{
-			node->left = nullptr;
-			node->right = nullptr;
+		mTriangles = BuildVector<BVHBuilder::Triangle>(&tracker);
+		mTriangles.resize(triangleCount);
 
-			node->bIsNode = false;
+		mAttributes.Reset(triangleCount);
 
-			node->data.offset = triangles[begin].offset;
-			node->data.material = triangles[begin].material;
+		for (std::size_t j = 0; j < objects.size() - 1; ++j)
+		{
+			ObjectRange& range = mObjectRanges[j];
 
-			node->data.v0 = triangles[begin].v0;
-			node->data.v1 = triangles[begin].v1;
-			node->data.v2 = triangles[begin].v2;
+			range.vertices = GatherObject(objects[j], meshManager, materialManager, range.first, &mTriangles[range.first], mAttributes, mAttributes.GetSize());
 		}
-		else // node
-		{
-			int split;
-			Axis axis;
-			float cost;
 
-			FindBestSplit(triangles, begin, end, split, axis, cost);
+		// vertex buffer
+		WriteVertexBuffer(mAttributes.GetRecords().data(), mAttributes.GetSize());
 
-			SortAlongAxis(triangles, begin, end, axis);
+		mBuilder.Build(mTriangles.data(), mTriangles.size(), mSettings);
 
-			node->left = CreateTreeNode(triangles, begin, split - 1);
-			node->right = CreateTreeNode(triangles, split, end);
+		//PrintTreeNode(mTriangles);
+		//PrintTreeStats();
 
-			// access the child with the largest probability of collision first
-			const float surfaceAreaLeft = CalculateSurfaceArea(node->left->data.aabb);
-			const float surfaceAreaRight = CalculateSurfaceArea(node->right->data.aabb);
+		WriteTreeToBuffer(reinterpret_cast<const uint8_t*>(mBuilder.GetStream().data()), int(mBuilder.GetStreamSize()));
 
-			if (surfaceAreaRight > surfaceAreaLeft)
-			{
-				std::swap(node->left, node->right);
-			}
+		// build report
+		{
+			const BuildStats& stats = mBuilder.GetStats();
 
-			node->bIsNode = true;
+			std::stringstream ss;
+			ss << "BVH: " << stats.triangleCount << " triangles built in " << stats.buildTime << " ms on " << stats.threadCount << " threads, "
+			   << stats.referenceCount << " references (" << stats.spatialSplitCount << " spatial splits), "
+			   << stats.nodeCount << " nodes, " << stats.leafCount << " leaves (" << stats.leafSize << " bytes per triangle), " << stats.wideNodeCount << " wide nodes of " << stats.nodeSize << " bytes, "
+			   << stats.serializedSize << " bytes (" << stats.uncompressedSize << " with float bounds), "
+			   << "peak build memory " << stats.peakMemory << " bytes in " << stats.allocationCount << " allocations, "
+			   << "hit attributes " << GetHitAttributesSize() << " bytes for " << mAttributes.GetVertexCount() << " vertices\n";
+			OutputDebugStringA(ss.str().c_str());
 		}
-
-		return node;
 	}
 
-	void DeleteTreeNode(TreeNode* node)
+	// one object space tree per mesh and an instance per object, the vertex buffer holds the hit attributes of each mesh once
+	void BuildTwoLevel(const std::vector<Object>& objects,
+					   const MeshManager& meshManager,
+					   const MaterialManager& materialManager)
 	{
-		if (node)
-		{
-			DeleteTreeNode(node->left);
-			DeleteTreeNode(node->right);
+		mTwoLevel.Clear();
 
-			delete node;
-		}
-	}
+		BVHBuilder::MemoryTracker& tracker = mTwoLevel.GetMemoryTracker();
+		tracker.Reset();
 
-	enum class Axis
-	{
-		X,
-		Y,
-		Z,
-	};
+		mTwoLevel.SetBuildSettings(mSettings);
 
-	void FindBestSplit(std::vector<TriangleData>& triangles, const int begin, const int end, int& split, Axis& splitAxis, float& splitCost)
-	{
-		split = begin;
-		splitAxis = Axis::X;
-		splitCost = FLT_MAX;
+		// the last object (reflective surface) is not traced
+		std::vector<std::size_t> meshObjects; // first object using each mesh
+		std::vector<std::uint32_t> objectMeshes;
 
-		const int count = end - begin + 1;
-		int bestSplit = begin;
+		std::size_t triangleCount = 0;
 
-		for (int i = 0; i < 3; ++i)
+		for (std::size_t j = 0; j < objects.size() - 1; ++j)
 		{
-			Axis axis = Axis(i);
-
-			SortAlongAxis(triangles, begin, end, axis);
+			std::size_t index = 0;
 
-			AABB aabbLeft;
-			AABB aabbRight;
+			while (index < meshObjects.size() && objects[meshObjects[index]].mesh != objects[j].mesh)
+			{
+				index++;
+			}
 
-			for (int indexLeft = 0; indexLeft < count; ++indexLeft)
+			if (index == meshObjects.size())
 			{
-				int indexRight = count - indexLeft - 1;
+				const MeshData& mesh = meshManager.GetMesh(objects[j].mesh);
 
-				aabbLeft.Expand(triangles[begin + indexLeft].aabb);
-				aabbRight.Expand(triangles[begin + indexRight].aabb);
+				meshObjects.push_back(j);
+				triangleCount += (mesh.indexCount ? mesh.indexCount : mesh.vertices.size()) / 3;
+			}
 
-				float surfaceAreaLeft = CalculateSurfaceArea(aabbLeft);
-				float surfaceAreaRight = CalculateSurfaceArea(aabbRight);
+			objectMeshes.push_back(std::uint32_t(index));
+		}
 
-				triangles[begin + indexLeft].surfaceAreaLeft = surfaceAreaLeft;
-				triangles[begin + indexRight].surfaceAreaRight = surfaceAreaRight;
-			}
+		BuildVector<BVHBuilder::Triangle> triangles(&tracker);
+		triangles.resize(triangleCount);
 
-			float bestCost = FLT_MAX;
+		mAttributes.Reset(triangleCount);
 
-			for (int mid = begin + 1; mid <= end; ++mid)
-			{
-				float surfaceAreaLeft = triangles[mid - 1].surfaceAreaLeft;
-				float surfaceAreaRight = triangles[mid].surfaceAreaRight;
+		std::size_t firstTriangle = 0;
 
-				int countLeft = mid - begin;
-				int countRight = end - mid;
+		for (const std::size_t j : meshObjects)
+		{
+			// gathered in object space, the instance transforms the rays and the hit
+			Object object = objects[j];
+			XMStoreFloat4x4(&object.world, XMMatrixIdentity());
 
-				float costLeft = surfaceAreaLeft * (float)countLeft;
-				float costRight = surfaceAreaRight * (float)countRight;
+			const MeshData& mesh = meshManager.GetMesh(object.mesh);
+			const std::size_t meshTriangleCount = (mesh.indexCount ? mesh.indexCount : mesh.vertices.size()) / 3;
 
-				float cost = costLeft + costRight;
+			GatherObject(object, meshManager, materialManager, firstTriangle, &triangles[firstTriangle], mAttributes, mAttributes.GetSize());
 
-				if (cost < bestCost)
-				{
-					bestSplit = mid;
-					bestCost = cost;
-				}
-			}
+			mTwoLevel.AddMesh(&triangles[firstTriangle], meshTriangleCount);
 
-			if (bestCost < splitCost)
-			{
-				split = bestSplit;
-				splitAxis = axis;
-				splitCost = bestCost;
-			}
+			firstTriangle += meshTriangleCount;
+		}
+
+		WriteVertexBuffer(mAttributes.GetRecords().data(), mAttributes.GetSize());
+
+		for (std::size_t j = 0; j < objectMeshes.size(); ++j)
+		{
+			BVHTwoLevel::Instance instance;
+			instance.mesh = objectMeshes[j];
+			instance.material = std::uint32_t(objects[j].material);
+			instance.world = ToMatrix34(objects[j].world);
+
+			mTwoLevel.AddInstance(instance);
+		}
+
+		mTwoLevel.BuildTopLevel();
+
+		WriteTreeToBuffer(reinterpret_cast<const uint8_t*>(mTwoLevel.GetStream().data()), int(mTwoLevel.GetStreamSize()));
+
+		// build report
+		{
+			const BVHTwoLevel::Stats& stats = mTwoLevel.GetStats();
+
+			std::stringstream ss;
+			ss << "BVH: " << stats.meshCount << " meshes, " << stats.triangleCount << " triangles built in " << stats.meshBuildTime << " ms, "
+			   << stats.instanceCount << " instances (" << stats.instancedTriangleCount << " triangles) built in " << stats.topLevelBuildTime << " ms, "
+			   << stats.serializedSize << " bytes, top level " << stats.topLevelSize << " bytes, "
+			   << "hit attributes " << GetHitAttributesSize() << " bytes for " << mAttributes.GetVertexCount() << " vertices\n";
+			OutputDebugStringA(ss.str().c_str());
 		}
 	}
 
-	void SortAlongAxis(std::vector<TriangleData>& data, const int begin, const int end, const Axis axis)
+	// the meshes are not touched, only the top level is rebuilt and uploaded
+	void RefitTwoLevel(const std::vector<Object>& objects, const std::vector<std::size_t>& changedObjects)
 	{
-		TriangleData* base = data.data() + begin;
-		const int count = end - begin + 1;
-		const std::size_t size = sizeof(TriangleData);
-
-		switch (axis)
+		for (const std::size_t j : changedObjects)
 		{
-			case Axis::X:
-				std::qsort(base, count, size, [](const void* lhs, const void* rhs)
-				{
-					const TriangleData* a = static_cast<const TriangleData*>(lhs);
-					const TriangleData* b = static_cast<const TriangleData*>(rhs);
-
-					return (XMVectorGetX(a->aabb.mid) < XMVectorGetX(b->aabb.mid)) ? -1 : +1;
-				});
-				break;
-			case Axis::Y:
-				std::qsort(base, count, size, [](const void* lhs, const void* rhs)
-				{
-					const TriangleData* a = static_cast<const TriangleData*>(lhs);
-					const TriangleData* b = static_cast<const TriangleData*>(rhs);
-
-					return (XMVectorGetY(a->aabb.mid) < XMVectorGetY(b->aabb.mid)) ? -1 : +1;
-				});
-				break;
-			case Axis::Z:
-				std::qsort(base, count, size, [](const void* lhs, const void* rhs)
-				{
-					const TriangleData* a = static_cast<const TriangleData*>(lhs);
-					const TriangleData* b = static_cast<const TriangleData*>(rhs);
+			mTwoLevel.SetInstanceTransform(std::uint32_t(j), ToMatrix34(objects[j].world));
+		}
+
+		const std::size_t size = mTwoLevel.GetStreamSize();
 
-					return (XMVectorGetZ(a->aabb.mid) < XMVectorGetZ(b->aabb.mid)) ? -1 : +1;
-				});
-				break;
+		mTwoLevel.BuildTopLevel();
+
+		const BVHBuilder::StreamRange range = mTwoLevel.GetTopLevelRange();
+
+		if (mTwoLevel.GetStreamSize() != size)
+		{
+			WriteTreeToBuffer(reinterpret_cast<const uint8_t*>(mTwoLevel.GetStream().data()), int(mTwoLevel.GetStreamSize()));
+			return;
 		}
+
+		UpdateBufferRange(mTreeBuffer.Get(), mTwoLevel.GetStream().data() + range.begin, range.begin, range.end - range.begin);
 	}
 
-	inline float CalculateSurfaceArea(const AABB& aabb)
+	// XMFLOAT4X4 transforms row vectors, Matrix34 column vectors
+	static Matrix34 ToMatrix34(const XMFLOAT4X4& m)
 	{
-		XMFLOAT3 extents;
-		XMStoreFloat3(&extents, aabb.max - aabb.min); // abs ?
+		Matrix34 result;
+		result.rows[0] = Float4(m._11, m._21, m._31, m._41);
+		result.rows[1] = Float4(m._12, m._22, m._32, m._42);
+		result.rows[2] = Float4(m._13, m._23, m._33, m._43);
 
-		return (extents.x * extents.y + extents.y * extents.z + extents.z * extents.x) * 2.0f;
+		return result;
 	}
 
-	void WriteNode(TreeNode* root, TreeNode* treeNode, uint8_t* data, int& dataOffset)
+	static Float3 ToFloat3(const XMVECTOR& v)
 	{
-		if (treeNode)
+		XMFLOAT3 f3;
+		XMStoreFloat3(&f3, v);
+
+		return Float3(f3.x, f3.y, f3.z);
+	}
+
+	// transforms the triangles of an object to world space, writes them and their hit attributes from the record firstVertex on,
+	// returns the vertex records of the object
+	static BVHBuilder::StreamRange GatherObject(const Object& object,
+												const MeshManager& meshManager,
+												const MaterialManager& materialManager,
+												const std::size_t firstTriangle,
+												BVHBuilder::Triangle* triangles,
+												BVHHitAttributes& attributes,
+												const std::size_t firstVertex)
+	{
+		const MeshData& mesh = meshManager.GetMesh(object.mesh);
+		const XMMATRIX world = XMLoadFloat4x4(&object.world);
+		const Material& material = materialManager.GetMaterial(object.material);
+		const XMMATRIX uvTransform = XMLoadFloat4x4(&object.uvTransform) * XMLoadFloat4x4(&material.uvTransform);
+
+		const std::size_t indexCount = mesh.indexCount ? mesh.indexCount : mesh.vertices.size();
+
+		std::size_t offset = firstTriangle; // triangle record in the hit attributes
+
+		attributes.BeginObject(firstVertex);
+
+		for (std::size_t i = 0; i < indexCount; i += 3)
 		{
-			if (treeNode->bIsNode)
-			{
-				int tempDataOffset = 0;
-				Node* node = nullptr;
+			const MeshData::IndexType i0 = mesh.indexCount ? mesh.indices[i + 0] : MeshData::IndexType(i + 0);
+			const MeshData::IndexType i1 = mesh.indexCount ? mesh.indices[i + 1] : MeshData::IndexType(i + 1);
+			const MeshData::IndexType i2 = mesh.indexCount ? mesh.indices[i + 2] : MeshData::IndexType(i + 2);
 
-				// do not write the root node, for secondary rays the origin will always be in the scene bounding box
-				if (treeNode != root)
-				{
-					node = reinterpret_cast<Node*>(data + dataOffset);
+			// the w member of the returned XMVECTOR is initialized to 0
+			XMVECTOR v0 = XMLoadFloat3(&mesh.vertices[i0].position);
+			XMVECTOR v1 = XMLoadFloat3(&mesh.vertices[i1].position);
+			XMVECTOR v2 = XMLoadFloat3(&mesh.vertices[i2].position);
 
-					XMStoreFloat4(&node->min, treeNode->data.aabb.min);
-					XMStoreFloat4(&node->max, treeNode->data.aabb.max);
+			// XMVector3Transform ignores the w component of the input vector, and uses a value of 1 instead
+			v0 = XMVector3Transform(v0, world);
+			v1 = XMVector3Transform(v1, world);
+			v2 = XMVector3Transform(v2, world);
 
-					dataOffset += sizeof(Node);
+			BVHBuilder::Triangle& triangle = *triangles++;
 
-					tempDataOffset = dataOffset;
-				}
+			triangle.v0 = ToFloat3(v0);
+			triangle.v1 = ToFloat3(v1);
+			triangle.v2 = ToFloat3(v2);
 
-				WriteNode(root, treeNode->left, data, dataOffset);
-				WriteNode(root, treeNode->right, data, dataOffset);
+			triangle.offset = std::uint32_t(offset);
 
-				if (treeNode != root)
-				{
-					// when on the left branch, how many float4 elements we need to skip to reach the right branch?
-					node->min.w = -float(dataOffset - tempDataOffset) / sizeof(XMFLOAT4);
-				}
-			}
-			else // leaf
+			triangle.material = std::uint32_t(object.material);
+
+			// hit attributes, vertices with the same object space attributes are stored once
 			{
-				Leaf* leaf = reinterpret_cast<Leaf*>(data + dataOffset);
+				std::uint32_t records[3];
 
-				XMStoreFloat4(&leaf->v0, treeNode->data.v0);
-				XMStoreFloat4(&leaf->e1, treeNode->data.v1 - treeNode->data.v0);
-				XMStoreFloat4(&leaf->e2, treeNode->data.v2 - treeNode->data.v0);
+				for (int k = 0; k < 3; ++k)
+				{
+					const auto& meshVertex = mesh.vertices[(k == 0) ? i0 : (k == 1) ? i1 : i2];
 
-				// when on the left branch, how many float4 elements we need to skip to reach the right branch?
-				leaf->v0.w = sizeof(Leaf) / sizeof(XMFLOAT4);
+					BVHHitAttributes::Vertex key;
+					key.normal = Float3(meshVertex.normal.x, meshVertex.normal.y, meshVertex.normal.z);
+					key.tangent = Float3(meshVertex.tangent.x, meshVertex.tangent.y, meshVertex.tangent.z);
+					key.u = meshVertex.uv.x;
+					key.v = meshVertex.uv.y;
 
-				leaf->e1.w = float(treeNode->data.offset); // triangle index to fetch vertex data
-				leaf->e2.w = float(treeNode->data.material); // material index
+					//uv = XMVector2Transform(uv, uvTransform);
 
-				dataOffset += sizeof(Leaf);
+					BVHHitAttributes::Vertex vertex = key;
+					vertex.normal = ToFloat3(XMVector3TransformNormal(XMLoadFloat3(&meshVertex.normal), world));
+					vertex.tangent = ToFloat3(XMVector3TransformNormal(XMLoadFloat3(&meshVertex.tangent), world));
+
+					records[k] = attributes.AddVertex(key, vertex);
+				}
+
+				attributes.SetTriangle(offset, records[0], records[1], records[2]);
 			}
+
+			offset++;
 		}
+
+		return attributes.EndObject();
+	}
+
+	// rewrites count elements of a buffer starting at element first
+	void UpdateBufferRange(ID3D11Buffer* pBuffer, const void* data, const std::size_t first, const std::size_t count, const std::size_t stride = sizeof(XMFLOAT4))
+	{
+		D3D11_BOX box;
+		box.left = UINT(first * stride);
+		box.right = UINT((first + count) * stride);
+		box.top = 0;
+		box.bottom = 1;
+		box.front = 0;
+		box.back = 1;
+
+		mContext->UpdateSubresource(pBuffer, 0, &box, data, 0, 0);
 	}
 
-	void WriteTreeToBuffer(uint8_t* data, const int size)
+	void WriteTreeToBuffer(const uint8_t* data, const int size)
 	{
 #if STRUCTURED
 		D3D11_BUFFER_DESC desc;
@@ -571,18 +682,21 @@ private:
 		//mContext->Unmap(mTreeBuffer.Get(), 0);
 	}
 
-	void WriteVertexBuffer(const std::vector<XMFLOAT4>& vertices)
+	// a StructuredBuffer<uint3> of BVHHitAttributes records
+	void WriteVertexBuffer(const BVHHitAttributes::Record* vertices, const std::size_t count)
 	{
+		mHitAttributesSize = count * sizeof(BVHHitAttributes::Record);
+
 		D3D11_BUFFER_DESC desc;
-		desc.ByteWidth = UINT(vertices.size()) * sizeof(XMFLOAT4);
+		desc.ByteWidth = UINT(count * sizeof(BVHHitAttributes::Record));
 		desc.Usage = D3D11_USAGE_DEFAULT;
 		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 		desc.CPUAccessFlags = 0;
 		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
-		desc.StructureByteStride = sizeof(XMFLOAT4);
+		desc.StructureByteStride = sizeof(BVHHitAttributes::Record);
 
 		D3D11_SUBRESOURCE_DATA initData;
-		initData.pSysMem = vertices.data();
+		initData.pSysMem = vertices;
 
 		ThrowIfFailed(mDevice->CreateBuffer(&desc, &initData, &mVertexBuffer));
 		NameResource(mVertexBuffer.Get(), "BVHVertexBuffer");
@@ -594,6 +708,32 @@ private:
 	ComPtr<ID3D11Device> mDevice;
 	ComPtr<ID3D11DeviceContext> mContext;
 
+	BuildSettings mSettings;
+	BVHBuilder mBuilder;
+
+	// world space triangles and where each object starts, kept for refits
+	struct ObjectRange
+	{
+		std::size_t first;
+		std::size_t count;
+		BVHBuilder::StreamRange vertices; // hit attribute records
+	};
+
+	BuildVector<BVHBuilder::Triangle> mTriangles;
+	std::vector<ObjectRange> mObjectRanges;
+
+	// indexed hit attributes of the triangles, rewritten per object by the refits
+	BVHHitAttributes mAttributes;
+
+	// BVH_TWO_LEVEL, instance j is object j
+	BVHTwoLevel mTwoLevel;
+
+	std::string mCachePath;
+	std::vector<std::uint64_t> mMeshKeys; // SetMeshKey, 0 hashes the vertices
+	bool mbCachedTree = false; // uploaded from the cache, nothing to refit
+
+	std::size_t mHitAttributesSize = 0; // bytes of the vertex buffer, built or loaded
+
 	ComPtr<ID3D11Buffer> mTreeBuffer;
 	ComPtr<ID3D11ShaderResourceView> mTreeBufferSRV;
 
@@ -0,0 +1,1769 @@
+#include "BVHBuilder.h"
+
+// std
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace
+{
+	float GetQuantizedScale(const BVHBuilder::QuantizedFrame& frame, const int axis)
+	{
+		// a power of two built from its biased exponent, as asfloat(exponent << 23) in the shaders
+		const std::uint32_t bits = ((frame.exponents >> (8 * axis)) & 0xff) << 23;
+
+		float scale;
+		std::memcpy(&scale, &bits, sizeof(scale));
+
+		return scale;
+	}
+
+	// q * scale is exact, so the decoded bound is the same with or without a fused multiply-add
+	float Dequantize(const BVHBuilder::QuantizedFrame& frame, const int axis, const std::uint32_t q)
+	{
+		return frame.origin[axis] + float(q) * GetQuantizedScale(frame, axis);
+	}
+
+	// the smallest power of two scale that covers the box extent with maxQ steps
+	BVHBuilder::QuantizedFrame GetQuantizedFrame(const AABB& aabb, const std::uint32_t maxQ)
+	{
+		BVHBuilder::QuantizedFrame frame;
+		frame.origin = aabb.min;
+		frame.exponents = 0;
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float extent = aabb.max[axis] - aabb.min[axis];
+
+			int exponent = -126;
+
+			if (extent > 0.0f)
+			{
+				std::frexp(extent / float(maxQ), &exponent);
+				exponent = std::clamp(exponent - 1, -126, 127);
+			}
+
+			frame.exponents &= ~(0xffu << (8 * axis));
+			frame.exponents |= std::uint32_t(exponent + 127) << (8 * axis);
+
+			// rounding in the addition may leave the last step short of the max
+			while (Dequantize(frame, axis, maxQ) < aabb.max[axis] && exponent < 127)
+			{
+				exponent++;
+
+				frame.exponents &= ~(0xffu << (8 * axis));
+				frame.exponents |= std::uint32_t(exponent + 127) << (8 * axis);
+			}
+		}
+
+		return frame;
+	}
+
+	// rounds min down and max up, returns false when the box is not inside the frame
+	bool Quantize(const BVHBuilder::QuantizedFrame& frame, const AABB& aabb, const std::uint32_t maxQ, std::uint32_t* q)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float scale = GetQuantizedScale(frame, axis);
+
+			const float min = std::floor((aabb.min[axis] - frame.origin[axis]) / scale);
+			const float max = std::ceil((aabb.max[axis] - frame.origin[axis]) / scale);
+
+			std::uint32_t qMin = std::uint32_t(std::clamp(min, 0.0f, float(maxQ)));
+			std::uint32_t qMax = std::uint32_t(std::clamp(max, 0.0f, float(maxQ)));
+
+			while (qMin > 0 && Dequantize(frame, axis, qMin) > aabb.min[axis])
+			{
+				qMin--;
+			}
+
+			while (qMax < maxQ && Dequantize(frame, axis, qMax) < aabb.max[axis])
+			{
+				qMax++;
+			}
+
+			if (Dequantize(frame, axis, qMin) > aabb.min[axis] || Dequantize(frame, axis, qMax) < aabb.max[axis])
+			{
+				return false;
+			}
+
+			q[axis] = qMin;
+			q[3 + axis] = qMax;
+		}
+
+		return true;
+	}
+}
+
+BVHBuilder::BVHBuilder()
+	: mTriangles(&mTracker)
+	, mNodes(&mTracker)
+	, mStream(&mTracker)
+	, mTriangleSlots(&mTracker)
+	, mTriangleLeaves(&mTracker)
+	, mDirtyRanges(&mTracker)
+{}
+
+template <typename GetBounds>
+void BVHBuilder::BuildTree(const std::size_t count, const BuildSettings& settings, GetBounds getBounds)
+{
+	assert(count > 0);
+	assert(settings.binCount >= 2 && settings.binCount <= kMaxBinCount);
+	assert(settings.maxLeafSize >= 1 && settings.maxLeafSize <= kMaxLeafSize);
+	assert(settings.width == 2 || settings.width == 4 || settings.width == 8);
+	assert(settings.quantization == 0 || (settings.width != 2 && (settings.quantization == 8 || settings.quantization == 16)));
+	assert(count <= std::size_t(settings.maxLeafSize) << std::min(GetMaxDepth(settings.width), 32));
+
+	Clear();
+
+	mSettings = settings;
+
+	mStats = BuildStats();
+	mStats.triangleCount = count;
+
+	mTriangles.reserve(count);
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		TriangleData data;
+
+		getBounds(i, data);
+
+		data.centroid = data.aabb.GetCentroid();
+		data.index = std::uint32_t(i);
+
+		mTriangles.push_back(data);
+	}
+
+	// the pool only lives for the duration of the build, spatial splits are built serially
+	std::unique_ptr<TaskPool> pool;
+
+	if (mSettings.threadCount != 1 && mSettings.mode != BuildMode::Spatial)
+	{
+		pool = std::make_unique<TaskPool>(mSettings.threadCount);
+		mPool = pool.get();
+	}
+
+	mNodeCount = 0;
+	mLeafCount = 0;
+
+	if (mSettings.mode == BuildMode::Spatial)
+	{
+		// the reference count is only known at the end, nodes and leaves grow as they are created
+		BuildVector<TriangleData> leafReferences(&mTracker);
+		leafReferences.reserve(count);
+
+		mNodes.reserve(2 * count - 1);
+
+		// spatial splits clip the input triangles, a hierarchy over plain bounds only gets object splits
+		mSpatialBudget = mInput ? std::size_t(float(count) * mSettings.spatialSplitBudget) : 0;
+		mRootSurfaceArea = ComputeBounds(0, int(count - 1)).GetSurfaceArea();
+
+		CreateSpatialNode(0, 0, leafReferences);
+
+		mTriangles = std::move(leafReferences);
+		mTriangleLeaves.resize(mTriangles.size());
+
+		for (int index = 0; index < int(mNodes.size()); ++index)
+		{
+			const TreeNode& node = mNodes[index];
+
+			for (int i = node.first; i < node.first + node.count; ++i)
+			{
+				mTriangleLeaves[i] = index;
+			}
+		}
+	}
+	else
+	{
+		mNodes.resize(2 * count - 1);
+		mTriangleLeaves.resize(count);
+
+		CreateTreeNode(0, 0, int(count - 1), 0);
+	}
+
+	mStats.threadCount = pool ? pool->GetThreadCount() : 1;
+
+	mPool = nullptr;
+	pool.reset();
+
+	// with spatial splits a triangle maps to its last reference, such trees are not refitted
+	mTriangleSlots.resize(count);
+
+	for (std::size_t i = 0; i < mTriangles.size(); ++i)
+	{
+		mTriangleSlots[mTriangles[i].index] = std::uint32_t(i);
+	}
+
+	mStats.referenceCount = mTriangles.size();
+	mStats.nodeCount = mNodeCount;
+	mStats.leafCount = mLeafCount;
+	mStats.sahCost = GetSAHCost(0) / mNodes[0].aabb.GetSurfaceArea();
+	mStats.peakMemory = mTracker.peakBytes;
+	mStats.allocationCount = mTracker.allocationCount;
+}
+
+void BVHBuilder::Build(const Triangle* triangles, const std::size_t triangleCount, const BuildSettings& settings)
+{
+	const auto buildBegin = std::chrono::steady_clock::now();
+
+	// read by the spatial splits and the serialization
+	mInput = triangles;
+
+	BuildTree(triangleCount, settings, [&](const std::size_t i, TriangleData& data)
+	{
+		const Triangle& triangle = triangles[i];
+
+		data.aabb.Expand(triangle.v0);
+		data.aabb.Expand(triangle.v1);
+		data.aabb.Expand(triangle.v2);
+	});
+
+	const std::size_t size = GetSerializedSize();
+
+	mStream.resize(size / sizeof(Float4));
+
+	int dataOffset = 0;
+
+	if (mSettings.width == 2)
+	{
+		WriteNode(0, reinterpret_cast<uint8_t*>(mStream.data()), dataOffset);
+
+		// terminate tree
+		Node* node = reinterpret_cast<Node*>(reinterpret_cast<uint8_t*>(mStream.data()) + dataOffset);
+		*node = Node{ Float4(0, 0, 0, 0), Float4(0, 0, 0, 0) };
+
+		dataOffset += sizeof(Node);
+	}
+	else
+	{
+		// the traversal stack ends the wide stream, no terminator
+		WriteWideNode(0, reinterpret_cast<uint8_t*>(mStream.data()), dataOffset);
+	}
+
+	assert(std::size_t(dataOffset) == size);
+
+	mInput = nullptr;
+
+	const std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - buildBegin;
+
+	mStats.wideNodeCount = (mSettings.width == 2) ? 0 : GetWideNodeCount(0);
+	mStats.nodeSize = (mSettings.width == 2) ? sizeof(Node) : GetWideNodeSize(mSettings.width, mSettings.quantization) * sizeof(Float4);
+	mStats.leafSize = GetLeafSize(mSettings.leafFormat) * sizeof(Float4);
+	mStats.serializedSize = size;
+	mStats.uncompressedSize = size + mStats.wideNodeCount * GetWideNodeSize(mSettings.width, 0) * sizeof(Float4) - mStats.wideNodeCount * mStats.nodeSize;
+	mStats.peakMemory = mTracker.peakBytes;
+	mStats.allocationCount = mTracker.allocationCount;
+	mStats.buildTime = buildTime.count();
+}
+
+void BVHBuilder::BuildHierarchy(const AABB* bounds, const std::size_t count, const BuildSettings& settings)
+{
+	const auto buildBegin = std::chrono::steady_clock::now();
+
+	BuildTree(count, settings, [&](const std::size_t i, TriangleData& data)
+	{
+		data.aabb = bounds[i];
+	});
+
+	const std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - buildBegin;
+
+	mStats.buildTime = buildTime.count();
+}
+
+void BVHBuilder::Clear()
+{
+	mTriangles = BuildVector<TriangleData>(&mTracker);
+	mNodes = BuildVector<TreeNode>(&mTracker);
+	mStream = BuildVector<Float4>(&mTracker);
+	mTriangleSlots = BuildVector<std::uint32_t>(&mTracker);
+	mTriangleLeaves = BuildVector<int>(&mTracker);
+	mDirtyRanges = BuildVector<StreamRange>(&mTracker);
+}
+
+void BVHBuilder::Print(std::ostream& stream, const Triangle* triangles, const int index, const int level) const
+{
+	auto Float3ToStr = [](const Float3& f3)
+	{
+		std::string str = "(";
+		str.append(std::to_string(f3.x)).append(",");
+		str.append(std::to_string(f3.y)).append(",");
+		str.append(std::to_string(f3.z)).append(")");
+
+		return str;
+	};
+
+	if (index >= 0)
+	{
+		const TreeNode& node = mNodes[index];
+
+		stream << !node.bIsNode << " " << std::string(level, '.') << " AABB min=" << Float3ToStr(node.aabb.min) << " max=" << Float3ToStr(node.aabb.max) << "\n";
+
+		if (!node.bIsNode)
+		{
+			for (int i = node.first; i < node.first + node.count; ++i)
+			{
+				const Triangle& triangle = triangles[mTriangles[i].index];
+
+				stream << "  " << std::string(level, '.') << " v0=" << Float3ToStr(triangle.v0) << " v1=" << Float3ToStr(triangle.v1) << " v2=" << Float3ToStr(triangle.v2) << "\n";
+			}
+		}
+
+		Print(stream, triangles, node.left, level + 1);
+		Print(stream, triangles, node.right, level + 1);
+	}
+}
+
+void BVHBuilder::CreateTreeNode(const int index, const int begin, const int end, const int depth)
+{
+	int count = end - begin + 1;
+	assert(count > 0);
+
+	TreeNode* node = &mNodes[index];
+
+	node->aabb = ComputeBounds(begin, end);
+
+	int split = begin;
+	Axis axis = Axis::X;
+	float splitCost = FLT_MAX;
+
+	if (count > 1)
+	{
+		if (mSettings.mode == BuildMode::Binned)
+		{
+			split = PartitionBinned(begin, end, splitCost);
+		}
+		else
+		{
+			FindBestSplit(begin, end, split, axis, splitCost);
+		}
+	}
+
+	// SAH termination: intersecting every triangle against splitting and traversing two children
+	const float surfaceArea = node->aabb.GetSurfaceArea();
+	const float leafCost = mSettings.intersectionCost * surfaceArea * float(count);
+	const float nodeCost = mSettings.traversalCost * surfaceArea + mSettings.intersectionCost * splitCost;
+
+	// the last level only holds leaves, the capacity of the levels above keeps them small enough
+	const int maxDepth = GetMaxDepth(mSettings.width);
+	assert(depth < maxDepth || count <= mSettings.maxLeafSize);
+
+	if (count == 1 || (count <= mSettings.maxLeafSize && (leafCost <= nodeCost || depth == maxDepth))) // leaf
+	{
+		node->bIsNode = false;
+
+		node->first = begin;
+		node->count = count;
+
+		for (int i = begin; i <= end; ++i)
+		{
+			mTriangleLeaves[i] = index;
+		}
+
+		mLeafCount++;
+	}
+	else // node
+	{
+		const std::size_t childCapacity = GetSubtreeCapacity(maxDepth - depth - 1);
+
+		if (std::size_t(std::max(split - begin, end - split + 1)) > childCapacity)
+		{
+			split = PartitionMedian(begin, end);
+		}
+		else if (mSettings.mode == BuildMode::Sweep)
+		{
+			SortAlongAxis(begin, end, axis);
+		}
+
+		// the left subtree owns the 2 * countLeft - 1 slots after this node, the right one the slots after those
+		node->left = index + 1;
+		node->right = index + 2 * (split - begin);
+
+		// the two subranges are disjoint, large ones are built concurrently
+		if (mPool && count >= mSettings.parallelThreshold)
+		{
+			TaskPool::TaskGroup group;
+
+			mPool->Submit(group, [&]
+			{
+				CreateTreeNode(node->left, begin, split - 1, depth + 1);
+			});
+
+			CreateTreeNode(node->right, split, end, depth + 1);
+
+			mPool->Wait(group);
+		}
+		else
+		{
+			CreateTreeNode(node->left, begin, split - 1, depth + 1);
+			CreateTreeNode(node->right, split, end, depth + 1);
+		}
+
+		// access the child with the largest probability of collision first
+		const float surfaceAreaLeft = mNodes[node->left].aabb.GetSurfaceArea();
+		const float surfaceAreaRight = mNodes[node->right].aabb.GetSurfaceArea();
+
+		if (surfaceAreaRight > surfaceAreaLeft)
+		{
+			std::swap(node->left, node->right);
+		}
+
+		mNodes[node->left].parent = index;
+		mNodes[node->right].parent = index;
+
+		node->bIsNode = true;
+
+		mNodeCount++;
+	}
+}
+
+std::size_t BVHBuilder::GetSubtreeCapacity(const int levels) const
+{
+	// the counts are ints, deeper subtrees hold any of them
+	return std::size_t(mSettings.maxLeafSize) << std::min(levels, 32);
+}
+
+int BVHBuilder::PartitionMedian(const int begin, const int end)
+{
+	AABB centroids;
+
+	for (int i = begin; i <= end; ++i)
+	{
+		centroids.Expand(mTriangles[i].centroid);
+	}
+
+	const Float3 extent = centroids.max - centroids.min;
+	const int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z) ? 1 : 2;
+
+	const int split = begin + (end - begin + 1) / 2;
+
+	std::nth_element(mTriangles.begin() + begin, mTriangles.begin() + split, mTriangles.begin() + end + 1, [axis](const TriangleData& a, const TriangleData& b)
+	{
+		return a.centroid[axis] < b.centroid[axis];
+	});
+
+	return split;
+}
+
+// kept out of CreateTreeNode so the per chunk bounds do not sit on the stack of every recursion level
+AABB BVHBuilder::ComputeBounds(const int begin, const int end)
+{
+	const int chunkCount = GetChunkCount(end - begin + 1);
+	AABB chunkAABBs[kMaxChunkCount];
+
+	auto expand = [&](const int chunk, const int chunkBegin, const int chunkEnd)
+	{
+		for (int i = chunkBegin; i <= chunkEnd; ++i)
+		{
+			chunkAABBs[chunk].Expand(mTriangles[i].aabb);
+		}
+	};
+
+	RunChunks(begin, end, chunkCount, expand);
+
+	// merged in chunk order
+	AABB aabb;
+
+	for (int chunk = 0; chunk < chunkCount; ++chunk)
+	{
+		aabb.Expand(chunkAABBs[chunk]);
+	}
+
+	return aabb;
+}
+
+void BVHBuilder::FindBestSplit(const int begin, const int end, int& split, Axis& splitAxis, float& splitCost)
+{
+	split = begin;
+	splitAxis = Axis::X;
+	splitCost = FLT_MAX;
+
+	const int count = end - begin + 1;
+	int bestSplit = begin;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		Axis axis = Axis(i);
+
+		SortAlongAxis(begin, end, axis);
+
+		AABB aabbLeft;
+		AABB aabbRight;
+
+		for (int indexLeft = 0; indexLeft < count; ++indexLeft)
+		{
+			int indexRight = count - indexLeft - 1;
+
+			aabbLeft.Expand(mTriangles[begin + indexLeft].aabb);
+			aabbRight.Expand(mTriangles[begin + indexRight].aabb);
+
+			float surfaceAreaLeft = aabbLeft.GetSurfaceArea();
+			float surfaceAreaRight = aabbRight.GetSurfaceArea();
+
+			mTriangles[begin + indexLeft].surfaceAreaLeft = surfaceAreaLeft;
+			mTriangles[begin + indexRight].surfaceAreaRight = surfaceAreaRight;
+		}
+
+		float bestCost = FLT_MAX;
+
+		for (int mid = begin + 1; mid <= end; ++mid)
+		{
+			float surfaceAreaLeft = mTriangles[mid - 1].surfaceAreaLeft;
+			float surfaceAreaRight = mTriangles[mid].surfaceAreaRight;
+
+			int countLeft = mid - begin;
+			int countRight = end - mid + 1;
+
+			float costLeft = surfaceAreaLeft * (float)countLeft;
+			float costRight = surfaceAreaRight * (float)countRight;
+
+			float cost = costLeft + costRight;
+
+			if (cost < bestCost)
+			{
+				bestSplit = mid;
+				bestCost = cost;
+			}
+		}
+
+		if (bestCost < splitCost)
+		{
+			split = bestSplit;
+			splitAxis = axis;
+			splitCost = bestCost;
+		}
+	}
+}
+
+void BVHBuilder::SortAlongAxis(const int begin, const int end, const Axis axis)
+{
+	TriangleData* base = mTriangles.data() + begin;
+	const int count = end - begin + 1;
+	const std::size_t size = sizeof(TriangleData);
+
+	switch (axis)
+	{
+		case Axis::X:
+			std::qsort(base, count, size, [](const void* lhs, const void* rhs)
+			{
+				const TriangleData* a = static_cast<const TriangleData*>(lhs);
+				const TriangleData* b = static_cast<const TriangleData*>(rhs);
+
+				return (a->centroid.x < b->centroid.x) ? -1 : +1;
+			});
+			break;
+		case Axis::Y:
+			std::qsort(base, count, size, [](const void* lhs, const void* rhs)
+			{
+				const TriangleData* a = static_cast<const TriangleData*>(lhs);
+				const TriangleData* b = static_cast<const TriangleData*>(rhs);
+
+				return (a->centroid.y < b->centroid.y) ? -1 : +1;
+			});
+			break;
+		case Axis::Z:
+			std::qsort(base, count, size, [](const void* lhs, const void* rhs)
+			{
+				const TriangleData* a = static_cast<const TriangleData*>(lhs);
+				const TriangleData* b = static_cast<const TriangleData*>(rhs);
+
+				return (a->centroid.z < b->centroid.z) ? -1 : +1;
+			});
+			break;
+	}
+}
+
+// bin index of the triangle centroid along the axis, the same mapping is used to evaluate and to partition
+int BVHBuilder::GetBinIndex(const TriangleData& triangle, const int axis, const float min, const float scale) const
+{
+	const int index = int((triangle.centroid[axis] - min) * scale);
+	return std::clamp(index, 0, mSettings.binCount - 1);
+}
+
+void BVHBuilder::FindBestSplitBinned(const int begin, const int end, const AABB& centroids, int& splitBin, Axis& splitAxis, float& splitCost)
+{
+	splitBin = 0;
+	splitAxis = Axis::X;
+	splitCost = FLT_MAX;
+
+	const int binCount = mSettings.binCount;
+
+	float mins[3];
+	float scales[3];
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		mins[axis] = centroids.min[axis];
+		const float extent = centroids.max[axis] - mins[axis];
+
+		// all centroids on the same plane, nothing to split along this axis
+		scales[axis] = (extent > 0.0f) ? float(binCount) * (1.0f - 1e-6f) / extent : 0.0f;
+	}
+
+	// bin every axis in a single pass, one bin set per chunk
+	const int chunkCount = GetChunkCount(end - begin + 1);
+
+	// only nodes above parallelSplitThreshold need the extra bin sets
+	BinSet binSet;
+	BuildVector<BinSet> chunkBinSets(chunkCount - 1, BinSet(), &mTracker);
+
+	auto bin = [&](const int chunk, const int chunkBegin, const int chunkEnd)
+	{
+		BinSet& set = chunk ? chunkBinSets[chunk - 1] : binSet;
+
+		for (int i = chunkBegin; i <= chunkEnd; ++i)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				if (scales[axis] > 0.0f)
+				{
+					Bin& bin = set.bins[axis][GetBinIndex(mTriangles[i], axis, mins[axis], scales[axis])];
+					bin.aabb.Expand(mTriangles[i].aabb);
+					bin.count++;
+				}
+			}
+		}
+	};
+
+	RunChunks(begin, end, chunkCount, bin);
+
+	// merge in chunk order, min/max and counts are exact so the result does not depend on the chunking
+	for (const BinSet& set : chunkBinSets)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			for (int i = 0; i < binCount; ++i)
+			{
+				binSet.bins[axis][i].aabb.Expand(set.bins[axis][i].aabb);
+				binSet.bins[axis][i].count += set.bins[axis][i].count;
+			}
+		}
+	}
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (scales[axis] == 0.0f)
+		{
+			continue;
+		}
+
+		const Bin* bins = binSet.bins[axis];
+
+		// sweep from the right to accumulate the right side of every plane
+		float surfaceAreaRight[kMaxBinCount];
+		int countRight[kMaxBinCount];
+
+		AABB aabbRight;
+		int count = 0;
+
+		for (int i = binCount - 1; i > 0; --i)
+		{
+			aabbRight.Expand(bins[i].aabb);
+			count += bins[i].count;
+
+			surfaceAreaRight[i] = aabbRight.GetSurfaceArea();
+			countRight[i] = count;
+		}
+
+		// sweep from the left and evaluate the plane between bin i - 1 and bin i
+		AABB aabbLeft;
+		int countLeft = 0;
+
+		for (int i = 1; i < binCount; ++i)
+		{
+			aabbLeft.Expand(bins[i - 1].aabb);
+			countLeft += bins[i - 1].count;
+
+			if (countLeft == 0 || countRight[i] == 0)
+			{
+				continue;
+			}
+
+			const float cost = aabbLeft.GetSurfaceArea() * (float)countLeft + surfaceAreaRight[i] * (float)countRight[i];
+
+			if (cost < splitCost)
+			{
+				splitBin = i;
+				splitAxis = Axis(axis);
+				splitCost = cost;
+			}
+		}
+	}
+}
+
+int BVHBuilder::PartitionBinned(const int begin, const int end, float& splitCost)
+{
+	AABB centroids;
+
+	{
+		const int chunkCount = GetChunkCount(end - begin + 1);
+		AABB chunkCentroids[kMaxChunkCount];
+
+		auto expand = [&](const int chunk, const int chunkBegin, const int chunkEnd)
+		{
+			for (int i = chunkBegin; i <= chunkEnd; ++i)
+			{
+				chunkCentroids[chunk].Expand(mTriangles[i].centroid);
+			}
+		};
+
+		RunChunks(begin, end, chunkCount, expand);
+
+		for (int chunk = 0; chunk < chunkCount; ++chunk)
+		{
+			centroids.Expand(chunkCentroids[chunk]);
+		}
+	}
+
+	int splitBin;
+	Axis splitAxis;
+
+	FindBestSplitBinned(begin, end, centroids, splitBin, splitAxis, splitCost);
+
+	if (splitCost == FLT_MAX)
+	{
+		// coincident centroids, any split is as good as another
+		return begin + (end - begin + 1) / 2;
+	}
+
+	const int axis = int(splitAxis);
+	const float min = centroids.min[axis];
+	const float scale = float(mSettings.binCount) * (1.0f - 1e-6f) / (centroids.max[axis] - min);
+
+	auto middle = std::partition(mTriangles.begin() + begin, mTriangles.begin() + end + 1, [&](const TriangleData& triangle)
+	{
+		return GetBinIndex(triangle, axis, min, scale) < splitBin;
+	});
+
+	return int(middle - mTriangles.begin());
+}
+
+int BVHBuilder::CreateSpatialNode(const int begin, const int depth, BuildVector<TriangleData>& leafReferences)
+{
+	const int end = int(mTriangles.size()) - 1;
+	const int count = end - begin + 1;
+	assert(count > 0);
+
+	const int index = int(mNodes.size());
+	mNodes.emplace_back();
+
+	const AABB aabb = ComputeBounds(begin, end);
+	mNodes[index].aabb = aabb;
+
+	// object split, as in Binned mode
+	AABB centroids;
+
+	for (int i = begin; i <= end; ++i)
+	{
+		centroids.Expand(mTriangles[i].centroid);
+	}
+
+	int splitBin = 0;
+	Axis splitAxis = Axis::X;
+	float objectCost = FLT_MAX;
+
+	if (count > 1)
+	{
+		FindBestSplitBinned(begin, end, centroids, splitBin, splitAxis, objectCost);
+	}
+
+	const int axis = int(splitAxis);
+	const float min = centroids.min[axis];
+	const float scale = (objectCost < FLT_MAX) ? float(mSettings.binCount) * (1.0f - 1e-6f) / (centroids.max[axis] - min) : 0.0f;
+
+	// the references of a child are bounded by the levels left above GetMaxDepth, as in CreateTreeNode. a spatial split
+	// child may hold as many references as the node
+	const int maxDepth = GetMaxDepth(mSettings.width);
+	assert(depth < maxDepth || count <= mSettings.maxLeafSize);
+
+	const std::size_t childCapacity = (depth < maxDepth) ? GetSubtreeCapacity(maxDepth - depth - 1) : 0;
+
+	// spatial split, only tried where the object split children overlap enough to be worth duplicating references
+	SpatialSplit spatialSplit;
+
+	if (count > 1 && mSpatialBudget > 0 && std::size_t(count) <= childCapacity)
+	{
+		float overlap = aabb.GetSurfaceArea();
+
+		if (objectCost < FLT_MAX)
+		{
+			AABB aabbLeft;
+			AABB aabbRight;
+
+			for (int i = begin; i <= end; ++i)
+			{
+				(GetBinIndex(mTriangles[i], axis, min, scale) < splitBin ? aabbLeft : aabbRight).Expand(mTriangles[i].aabb);
+			}
+
+			const Float3 overlapMin = Max(aabbLeft.min, aabbRight.min);
+			const Float3 overlapMax = Min(aabbLeft.max, aabbRight.max);
+
+			overlap = 0.0f;
+
+			if (overlapMin.x <= overlapMax.x && overlapMin.y <= overlapMax.y && overlapMin.z <= overlapMax.z)
+			{
+				overlap = AABB{ overlapMin, overlapMax }.GetSurfaceArea();
+			}
+		}
+
+		if (overlap > mSettings.spatialSplitAlpha * mRootSurfaceArea)
+		{
+			FindBestSpatialSplit(begin, end, aabb, spatialSplit);
+		}
+	}
+
+	// SAH termination, as in CreateTreeNode
+	const float splitCost = std::min(objectCost, spatialSplit.cost);
+	const float surfaceArea = aabb.GetSurfaceArea();
+	const float leafCost = mSettings.intersectionCost * surfaceArea * float(count);
+	const float nodeCost = mSettings.traversalCost * surfaceArea + mSettings.intersectionCost * splitCost;
+
+	if (count == 1 || (count <= mSettings.maxLeafSize && (leafCost <= nodeCost || depth == maxDepth))) // leaf
+	{
+		TreeNode& node = mNodes[index];
+
+		node.bIsNode = false;
+
+		node.first = int(leafReferences.size());
+		node.count = count;
+
+		leafReferences.insert(leafReferences.end(), mTriangles.begin() + begin, mTriangles.end());
+		mTriangles.resize(begin);
+
+		mLeafCount++;
+
+		return index;
+	}
+
+	int split = -1;
+
+	if (spatialSplit.cost < objectCost)
+	{
+		split = PartitionSpatial(begin, end, spatialSplit);
+
+		if (split >= 0)
+		{
+			mStats.spatialSplitCount++;
+		}
+	}
+
+	if (split < 0)
+	{
+		if (objectCost == FLT_MAX)
+		{
+			// coincident centroids, any split is as good as another
+			split = begin + count / 2;
+		}
+		else
+		{
+			auto middle = std::partition(mTriangles.begin() + begin, mTriangles.begin() + end + 1, [&](const TriangleData& triangle)
+			{
+				return GetBinIndex(triangle, axis, min, scale) < splitBin;
+			});
+
+			split = int(middle - mTriangles.begin());
+		}
+
+		if (std::size_t(std::max(split - begin, end - split + 1)) > childCapacity)
+		{
+			split = PartitionMedian(begin, end);
+		}
+	}
+
+	// the right references are on top, their subtree is built first and both pop their references
+	const int right = CreateSpatialNode(split, depth + 1, leafReferences);
+	const int left = CreateSpatialNode(begin, depth + 1, leafReferences);
+
+	TreeNode& node = mNodes[index];
+
+	node.left = left;
+	node.right = right;
+
+	// access the child with the largest probability of collision first
+	if (mNodes[node.right].aabb.GetSurfaceArea() > mNodes[node.left].aabb.GetSurfaceArea())
+	{
+		std::swap(node.left, node.right);
+	}
+
+	mNodes[node.left].parent = index;
+	mNodes[node.right].parent = index;
+
+	node.bIsNode = true;
+
+	mNodeCount++;
+
+	return index;
+}
+
+void BVHBuilder::FindBestSpatialSplit(const int begin, const int end, const AABB& aabb, SpatialSplit& split) const
+{
+	const int binCount = mSettings.binCount;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float min = aabb.min[axis];
+		const float extent = aabb.max[axis] - min;
+
+		if (extent <= 0.0f)
+		{
+			continue;
+		}
+
+		const float scale = float(binCount) * (1.0f - 1e-6f) / extent;
+		const float binSize = extent / float(binCount);
+
+		// a reference adds its clipped part to every bin it spans
+		SpatialBin bins[kMaxBinCount];
+
+		for (int i = begin; i <= end; ++i)
+		{
+			const TriangleData& reference = mTriangles[i];
+
+			const int first = std::clamp(int((reference.aabb.min[axis] - min) * scale), 0, binCount - 1);
+			const int last = std::clamp(int((reference.aabb.max[axis] - min) * scale), first, binCount - 1);
+
+			for (int bin = first; bin <= last; ++bin)
+			{
+				// the outer bins are open so that rounding does not cut off a part of the reference
+				const float binMin = (bin == first) ? -FLT_MAX : min + binSize * float(bin);
+				const float binMax = (bin == last) ? FLT_MAX : min + binSize * float(bin + 1);
+
+				bins[bin].aabb.Expand(ClipTriangle(reference, axis, binMin, binMax));
+			}
+
+			bins[first].entryCount++;
+			bins[last].exitCount++;
+		}
+
+		// sweep from the right to accumulate the right side of every plane
+		AABB aabbRights[kMaxBinCount];
+		int countRights[kMaxBinCount];
+
+		AABB aabbRight;
+		int countRight = 0;
+
+		for (int i = binCount - 1; i > 0; --i)
+		{
+			aabbRight.Expand(bins[i].aabb);
+			countRight += bins[i].exitCount;
+
+			aabbRights[i] = aabbRight;
+			countRights[i] = countRight;
+		}
+
+		// sweep from the left and evaluate the plane between bin i - 1 and bin i
+		AABB aabbLeft;
+		int countLeft = 0;
+
+		for (int i = 1; i < binCount; ++i)
+		{
+			aabbLeft.Expand(bins[i - 1].aabb);
+			countLeft += bins[i - 1].entryCount;
+
+			if (countLeft == 0 || countRights[i] == 0)
+			{
+				continue;
+			}
+
+			const float cost = aabbLeft.GetSurfaceArea() * (float)countLeft + aabbRights[i].GetSurfaceArea() * (float)countRights[i];
+
+			if (cost < split.cost)
+			{
+				split.axis = axis;
+				split.plane = min + binSize * float(i);
+				split.cost = cost;
+
+				split.left = aabbLeft;
+				split.right = aabbRights[i];
+				split.countLeft = countLeft;
+				split.countRight = countRights[i];
+			}
+		}
+	}
+}
+
+int BVHBuilder::PartitionSpatial(const int begin, const int end, const SpatialSplit& split)
+{
+	auto IsEmpty = [](const AABB& aabb)
+	{
+		return aabb.min.x > aabb.max.x || aabb.min.y > aabb.max.y || aabb.min.z > aabb.max.z;
+	};
+
+	const int axis = split.axis;
+
+	BuildVector<TriangleData> left(&mTracker);
+	BuildVector<TriangleData> right(&mTracker);
+
+	left.reserve(split.countLeft);
+	right.reserve(split.countRight);
+
+	AABB aabbLeft = split.left;
+	AABB aabbRight = split.right;
+	int countLeft = split.countLeft;
+	int countRight = split.countRight;
+
+	std::size_t budget = mSpatialBudget;
+
+	for (int i = begin; i <= end; ++i)
+	{
+		const TriangleData& reference = mTriangles[i];
+
+		if (reference.aabb.max[axis] <= split.plane)
+		{
+			left.push_back(reference);
+		}
+		else if (reference.aabb.min[axis] >= split.plane)
+		{
+			right.push_back(reference);
+		}
+		else
+		{
+			TriangleData referenceLeft = reference;
+			TriangleData referenceRight = reference;
+
+			referenceLeft.aabb = ClipTriangle(reference, axis, -FLT_MAX, split.plane);
+			referenceRight.aabb = ClipTriangle(reference, axis, split.plane, FLT_MAX);
+
+			referenceLeft.centroid = referenceLeft.aabb.GetCentroid();
+			referenceRight.centroid = referenceRight.aabb.GetCentroid();
+
+			// reference unsplitting: the whole triangle goes to one side when that is cheaper than duplicating it
+			AABB unionLeft = aabbLeft;
+			unionLeft.Expand(reference.aabb);
+
+			AABB unionRight = aabbRight;
+			unionRight.Expand(reference.aabb);
+
+			const float duplicateCost = aabbLeft.GetSurfaceArea() * float(countLeft) + aabbRight.GetSurfaceArea() * float(countRight);
+			const float leftCost = unionLeft.GetSurfaceArea() * float(countLeft) + aabbRight.GetSurfaceArea() * float(countRight - 1);
+			const float rightCost = aabbLeft.GetSurfaceArea() * float(countLeft - 1) + unionRight.GetSurfaceArea() * float(countRight);
+
+			const bool bEmptyLeft = IsEmpty(referenceLeft.aabb);
+			const bool bEmptyRight = IsEmpty(referenceRight.aabb);
+
+			if (!bEmptyLeft && !bEmptyRight && budget > 0 && duplicateCost <= std::min(leftCost, rightCost))
+			{
+				left.push_back(referenceLeft);
+				right.push_back(referenceRight);
+
+				budget--;
+			}
+			else if (bEmptyRight || (!bEmptyLeft && leftCost <= rightCost))
+			{
+				left.push_back(reference);
+
+				aabbLeft = unionLeft;
+				countRight--;
+			}
+			else
+			{
+				right.push_back(reference);
+
+				aabbRight = unionRight;
+				countLeft--;
+			}
+		}
+	}
+
+	if (left.empty() || right.empty())
+	{
+		return -1;
+	}
+
+	mSpatialBudget = budget;
+
+	mTriangles.resize(begin);
+	mTriangles.insert(mTriangles.end(), left.begin(), left.end());
+	mTriangles.insert(mTriangles.end(), right.begin(), right.end());
+
+	return begin + int(left.size());
+}
+
+AABB BVHBuilder::ClipTriangle(const TriangleData& reference, const int axis, const float min, const float max) const
+{
+	const Triangle& triangle = mInput[reference.index];
+	const Float3 vertices[3] = { triangle.v0, triangle.v1, triangle.v2 };
+
+	AABB aabb;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		const Float3& a = vertices[i];
+		const Float3& b = vertices[(i + 1) % 3];
+
+		if (a[axis] >= min && a[axis] <= max)
+		{
+			aabb.Expand(a);
+		}
+
+		// where the edge crosses the planes
+		for (const float plane : { min, max })
+		{
+			if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane))
+			{
+				Float3 point = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+				point[axis] = plane;
+
+				aabb.Expand(point);
+			}
+		}
+	}
+
+	// earlier splits already clipped the reference
+	aabb.min = Max(aabb.min, reference.aabb.min);
+	aabb.max = Min(aabb.max, reference.aabb.max);
+
+	if (aabb.min.x > aabb.max.x || aabb.min.y > aabb.max.y || aabb.min.z > aabb.max.z)
+	{
+		return AABB();
+	}
+
+	return aabb;
+}
+
+int BVHBuilder::GetChunkCount(const int count) const
+{
+	return (mPool && count >= mSettings.parallelSplitThreshold) ? std::min(int(mPool->GetThreadCount()), kMaxChunkCount) : 1;
+}
+
+template <typename Body>
+void BVHBuilder::RunChunks(const int begin, const int end, const int chunkCount, Body& body)
+{
+	if (chunkCount == 1)
+	{
+		body(0, begin, end);
+		return;
+	}
+
+	const std::int64_t count = end - begin + 1;
+
+	TaskPool::TaskGroup group;
+
+	for (int chunk = 0; chunk < chunkCount; ++chunk)
+	{
+		const int chunkBegin = begin + int(count * chunk / chunkCount);
+		const int chunkEnd = begin + int(count * (chunk + 1) / chunkCount) - 1;
+
+		mPool->Submit(group, [&body, chunk, chunkBegin, chunkEnd]
+		{
+			body(chunk, chunkBegin, chunkEnd);
+		});
+	}
+
+	mPool->Wait(group);
+}
+
+// the root node is not written, every other node is followed by its subtree and the stream is terminated by an empty node
+std::size_t BVHBuilder::GetSerializedSize() const
+{
+	const std::size_t leafSize = GetLeafSize(mSettings.leafFormat) * sizeof(Float4);
+
+	if (mSettings.width != 2)
+	{
+		return GetWideNodeCount(0) * GetWideNodeSize(mSettings.width, mSettings.quantization) * sizeof(Float4) + mTriangles.size() * leafSize;
+	}
+
+	const std::size_t writtenNodeCount = mNodes[0].bIsNode ? mNodeCount - 1 : 0;
+
+	return writtenNodeCount * sizeof(Node) + mTriangles.size() * leafSize + sizeof(Node);
+}
+
+void BVHBuilder::WriteNode(const int index, uint8_t* data, int& dataOffset)
+{
+	TreeNode& treeNode = mNodes[index];
+
+	if (treeNode.bIsNode)
+	{
+		int tempDataOffset = 0;
+		Node* node = nullptr;
+
+		// do not write the root node, for secondary rays the origin will always be in the scene bounding box
+		if (index != 0)
+		{
+			node = reinterpret_cast<Node*>(data + dataOffset);
+
+			treeNode.boundsOffset = int(dataOffset / sizeof(Float4));
+
+			node->min = Float4(treeNode.aabb.min, 0.0f);
+			node->max = Float4(treeNode.aabb.max, float(GetChildOrder(mNodes[treeNode.left].aabb, mNodes[treeNode.right].aabb)));
+
+			dataOffset += sizeof(Node);
+
+			tempDataOffset = dataOffset;
+		}
+
+		WriteNode(treeNode.left, data, dataOffset);
+		WriteNode(treeNode.right, data, dataOffset);
+
+		if (index != 0)
+		{
+			// when on the left branch, how many float4 elements we need to skip to reach the right branch?
+			node->min.w = -float(dataOffset - tempDataOffset) / sizeof(Float4);
+		}
+	}
+	else // leaf
+	{
+		WriteLeaf(treeNode, data, dataOffset);
+	}
+}
+
+void BVHBuilder::WriteLeaf(TreeNode& treeNode, uint8_t* data, int& dataOffset) const
+{
+	treeNode.leafOffset = int(dataOffset / sizeof(Float4));
+
+	// the leaf triangles are stored back to back
+	for (int i = 0; i < treeNode.count; ++i)
+	{
+		const Triangle& triangle = mInput[mTriangles[treeNode.first + i].index];
+
+		// how many triangles are left in the leaf, the first one holds the size of the triangle list
+		WriteLeafTriangle(reinterpret_cast<Float4*>(data + dataOffset), triangle, treeNode.count - i, mSettings.leafFormat);
+
+		dataOffset += GetLeafSize(mSettings.leafFormat) * sizeof(Float4);
+	}
+}
+
+void BVHBuilder::WriteLeafTriangle(Float4* leaf, const Triangle& triangle, const int remaining, const LeafFormat format)
+{
+	const Float3 e1 = triangle.v1 - triangle.v0;
+	const Float3 e2 = triangle.v2 - triangle.v0;
+
+	if (format == LeafFormat::Edges)
+	{
+		Leaf& edges = *reinterpret_cast<Leaf*>(leaf);
+
+		edges.v0 = Float4(triangle.v0, float(remaining));
+		edges.e1 = Float4(e1, float(triangle.offset)); // triangle index to fetch vertex data
+		edges.e2 = Float4(e2, float(triangle.material)); // material index
+
+		return;
+	}
+
+	const Float3 normal = Cross(e1, e2);
+
+	// the third column is the normal for Woop, the axis of its largest component for Baldwin-Weber
+	int axis = (std::abs(normal.x) > std::abs(normal.y)) ? 0 : 1;
+	axis = (std::abs(normal.z) > std::abs(normal[axis])) ? 2 : axis;
+
+	Float3 third = normal;
+
+	if (format == LeafFormat::BaldwinWeber)
+	{
+		third = Float3(0.0f);
+		third[axis] = 1.0f;
+	}
+
+	Matrix34 triangleToWorld;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		triangleToWorld.rows[i] = Float4(e1[i], e2[i], third[i], triangle.v0[i]);
+	}
+
+	const Matrix34 worldToTriangle = triangleToWorld.Inverse();
+
+	if (format == LeafFormat::Woop)
+	{
+		WoopLeaf& woop = *reinterpret_cast<WoopLeaf*>(leaf);
+
+		woop.header = Float4(float(triangle.offset), float(triangle.material), 0.0f, float(remaining));
+
+		for (int i = 0; i < 3; ++i)
+		{
+			woop.rows[i] = worldToTriangle.rows[i];
+		}
+
+		return;
+	}
+
+	assert(triangle.material < (1u << 21)); // the material shares the float with the axis
+
+	BaldwinWeberLeaf& baldwinWeber = *reinterpret_cast<BaldwinWeberLeaf*>(leaf);
+
+	// the z row is the normal over its component along the axis, the sign of that component tells the front face
+	const std::uint32_t axisBits = ((normal[axis] < 0.0f) ? 4u : 0u) | std::uint32_t(axis);
+	const float counters[3] = { float(remaining), float(triangle.offset), float((triangle.material << 3) | axisBits) };
+
+	for (int i = 0; i < 3; ++i)
+	{
+		const Float4& row = worldToTriangle.rows[i];
+
+		(&baldwinWeber.row0)[i] = Float4((&row.x)[(axis + 1) % 3], (&row.x)[(axis + 2) % 3], row.w, counters[i]);
+	}
+}
+
+int BVHBuilder::CollapseNode(const int index, int* children) const
+{
+	const TreeNode& treeNode = mNodes[index];
+
+	// a leaf root becomes the only child of the wide root
+	if (!treeNode.bIsNode)
+	{
+		children[0] = index;
+		return 1;
+	}
+
+	children[0] = treeNode.left;
+	children[1] = treeNode.right;
+
+	int count = 2;
+
+	// levels below the node of each child. the nodes less than log2(width) levels below it are opened first, there is
+	// always room for them, so that the wide children that are nodes are at least that deep (GetStackSize)
+	const int minLevels = (mSettings.width == 8) ? 3 : (mSettings.width == 4) ? 2 : 1;
+	int levels[kMaxWidth] = { 1, 1 };
+
+	while (count < mSettings.width)
+	{
+		int best = -1;
+		bool bBestShallow = false;
+		float bestSurfaceArea = -1.0f;
+
+		for (int i = 0; i < count; ++i)
+		{
+			const TreeNode& child = mNodes[children[i]];
+			const bool bShallow = levels[i] < minLevels;
+
+			if (child.bIsNode && (bShallow > bBestShallow || (bShallow == bBestShallow && child.aabb.GetSurfaceArea() > bestSurfaceArea)))
+			{
+				best = i;
+				bBestShallow = bShallow;
+				bestSurfaceArea = child.aabb.GetSurfaceArea();
+			}
+		}
+
+		if (best < 0)
+		{
+			break;
+		}
+
+		// the grandchildren take the place of their parent, children stay in tree order
+		const TreeNode& child = mNodes[children[best]];
+		const int level = levels[best] + 1;
+
+		for (int i = count; i > best + 1; --i)
+		{
+			children[i] = children[i - 1];
+			levels[i] = levels[i - 1];
+		}
+
+		children[best] = child.left;
+		children[best + 1] = child.right;
+		levels[best] = level;
+		levels[best + 1] = level;
+
+		count++;
+	}
+
+#ifndef NDEBUG
+	for (int i = 0; i < count; ++i)
+	{
+		assert(!mNodes[children[i]].bIsNode || levels[i] >= minLevels);
+	}
+#endif
+
+	return count;
+}
+
+std::size_t BVHBuilder::GetWideNodeCount(const int index) const
+{
+	int children[kMaxWidth];
+	const int count = CollapseNode(index, children);
+
+	std::size_t nodeCount = 1;
+
+	for (int i = 0; i < count; ++i)
+	{
+		if (mNodes[children[i]].bIsNode)
+		{
+			nodeCount += GetWideNodeCount(children[i]);
+		}
+	}
+
+	return nodeCount;
+}
+
+// a wide node is followed by the subtrees of its children in order, leaves included
+void BVHBuilder::WriteWideNode(const int index, uint8_t* data, int& dataOffset)
+{
+	int children[kMaxWidth];
+	const int count = CollapseNode(index, children);
+
+	const int nodeOffset = int(dataOffset / sizeof(Float4));
+	Float4* node = reinterpret_cast<Float4*>(data) + nodeOffset;
+
+	dataOffset += GetWideNodeSize(mSettings.width, mSettings.quantization) * sizeof(Float4);
+
+	if (mSettings.quantization != 0)
+	{
+		// the children are quantized in the node box
+		*reinterpret_cast<QuantizedFrame*>(node) = GetQuantizedFrame(mNodes[index].aabb, (1u << mSettings.quantization) - 1);
+	}
+
+	for (int i = 0; i < mSettings.width; ++i)
+	{
+		std::int32_t& reference = GetWideChildren(node, i / 4, mSettings.quantization)[i % 4];
+
+		if (i >= count)
+		{
+			// empty slot, skipped by the traversal
+			WriteWideBounds(node, i, AABB());
+			reference = 0;
+			continue;
+		}
+
+		TreeNode& child = mNodes[children[i]];
+
+		child.boundsOffset = nodeOffset;
+		child.boundsSlot = i;
+
+		const bool bFits = WriteWideBounds(node, i, child.aabb);
+		assert(bFits);
+		(void)bFits;
+
+		const std::int32_t childOffset = std::int32_t(dataOffset / sizeof(Float4));
+
+		if (child.bIsNode)
+		{
+			reference = childOffset;
+			WriteWideNode(children[i], data, dataOffset);
+		}
+		else
+		{
+			reference = -((childOffset << 4) | child.count);
+			WriteLeaf(child, data, dataOffset);
+		}
+	}
+}
+
+bool BVHBuilder::WriteWideBounds(Float4* node, const int slot, const AABB& aabb) const
+{
+	const int group = slot / 4;
+	const int i = slot % 4;
+
+	// empty slots are written as zeros
+	const bool bEmpty = aabb.min.x > aabb.max.x;
+
+	if (mSettings.quantization == 0)
+	{
+		WideGroup& wideGroup = reinterpret_cast<WideGroup*>(node)[group];
+
+		(&wideGroup.minX.x)[i] = bEmpty ? 0.0f : aabb.min.x;
+		(&wideGroup.minY.x)[i] = bEmpty ? 0.0f : aabb.min.y;
+		(&wideGroup.minZ.x)[i] = bEmpty ? 0.0f : aabb.min.z;
+		(&wideGroup.maxX.x)[i] = bEmpty ? 0.0f : aabb.max.x;
+		(&wideGroup.maxY.x)[i] = bEmpty ? 0.0f : aabb.max.y;
+		(&wideGroup.maxZ.x)[i] = bEmpty ? 0.0f : aabb.max.z;
+
+		return true;
+	}
+
+	const QuantizedFrame& frame = *reinterpret_cast<const QuantizedFrame*>(node);
+
+	std::uint32_t q[6] = {};
+
+	if (!bEmpty && !Quantize(frame, aabb, (1u << mSettings.quantization) - 1, q))
+	{
+		return false;
+	}
+
+	if (mSettings.quantization == 8)
+	{
+		QuantizedGroup8& quantizedGroup = reinterpret_cast<QuantizedGroup8*>(node + 1)[group];
+
+		for (int row = 0; row < 6; ++row)
+		{
+			quantizedGroup.bounds[row][i] = std::uint8_t(q[row]);
+		}
+
+		quantizedGroup.padding[0] = quantizedGroup.padding[1] = 0;
+	}
+	else
+	{
+		QuantizedGroup16& quantizedGroup = reinterpret_cast<QuantizedGroup16*>(node + 1)[group];
+
+		for (int row = 0; row < 6; ++row)
+		{
+			quantizedGroup.bounds[row][i] = std::uint16_t(q[row]);
+		}
+	}
+
+	return true;
+}
+
+int BVHBuilder::GetWideNodeSize(const int width, const int quantization)
+{
+	const int groupCount = width / 4;
+
+	switch (quantization)
+	{
+		case 8:
+			return 1 + groupCount * int(sizeof(QuantizedGroup8) / sizeof(Float4));
+		case 16:
+			return 1 + groupCount * int(sizeof(QuantizedGroup16) / sizeof(Float4));
+		default:
+			return groupCount * int(sizeof(WideGroup) / sizeof(Float4));
+	}
+}
+
+const std::int32_t* BVHBuilder::GetWideChildren(const Float4* node, const int group, const int quantization)
+{
+	switch (quantization)
+	{
+		case 8:
+			return reinterpret_cast<const QuantizedGroup8*>(node + 1)[group].children;
+		case 16:
+			return reinterpret_cast<const QuantizedGroup16*>(node + 1)[group].children;
+		default:
+			return reinterpret_cast<const WideGroup*>(node)[group].children;
+	}
+}
+
+void BVHBuilder::DecodeQuantizedGroup(const Float4* node, const int group, const int quantization, WideGroup& decoded)
+{
+	const QuantizedFrame& frame = *reinterpret_cast<const QuantizedFrame*>(node);
+
+	float* rows[6] = { &decoded.minX.x, &decoded.minY.x, &decoded.minZ.x, &decoded.maxX.x, &decoded.maxY.x, &decoded.maxZ.x };
+
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int row = 0; row < 6; ++row)
+		{
+			const std::uint32_t q = (quantization == 8) ? reinterpret_cast<const QuantizedGroup8*>(node + 1)[group].bounds[row][i]
+														: reinterpret_cast<const QuantizedGroup16*>(node + 1)[group].bounds[row][i];
+
+			rows[row][i] = Dequantize(frame, row % 3, q);
+		}
+
+		decoded.children[i] = GetWideChildren(node, group, quantization)[i];
+	}
+}
+
+// interior nodes weighted by the traversal cost, leaves by the cost of testing their triangles
+float BVHBuilder::GetSAHCost(const int index) const
+{
+	const TreeNode& node = mNodes[index];
+	const float surfaceArea = node.aabb.GetSurfaceArea();
+
+	if (!node.bIsNode)
+	{
+		return mSettings.intersectionCost * surfaceArea * float(node.count);
+	}
+
+	return mSettings.traversalCost * surfaceArea + GetSAHCost(node.left) + GetSAHCost(node.right);
+}
+
+bool BVHBuilder::Refit(const Triangle* triangles, const std::uint32_t* changed, const std::size_t changedCount)
+{
+	assert(!mStream.empty());
+
+	const auto refitBegin = std::chrono::steady_clock::now();
+
+	mRefitStats = RefitStats();
+	mRefitStats.triangleCount = changedCount;
+
+	// the references of a moved triangle were clipped to planes that do not move with it
+	if (mSettings.mode == BuildMode::Spatial)
+	{
+		return false;
+	}
+
+	mDirtyRanges.clear();
+
+	// nodes whose bounds have to be recomputed, leaves first
+	BuildVector<int> leaves(&mTracker);
+	leaves.reserve(changedCount);
+
+	for (std::size_t i = 0; i < changedCount; ++i)
+	{
+		const Triangle& triangle = triangles[changed[i]];
+		const std::uint32_t slot = mTriangleSlots[changed[i]];
+
+		TriangleData& data = mTriangles[slot];
+
+		data.aabb = AABB();
+		data.aabb.Expand(triangle.v0);
+		data.aabb.Expand(triangle.v1);
+		data.aabb.Expand(triangle.v2);
+
+		data.centroid = data.aabb.GetCentroid();
+
+		// rewrite the triangle record, the counters stay as they are
+		const int leafIndex = mTriangleLeaves[slot];
+		const TreeNode& leafNode = mNodes[leafIndex];
+
+		const int leafSize = GetLeafSize(mSettings.leafFormat);
+		const std::size_t begin = leafNode.leafOffset + (int(slot) - leafNode.first) * leafSize;
+
+		WriteLeafTriangle(mStream.data() + begin, triangle, leafNode.count - (int(slot) - leafNode.first), mSettings.leafFormat);
+
+		AddDirtyRange(begin, begin + leafSize);
+
+		leaves.push_back(leafIndex);
+	}
+
+	auto IsEqual = [](const AABB& a, const AABB& b)
+	{
+		return a.min.x == b.min.x && a.min.y == b.min.y && a.min.z == b.min.z &&
+			   a.max.x == b.max.x && a.max.y == b.max.y && a.max.z == b.max.z;
+	};
+
+	// bottom-up, a path stops at the first node whose bounds do not change
+	for (const int leafIndex : leaves)
+	{
+		int index = leafIndex;
+
+		while (index >= 0)
+		{
+			TreeNode& node = mNodes[index];
+
+			AABB aabb;
+
+			if (node.bIsNode)
+			{
+				aabb.Expand(mNodes[node.left].aabb);
+				aabb.Expand(mNodes[node.right].aabb);
+			}
+			else
+			{
+				for (int i = node.first; i < node.first + node.count; ++i)
+				{
+					aabb.Expand(mTriangles[i].aabb);
+				}
+			}
+
+			// the bounds above stay, but the children moved inside them and may have swapped sides
+			if (IsEqual(aabb, node.aabb))
+			{
+				if (node.bIsNode && WriteChildOrder(node))
+				{
+					mRefitStats.nodeCount++;
+				}
+
+				break;
+			}
+
+			node.aabb = aabb;
+
+			WriteBounds(node);
+
+			mRefitStats.nodeCount++;
+
+			index = node.parent;
+		}
+	}
+
+	// merge the touched ranges for the upload
+	std::sort(mDirtyRanges.begin(), mDirtyRanges.end(), [](const StreamRange& a, const StreamRange& b)
+	{
+		return a.begin < b.begin;
+	});
+
+	std::size_t rangeCount = 0;
+
+	for (const StreamRange& range : mDirtyRanges)
+	{
+		if (rangeCount > 0 && range.begin <= mDirtyRanges[rangeCount - 1].end)
+		{
+			mDirtyRanges[rangeCount - 1].end = std::max(mDirtyRanges[rangeCount - 1].end, range.end);
+		}
+		else
+		{
+			mDirtyRanges[rangeCount++] = range;
+		}
+	}
+
+	mDirtyRanges.resize(rangeCount);
+
+	const std::chrono::duration<double, std::milli> refitTime = std::chrono::steady_clock::now() - refitBegin;
+
+	mRefitStats.rangeCount = rangeCount;
+
+	for (const StreamRange& range : mDirtyRanges)
+	{
+		mRefitStats.dirtySize += (range.end - range.begin) * sizeof(Float4);
+	}
+
+	mRefitStats.sahCost = GetSAHCost(0) / mNodes[0].aabb.GetSurfaceArea();
+	mRefitStats.refitTime = refitTime.count();
+
+	return mRefitStats.overflowCount == 0 && mRefitStats.sahCost <= mStats.sahCost * mSettings.maxRefitCostRatio;
+}
+
+// updates the serialized bounds of a node, where the serialization wrote them
+void BVHBuilder::WriteBounds(const TreeNode& treeNode)
+{
+	if (treeNode.boundsOffset < 0)
+	{
+		return;
+	}
+
+	if (mSettings.width == 2)
+	{
+		Node* node = reinterpret_cast<Node*>(mStream.data() + treeNode.boundsOffset);
+
+		node->min = Float4(treeNode.aabb.min, node->min.w);
+		node->max = Float4(treeNode.aabb.max, float(GetChildOrder(mNodes[treeNode.left].aabb, mNodes[treeNode.right].aabb)));
+
+		AddDirtyRange(treeNode.boundsOffset, treeNode.boundsOffset + sizeof(Node) / sizeof(Float4));
+	}
+	else
+	{
+		Float4* node = mStream.data() + treeNode.boundsOffset;
+
+		if (!WriteWideBounds(node, treeNode.boundsSlot, treeNode.aabb))
+		{
+			// the stream keeps the old bounds, the caller has to rebuild
+			mRefitStats.overflowCount++;
+			return;
+		}
+
+		// the bounds rows of the group, the six first ones of a WideGroup or the ones after the references of a quantized group
+		const int group = treeNode.boundsSlot / 4;
+
+		if (mSettings.quantization == 0)
+		{
+			const int groupOffset = treeNode.boundsOffset + group * int(sizeof(WideGroup) / sizeof(Float4));
+
+			AddDirtyRange(groupOffset, groupOffset + 6);
+		}
+		else
+		{
+			const int groupSize = GetWideNodeSize(4, mSettings.quantization) - 1;
+			const int groupOffset = treeNode.boundsOffset + 1 + group * groupSize;
+
+			AddDirtyRange(groupOffset + 1, groupOffset + groupSize);
+		}
+	}
+}
+
+bool BVHBuilder::WriteChildOrder(const TreeNode& treeNode)
+{
+	// the wide stream orders the children by their entry distance instead
+	if (treeNode.boundsOffset < 0 || mSettings.width != 2)
+	{
+		return false;
+	}
+
+	Node* node = reinterpret_cast<Node*>(mStream.data() + treeNode.boundsOffset);
+
+	const float order = float(GetChildOrder(mNodes[treeNode.left].aabb, mNodes[treeNode.right].aabb));
+
+	if (node->max.w == order)
+	{
+		return false;
+	}
+
+	node->max.w = order;
+
+	AddDirtyRange(treeNode.boundsOffset, treeNode.boundsOffset + sizeof(Node) / sizeof(Float4));
+
+	return true;
+}
+
+void BVHBuilder::AddDirtyRange(const std::size_t begin, const std::size_t end)
+{
+	mDirtyRanges.push_back({ begin, end });
+}
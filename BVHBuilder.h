@@ -0,0 +1,574 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <new>
+#include <ostream>
+#include <vector>
+
+//
+#include "BVHMath.h"
+#include "TaskPool.h"
+
+// platform independent BVH build, flattening and serialization
+class BVHBuilder
+{
+public:
+
+	enum class BuildMode
+	{
+		Sweep,  // exact SAH, sort along each axis at every node
+		Binned, // approximate SAH, centroid binning and in-place partition
+		Spatial, // Binned object splits and spatial splits that clip triangle references at a plane (SBVH), serial
+	};
+
+	// triangle encoding of the leaves, all formats keep the triangles left in the leaf in the w of the first element
+	enum class LeafFormat
+	{
+		Edges, // v0, e1, e2, the test computes two cross products and a reciprocal (Leaf)
+		Woop, // the transform to the unit triangle space, four float4 per triangle (WoopLeaf)
+		BaldwinWeber, // the nine free entries of the transform to the triangle space (BaldwinWeberLeaf)
+	};
+
+	struct BuildSettings
+	{
+		BuildMode mode = BuildMode::Sweep;
+		int binCount = 32; // bins per axis, Binned and Spatial modes
+
+		// Spatial mode only, a triangle split at a plane is referenced by both children
+		float spatialSplitBudget = 0.3f; // extra references allowed, as a fraction of the triangle count
+		float spatialSplitAlpha = 1e-5f; // spatial splits are tried where the object split children overlap by more than this fraction of the root area
+
+		unsigned threadCount = 0; // build threads including the calling one, 0 = hardware concurrency, 1 = serial
+		int parallelThreshold = 4096; // smallest subtree that is spawned as a separate task
+		int parallelSplitThreshold = 65536; // smallest node whose split evaluation is spread across the workers
+
+		// SAH cost model, a node becomes a leaf when intersecting all its triangles is cheaper than splitting it
+		int maxLeafSize = 4; // triangles per leaf, 1 keeps one triangle per leaf
+		float traversalCost = 1.0f; // cost of visiting a node
+		float intersectionCost = 1.0f; // cost of a ray/triangle test
+
+		int width = 2; // children per serialized node, 2 writes the skip-offset stream, 4 or 8 the wide stream
+		int quantization = 0; // bits per child bound in the wide stream, 8 or 16, 0 keeps float bounds
+		LeafFormat leafFormat = LeafFormat::Edges;
+
+		float maxRefitCostRatio = 1.5f; // Refit asks for a rebuild once the SAH cost grows past this ratio of the built tree cost
+	};
+
+	// build figures, reported after every build
+	struct BuildStats
+	{
+		std::size_t triangleCount = 0;
+		std::size_t referenceCount = 0; // triangles written to the leaves, more than triangleCount after spatial splits
+		std::size_t spatialSplitCount = 0;
+		std::size_t nodeCount = 0; // interior nodes
+		std::size_t leafCount = 0;
+		std::size_t wideNodeCount = 0; // nodes of the wide stream, width 4 or 8 only
+		std::size_t nodeSize = 0; // bytes per serialized node
+		std::size_t leafSize = 0; // bytes per leaf triangle
+		std::size_t serializedSize = 0; // tree buffer bytes
+		std::size_t uncompressedSize = 0; // tree buffer bytes with float bounds, serializedSize unless quantized
+		std::size_t peakMemory = 0; // largest amount of bytes held by the build containers at the same time
+		std::size_t allocationCount = 0; // allocations made by the build containers
+		unsigned threadCount = 1;
+		double buildTime = 0.0; // ms
+		float sahCost = 0.0f; // expected cost of a ray through the tree, relative to the root surface area
+	};
+
+	// refit figures, reported after every refit
+	struct RefitStats
+	{
+		std::size_t triangleCount = 0; // moved triangles
+		std::size_t nodeCount = 0; // nodes whose bounds changed
+		std::size_t rangeCount = 0; // dirty stream ranges
+		std::size_t dirtySize = 0; // stream bytes to upload
+		std::size_t overflowCount = 0; // quantized bounds that grew out of the box they are quantized in
+		float sahCost = 0.0f;
+		double refitTime = 0.0; // ms
+	};
+
+	// float4 elements [begin, end) of the stream rewritten by the last refit
+	struct StreamRange
+	{
+		std::size_t begin;
+		std::size_t end;
+	};
+
+	// tracks the memory held by the build containers, shared by the worker threads
+	struct MemoryTracker
+	{
+		std::atomic<std::size_t> allocationCount = 0;
+		std::atomic<std::size_t> currentBytes = 0;
+		std::atomic<std::size_t> peakBytes = 0;
+
+		void Allocate(const std::size_t bytes)
+		{
+			allocationCount++;
+
+			const std::size_t current = currentBytes += bytes;
+			std::size_t peak = peakBytes;
+
+			while (current > peak && !peakBytes.compare_exchange_weak(peak, current));
+		}
+
+		void Deallocate(const std::size_t bytes)
+		{
+			currentBytes -= bytes;
+		}
+
+		// start a new measurement from what is currently held
+		void Reset()
+		{
+			allocationCount = 0;
+			peakBytes = currentBytes.load();
+		}
+	};
+
+	template <typename T>
+	struct BuildAllocator
+	{
+		using value_type = T;
+
+		MemoryTracker* tracker;
+
+		BuildAllocator(MemoryTracker* tracker)
+			: tracker(tracker)
+		{}
+
+		template <typename U>
+		BuildAllocator(const BuildAllocator<U>& other)
+			: tracker(other.tracker)
+		{}
+
+		T* allocate(const std::size_t count)
+		{
+			tracker->Allocate(count * sizeof(T));
+			return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(alignof(T))));
+		}
+
+		void deallocate(T* pointer, const std::size_t count)
+		{
+			tracker->Deallocate(count * sizeof(T));
+			::operator delete(pointer, std::align_val_t(alignof(T)));
+		}
+
+		template <typename U>
+		bool operator==(const BuildAllocator<U>& other) const
+		{
+			return tracker == other.tracker;
+		}
+
+		template <typename U>
+		bool operator!=(const BuildAllocator<U>& other) const
+		{
+			return tracker != other.tracker;
+		}
+	};
+
+	template <typename T>
+	using BuildVector = std::vector<T, BuildAllocator<T>>;
+
+	// input triangle, offset and material are passed through to the leaves
+	struct Triangle
+	{
+		Float3 v0;
+		Float3 v1;
+		Float3 v2;
+
+		std::uint32_t offset; // triangle record in the hit attributes (BVHHitAttributes)
+		std::uint32_t material;
+	};
+
+	// flattened stream, read as float4 elements by RayTraced() in RayTracedCommon.hlsl:
+	// nodes in pre-order without the root, a leaf is its triangles back to back, an empty node terminates the stream
+	struct Node
+	{
+		Float4 min; // min.w = -(float4 elements to skip to leave the subtree)
+		Float4 max; // max.w = order of the two children, GetChildOrder
+	};
+
+	struct Leaf
+	{
+		Float4 v0; // v0.w = triangles left in the leaf, including this one
+		Float4 e1; // v1 - v0, e1.w = triangle offset
+		Float4 e2; // v2 - v0, e2.w = material index
+	};
+
+	// wide stream, read by RayTraced() when BVH_WIDTH is 4 or 8: the root is written, a node is width / 4 groups of
+	// four children with their bounds in SoA form, leaves are the same triangle lists as in the skip-offset stream
+	struct WideGroup
+	{
+		Float4 minX;
+		Float4 minY;
+		Float4 minZ;
+		Float4 maxX;
+		Float4 maxY;
+		Float4 maxZ;
+
+		// > 0 node offset, < 0 leaf -(offset << 4 | triangle count), 0 empty slot, offsets in float4 elements
+		std::int32_t children[4];
+	};
+
+	// quantized wide stream (BuildSettings::quantization): a node starts with the frame its children are quantized in,
+	// followed by width / 4 groups. a bound decodes to origin + q * scale, rounded outwards so that no hit is lost
+	struct QuantizedFrame
+	{
+		Float3 origin; // node box min
+		std::uint32_t exponents; // biased float exponents of the power of two x, y, z scales in bytes 0, 1, 2
+	};
+
+	struct QuantizedGroup8
+	{
+		std::int32_t children[4]; // as in WideGroup
+		std::uint8_t bounds[6][4]; // min x/y/z, max x/y/z of the four children
+		std::uint32_t padding[2];
+	};
+
+	struct QuantizedGroup16
+	{
+		std::int32_t children[4];
+		std::uint16_t bounds[6][4];
+	};
+
+	// LeafFormat::Woop, rows of the inverse of [e1 e2 n v0]: a point of the triangle plane has z = 0 and its barycentrics in x, y
+	struct WoopLeaf
+	{
+		Float4 header; // x triangle offset, y material index, w = triangles left in the leaf, including this one
+		Float4 rows[3];
+	};
+
+	// LeafFormat::BaldwinWeber, the inverse of [e1 e2 a v0] where a is the axis of the largest normal component.
+	// the column of that axis is (0, 0, 1), each row keeps its two other entries in x, y and its translation in z
+	struct BaldwinWeberLeaf
+	{
+		Float4 row0; // row0.w = triangles left in the leaf, including this one
+		Float4 row1; // row1.w = triangle offset
+		Float4 row2; // row2.w = material index << 3 | (normal[axis] < 0) << 2 | axis
+	};
+
+	static_assert(sizeof(Node) == 2 * sizeof(Float4), "unexpected Node layout");
+	static_assert(sizeof(Leaf) == 3 * sizeof(Float4), "unexpected Leaf layout");
+	static_assert(sizeof(WoopLeaf) == 4 * sizeof(Float4), "unexpected WoopLeaf layout");
+	static_assert(sizeof(BaldwinWeberLeaf) == 3 * sizeof(Float4), "unexpected BaldwinWeberLeaf layout");
+	static_assert(sizeof(WideGroup) == 7 * sizeof(Float4), "unexpected WideGroup layout");
+	static_assert(sizeof(QuantizedFrame) == sizeof(Float4), "unexpected QuantizedFrame layout");
+	static_assert(sizeof(QuantizedGroup8) == 3 * sizeof(Float4), "unexpected QuantizedGroup8 layout");
+	static_assert(sizeof(QuantizedGroup16) == 4 * sizeof(Float4), "unexpected QuantizedGroup16 layout");
+
+	// the axis along which the centers of two sibling boxes are the furthest apart, | 4 when the first one lies above the
+	// second. the ordered closest-hit traversal visits the second child first when the ray goes the other way along it
+	static int GetChildOrder(const AABB& first, const AABB& second)
+	{
+		const Float3 d = (second.min + second.max) - (first.min + first.max);
+
+		int axis = (std::abs(d.x) > std::abs(d.y)) ? 0 : 1;
+		axis = (std::abs(d.z) > std::abs(d[axis])) ? 2 : axis;
+
+		return axis | ((d[axis] < 0.0f) ? 4 : 0);
+	}
+
+	// float4 elements of a serialized wide node
+	static int GetWideNodeSize(const int width, const int quantization);
+
+	// float4 elements per leaf triangle
+	static int GetLeafSize(const LeafFormat format)
+	{
+		return (format == LeafFormat::Woop) ? 4 : 3;
+	}
+
+	// writes one leaf triangle, remaining is the number of triangles left in the leaf including this one
+	static void WriteLeafTriangle(Float4* leaf, const Triangle& triangle, const int remaining, const LeafFormat format);
+
+	// child references of a group of a wide node, in either format
+	static const std::int32_t* GetWideChildren(const Float4* node, const int group, const int quantization);
+
+	static std::int32_t* GetWideChildren(Float4* node, const int group, const int quantization)
+	{
+		return const_cast<std::int32_t*>(GetWideChildren(static_cast<const Float4*>(node), group, quantization));
+	}
+
+	// decodes a group of a quantized wide node to float bounds, the reference of the decoder in RayTracedCommon.hlsl
+	static void DecodeQuantizedGroup(const Float4* node, const int group, const int quantization, WideGroup& decoded);
+
+	// reference to an input triangle, reordered by the build
+	struct TriangleData
+	{
+		AABB aabb;
+		Float3 centroid;
+
+		std::uint32_t index; // input triangle
+
+		float surfaceAreaLeft;
+		float surfaceAreaRight;
+	};
+
+	// nodes live in a flat array, a subtree over n triangles owns the 2n - 1 slots that follow its root
+	struct TreeNode
+	{
+		AABB aabb;
+
+		bool bIsNode = false; // otherwise leaf
+
+		int parent = -1;
+
+		// children indices, node only
+		int left = -1;
+		int right = -1;
+
+		// triangles range, leaf only
+		int first = 0;
+		int count = 0;
+
+		// where the serialization put the node, in float4 elements
+		int boundsOffset = -1; // Node or wide node holding the bounds, -1 when they are not written
+		int boundsSlot = 0; // child slot in the wide node
+		int leafOffset = -1; // first triangle record, leaf only
+	};
+
+	BVHBuilder();
+
+	BVHBuilder(const BVHBuilder&) = delete;
+	BVHBuilder& operator=(const BVHBuilder&) = delete;
+
+	// builds the tree over the triangles and serializes it, the triangles are only read during the call
+	void Build(const Triangle* triangles, const std::size_t triangleCount, const BuildSettings& settings);
+
+	void Build(const std::vector<Triangle>& triangles, const BuildSettings& settings)
+	{
+		Build(triangles.data(), triangles.size(), settings);
+	}
+
+	// moves the changed triangles and refits the tree bottom-up, the topology and the stream layout are kept and only
+	// the rewritten ranges are reported. triangles is the full input of Build, changed lists the moved input triangles.
+	// returns false when the SAH cost drifted past BuildSettings::maxRefitCostRatio and the tree should be rebuilt,
+	// and always for Spatial builds whose clipped references cannot be refitted
+	bool Refit(const Triangle* triangles, const std::uint32_t* changed, const std::size_t changedCount);
+
+	const BuildVector<StreamRange>& GetDirtyRanges() const
+	{
+		return mDirtyRanges;
+	}
+
+	const RefitStats& GetRefitStats() const
+	{
+		return mRefitStats;
+	}
+
+	// builds only the tree over arbitrary bounds, nothing is serialized, GetTriangles()[i].index refers to bounds[index]
+	void BuildHierarchy(const AABB* bounds, const std::size_t count, const BuildSettings& settings);
+
+	// frees the tree and the stream
+	void Clear();
+
+	const BuildVector<Float4>& GetStream() const
+	{
+		return mStream;
+	}
+
+	std::size_t GetStreamSize() const // bytes
+	{
+		return mStream.size() * sizeof(Float4);
+	}
+
+	const BuildVector<TreeNode>& GetNodes() const
+	{
+		return mNodes;
+	}
+
+	const BuildVector<TriangleData>& GetTriangles() const
+	{
+		return mTriangles;
+	}
+
+	const BuildStats& GetStats() const
+	{
+		return mStats;
+	}
+
+	// the settings of the last build
+	const BuildSettings& GetSettings() const
+	{
+		return mSettings;
+	}
+
+	// lets the caller account its own build containers in the stats
+	MemoryTracker& GetMemoryTracker()
+	{
+		return mTracker;
+	}
+
+	// one line per node, leaves list their triangles
+	void Print(std::ostream& stream, const Triangle* triangles, const int index = 0, const int level = 0) const;
+
+	static constexpr int kMaxBinCount = 64;
+	static constexpr int kMaxLeafSize = 8;
+	static constexpr int kMaxWidth = 8;
+
+	static_assert(kMaxLeafSize < 16, "the leaf triangle count must fit the 4 bits of a wide child reference");
+
+	// entries of the traversal stacks (BVHTraversal, kStackSize of RayTracedCommon.hlsl), the build bounds the depth of
+	// the tree so that no traversal of it pushes more
+	static constexpr int kMaxStackSize = 64;
+
+	// stack entries a traversal needs at most on a tree of the width whose leaves are at most depth binary levels below
+	// the root. the wide children of a node are at least log2(width) levels below it (CollapseNode) and the traversal
+	// pops a node and pushes its children, so every wide node above the deepest one leaves width - 1 entries behind
+	static constexpr int GetStackSize(const int width, const int depth)
+	{
+		const int levels = (width == 8) ? 3 : (width == 4) ? 2 : 1;
+
+		return (width - 1) * ((depth - 1) / levels + 1) + 1;
+	}
+
+	// the deepest level of a tree built for the width, the root at 0. 63 binary, 42 at width 4 and 27 at width 8,
+	// splits that would go deeper become median splits
+	static constexpr int GetMaxDepth(const int width)
+	{
+		int depth = 1;
+
+		while (GetStackSize(width, depth + 1) <= kMaxStackSize)
+		{
+			depth++;
+		}
+
+		return depth;
+	}
+
+private:
+
+	enum class Axis
+	{
+		X,
+		Y,
+		Z,
+	};
+
+	struct Bin
+	{
+		AABB aabb;
+		int count = 0;
+	};
+
+	struct BinSet
+	{
+		Bin bins[3][kMaxBinCount];
+	};
+
+	// clipped triangle parts falling in the bin, references are counted where they start and where they end
+	struct SpatialBin
+	{
+		AABB aabb;
+		int entryCount = 0;
+		int exitCount = 0;
+	};
+
+	struct SpatialSplit
+	{
+		int axis = 0;
+		float plane = 0.0f;
+		float cost = FLT_MAX;
+
+		AABB left;
+		AABB right;
+		int countLeft = 0;
+		int countRight = 0;
+	};
+
+	static constexpr int kMaxChunkCount = 64;
+
+	// fills the references through getBounds and builds the tree, shared by Build and BuildHierarchy
+	template <typename GetBounds>
+	void BuildTree(const std::size_t count, const BuildSettings& settings, GetBounds getBounds);
+
+	void CreateTreeNode(const int index, const int begin, const int end, const int depth);
+
+	// references a subtree can hold when its leaves are at most levels below its root
+	std::size_t GetSubtreeCapacity(const int levels) const;
+
+	// splits the references at the centroid median along the longest axis of their centroid bounds, for the nodes
+	// whose split would leave a child more references than the levels left above GetMaxDepth can hold
+	int PartitionMedian(const int begin, const int end);
+
+	AABB ComputeBounds(const int begin, const int end);
+
+	void FindBestSplit(const int begin, const int end, int& split, Axis& splitAxis, float& splitCost);
+
+	void SortAlongAxis(const int begin, const int end, const Axis axis);
+
+	int GetBinIndex(const TriangleData& triangle, const int axis, const float min, const float scale) const;
+
+	void FindBestSplitBinned(const int begin, const int end, const AABB& centroids, int& splitBin, Axis& splitAxis, float& splitCost);
+
+	int PartitionBinned(const int begin, const int end, float& splitCost);
+
+	// the references of the node being built are the last ones of mTriangles, leaves are moved to leafReferences
+	int CreateSpatialNode(const int begin, const int depth, BuildVector<TriangleData>& leafReferences);
+
+	void FindBestSpatialSplit(const int begin, const int end, const AABB& aabb, SpatialSplit& split) const;
+
+	// returns the first right reference, or -1 when the split leaves a side empty and nothing was changed
+	int PartitionSpatial(const int begin, const int end, const SpatialSplit& split);
+
+	// bounds of the part of the input triangle between two planes along the axis, within the reference bounds
+	AABB ClipTriangle(const TriangleData& reference, const int axis, const float min, const float max) const;
+
+	// large nodes are split in one chunk per worker, the partial results are merged in chunk order
+	int GetChunkCount(const int count) const;
+
+	template <typename Body>
+	void RunChunks(const int begin, const int end, const int chunkCount, Body& body);
+
+	float GetSAHCost(const int index) const;
+
+	std::size_t GetSerializedSize() const;
+
+	void WriteNode(const int index, uint8_t* data, int& dataOffset);
+
+	void WriteLeaf(TreeNode& treeNode, uint8_t* data, int& dataOffset) const;
+
+	void WriteBounds(const TreeNode& treeNode);
+
+	// rewrites the child order of a node whose bounds are unchanged, returns true when it changed
+	bool WriteChildOrder(const TreeNode& treeNode);
+
+	void AddDirtyRange(const std::size_t begin, const std::size_t end);
+
+	// opens the first log2(width) levels below the node, then pulls the largest grandchildren up until the node has
+	// width children or only leaves are left
+	int CollapseNode(const int index, int* children) const;
+
+	std::size_t GetWideNodeCount(const int index) const;
+
+	// writes the bounds of a child slot of a wide node, returns false when quantized bounds do not fit the node frame
+	bool WriteWideBounds(Float4* node, const int slot, const AABB& aabb) const;
+
+	void WriteWideNode(const int index, uint8_t* data, int& dataOffset);
+
+	BuildSettings mSettings;
+	BuildStats mStats;
+
+	MemoryTracker mTracker;
+
+	BuildVector<TriangleData> mTriangles;
+	BuildVector<TreeNode> mNodes;
+	BuildVector<Float4> mStream;
+
+	// refit
+	BuildVector<std::uint32_t> mTriangleSlots; // input triangle -> position in mTriangles
+	BuildVector<int> mTriangleLeaves; // position in mTriangles -> leaf node
+	BuildVector<StreamRange> mDirtyRanges;
+	RefitStats mRefitStats;
+
+	// only used while building
+	const Triangle* mInput = nullptr;
+	TaskPool* mPool = nullptr;
+	std::atomic<std::size_t> mNodeCount = 0;
+	std::atomic<std::size_t> mLeafCount = 0;
+	std::size_t mSpatialBudget = 0; // references the spatial splits may still add
+	float mRootSurfaceArea = 0.0f;
+};
+
+static_assert(BVHBuilder::GetMaxDepth(BVHBuilder::kMaxWidth) >= 24, "the depth bound must leave room for 2^24 leaves at every width");
@@ -0,0 +1,171 @@
+#include "BVHCache.h"
+
+// std
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	std::uint64_t AlignUp(const std::uint64_t offset)
+	{
+		return (offset + BVHCache::kAlignment - 1) / BVHCache::kAlignment * BVHCache::kAlignment;
+	}
+
+	bool WritePadding(std::FILE* file, const std::uint64_t from, const std::uint64_t to)
+	{
+		static const char zeros[BVHCache::kAlignment] = {};
+
+		return std::fwrite(zeros, 1, std::size_t(to - from), file) == std::size_t(to - from);
+	}
+}
+
+void BVHCache::Hasher::Add(const BVHBuilder::BuildSettings& settings)
+{
+	Add(settings.mode);
+	Add(settings.binCount);
+	Add(settings.spatialSplitBudget);
+	Add(settings.spatialSplitAlpha);
+	Add(settings.maxLeafSize);
+	Add(settings.traversalCost);
+	Add(settings.intersectionCost);
+	Add(settings.width);
+	Add(settings.quantization);
+	Add(settings.leafFormat);
+}
+
+BVHCache::Status BVHCache::Open(const std::string& path, const std::uint64_t key, const bool bVerifyChecksum)
+{
+	Close();
+
+	if (!mFile.Open(path))
+	{
+		return Status::Missing;
+	}
+
+	const Status status = Validate(key, bVerifyChecksum);
+
+	if (status != Status::Loaded)
+	{
+		Close();
+	}
+
+	return status;
+}
+
+void BVHCache::Close()
+{
+	mFile.Close();
+	mHeader = {};
+}
+
+bool BVHCache::Write(const std::string& path,
+					 const std::uint64_t key,
+					 const void* tree,
+					 const std::size_t treeSize,
+					 const void* attributes,
+					 const std::size_t attributesSize)
+{
+	Header header = {};
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.headerSize = sizeof(Header);
+	header.key = key;
+	header.checksum = GetChecksum(tree, treeSize, attributes, attributesSize);
+	header.tree = { AlignUp(sizeof(Header)), treeSize };
+	header.attributes = { AlignUp(header.tree.offset + treeSize), attributesSize };
+
+	const std::string temporaryPath = path + ".tmp";
+
+	std::FILE* file = std::fopen(temporaryPath.c_str(), "wb");
+
+	if (!file)
+	{
+		return false;
+	}
+
+	const bool bWritten = std::fwrite(&header, sizeof(Header), 1, file) == 1 &&
+						  WritePadding(file, sizeof(Header), header.tree.offset) &&
+						  std::fwrite(tree, 1, treeSize, file) == treeSize &&
+						  WritePadding(file, header.tree.offset + treeSize, header.attributes.offset) &&
+						  std::fwrite(attributes, 1, attributesSize, file) == attributesSize;
+
+	if (std::fclose(file) != 0 || !bWritten)
+	{
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+
+	// rename does not replace an existing file everywhere
+	std::remove(path.c_str());
+
+	return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+const char* BVHCache::GetStatusName(const Status status)
+{
+	switch (status)
+	{
+		case Status::Loaded:
+			return "loaded";
+		case Status::Missing:
+			return "missing";
+		case Status::Stale:
+			return "stale";
+		case Status::Corrupt:
+			return "corrupt";
+	}
+
+	return "unknown";
+}
+
+std::uint64_t BVHCache::GetChecksum(const void* tree, const std::size_t treeSize, const void* attributes, const std::size_t attributesSize)
+{
+	Hasher hasher;
+	hasher.Add(tree, treeSize);
+	hasher.Add(attributes, attributesSize);
+
+	return hasher.GetHash();
+}
+
+BVHCache::Status BVHCache::Validate(const std::uint64_t key, const bool bVerifyChecksum)
+{
+	const std::size_t size = mFile.GetSize();
+
+	if (size < sizeof(Header))
+	{
+		return Status::Corrupt;
+	}
+
+	Header& header = mHeader;
+	std::memcpy(&header, mFile.GetData(), sizeof(Header));
+
+	if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.headerSize != sizeof(Header))
+	{
+		return Status::Corrupt;
+	}
+
+	if (header.version != kVersion || header.key != key)
+	{
+		return Status::Stale;
+	}
+
+	// sections aligned, inside the file and made of whole elements
+	auto IsValid = [size](const Section& section, const std::size_t elementSize)
+	{
+		return section.offset % kAlignment == 0 &&
+			   section.offset <= size && section.size <= size - section.offset &&
+			   section.size % elementSize == 0;
+	};
+
+	if (!IsValid(header.tree, sizeof(Float4)) || !IsValid(header.attributes, sizeof(BVHHitAttributes::Record)))
+	{
+		return Status::Corrupt;
+	}
+
+	if (bVerifyChecksum && header.checksum != GetChecksum(GetTree(), GetTreeSize(), GetAttributes(), GetAttributesSize()))
+	{
+		return Status::Corrupt;
+	}
+
+	return Status::Loaded;
+}
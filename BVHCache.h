@@ -0,0 +1,139 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+//
+#include "BVHBuilder.h"
+#include "BVHHitAttributes.h"
+#include "MappedFile.h"
+
+// file holding a serialized tree stream and its hit attributes, keyed by a hash of everything they were built from.
+// a header, then the sections at kAlignment byte offsets. the file is memory-mapped and read in place
+class BVHCache
+{
+public:
+
+	static constexpr std::uint32_t kVersion = 3; // bump when the layout of the file or of the streams changes
+	static constexpr std::size_t kAlignment = 64;
+
+	// the checksum is a pass over every section byte, release builds trust the header and the key instead
+#ifdef NDEBUG
+	static constexpr bool kVerifyChecksum = false;
+#else
+	static constexpr bool kVerifyChecksum = true;
+#endif
+
+	enum class Status
+	{
+		Loaded,
+		Missing, // no file, or it could not be mapped
+		Stale, // another version or key, the inputs changed since it was written
+		Corrupt, // bad header, sections out of the file or checksum mismatch
+	};
+
+	struct Section
+	{
+		std::uint64_t offset; // bytes from the start of the file, a multiple of kAlignment
+		std::uint64_t size; // bytes
+	};
+
+	struct Header
+	{
+		char magic[8]; // kMagic
+		std::uint32_t version;
+		std::uint32_t headerSize;
+		std::uint64_t key;
+		std::uint64_t checksum; // of the section bytes
+		Section tree; // float4 elements
+		Section attributes; // BVHHitAttributes records
+	};
+
+	static_assert(sizeof(Header) <= kAlignment, "the first section must follow the header");
+
+	// 64-bit FNV-1a, builds the key out of the inputs of a build
+	class Hasher
+	{
+	public:
+
+		void Add(const void* data, const std::size_t size)
+		{
+			const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+			for (std::size_t i = 0; i < size; ++i)
+			{
+				mHash = (mHash ^ bytes[i]) * 0x100000001b3ull;
+			}
+		}
+
+		template <typename T>
+		void Add(const T& value)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "hashed as bytes");
+
+			Add(&value, sizeof(T));
+		}
+
+		// the settings that change the serialized streams, threads and thresholds do not
+		void Add(const BVHBuilder::BuildSettings& settings);
+
+		std::uint64_t GetHash() const
+		{
+			return mHash;
+		}
+
+	private:
+
+		std::uint64_t mHash = 0xcbf29ce484222325ull;
+	};
+
+	// maps the file and validates it against key, the sections stay readable until Close. bVerifyChecksum also
+	// checksums the sections
+	Status Open(const std::string& path, const std::uint64_t key, const bool bVerifyChecksum = kVerifyChecksum);
+
+	void Close();
+
+	const Float4* GetTree() const
+	{
+		return reinterpret_cast<const Float4*>(mFile.GetData() + mHeader.tree.offset);
+	}
+
+	std::size_t GetTreeSize() const // bytes
+	{
+		return std::size_t(mHeader.tree.size);
+	}
+
+	const void* GetAttributes() const
+	{
+		return mFile.GetData() + mHeader.attributes.offset;
+	}
+
+	std::size_t GetAttributesSize() const // bytes
+	{
+		return std::size_t(mHeader.attributes.size);
+	}
+
+	// writes a temporary file next to path and moves it over path, so that a reader never sees a partial file
+	static bool Write(const std::string& path,
+					  const std::uint64_t key,
+					  const void* tree,
+					  const std::size_t treeSize,
+					  const void* attributes,
+					  const std::size_t attributesSize);
+
+	static const char* GetStatusName(const Status status);
+
+private:
+
+	static constexpr char kMagic[8] = { 'H', 'S', 'S', 'P', 'R', 'B', 'V', 'H' };
+
+	static std::uint64_t GetChecksum(const void* tree, const std::size_t treeSize, const void* attributes, const std::size_t attributesSize);
+
+	Status Validate(const std::uint64_t key, const bool bVerifyChecksum);
+
+	MappedFile mFile;
+	Header mHeader = {};
+};
@@ -0,0 +1,209 @@
+#include "BVHHitAttributes.h"
+
+// std
+#include <cmath>
+
+namespace
+{
+	float SignNotZero(const float f)
+	{
+		return (f >= 0.0f) ? 1.0f : -1.0f;
+	}
+
+	std::uint32_t ToSnorm16(const float f)
+	{
+		const float clamped = std::min(std::max(f, -1.0f), 1.0f);
+
+		return std::uint32_t(std::int32_t(std::lround(clamped * 32767.0f))) & 0xffff;
+	}
+
+	float FromSnorm16(const std::uint32_t bits)
+	{
+		return std::max(float(std::int16_t(bits)) / 32767.0f, -1.0f);
+	}
+}
+
+void BVHHitAttributes::Reset(const std::size_t triangleCount)
+{
+	mRecords.clear();
+	mRecords.resize(triangleCount, Record{ 0, 0, 0 });
+
+	mTriangleCount = triangleCount;
+
+	mVertexRecords.clear();
+	mObjectBegin = mObjectEnd = triangleCount;
+}
+
+void BVHHitAttributes::BeginObject(const std::size_t first)
+{
+	assert(first >= mTriangleCount && first <= mRecords.size());
+
+	mVertexRecords.clear();
+	mObjectBegin = mObjectEnd = first;
+}
+
+std::uint32_t BVHHitAttributes::AddVertex(const Vertex& key, const Vertex& vertex)
+{
+	const auto found = mVertexRecords.find(key);
+
+	if (found != mVertexRecords.end())
+	{
+		return found->second;
+	}
+
+	const std::uint32_t index = std::uint32_t(mObjectEnd++);
+
+	// rewriting an object overwrites its range in place
+	if (index == mRecords.size())
+	{
+		mRecords.push_back(PackVertex(vertex));
+	}
+	else
+	{
+		mRecords[index] = PackVertex(vertex);
+	}
+
+	mVertexRecords.emplace(key, index);
+
+	return index;
+}
+
+void BVHHitAttributes::SetTriangle(const std::size_t triangle, const std::uint32_t v0, const std::uint32_t v1, const std::uint32_t v2)
+{
+	assert(triangle < mTriangleCount);
+
+	mRecords[triangle] = Record{ v0, v1, v2 };
+}
+
+BVHBuilder::StreamRange BVHHitAttributes::EndObject()
+{
+	mVertexRecords.clear();
+
+	return { mObjectBegin, mObjectEnd };
+}
+
+BVHHitAttributes::Record BVHHitAttributes::PackVertex(const Vertex& vertex)
+{
+	Record record;
+	record.x = EncodeOctahedral(vertex.normal);
+	record.y = EncodeOctahedral(vertex.tangent);
+	record.z = std::uint32_t(FloatToHalf(vertex.u)) | (std::uint32_t(FloatToHalf(vertex.v)) << 16);
+
+	return record;
+}
+
+BVHHitAttributes::Vertex BVHHitAttributes::UnpackVertex(const Record& record)
+{
+	Vertex vertex;
+	vertex.normal = DecodeOctahedral(record.x);
+	vertex.tangent = DecodeOctahedral(record.y);
+	vertex.u = HalfToFloat(std::uint16_t(record.z & 0xffff));
+	vertex.v = HalfToFloat(std::uint16_t(record.z >> 16));
+
+	return vertex;
+}
+
+std::uint32_t BVHHitAttributes::EncodeOctahedral(const Float3& n)
+{
+	const float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+
+	if (!(sum > 0.0f))
+	{
+		return 0;
+	}
+
+	float x = n.x / sum;
+	float y = n.y / sum;
+
+	// the lower hemisphere is folded over the diagonals
+	if (n.z < 0.0f)
+	{
+		const float foldedX = (1.0f - std::abs(y)) * SignNotZero(x);
+		const float foldedY = (1.0f - std::abs(x)) * SignNotZero(y);
+
+		x = foldedX;
+		y = foldedY;
+	}
+
+	return ToSnorm16(x) | (ToSnorm16(y) << 16);
+}
+
+Float3 BVHHitAttributes::DecodeOctahedral(const std::uint32_t packed)
+{
+	Float3 n(FromSnorm16(packed & 0xffff), FromSnorm16(packed >> 16), 0.0f);
+	n.z = 1.0f - std::abs(n.x) - std::abs(n.y);
+
+	const float t = std::max(-n.z, 0.0f);
+	n.x += (n.x >= 0.0f) ? -t : t;
+	n.y += (n.y >= 0.0f) ? -t : t;
+
+	return (1.0f / std::sqrt(Dot(n, n))) * n;
+}
+
+std::uint16_t BVHHitAttributes::FloatToHalf(const float f)
+{
+	std::uint32_t bits;
+	std::memcpy(&bits, &f, sizeof(bits));
+
+	const std::uint32_t sign = (bits >> 16) & 0x8000;
+	const std::int32_t exponent = std::int32_t((bits >> 23) & 0xff) - 127 + 15;
+	std::uint32_t mantissa = bits & 0x7fffff;
+
+	if (((bits >> 23) & 0xff) == 0xff) // inf, nan
+	{
+		return std::uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	}
+
+	if (exponent >= 31)
+	{
+		return std::uint16_t(sign | 0x7c00);
+	}
+
+	if (exponent <= 0) // denormal
+	{
+		if (exponent < -10)
+		{
+			return std::uint16_t(sign);
+		}
+
+		mantissa |= 0x800000;
+
+		const int shift = 14 - exponent;
+		const std::uint32_t remainder = mantissa & ((1u << shift) - 1);
+		const std::uint32_t halfway = 1u << (shift - 1);
+
+		std::uint32_t half = mantissa >> shift;
+		half += (remainder > halfway || (remainder == halfway && (half & 1))) ? 1 : 0;
+
+		return std::uint16_t(sign | half);
+	}
+
+	const std::uint32_t remainder = mantissa & 0x1fff;
+
+	// a carry out of the mantissa moves to the next exponent, or to inf
+	std::uint32_t half = (std::uint32_t(exponent) << 10) | (mantissa >> 13);
+	half += (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) ? 1 : 0;
+
+	return std::uint16_t(sign | half);
+}
+
+float BVHHitAttributes::HalfToFloat(const std::uint16_t h)
+{
+	const std::uint32_t sign = std::uint32_t(h & 0x8000) << 16;
+	const std::uint32_t exponent = (h >> 10) & 0x1f;
+	const std::uint32_t mantissa = h & 0x3ff;
+
+	if (exponent == 0) // zero, denormal
+	{
+		const float value = std::ldexp(float(mantissa), -24);
+
+		return sign ? -value : value;
+	}
+
+	const std::uint32_t bits = sign | ((exponent == 31) ? (0xffu << 23) : ((exponent + 112) << 23)) | (mantissa << 13);
+
+	float f;
+	std::memcpy(&f, &bits, sizeof(f));
+
+	return f;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+//
+#include "BVHBuilder.h"
+
+// indexed hit attributes read by RayTracedLeaf() when a reflection ray hits a triangle.
+// 12 byte records: one per triangle holding the records of its three vertices (Triangle::offset is the triangle record),
+// followed by the unique vertices with octahedral normal and tangent and half precision uvs
+class BVHHitAttributes
+{
+public:
+
+	template <typename T>
+	using BuildVector = BVHBuilder::BuildVector<T>;
+
+	struct Vertex
+	{
+		Float3 normal;
+		Float3 tangent;
+		float u;
+		float v;
+	};
+
+	// a triangle (three record indices) or a packed vertex (normal, tangent, u | v << 16), a uint3 in the shaders
+	struct Record
+	{
+		std::uint32_t x;
+		std::uint32_t y;
+		std::uint32_t z;
+	};
+
+	static_assert(sizeof(Record) == 12, "unexpected Record layout");
+
+	explicit BVHHitAttributes(BVHBuilder::MemoryTracker* tracker)
+		: mRecords(tracker)
+	{}
+
+	// starts a new buffer, the vertices are appended after the triangleCount triangle records
+	void Reset(const std::size_t triangleCount);
+
+	// vertices are shared within an object only, so that a moved object rewrites its own range.
+	// first is the record of the first vertex: GetSize() for a new object, the start of its range to rewrite it
+	void BeginObject(const std::size_t first);
+
+	// key identifies the vertex in the object (its object space attributes), the same keys in the same order
+	// give the same records when the object is written again with another transform
+	std::uint32_t AddVertex(const Vertex& key, const Vertex& vertex);
+
+	void SetTriangle(const std::size_t triangle, const std::uint32_t v0, const std::uint32_t v1, const std::uint32_t v2);
+
+	// vertex records [begin, end) written since BeginObject
+	BVHBuilder::StreamRange EndObject();
+
+	const BuildVector<Record>& GetRecords() const
+	{
+		return mRecords;
+	}
+
+	std::size_t GetSize() const // records
+	{
+		return mRecords.size();
+	}
+
+	std::size_t GetVertexCount() const
+	{
+		return mRecords.size() - mTriangleCount;
+	}
+
+	static Record PackVertex(const Vertex& vertex);
+	static Vertex UnpackVertex(const Record& record);
+
+	// unit vector to two snorm16 on the octahedron, x | y << 16. a zero vector decodes to +z
+	static std::uint32_t EncodeOctahedral(const Float3& n);
+	static Float3 DecodeOctahedral(const std::uint32_t packed);
+
+	// IEEE half rounded to nearest even, decoded by f16tof32 in the shaders
+	static std::uint16_t FloatToHalf(const float f);
+	static float HalfToFloat(const std::uint16_t h);
+
+private:
+
+	struct VertexHash
+	{
+		std::size_t operator()(const Vertex& vertex) const
+		{
+			std::uint32_t words[8];
+			std::memcpy(words, &vertex, sizeof(words));
+
+			std::size_t hash = 0;
+
+			for (const std::uint32_t word : words)
+			{
+				hash = (hash ^ word) * 0x100000001b3ull;
+			}
+
+			return hash;
+		}
+	};
+
+	// bitwise, so that keys are only merged when they encode the same way
+	struct VertexEqual
+	{
+		bool operator()(const Vertex& a, const Vertex& b) const
+		{
+			return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+		}
+	};
+
+	static_assert(sizeof(Vertex) == 8 * sizeof(float), "unexpected Vertex layout");
+
+	BuildVector<Record> mRecords;
+	std::size_t mTriangleCount = 0;
+
+	// object being written
+	std::unordered_map<Vertex, std::uint32_t, VertexHash, VertexEqual> mVertexRecords;
+	std::size_t mObjectBegin = 0;
+	std::size_t mObjectEnd = 0;
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+// std
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// portable vector types for the BVH core, Float4 has the layout of the float4 elements read by the shaders
+
+struct Float3
+{
+	float x;
+	float y;
+	float z;
+
+	Float3() = default;
+
+	constexpr Float3(const float x, const float y, const float z)
+		: x(x)
+		, y(y)
+		, z(z)
+	{}
+
+	explicit constexpr Float3(const float s)
+		: x(s)
+		, y(s)
+		, z(s)
+	{}
+
+	float operator[](const int axis) const
+	{
+		return (&x)[axis];
+	}
+
+	float& operator[](const int axis)
+	{
+		return (&x)[axis];
+	}
+};
+
+inline Float3 operator+(const Float3& a, const Float3& b) { return Float3(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline Float3 operator-(const Float3& a, const Float3& b) { return Float3(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline Float3 operator*(const Float3& a, const Float3& b) { return Float3(a.x * b.x, a.y * b.y, a.z * b.z); }
+inline Float3 operator*(const float s, const Float3& a) { return Float3(s * a.x, s * a.y, s * a.z); }
+inline Float3 operator*(const Float3& a, const float s) { return Float3(a.x * s, a.y * s, a.z * s); }
+
+inline Float3 Min(const Float3& a, const Float3& b) { return Float3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)); }
+inline Float3 Max(const Float3& a, const Float3& b) { return Float3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)); }
+
+inline float Dot(const Float3& a, const Float3& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Float3 Cross(const Float3& a, const Float3& b)
+{
+	return Float3(a.y * b.z - a.z * b.y,
+				  a.z * b.x - a.x * b.z,
+				  a.x * b.y - a.y * b.x);
+}
+
+struct Float4
+{
+	float x;
+	float y;
+	float z;
+	float w;
+
+	Float4() = default;
+
+	constexpr Float4(const float x, const float y, const float z, const float w)
+		: x(x)
+		, y(y)
+		, z(z)
+		, w(w)
+	{}
+
+	constexpr Float4(const Float3& v, const float w)
+		: x(v.x)
+		, y(v.y)
+		, z(v.z)
+		, w(w)
+	{}
+
+	Float3 xyz() const
+	{
+		return Float3(x, y, z);
+	}
+};
+
+static_assert(sizeof(Float4) == 16, "Float4 must match the shader float4 layout");
+
+struct AABB
+{
+	Float3 min = Float3(+FLT_MAX);
+	Float3 max = Float3(-FLT_MAX);
+
+	void Expand(const Float3& point)
+	{
+		min = Min(min, point);
+		max = Max(max, point);
+	}
+
+	void Expand(const AABB& aabb)
+	{
+		min = Min(min, aabb.min);
+		max = Max(max, aabb.max);
+	}
+
+	Float3 GetCentroid() const
+	{
+		return 0.5f * (min + max);
+	}
+
+	float GetSurfaceArea() const
+	{
+		const Float3 extents = max - min; // abs ?
+
+		return (extents.x * extents.y + extents.y * extents.z + extents.z * extents.x) * 2.0f;
+	}
+};
+
+// affine transform as three rows, p' = (dot(row0.xyz, p) + row0.w, ...), the layout of a float3x4 in the shaders
+struct Matrix34
+{
+	Float4 rows[3];
+
+	static Matrix34 Identity()
+	{
+		return { { Float4(1, 0, 0, 0), Float4(0, 1, 0, 0), Float4(0, 0, 1, 0) } };
+	}
+
+	Float3 TransformPoint(const Float3& p) const
+	{
+		return Float3(Dot(rows[0].xyz(), p) + rows[0].w,
+					  Dot(rows[1].xyz(), p) + rows[1].w,
+					  Dot(rows[2].xyz(), p) + rows[2].w);
+	}
+
+	Float3 TransformVector(const Float3& v) const
+	{
+		return Float3(Dot(rows[0].xyz(), v),
+					  Dot(rows[1].xyz(), v),
+					  Dot(rows[2].xyz(), v));
+	}
+
+	Matrix34 Inverse() const
+	{
+		const Float3 r0 = rows[0].xyz();
+		const Float3 r1 = rows[1].xyz();
+		const Float3 r2 = rows[2].xyz();
+
+		// the columns of the inverse are the cross products of the rows over the determinant
+		const Float3 c0 = Cross(r1, r2);
+		const Float3 c1 = Cross(r2, r0);
+		const Float3 c2 = Cross(r0, r1);
+
+		const float invDet = 1.0f / Dot(r0, c0);
+
+		Matrix34 inverse;
+		inverse.rows[0] = Float4(c0.x * invDet, c1.x * invDet, c2.x * invDet, 0.0f);
+		inverse.rows[1] = Float4(c0.y * invDet, c1.y * invDet, c2.y * invDet, 0.0f);
+		inverse.rows[2] = Float4(c0.z * invDet, c1.z * invDet, c2.z * invDet, 0.0f);
+
+		const Float3 translation = inverse.TransformVector(Float3(rows[0].w, rows[1].w, rows[2].w));
+
+		inverse.rows[0].w = -translation.x;
+		inverse.rows[1].w = -translation.y;
+		inverse.rows[2].w = -translation.z;
+
+		return inverse;
+	}
+
+	AABB TransformAABB(const AABB& aabb) const
+	{
+		AABB result;
+
+		for (int i = 0; i < 8; ++i)
+		{
+			result.Expand(TransformPoint(Float3((i & 1) ? aabb.max.x : aabb.min.x,
+												(i & 2) ? aabb.max.y : aabb.min.y,
+												(i & 4) ? aabb.max.z : aabb.min.z)));
+		}
+
+		return result;
+	}
+};
@@ -0,0 +1,269 @@
+#include "BVHPacketTraversal.h"
+
+// std
+#include <chrono>
+
+namespace
+{
+	SimdMask RayBoxIntersect(const SimdFloat3& origin,
+							 const SimdFloat3& dirInv,
+							 const Float3& aabbMin,
+							 const Float3& aabbMax)
+	{
+		const SimdFloat3 t0 = (Broadcast(aabbMin) - origin) * dirInv;
+		const SimdFloat3 t1 = (Broadcast(aabbMax) - origin) * dirInv;
+
+		const SimdFloat3 tmin = { Min(t0.x, t1.x), Min(t0.y, t1.y), Min(t0.z, t1.z) };
+		const SimdFloat3 tmax = { Max(t0.x, t1.x), Max(t0.y, t1.y), Max(t0.z, t1.z) };
+
+		const SimdFloat a0 = Max(Max(SimdFloat(0.0f), tmin.x), Max(tmin.y, tmin.z));
+		const SimdFloat a1 = Min(tmax.x, Min(tmax.y, tmax.z));
+
+		return a1 >= a0;
+	}
+
+	// returns the lanes that miss, written like the scalar test so that NaN lanes agree with it
+	SimdMask RayTriMiss(const SimdFloat3& origin,
+						const SimdFloat3& dir,
+						const Float3& v0,
+						const Float3& e1,
+						const Float3& e2,
+						const bool bBackfaceCulling,
+						SimdFloat& t,
+						SimdFloat& u,
+						SimdFloat& v)
+	{
+		const SimdFloat3 edge1 = Broadcast(e1);
+		const SimdFloat3 edge2 = Broadcast(e2);
+
+		const SimdFloat3 s1 = Cross(dir, edge2);
+		const SimdFloat det = Dot(s1, edge1);
+		const SimdFloat invd = SimdFloat(1.0f) / det;
+		const SimdFloat3 d = origin - Broadcast(v0);
+		u = Dot(d, s1) * invd;
+		const SimdFloat3 s2 = Cross(d, edge1);
+		v = Dot(dir, s2) * invd;
+		t = Dot(edge2, s2) * invd;
+
+		const SimdFloat zero(0.0f);
+		const SimdFloat one(1.0f);
+
+		SimdMask miss = (u < zero) | (u > one) | (v < zero) | ((u + v) > one) | (t < zero) | (t > SimdFloat(1e9f));
+
+		if (bBackfaceCulling)
+		{
+			miss = miss | (det < SimdFloat(-BVHTraversal::kEpsilon));
+		}
+
+		return miss;
+	}
+}
+
+void BVHPacketTraversal::TraceShadows(const Ray* rays, const std::size_t rayCount, bool* occluded)
+{
+	auto body = [&](const Packet& packet, const std::size_t first, const std::size_t count)
+	{
+		PacketHit hit;
+		const int hitBits = TracePacket<false>(packet, hit);
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			occluded[first + i] = (hitBits >> i) & 1;
+		}
+	};
+
+	TraceBatch(rays, rayCount, body);
+}
+
+void BVHPacketTraversal::TraceReflections(const Ray* rays, const std::size_t rayCount, Hit* hits, bool* results)
+{
+	auto body = [&](const Packet& packet, const std::size_t first, const std::size_t count)
+	{
+		PacketHit hit;
+		const int hitBits = TracePacket<true>(packet, hit);
+
+		float t[kPacketSize];
+		float u[kPacketSize];
+		float v[kPacketSize];
+		float offset[kPacketSize];
+		float material[kPacketSize];
+
+		hit.t.Store(t);
+		hit.u.Store(u);
+		hit.v.Store(v);
+		hit.offset.Store(offset);
+		hit.material.Store(material);
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			results[first + i] = (hitBits >> i) & 1;
+
+			if (results[first + i])
+			{
+				Hit& result = hits[first + i];
+				result.t = t[i];
+				result.u = u[i];
+				result.v = v[i];
+				result.offset = int(offset[i]);
+				result.material = int(material[i]);
+			}
+		}
+	};
+
+	TraceBatch(rays, rayCount, body);
+}
+
+BVHPacketTraversal::Packet BVHPacketTraversal::LoadPacket(const Ray* rays, const std::size_t count)
+{
+	float lanes[9][kPacketSize];
+
+	for (int i = 0; i < kPacketSize; ++i)
+	{
+		// unused lanes repeat the first ray, they are masked out but must not produce NaNs of their own
+		const Ray& ray = rays[(std::size_t(i) < count) ? i : 0];
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			lanes[0 + axis][i] = ray.origin[axis];
+			lanes[3 + axis][i] = ray.dir[axis];
+			lanes[6 + axis][i] = ray.dirInv[axis];
+		}
+	}
+
+	Packet packet;
+	packet.origin = { SimdFloat::Load(lanes[0]), SimdFloat::Load(lanes[1]), SimdFloat::Load(lanes[2]) };
+	packet.dir = { SimdFloat::Load(lanes[3]), SimdFloat::Load(lanes[4]), SimdFloat::Load(lanes[5]) };
+	packet.dirInv = { SimdFloat::Load(lanes[6]), SimdFloat::Load(lanes[7]), SimdFloat::Load(lanes[8]) };
+	packet.validBits = (1 << count) - 1;
+
+	return packet;
+}
+
+template <typename TraceBody>
+void BVHPacketTraversal::TraceBatch(const Ray* rays, const std::size_t rayCount, TraceBody& body)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for (std::size_t first = 0; first < rayCount; first += kPacketSize)
+	{
+		const std::size_t count = std::min<std::size_t>(kPacketSize, rayCount - first);
+
+		body(LoadPacket(rays + first, count), first, count);
+
+		mStats.packetCount++;
+	}
+
+	const auto end = std::chrono::steady_clock::now();
+
+	mStats.rayCount += rayCount;
+	mStats.traceTime += std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+template <bool bClosestHit>
+int BVHPacketTraversal::TracePacket(const Packet& packet, PacketHit& hit) const
+{
+	int activeBits = packet.validBits;
+	int hitBits = 0;
+
+	hit.t = SimdFloat(BVHTraversal::kMaxDistance);
+	hit.u = SimdFloat(0.0f);
+	hit.v = SimdFloat(0.0f);
+	hit.offset = SimdFloat(-1.0f);
+	hit.material = SimdFloat(-1.0f);
+
+	StackEntry stack[kMaxStackSize];
+	int stackSize = 0;
+
+	int dataOffset = 0;
+
+	while (true)
+	{
+		// leaving a subtree brings back the lanes that skipped it, except the ones already occluded
+		while (stackSize > 0 && dataOffset == stack[stackSize - 1].end)
+		{
+			activeBits = stack[--stackSize].activeBits & ~(bClosestHit ? 0 : hitBits);
+		}
+
+		if (activeBits == 0)
+		{
+			if (stackSize == 0)
+			{
+				break;
+			}
+
+			dataOffset = stack[stackSize - 1].end;
+			continue;
+		}
+
+		const Float4& element0 = mStream[dataOffset];
+		const Float4& element1 = mStream[dataOffset + 1];
+
+		const int offsetToNextNode = int(element0.w);
+
+		if (offsetToNextNode < 0) // node
+		{
+			const int collisionBits = RayBoxIntersect(packet.origin, packet.dirInv, element0.xyz(), element1.xyz()).GetBits() & activeBits;
+
+			dataOffset += 2;
+
+			if (collisionBits == 0)
+			{
+				// no lane enters the node, skip over the whole branch
+				dataOffset += -offsetToNextNode;
+			}
+			else if (collisionBits != activeBits && stackSize < kMaxStackSize)
+			{
+				// only the lanes that hit the box traverse the branch, a full stack keeps all of them (more tests, same results)
+				stack[stackSize++] = { dataOffset - offsetToNextNode, activeBits };
+				activeBits = collisionBits;
+			}
+		}
+		else if (offsetToNextNode > 0) // leaf
+		{
+			const int triangleCount = offsetToNextNode;
+			const SimdMask activeMask = MaskFromBits(activeBits);
+
+			for (int i = 0; i < triangleCount; ++i)
+			{
+				const Float4& triangle0 = mStream[dataOffset++];
+				const Float4& triangle1 = mStream[dataOffset++];
+				const Float4& triangle2 = mStream[dataOffset++];
+
+				SimdFloat t, u, v;
+				const SimdMask collision = AndNot(activeMask, RayTriMiss(packet.origin, packet.dir, triangle0.xyz(), triangle1.xyz(), triangle2.xyz(), bClosestHit, t, u, v));
+
+				if (!bClosestHit)
+				{
+					hitBits |= collision.GetBits();
+				}
+				else
+				{
+					const SimdMask closer = collision & (t < hit.t);
+
+					if (closer.GetBits() != 0)
+					{
+						hit.t = Select(closer, t, hit.t);
+						hit.u = Select(closer, u, hit.u);
+						hit.v = Select(closer, v, hit.v);
+						hit.offset = Select(closer, SimdFloat(triangle1.w), hit.offset);
+						hit.material = Select(closer, SimdFloat(triangle2.w), hit.material);
+
+						hitBits |= closer.GetBits();
+					}
+				}
+			}
+
+			if (!bClosestHit)
+			{
+				// occluded lanes are done
+				activeBits &= ~hitBits;
+			}
+		}
+		else // empty node, end of the stream
+		{
+			break;
+		}
+	}
+
+	return hitBits;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+// std
+#include <cstddef>
+
+//
+#include "BVHSimd.h"
+#include "BVHTraversal.h"
+
+// traces packets of SimdFloat::kWidth rays through the flattened skip-offset stream (BuildSettings::width 2, LeafFormat::Edges),
+// every lane visits the same nodes and leaves as BVHTraversal and gets the same result
+class BVHPacketTraversal
+{
+public:
+
+	using Ray = BVHTraversal::Ray;
+	using Hit = BVHTraversal::Hit;
+
+	static constexpr int kPacketSize = SimdFloat::kWidth;
+
+	// accumulated over the Trace* calls since the last ResetStats()
+	struct TraceStats
+	{
+		std::size_t rayCount = 0;
+		std::size_t packetCount = 0;
+		double traceTime = 0.0; // ms
+
+		double GetRaysPerSecond() const
+		{
+			return (traceTime > 0.0) ? double(rayCount) / (traceTime * 0.001) : 0.0;
+		}
+	};
+
+	explicit BVHPacketTraversal(const Float4* stream)
+		: mStream(stream)
+	{}
+
+	// any hit, occluded[i] is set for every ray that hits a triangle
+	void TraceShadows(const Ray* rays, const std::size_t rayCount, bool* occluded);
+
+	// closest hit with backface culling, hits[i] is only written where results[i] is set
+	void TraceReflections(const Ray* rays, const std::size_t rayCount, Hit* hits, bool* results);
+
+	const TraceStats& GetStats() const
+	{
+		return mStats;
+	}
+
+	void ResetStats()
+	{
+		mStats = TraceStats();
+	}
+
+	static const char* GetInstructionSet()
+	{
+		return SimdFloat::kName;
+	}
+
+private:
+
+	struct Packet
+	{
+		SimdFloat3 origin;
+		SimdFloat3 dir;
+		SimdFloat3 dirInv;
+
+		int validBits; // lanes holding a ray, the last packet of a batch may be partial
+	};
+
+	// closest hit lanes
+	struct PacketHit
+	{
+		SimdFloat t;
+		SimdFloat u;
+		SimdFloat v;
+		SimdFloat offset;
+		SimdFloat material;
+	};
+
+	// a subtree entered by a subset of the active lanes, they are restored when the traversal leaves it
+	struct StackEntry
+	{
+		int end;
+		int activeBits;
+	};
+
+	static const int kMaxStackSize = 64;
+
+	static Packet LoadPacket(const Ray* rays, const std::size_t count);
+
+	template <bool bClosestHit>
+	int TracePacket(const Packet& packet, PacketHit& hit) const;
+
+	template <typename TraceBody>
+	void TraceBatch(const Ray* rays, const std::size_t rayCount, TraceBody& body);
+
+	const Float4* mStream;
+
+	TraceStats mStats;
+};
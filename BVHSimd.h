@@ -0,0 +1,248 @@
+#pragma once
+
+// std
+#include <algorithm>
+#include <cstring>
+
+//
+#include "BVHMath.h"
+
+// minimal SIMD float lanes for the packet tracer: AVX2 (8 lanes), SSE2 (4 lanes) or a scalar fallback (4 lanes)
+// Min/Max keep the operand order of std::min/std::max so that lanes match the scalar traversal bit for bit
+
+#if !defined(BVH_SIMD_SCALAR) && defined(__AVX2__)
+#define BVH_SIMD_AVX
+#include <immintrin.h>
+#elif !defined(BVH_SIMD_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define BVH_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#if defined(BVH_SIMD_AVX)
+
+struct SimdMask
+{
+	__m256 m;
+
+	static constexpr int kWidth = 8;
+
+	int GetBits() const
+	{
+		return _mm256_movemask_ps(m);
+	}
+};
+
+struct SimdFloat
+{
+	__m256 v;
+
+	static constexpr int kWidth = 8;
+	static constexpr const char* kName = "AVX2";
+
+	SimdFloat() = default;
+	SimdFloat(const __m256 v) : v(v) {}
+	explicit SimdFloat(const float s) : v(_mm256_set1_ps(s)) {}
+
+	static SimdFloat Load(const float* data) { return _mm256_loadu_ps(data); }
+	void Store(float* data) const { _mm256_storeu_ps(data, v); }
+};
+
+inline SimdFloat operator+(const SimdFloat& a, const SimdFloat& b) { return _mm256_add_ps(a.v, b.v); }
+inline SimdFloat operator-(const SimdFloat& a, const SimdFloat& b) { return _mm256_sub_ps(a.v, b.v); }
+inline SimdFloat operator*(const SimdFloat& a, const SimdFloat& b) { return _mm256_mul_ps(a.v, b.v); }
+inline SimdFloat operator/(const SimdFloat& a, const SimdFloat& b) { return _mm256_div_ps(a.v, b.v); }
+
+inline SimdFloat Min(const SimdFloat& a, const SimdFloat& b) { return _mm256_min_ps(b.v, a.v); }
+inline SimdFloat Max(const SimdFloat& a, const SimdFloat& b) { return _mm256_max_ps(b.v, a.v); }
+
+inline SimdMask operator<(const SimdFloat& a, const SimdFloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline SimdMask operator>(const SimdFloat& a, const SimdFloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline SimdMask operator>=(const SimdFloat& a, const SimdFloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+
+inline SimdMask operator&(const SimdMask& a, const SimdMask& b) { return { _mm256_and_ps(a.m, b.m) }; }
+inline SimdMask operator|(const SimdMask& a, const SimdMask& b) { return { _mm256_or_ps(a.m, b.m) }; }
+inline SimdMask AndNot(const SimdMask& a, const SimdMask& b) { return { _mm256_andnot_ps(b.m, a.m) }; } // a & ~b
+
+inline SimdMask MaskFromBits(const int bits)
+{
+	const __m256i lanes = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+	const __m256i set = _mm256_and_si256(_mm256_set1_epi32(bits), lanes);
+
+	return { _mm256_castsi256_ps(_mm256_cmpeq_epi32(set, lanes)) };
+}
+
+inline SimdFloat Select(const SimdMask& mask, const SimdFloat& a, const SimdFloat& b) // mask ? a : b
+{
+	return _mm256_blendv_ps(b.v, a.v, mask.m);
+}
+
+#elif defined(BVH_SIMD_SSE)
+
+struct SimdMask
+{
+	__m128 m;
+
+	static constexpr int kWidth = 4;
+
+	int GetBits() const
+	{
+		return _mm_movemask_ps(m);
+	}
+};
+
+struct SimdFloat
+{
+	__m128 v;
+
+	static constexpr int kWidth = 4;
+	static constexpr const char* kName = "SSE2";
+
+	SimdFloat() = default;
+	SimdFloat(const __m128 v) : v(v) {}
+	explicit SimdFloat(const float s) : v(_mm_set1_ps(s)) {}
+
+	static SimdFloat Load(const float* data) { return _mm_loadu_ps(data); }
+	void Store(float* data) const { _mm_storeu_ps(data, v); }
+};
+
+inline SimdFloat operator+(const SimdFloat& a, const SimdFloat& b) { return _mm_add_ps(a.v, b.v); }
+inline SimdFloat operator-(const SimdFloat& a, const SimdFloat& b) { return _mm_sub_ps(a.v, b.v); }
+inline SimdFloat operator*(const SimdFloat& a, const SimdFloat& b) { return _mm_mul_ps(a.v, b.v); }
+inline SimdFloat operator/(const SimdFloat& a, const SimdFloat& b) { return _mm_div_ps(a.v, b.v); }
+
+inline SimdFloat Min(const SimdFloat& a, const SimdFloat& b) { return _mm_min_ps(b.v, a.v); }
+inline SimdFloat Max(const SimdFloat& a, const SimdFloat& b) { return _mm_max_ps(b.v, a.v); }
+
+inline SimdMask operator<(const SimdFloat& a, const SimdFloat& b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+inline SimdMask operator>(const SimdFloat& a, const SimdFloat& b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+inline SimdMask operator>=(const SimdFloat& a, const SimdFloat& b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+
+inline SimdMask operator&(const SimdMask& a, const SimdMask& b) { return { _mm_and_ps(a.m, b.m) }; }
+inline SimdMask operator|(const SimdMask& a, const SimdMask& b) { return { _mm_or_ps(a.m, b.m) }; }
+inline SimdMask AndNot(const SimdMask& a, const SimdMask& b) { return { _mm_andnot_ps(b.m, a.m) }; } // a & ~b
+
+inline SimdMask MaskFromBits(const int bits)
+{
+	const __m128i lanes = _mm_set_epi32(8, 4, 2, 1);
+	const __m128i set = _mm_and_si128(_mm_set1_epi32(bits), lanes);
+
+	return { _mm_castsi128_ps(_mm_cmpeq_epi32(set, lanes)) };
+}
+
+inline SimdFloat Select(const SimdMask& mask, const SimdFloat& a, const SimdFloat& b) // mask ? a : b
+{
+	return _mm_or_ps(_mm_and_ps(mask.m, a.v), _mm_andnot_ps(mask.m, b.v));
+}
+
+#else
+
+struct SimdMask
+{
+	bool m[4];
+
+	static constexpr int kWidth = 4;
+
+	int GetBits() const
+	{
+		return int(m[0]) | (int(m[1]) << 1) | (int(m[2]) << 2) | (int(m[3]) << 3);
+	}
+};
+
+struct SimdFloat
+{
+	float v[4];
+
+	static constexpr int kWidth = 4;
+	static constexpr const char* kName = "scalar";
+
+	SimdFloat() = default;
+	explicit SimdFloat(const float s) : v{ s, s, s, s } {}
+
+	static SimdFloat Load(const float* data) { SimdFloat r; std::memcpy(r.v, data, sizeof(r.v)); return r; }
+	void Store(float* data) const { std::memcpy(data, v, sizeof(v)); }
+};
+
+template <typename Op>
+inline SimdFloat SimdApply(const SimdFloat& a, const SimdFloat& b, Op op)
+{
+	SimdFloat r;
+	for (int i = 0; i < 4; ++i) r.v[i] = op(a.v[i], b.v[i]);
+	return r;
+}
+
+template <typename Op>
+inline SimdMask SimdCompare(const SimdFloat& a, const SimdFloat& b, Op op)
+{
+	SimdMask r;
+	for (int i = 0; i < 4; ++i) r.m[i] = op(a.v[i], b.v[i]);
+	return r;
+}
+
+inline SimdFloat operator+(const SimdFloat& a, const SimdFloat& b) { return SimdApply(a, b, [](float x, float y) { return x + y; }); }
+inline SimdFloat operator-(const SimdFloat& a, const SimdFloat& b) { return SimdApply(a, b, [](float x, float y) { return x - y; }); }
+inline SimdFloat operator*(const SimdFloat& a, const SimdFloat& b) { return SimdApply(a, b, [](float x, float y) { return x * y; }); }
+inline SimdFloat operator/(const SimdFloat& a, const SimdFloat& b) { return SimdApply(a, b, [](float x, float y) { return x / y; }); }
+
+inline SimdFloat Min(const SimdFloat& a, const SimdFloat& b) { return SimdApply(a, b, [](float x, float y) { return std::min(x, y); }); }
+inline SimdFloat Max(const SimdFloat& a, const SimdFloat& b) { return SimdApply(a, b, [](float x, float y) { return std::max(x, y); }); }
+
+inline SimdMask operator<(const SimdFloat& a, const SimdFloat& b) { return SimdCompare(a, b, [](float x, float y) { return x < y; }); }
+inline SimdMask operator>(const SimdFloat& a, const SimdFloat& b) { return SimdCompare(a, b, [](float x, float y) { return x > y; }); }
+inline SimdMask operator>=(const SimdFloat& a, const SimdFloat& b) { return SimdCompare(a, b, [](float x, float y) { return x >= y; }); }
+
+inline SimdMask operator&(const SimdMask& a, const SimdMask& b) { SimdMask r; for (int i = 0; i < 4; ++i) r.m[i] = a.m[i] && b.m[i]; return r; }
+inline SimdMask operator|(const SimdMask& a, const SimdMask& b) { SimdMask r; for (int i = 0; i < 4; ++i) r.m[i] = a.m[i] || b.m[i]; return r; }
+inline SimdMask AndNot(const SimdMask& a, const SimdMask& b) { SimdMask r; for (int i = 0; i < 4; ++i) r.m[i] = a.m[i] && !b.m[i]; return r; } // a & ~b
+
+inline SimdMask MaskFromBits(const int bits)
+{
+	SimdMask r;
+	for (int i = 0; i < 4; ++i) r.m[i] = (bits >> i) & 1;
+	return r;
+}
+
+inline SimdFloat Select(const SimdMask& mask, const SimdFloat& a, const SimdFloat& b) // mask ? a : b
+{
+	SimdFloat r;
+	for (int i = 0; i < 4; ++i) r.v[i] = mask.m[i] ? a.v[i] : b.v[i];
+	return r;
+}
+
+#endif
+
+static_assert(SimdFloat::kWidth == SimdMask::kWidth, "mask and float lanes must match");
+
+// three lanes of vectors, one ray per lane
+struct SimdFloat3
+{
+	SimdFloat x;
+	SimdFloat y;
+	SimdFloat z;
+};
+
+inline SimdFloat Dot(const SimdFloat3& a, const SimdFloat3& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline SimdFloat3 Cross(const SimdFloat3& a, const SimdFloat3& b)
+{
+	return { a.y * b.z - a.z * b.y,
+			 a.z * b.x - a.x * b.z,
+			 a.x * b.y - a.y * b.x };
+}
+
+inline SimdFloat3 operator-(const SimdFloat3& a, const SimdFloat3& b)
+{
+	return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+inline SimdFloat3 operator*(const SimdFloat3& a, const SimdFloat3& b)
+{
+	return { a.x * b.x, a.y * b.y, a.z * b.z };
+}
+
+inline SimdFloat3 Broadcast(const Float3& v)
+{
+	return { SimdFloat(v.x), SimdFloat(v.y), SimdFloat(v.z) };
+}
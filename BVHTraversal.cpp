@@ -0,0 +1,585 @@
+#include "BVHTraversal.h"
+
+//
+#include "BVHBuilder.h"
+#include "BVHSimd.h"
+#include "BVHTwoLevel.h"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+	// tests the ray against the four children of a wide group, returns one bit per child hit. with tNear the entry distances
+	// are returned and the boxes entered beyond maxDist are missed
+	int RayBoxIntersect4(const Float3& origin, const Float3& dirInv, const BVHBuilder::WideGroup& group, float* tNear = nullptr, const float maxDist = 0.0f)
+	{
+#if defined(BVH_SIMD_AVX) || defined(BVH_SIMD_SSE)
+		const __m128 ox = _mm_set1_ps(origin.x);
+		const __m128 oy = _mm_set1_ps(origin.y);
+		const __m128 oz = _mm_set1_ps(origin.z);
+		const __m128 ix = _mm_set1_ps(dirInv.x);
+		const __m128 iy = _mm_set1_ps(dirInv.y);
+		const __m128 iz = _mm_set1_ps(dirInv.z);
+
+		const __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&group.minX.x), ox), ix);
+		const __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&group.minY.x), oy), iy);
+		const __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&group.minZ.x), oz), iz);
+		const __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&group.maxX.x), ox), ix);
+		const __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&group.maxY.x), oy), iy);
+		const __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&group.maxZ.x), oz), iz);
+
+		// operands swapped to get std::min/std::max, as in the scalar test
+		const __m128 tminx = _mm_min_ps(t1x, t0x);
+		const __m128 tminy = _mm_min_ps(t1y, t0y);
+		const __m128 tminz = _mm_min_ps(t1z, t0z);
+		const __m128 tmaxx = _mm_max_ps(t1x, t0x);
+		const __m128 tmaxy = _mm_max_ps(t1y, t0y);
+		const __m128 tmaxz = _mm_max_ps(t1z, t0z);
+
+		const __m128 a0 = _mm_max_ps(_mm_max_ps(tminz, tminy), _mm_max_ps(tminx, _mm_setzero_ps()));
+		const __m128 a1 = _mm_min_ps(_mm_min_ps(tmaxz, tmaxy), tmaxx);
+
+		if (tNear)
+		{
+			_mm_storeu_ps(tNear, a0);
+
+			return _mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(a1, a0), _mm_cmple_ps(a0, _mm_set1_ps(maxDist))));
+		}
+
+		return _mm_movemask_ps(_mm_cmpge_ps(a1, a0));
+#else
+		int bits = 0;
+
+		for (int i = 0; i < 4; ++i)
+		{
+			const Float3 aabbMin((&group.minX.x)[i], (&group.minY.x)[i], (&group.minZ.x)[i]);
+			const Float3 aabbMax((&group.maxX.x)[i], (&group.maxY.x)[i], (&group.maxZ.x)[i]);
+
+			if (tNear)
+			{
+				bits |= int(BVHTraversal::RayBoxIntersect(origin, dirInv, aabbMin, aabbMax, maxDist, tNear[i])) << i;
+			}
+			else
+			{
+				bits |= int(BVHTraversal::RayBoxIntersect(origin, dirInv, aabbMin, aabbMax)) << i;
+			}
+		}
+
+		return bits;
+#endif
+	}
+
+	// the child order bits of BVHBuilder::GetChildOrder against the ray direction
+	bool IsSecondChildFirst(const Float3& dir, const int order)
+	{
+		return (dir[order & 3] < 0.0f) != ((order & 4) != 0);
+	}
+}
+
+bool BVHTraversal::TraceShadow(const Ray& ray) const
+{
+	return Trace<false>(ray, nullptr, nullptr);
+}
+
+bool BVHTraversal::TraceShadow(const Ray& ray, Counters& counters) const
+{
+	return Trace<false>(ray, nullptr, &counters);
+}
+
+bool BVHTraversal::TraceReflection(const Ray& ray, Hit& hit) const
+{
+	return Trace<true>(ray, &hit, nullptr);
+}
+
+bool BVHTraversal::TraceReflection(const Ray& ray, Hit& hit, Counters& counters) const
+{
+	return Trace<true>(ray, &hit, &counters);
+}
+
+template <bool bClosestHit>
+bool BVHTraversal::Trace(const Ray& ray, Hit* hit, Counters* counters) const
+{
+	if (mbTwoLevel)
+	{
+		return TraceTwoLevel<bClosestHit>(ray, hit, counters);
+	}
+
+	float minDist = kMaxDistance;
+	const bool collision = TraceMesh<bClosestHit>(ray, 0, minDist, hit, counters);
+
+	return bClosestHit ? (minDist < kMaxDistance) : collision;
+}
+
+template <bool bClosestHit>
+bool BVHTraversal::TraceTwoLevel(const Ray& ray, Hit* hit, Counters* counters) const
+{
+	BVHTwoLevel::Header header;
+	std::memcpy(&header, mStream, sizeof(header));
+
+	int dataOffset = header.topLevelOffset;
+	int offsetToNextNode = 1;
+
+	float minDist = kMaxDistance;
+
+	while (offsetToNextNode != 0)
+	{
+		const Float4& element0 = mStream[dataOffset++];
+		const Float4& element1 = mStream[dataOffset++];
+
+		offsetToNextNode = int(element0.w);
+
+		if (counters)
+		{
+			++counters->iterations;
+		}
+
+		if (offsetToNextNode < 0) // node
+		{
+			if (counters)
+			{
+				++counters->boxTests;
+			}
+
+			float tNear = 0.0f;
+
+			// the ordered mode also skips the instances behind the closest hit
+			const bool collision = (bClosestHit && mbOrdered) ?
+								   RayBoxIntersect(ray.origin, ray.dirInv, element0.xyz(), element1.xyz(), minDist, tNear) :
+								   RayBoxIntersect(ray.origin, ray.dirInv, element0.xyz(), element1.xyz());
+
+			if (!collision)
+			{
+				dataOffset += -offsetToNextNode;
+			}
+		}
+		else if (offsetToNextNode > 0) // instance
+		{
+			const BVHTwoLevel::InstanceRecord& record = *reinterpret_cast<const BVHTwoLevel::InstanceRecord*>(mStream + dataOffset - 2);
+
+			Matrix34 worldInv;
+			worldInv.rows[0] = record.worldInv[0];
+			worldInv.rows[1] = record.worldInv[1];
+			worldInv.rows[2] = record.worldInv[2];
+
+			// the direction is not normalized so that t is the same in object and world space
+			const Ray objectRay(worldInv.TransformPoint(ray.origin), worldInv.TransformVector(ray.dir));
+
+			const float instanceMinDist = minDist;
+
+			if (TraceMesh<bClosestHit>(objectRay, offsetToNextNode, minDist, hit, counters) && !bClosestHit)
+			{
+				return true;
+			}
+
+			if (bClosestHit && minDist < instanceMinDist)
+			{
+				hit->material = int(record.header.x);
+				hit->instance = int(record.header.y);
+			}
+
+			dataOffset += sizeof(BVHTwoLevel::InstanceRecord) / sizeof(Float4) - 2;
+		}
+	}
+
+	return bClosestHit ? (minDist < kMaxDistance) : false;
+}
+
+template <bool bClosestHit>
+bool BVHTraversal::TraceMesh(const Ray& ray, const int rootOffset, float& minDist, Hit* hit, Counters* counters) const
+{
+	if (bClosestHit && mbOrdered)
+	{
+		return (mWidth != 2) ? TraceWideOrdered(ray, rootOffset, minDist, hit, counters) : TraceMeshOrdered(ray, rootOffset, minDist, hit, counters);
+	}
+
+	if (mWidth != 2)
+	{
+		return TraceWide<bClosestHit>(ray, rootOffset, minDist, hit, counters);
+	}
+
+	bool collision = false;
+	int dataOffset = rootOffset;
+	int offsetToNextNode = 1;
+
+	while (offsetToNextNode != 0)
+	{
+		const Float4& element0 = mStream[dataOffset++];
+		const Float4& element1 = mStream[dataOffset++];
+
+		offsetToNextNode = int(element0.w);
+
+		collision = false;
+
+		if (counters)
+		{
+			++counters->iterations;
+		}
+
+		if (offsetToNextNode < 0) // node
+		{
+			if (counters)
+			{
+				++counters->boxTests;
+			}
+
+			// check for intersection with node AABB
+			collision = RayBoxIntersect(ray.origin, ray.dirInv, element0.xyz(), element1.xyz());
+
+			// if there is collision, go to the next node (left)
+			if (!collision)
+			{
+				// or else skip over the whole branch (right)
+				dataOffset += -offsetToNextNode;
+			}
+		}
+		else if (offsetToNextNode > 0) // leaf
+		{
+			// the leaf triangles are stored back to back, the first one holds the size of the list
+			const int triangleCount = offsetToNextNode;
+
+			collision = TraceLeaf<bClosestHit>(ray, dataOffset - 2, triangleCount, minDist, hit, counters);
+
+			if (!bClosestHit && collision)
+			{
+				break;
+			}
+
+			dataOffset += BVHBuilder::GetLeafSize(mLeafFormat) * triangleCount - 2;
+		}
+	}
+
+	return collision;
+}
+
+template <bool bClosestHit>
+bool BVHTraversal::TraceWide(const Ray& ray, const int rootOffset, float& minDist, Hit* hit, Counters* counters) const
+{
+	const int groupCount = mWidth / 4;
+
+	std::int32_t stack[kMaxStackSize];
+	int stackSize = 0;
+
+	// every reference is a node (> 0) or a leaf (< 0), the root of a single-level stream sits at 0
+	std::int32_t child = rootOffset;
+
+	while (true)
+	{
+		if (counters)
+		{
+			++counters->iterations;
+		}
+
+		if (child >= 0) // node
+		{
+			const Float4* node = mStream + child;
+
+			if (counters)
+			{
+				counters->boxTests += 4 * groupCount;
+			}
+
+			// push the children that are hit, the last one first so that they are visited in tree order
+			for (int g = groupCount - 1; g >= 0; --g)
+			{
+				const BVHBuilder::WideGroup* group = reinterpret_cast<const BVHBuilder::WideGroup*>(node) + g;
+				BVHBuilder::WideGroup decoded;
+
+				if (mQuantization != 0)
+				{
+					BVHBuilder::DecodeQuantizedGroup(node, g, mQuantization, decoded);
+					group = &decoded;
+				}
+
+				const int collisionBits = RayBoxIntersect4(ray.origin, ray.dirInv, *group);
+
+				for (int i = 3; i >= 0; --i)
+				{
+					if (((collisionBits >> i) & 1) && group->children[i] != 0)
+					{
+						// the depth of the tree bounds the pushed children (BVHBuilder::GetMaxDepth)
+						assert(stackSize < kMaxStackSize);
+						stack[stackSize++] = group->children[i];
+					}
+				}
+			}
+		}
+		else // leaf
+		{
+			const std::int32_t leaf = -child;
+
+			if (TraceLeaf<bClosestHit>(ray, leaf >> 4, leaf & 15, minDist, hit, counters) && !bClosestHit)
+			{
+				return true;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		child = stack[--stackSize];
+	}
+
+	return false;
+}
+
+bool BVHTraversal::TraceMeshOrdered(const Ray& ray, const int rootOffset, float& minDist, Hit* hit, Counters* counters) const
+{
+	const float meshMinDist = minDist;
+
+	std::int32_t stack[kMaxStackSize];
+	int stackSize = 0;
+
+	int dataOffset = rootOffset;
+
+	// the root is not written, its children are the first entry and the one that follows it. they are ordered like the
+	// children of any node when both have bounds, a leaf root is followed by the terminator
+	{
+		int first = rootOffset;
+		int second = rootOffset + GetEntrySize(rootOffset);
+
+		if (int(mStream[second].w) != 0)
+		{
+			if (int(mStream[first].w) < 0 && int(mStream[second].w) < 0)
+			{
+				AABB firstBounds;
+				firstBounds.min = mStream[first].xyz();
+				firstBounds.max = mStream[first + 1].xyz();
+
+				AABB secondBounds;
+				secondBounds.min = mStream[second].xyz();
+				secondBounds.max = mStream[second + 1].xyz();
+
+				if (IsSecondChildFirst(ray.dir, BVHBuilder::GetChildOrder(firstBounds, secondBounds)))
+				{
+					std::swap(first, second);
+				}
+			}
+
+			stack[stackSize++] = second;
+			dataOffset = first;
+		}
+	}
+
+	while (true)
+	{
+		const Float4& element0 = mStream[dataOffset];
+		const Float4& element1 = mStream[dataOffset + 1];
+
+		const int offsetToNextNode = int(element0.w);
+
+		if (counters)
+		{
+			++counters->iterations;
+		}
+
+		if (offsetToNextNode < 0) // node
+		{
+			if (counters)
+			{
+				++counters->boxTests;
+			}
+
+			float tNear = 0.0f;
+
+			// the boxes entered beyond the closest hit are skipped
+			if (RayBoxIntersect(ray.origin, ray.dirInv, element0.xyz(), element1.xyz(), minDist, tNear))
+			{
+				// the near child next, the far one waits on the stack
+				int first = dataOffset + 2;
+				int second = first + GetEntrySize(first);
+
+				if (IsSecondChildFirst(ray.dir, int(element1.w)))
+				{
+					std::swap(first, second);
+				}
+
+				assert(stackSize < kMaxStackSize);
+				stack[stackSize++] = second;
+
+				dataOffset = first;
+				continue;
+			}
+		}
+		else if (offsetToNextNode > 0) // leaf
+		{
+			TraceLeaf<true>(ray, dataOffset, offsetToNextNode, minDist, hit, counters);
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		dataOffset = stack[--stackSize];
+	}
+
+	return minDist < meshMinDist;
+}
+
+bool BVHTraversal::TraceWideOrdered(const Ray& ray, const int rootOffset, float& minDist, Hit* hit, Counters* counters) const
+{
+	const int groupCount = mWidth / 4;
+	const float meshMinDist = minDist;
+
+	// the children that are hit, with the distance at which the ray enters them
+	struct Entry
+	{
+		std::int32_t child;
+		float tNear;
+	};
+
+	Entry stack[kMaxStackSize];
+	int stackSize = 0;
+
+	Entry entry = { rootOffset, 0.0f };
+
+	while (true)
+	{
+		if (counters)
+		{
+			++counters->iterations;
+		}
+
+		if (entry.tNear > minDist)
+		{
+			// a closer hit was found since the child was pushed
+		}
+		else if (entry.child >= 0) // node
+		{
+			const Float4* node = mStream + entry.child;
+			const int base = stackSize;
+
+			if (counters)
+			{
+				counters->boxTests += 4 * groupCount;
+			}
+
+			// pushed last first as in TraceWide, so that the sort keeps the tree order between equal distances
+			for (int g = groupCount - 1; g >= 0; --g)
+			{
+				const BVHBuilder::WideGroup* group = reinterpret_cast<const BVHBuilder::WideGroup*>(node) + g;
+				BVHBuilder::WideGroup decoded;
+
+				if (mQuantization != 0)
+				{
+					BVHBuilder::DecodeQuantizedGroup(node, g, mQuantization, decoded);
+					group = &decoded;
+				}
+
+				float tNear[4];
+				const int collisionBits = RayBoxIntersect4(ray.origin, ray.dirInv, *group, tNear, minDist);
+
+				for (int i = 3; i >= 0; --i)
+				{
+					if (((collisionBits >> i) & 1) && group->children[i] != 0)
+					{
+						assert(stackSize < kMaxStackSize);
+						stack[stackSize++] = { group->children[i], tNear[i] };
+					}
+				}
+			}
+
+			// the nearest child on top
+			for (int i = base + 1; i < stackSize; ++i)
+			{
+				const Entry pushed = stack[i];
+				int j = i;
+
+				for (; j > base && stack[j - 1].tNear < pushed.tNear; --j)
+				{
+					stack[j] = stack[j - 1];
+				}
+
+				stack[j] = pushed;
+			}
+		}
+		else // leaf
+		{
+			const std::int32_t leaf = -entry.child;
+
+			TraceLeaf<true>(ray, leaf >> 4, leaf & 15, minDist, hit, counters);
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		entry = stack[--stackSize];
+	}
+
+	return minDist < meshMinDist;
+}
+
+template <bool bClosestHit>
+bool BVHTraversal::TraceLeaf(const Ray& ray, int dataOffset, const int triangleCount, float& minDist, Hit* hit, Counters* counters) const
+{
+	bool collision = false;
+
+	float t = 0;
+	float u = 0; // barycentric coords
+	float v = 0;
+
+	const int leafSize = BVHBuilder::GetLeafSize(mLeafFormat);
+
+	for (int i = 0; i < triangleCount; ++i, dataOffset += leafSize)
+	{
+		const Float4* triangle = mStream + dataOffset;
+
+		if (counters)
+		{
+			++counters->triangleTests;
+		}
+
+		int offset = 0;
+		int material = 0;
+
+		// check for intersection with leaf triangle
+		if (mLeafFormat == LeafFormat::Edges)
+		{
+			collision = RayTriIntersect(ray.origin, ray.dir, triangle[0].xyz(), triangle[1].xyz(), triangle[2].xyz(), bClosestHit, t, u, v);
+
+			offset = int(triangle[1].w);
+			material = int(triangle[2].w);
+		}
+		else if (mLeafFormat == LeafFormat::Woop)
+		{
+			collision = RayTriIntersectWoop(ray.origin, ray.dir, triangle + 1, bClosestHit, t, u, v);
+
+			offset = int(triangle[0].x);
+			material = int(triangle[0].y);
+		}
+		else
+		{
+			collision = RayTriIntersect(ray.origin, ray.dir, triangle, bClosestHit, t, u, v);
+
+			offset = int(triangle[1].w);
+			material = int(triangle[2].w) >> 3;
+		}
+
+		if (!bClosestHit)
+		{
+			if (collision)
+			{
+				break;
+			}
+		}
+		else if (collision && t < minDist)
+		{
+			minDist = t;
+
+			hit->t = t;
+			hit->u = u;
+			hit->v = v;
+			hit->offset = offset;
+			hit->material = material;
+		}
+	}
+
+	return collision;
+}
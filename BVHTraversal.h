@@ -0,0 +1,262 @@
+#pragma once
+
+//
+#include "BVHBuilder.h"
+#include "BVHMath.h"
+
+// CPU reference of RayTraced() in RayTracedCommon.hlsl, walks the same flattened skip-offset stream or wide stream
+class BVHTraversal
+{
+public:
+
+	struct Ray
+	{
+		Float3 origin;
+		Float3 dir;
+		Float3 dirInv;
+
+		Ray() = default;
+
+		Ray(const Float3& origin, const Float3& dir)
+			: origin(origin)
+			, dir(dir)
+			, dirInv(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z)
+		{}
+	};
+
+	struct Hit
+	{
+		float t = 0.0f;
+		float u = 0.0f; // barycentric coords, v1 and v2 weights
+		float v = 0.0f;
+
+		int offset = -1; // triangle offset in the hit attributes vertex buffer
+		int material = -1;
+		int instance = -1; // two-level stream only
+	};
+
+	// work of the traversal, counted as the BVH_COUNTERS permutation of the shaders counts it: one box test per node
+	// of the skip-offset stream and four per group of a wide node, one triangle test per leaf triangle and one
+	// iteration per pass of the node loops, the top level included
+	struct Counters
+	{
+		std::uint64_t boxTests = 0;
+		std::uint64_t triangleTests = 0;
+		std::uint64_t iterations = 0;
+
+		Counters& operator+=(const Counters& other)
+		{
+			boxTests += other.boxTests;
+			triangleTests += other.triangleTests;
+			iterations += other.iterations;
+
+			return *this;
+		}
+	};
+
+	static constexpr float kEpsilon = 0.00001f;
+	static constexpr float kMaxDistance = 1000000000.0f; // FLT_MAX of the reflections shader
+
+	using LeafFormat = BVHBuilder::LeafFormat;
+
+	// width, quantization and leafFormat are the BuildSettings the stream was written with, bTwoLevel for a BVHTwoLevel stream.
+	// bOrdered is BVH_ORDERED: the closest-hit queries skip the boxes beyond the closest hit and visit the nearer child first
+	explicit BVHTraversal(const Float4* stream,
+						  const int width = 2,
+						  const bool bTwoLevel = false,
+						  const int quantization = 0,
+						  const LeafFormat leafFormat = LeafFormat::Edges,
+						  const bool bOrdered = false)
+		: mStream(stream)
+		, mWidth(width)
+		, mbTwoLevel(bTwoLevel)
+		, mQuantization(quantization)
+		, mLeafFormat(leafFormat)
+		, mbOrdered(bOrdered)
+	{}
+
+	// any hit, RAYTRACED_SHADOWS
+	bool TraceShadow(const Ray& ray) const;
+	bool TraceShadow(const Ray& ray, Counters& counters) const;
+
+	// closest hit with backface culling, RAYTRACED_REFLECTIONS
+	bool TraceReflection(const Ray& ray, Hit& hit) const;
+	bool TraceReflection(const Ray& ray, Hit& hit, Counters& counters) const;
+
+	static bool RayBoxIntersect(const Float3& origin,
+								const Float3& dirInv,
+								const Float3& aabbMin,
+								const Float3& aabbMax)
+	{
+		const Float3 t0 = (aabbMin - origin) * dirInv;
+		const Float3 t1 = (aabbMax - origin) * dirInv;
+
+		const Float3 tmin = Min(t0, t1);
+		const Float3 tmax = Max(t0, t1);
+
+		const float a0 = std::max(std::max(0.0f, tmin.x), std::max(tmin.y, tmin.z));
+		const float a1 = std::min(tmax.x, std::min(tmax.y, tmax.z));
+
+		return a1 >= a0;
+	}
+
+	// the same test clipped to the closest hit so far, tNear is where the ray enters the box
+	static bool RayBoxIntersect(const Float3& origin,
+								const Float3& dirInv,
+								const Float3& aabbMin,
+								const Float3& aabbMax,
+								const float maxDist,
+								float& tNear)
+	{
+		const Float3 t0 = (aabbMin - origin) * dirInv;
+		const Float3 t1 = (aabbMax - origin) * dirInv;
+
+		const Float3 tmin = Min(t0, t1);
+		const Float3 tmax = Max(t0, t1);
+
+		tNear = std::max(std::max(0.0f, tmin.x), std::max(tmin.y, tmin.z));
+		const float a1 = std::min(tmax.x, std::min(tmax.y, tmax.z));
+
+		return a1 >= tNear && tNear <= maxDist;
+	}
+
+	static bool RayTriIntersect(const Float3& origin,
+								const Float3& dir,
+								const Float3& v0,
+								const Float3& e1, // v1 - v0
+								const Float3& e2, // v2 - v0
+								const bool bBackfaceCulling,
+								float& t,
+								float& u,
+								float& v)
+	{
+		const Float3 s1 = Cross(dir, e2);
+		const float invd = 1.0f / Dot(s1, e1);
+		const Float3 d = origin - v0;
+		u = Dot(d, s1) * invd;
+		const Float3 s2 = Cross(d, e1);
+		v = Dot(dir, s2) * invd;
+		t = Dot(e2, s2) * invd;
+
+		if ((bBackfaceCulling && Dot(s1, e1) < -kEpsilon) ||
+			u < 0.0f || u > 1.0f || v < 0.0f || (u + v) > 1.0f || t < 0.0f || t > 1e9f)
+		{
+			return false;
+		}
+		else
+		{
+			return true;
+		}
+	}
+
+	// LeafFormat::Woop, rows of the world to triangle space transform: the ray crosses the triangle where z = 0 and
+	// x, y are its barycentrics there. the builder writes the z row along the triangle normal
+	static bool RayTriIntersectWoop(const Float3& origin,
+									const Float3& dir,
+									const Float4* rows,
+									const bool bBackfaceCulling,
+									float& t,
+									float& u,
+									float& v)
+	{
+		const float oz = Dot(rows[2].xyz(), origin) + rows[2].w;
+		const float dz = Dot(rows[2].xyz(), dir);
+		t = -oz / dz;
+		u = Dot(rows[0].xyz(), origin) + rows[0].w + t * Dot(rows[0].xyz(), dir);
+		v = Dot(rows[1].xyz(), origin) + rows[1].w + t * Dot(rows[1].xyz(), dir);
+
+		// a ray going along the normal sees the back face
+		if ((bBackfaceCulling && dz > 0.0f) ||
+			u < 0.0f || u > 1.0f || v < 0.0f || (u + v) > 1.0f || t < 0.0f || t > 1e9f)
+		{
+			return false;
+		}
+		else
+		{
+			return true;
+		}
+	}
+
+	// LeafFormat::BaldwinWeber, the same test with the fixed column of the axis folded in: two products per row instead of three
+	static bool RayTriIntersect(const Float3& origin,
+								const Float3& dir,
+								const Float4* leaf,
+								const bool bBackfaceCulling,
+								float& t,
+								float& u,
+								float& v)
+	{
+		const int bits = int(leaf[2].w);
+		const int axis = bits & 3;
+		const int axis1 = (axis == 2) ? 0 : axis + 1;
+		const int axis2 = (axis == 0) ? 2 : axis - 1;
+
+		const float oz = origin[axis] + leaf[2].x * origin[axis1] + leaf[2].y * origin[axis2] + leaf[2].z;
+		const float dz = dir[axis] + leaf[2].x * dir[axis1] + leaf[2].y * dir[axis2];
+		t = -oz / dz;
+
+		const float o1 = origin[axis1] + t * dir[axis1];
+		const float o2 = origin[axis2] + t * dir[axis2];
+		u = leaf[0].x * o1 + leaf[0].y * o2 + leaf[0].z;
+		v = leaf[1].x * o1 + leaf[1].y * o2 + leaf[1].z;
+
+		// the axis component of the normal may be negative
+		if ((bBackfaceCulling && ((bits & 4) ? -dz : dz) > 0.0f) ||
+			u < 0.0f || u > 1.0f || v < 0.0f || (u + v) > 1.0f || t < 0.0f || t > 1e9f)
+		{
+			return false;
+		}
+		else
+		{
+			return true;
+		}
+	}
+
+private:
+
+	// the stack of the ordered and the wide traversals, enough for every tree of BVHBuilder
+	static constexpr int kMaxStackSize = BVHBuilder::kMaxStackSize;
+
+	static_assert(BVHBuilder::GetStackSize(2, BVHBuilder::GetMaxDepth(2)) <= kMaxStackSize &&
+				  BVHBuilder::GetStackSize(4, BVHBuilder::GetMaxDepth(4)) <= kMaxStackSize &&
+				  BVHBuilder::GetStackSize(8, BVHBuilder::GetMaxDepth(8)) <= kMaxStackSize,
+				  "the stack must hold the children pushed on the deepest tree of the builder");
+
+	template <bool bClosestHit>
+	bool Trace(const Ray& ray, Hit* hit, Counters* counters) const;
+
+	// walks the instance records of the top level and traces the ray in object space through their meshes
+	template <bool bClosestHit>
+	bool TraceTwoLevel(const Ray& ray, Hit* hit, Counters* counters) const;
+
+	// one mesh stream, from the element holding its root
+	template <bool bClosestHit>
+	bool TraceMesh(const Ray& ray, const int rootOffset, float& minDist, Hit* hit, Counters* counters) const;
+
+	template <bool bClosestHit>
+	bool TraceWide(const Ray& ray, const int rootOffset, float& minDist, Hit* hit, Counters* counters) const;
+
+	// closest hit of the ordered mode: the far child goes on a stack and the stream is not walked in order
+	bool TraceMeshOrdered(const Ray& ray, const int rootOffset, float& minDist, Hit* hit, Counters* counters) const;
+
+	bool TraceWideOrdered(const Ray& ray, const int rootOffset, float& minDist, Hit* hit, Counters* counters) const;
+
+	// float4 elements of a node and its subtree or of a leaf in the skip-offset stream
+	int GetEntrySize(const int offset) const
+	{
+		const int w = int(mStream[offset].w);
+
+		return (w < 0) ? 2 - w : (w > 0) ? BVHBuilder::GetLeafSize(mLeafFormat) * w : 2;
+	}
+
+	// triangles stored back to back at dataOffset, returns true on the first hit of an any hit query
+	template <bool bClosestHit>
+	bool TraceLeaf(const Ray& ray, int dataOffset, const int triangleCount, float& minDist, Hit* hit, Counters* counters) const;
+
+	const Float4* mStream;
+	int mWidth;
+	bool mbTwoLevel;
+	int mQuantization;
+	LeafFormat mLeafFormat;
+	bool mbOrdered;
+};
@@ -0,0 +1,429 @@
+#include "BVHTreeStats.h"
+
+// std
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	using Triangle = BVHBuilder::Triangle;
+	using TreeNode = BVHBuilder::TreeNode;
+
+	bool Overlaps(const AABB& a, const AABB& b)
+	{
+		return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+			   a.min.y <= b.max.y && a.max.y >= b.min.y &&
+			   a.min.z <= b.max.z && a.max.z >= b.min.z;
+	}
+
+	float GetIntersectionArea(const AABB& a, const AABB& b)
+	{
+		if (!Overlaps(a, b))
+		{
+			return 0.0f;
+		}
+
+		AABB intersection;
+		intersection.min = Max(a.min, b.min);
+		intersection.max = Min(a.max, b.max);
+
+		return intersection.GetSurfaceArea();
+	}
+
+	float GetPolygonArea(const Float3* vertices, const int count)
+	{
+		Float3 sum(0.0f);
+
+		for (int i = 1; i + 1 < count; ++i)
+		{
+			sum = sum + Cross(vertices[i] - vertices[0], vertices[i + 1] - vertices[0]);
+		}
+
+		return 0.5f * std::sqrt(Dot(sum, sum));
+	}
+
+	// area of the part of the triangle inside the box, the triangle is clipped against the six planes
+	float GetClippedArea(const Triangle& triangle, const AABB& aabb)
+	{
+		Float3 polygon[9] = { triangle.v0, triangle.v1, triangle.v2 };
+		Float3 clipped[9];
+		int count = 3;
+
+		for (int axis = 0; axis < 3 && count >= 3; ++axis)
+		{
+			for (int side = 0; side < 2 && count >= 3; ++side)
+			{
+				const float plane = side ? aabb.max[axis] : aabb.min[axis];
+				const float sign = side ? -1.0f : 1.0f; // inside when sign * (p - plane) >= 0
+
+				int clippedCount = 0;
+
+				for (int i = 0; i < count; ++i)
+				{
+					const Float3& a = polygon[i];
+					const Float3& b = polygon[(i + 1) % count];
+
+					const float da = sign * (a[axis] - plane);
+					const float db = sign * (b[axis] - plane);
+
+					if (da >= 0.0f)
+					{
+						clipped[clippedCount++] = a;
+					}
+
+					if ((da < 0.0f && db > 0.0f) || (da > 0.0f && db < 0.0f))
+					{
+						Float3 point = a + (b - a) * (da / (da - db));
+						point[axis] = plane;
+
+						clipped[clippedCount++] = point;
+					}
+				}
+
+				std::copy(clipped, clipped + clippedCount, polygon);
+				count = clippedCount;
+			}
+		}
+
+		return (count >= 3) ? GetPolygonArea(polygon, count) : 0.0f;
+	}
+
+	BVHTreeStats::Level& GetLevel(std::vector<BVHTreeStats::Level>& levels, const std::size_t level)
+	{
+		if (levels.size() <= level)
+		{
+			levels.resize(level + 1);
+		}
+
+		return levels[level];
+	}
+}
+
+BVHTreeStats BVHTreeStats::Compute(const BVHBuilder& builder, const Triangle* triangles)
+{
+	BVHTreeStats stats;
+
+	const BVHBuilder::BuildVector<TreeNode>& nodes = builder.GetNodes();
+	const BVHBuilder::BuildVector<BVHBuilder::TriangleData>& references = builder.GetTriangles();
+	const BVHBuilder::BuildSettings& settings = builder.GetSettings();
+
+	if (nodes.empty())
+	{
+		return stats;
+	}
+
+	const float rootArea = nodes[0].aabb.GetSurfaceArea();
+
+	// nodes in depth first order with their depth, parents before children
+	std::vector<std::pair<int, int>> order;
+	order.reserve(nodes.size());
+	order.emplace_back(0, 0);
+
+	float cost = 0.0f;
+	float overlap = 0.0f;
+	std::size_t leafDepthSum = 0;
+	std::size_t leafCount = 0;
+
+	for (std::size_t i = 0; i < order.size(); ++i)
+	{
+		const TreeNode& node = nodes[order[i].first];
+		const std::size_t depth = std::size_t(order[i].second);
+
+		if (node.bIsNode)
+		{
+			cost += settings.traversalCost * node.aabb.GetSurfaceArea();
+			overlap += GetIntersectionArea(nodes[node.left].aabb, nodes[node.right].aabb);
+
+			order.emplace_back(node.left, int(depth + 1));
+			order.emplace_back(node.right, int(depth + 1));
+		}
+		else
+		{
+			cost += settings.intersectionCost * node.aabb.GetSurfaceArea() * float(node.count);
+
+			if (stats.depthHistogram.size() <= depth)
+			{
+				stats.depthHistogram.resize(depth + 1, 0);
+			}
+
+			if (stats.leafSizeHistogram.size() <= std::size_t(node.count))
+			{
+				stats.leafSizeHistogram.resize(std::size_t(node.count) + 1, 0);
+			}
+
+			stats.depthHistogram[depth]++;
+			stats.leafSizeHistogram[node.count]++;
+			stats.maxDepth = std::max(stats.maxDepth, depth);
+
+			leafDepthSum += depth;
+			leafCount++;
+		}
+	}
+
+	stats.sahCost = cost / rootArea;
+	stats.overlap = overlap / rootArea;
+	stats.averageLeafDepth = float(leafDepthSum) / float(leafCount);
+
+	// levels of the serialized stream
+	{
+		const BVHBuilder::BuildVector<Float4>& stream = builder.GetStream();
+		const std::size_t leafElementCount = std::size_t(BVHBuilder::GetLeafSize(settings.leafFormat));
+
+		if (settings.width == 2)
+		{
+			// preorder, a node is followed by its subtrees and its w skips them. the root is not written
+			const std::size_t rootLevel = nodes[0].bIsNode ? 1 : 0;
+
+			if (nodes[0].bIsNode)
+			{
+				GetLevel(stats.levels, 0).nodeCount++;
+			}
+
+			std::vector<std::size_t> subtreeEnds;
+			std::size_t offset = 0;
+
+			while (offset < stream.size())
+			{
+				while (!subtreeEnds.empty() && subtreeEnds.back() <= offset)
+				{
+					subtreeEnds.pop_back();
+				}
+
+				const int offsetToNextNode = int(stream[offset].w);
+
+				if (offsetToNextNode == 0) // terminator
+				{
+					break;
+				}
+
+				Level& level = GetLevel(stats.levels, rootLevel + subtreeEnds.size());
+
+				if (offsetToNextNode < 0)
+				{
+					level.nodeCount++;
+					level.nodeSize += sizeof(BVHBuilder::Node);
+
+					subtreeEnds.push_back(offset + 2 + std::size_t(-offsetToNextNode));
+					offset += 2;
+				}
+				else
+				{
+					level.leafCount++;
+					level.triangleCount += std::size_t(offsetToNextNode);
+					level.leafSize += std::size_t(offsetToNextNode) * leafElementCount * sizeof(Float4);
+
+					offset += std::size_t(offsetToNextNode) * leafElementCount;
+				}
+			}
+		}
+		else
+		{
+			const std::size_t nodeSize = std::size_t(BVHBuilder::GetWideNodeSize(settings.width, settings.quantization)) * sizeof(Float4);
+
+			std::vector<std::pair<std::int32_t, std::size_t>> stack = { { 0, 0 } };
+
+			while (!stack.empty())
+			{
+				const std::int32_t offset = stack.back().first;
+				const std::size_t depth = stack.back().second;
+				stack.pop_back();
+
+				Level& level = GetLevel(stats.levels, depth);
+				level.nodeCount++;
+				level.nodeSize += nodeSize;
+
+				for (int g = 0; g < settings.width / 4; ++g)
+				{
+					const std::int32_t* children = BVHBuilder::GetWideChildren(stream.data() + offset, g, settings.quantization);
+
+					for (int i = 0; i < 4; ++i)
+					{
+						if (children[i] > 0)
+						{
+							stack.emplace_back(children[i], depth + 1);
+						}
+						else if (children[i] < 0)
+						{
+							const std::size_t triangleCount = std::size_t((-children[i]) & 15);
+
+							Level& leafLevel = GetLevel(stats.levels, depth + 1);
+							leafLevel.leafCount++;
+							leafLevel.triangleCount += triangleCount;
+							leafLevel.leafSize += triangleCount * leafElementCount * sizeof(Float4);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	if (!triangles)
+	{
+		return stats;
+	}
+
+	// EPO (Aila et al. 2013). a triangle costs nothing in the nodes that reference it, spatial splits reference a triangle more than once
+	{
+		std::vector<std::size_t> rangeBegin(nodes.size(), 0);
+		std::vector<std::size_t> rangeEnd(nodes.size(), 0);
+
+		for (std::size_t i = order.size(); i-- > 0;)
+		{
+			const int index = order[i].first;
+			const TreeNode& node = nodes[index];
+
+			if (node.bIsNode)
+			{
+				rangeBegin[index] = std::min(rangeBegin[node.left], rangeBegin[node.right]);
+				rangeEnd[index] = std::max(rangeEnd[node.left], rangeEnd[node.right]);
+			}
+			else
+			{
+				rangeBegin[index] = std::size_t(node.first);
+				rangeEnd[index] = std::size_t(node.first + node.count);
+			}
+		}
+
+		// references of every input triangle, sorted
+		std::size_t triangleCount = 0;
+
+		for (const BVHBuilder::TriangleData& reference : references)
+		{
+			triangleCount = std::max(triangleCount, std::size_t(reference.index) + 1);
+		}
+
+		std::vector<std::size_t> firstReference(triangleCount + 1, 0);
+		std::vector<std::size_t> triangleReferences(references.size());
+
+		for (const BVHBuilder::TriangleData& reference : references)
+		{
+			firstReference[reference.index + 1]++;
+		}
+
+		for (std::size_t i = 0; i < triangleCount; ++i)
+		{
+			firstReference[i + 1] += firstReference[i];
+		}
+
+		{
+			std::vector<std::size_t> next(firstReference.begin(), firstReference.end() - 1);
+
+			for (std::size_t r = 0; r < references.size(); ++r)
+			{
+				triangleReferences[next[references[r].index]++] = r;
+			}
+		}
+
+		double overlapCost = 0.0;
+		double totalArea = 0.0;
+
+		std::vector<int> stack;
+
+		for (std::size_t t = 0; t < triangleCount; ++t)
+		{
+			const Triangle& triangle = triangles[t];
+			const Float3 vertices[3] = { triangle.v0, triangle.v1, triangle.v2 };
+			const float area = GetPolygonArea(vertices, 3);
+
+			if (!(area > 0.0f))
+			{
+				continue;
+			}
+
+			totalArea += area;
+
+			AABB aabb;
+			aabb.Expand(triangle.v0);
+			aabb.Expand(triangle.v1);
+			aabb.Expand(triangle.v2);
+
+			stack.assign(1, 0);
+
+			while (!stack.empty())
+			{
+				const int index = stack.back();
+				stack.pop_back();
+
+				const TreeNode& node = nodes[index];
+
+				if (!Overlaps(node.aabb, aabb))
+				{
+					continue;
+				}
+
+				const bool bReferenced = std::any_of(triangleReferences.begin() + firstReference[t], triangleReferences.begin() + firstReference[t + 1], [&](const std::size_t r)
+				{
+					return r >= rangeBegin[index] && r < rangeEnd[index];
+				});
+
+				if (!bReferenced)
+				{
+					const float clippedArea = GetClippedArea(triangle, node.aabb);
+
+					// the children lie in the node, nothing of the triangle is in them either
+					if (!(clippedArea > 0.0f))
+					{
+						continue;
+					}
+
+					overlapCost += clippedArea * (node.bIsNode ? settings.traversalCost : settings.intersectionCost * float(node.count));
+				}
+
+				if (node.bIsNode)
+				{
+					stack.push_back(node.left);
+					stack.push_back(node.right);
+				}
+			}
+		}
+
+		stats.epo = (totalArea > 0.0) ? float(overlapCost / totalArea) : 0.0f;
+	}
+
+	return stats;
+}
+
+void BVHTreeStats::WriteJson(std::ostream& stream) const
+{
+	auto writeArray = [&stream](const std::vector<std::size_t>& values)
+	{
+		stream << "[";
+
+		for (std::size_t i = 0; i < values.size(); ++i)
+		{
+			stream << (i ? ", " : "") << values[i];
+		}
+
+		stream << "]";
+	};
+
+	stream << "{\n  \"sahCost\": " << sahCost << ",\n  \"epo\": " << epo << ",\n  \"overlap\": " << overlap
+		   << ",\n  \"maxDepth\": " << maxDepth << ",\n  \"averageLeafDepth\": " << averageLeafDepth << ",\n  \"depthHistogram\": ";
+	writeArray(depthHistogram);
+	stream << ",\n  \"leafSizeHistogram\": ";
+	writeArray(leafSizeHistogram);
+	stream << ",\n  \"levels\": [\n";
+
+	for (std::size_t i = 0; i < levels.size(); ++i)
+	{
+		const Level& level = levels[i];
+
+		stream << "    { \"nodes\": " << level.nodeCount << ", \"leaves\": " << level.leafCount << ", \"triangles\": " << level.triangleCount
+			   << ", \"nodeBytes\": " << level.nodeSize << ", \"leafBytes\": " << level.leafSize << " }" << ((i + 1 < levels.size()) ? ",\n" : "\n");
+	}
+
+	stream << "  ]\n}\n";
+}
+
+void BVHTreeStats::WriteSummary(std::ostream& stream) const
+{
+	stream << "SAH " << sahCost << ", EPO " << epo << ", overlap " << overlap << ", depth " << maxDepth << " max " << averageLeafDepth << " average\n";
+
+	for (std::size_t i = 0; i < levels.size(); ++i)
+	{
+		const Level& level = levels[i];
+
+		stream << "level " << i << ": " << level.nodeCount << " nodes, " << level.leafCount << " leaves, " << level.triangleCount << " triangles, "
+			   << level.nodeSize + level.leafSize << " bytes\n";
+	}
+}
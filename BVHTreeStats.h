@@ -0,0 +1,44 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+//
+#include "BVHBuilder.h"
+
+// quality figures of a built tree, to compare build modes and settings on scenes too large for BVH::PrintTreeNode.
+// the cost metrics and the histograms describe the binary tree, the levels the serialized stream
+struct BVHTreeStats
+{
+	// one depth of the serialized tree, wide nodes for width 4 and 8
+	struct Level
+	{
+		std::size_t nodeCount = 0; // interior nodes, the root of the skip-offset stream is counted but not written
+		std::size_t leafCount = 0;
+		std::size_t triangleCount = 0; // leaf triangle records
+		std::size_t nodeSize = 0; // bytes
+		std::size_t leafSize = 0; // bytes
+	};
+
+	float sahCost = 0.0f; // expected cost of a ray through the tree relative to the root surface area, BuildStats::sahCost
+	float epo = 0.0f; // end-point overlap: cost of the triangle area lying in nodes that do not reference it, relative to the whole triangle area
+	float overlap = 0.0f; // surface area of the intersections of sibling boxes, relative to the root surface area
+
+	std::size_t maxDepth = 0;
+	float averageLeafDepth = 0.0f;
+
+	std::vector<std::size_t> depthHistogram; // leaves per depth
+	std::vector<std::size_t> leafSizeHistogram; // leaves per triangle count
+
+	std::vector<Level> levels;
+
+	// triangles is the input of the build. without them the EPO, which clips every triangle against the nodes around it, is skipped
+	static BVHTreeStats Compute(const BVHBuilder& builder, const BVHBuilder::Triangle* triangles = nullptr);
+
+	void WriteJson(std::ostream& stream) const;
+
+	// the metrics on one line, then one line per level
+	void WriteSummary(std::ostream& stream) const;
+};
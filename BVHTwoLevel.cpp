@@ -0,0 +1,206 @@
+#include "BVHTwoLevel.h"
+
+// std
+#include <chrono>
+
+BVHTwoLevel::BVHTwoLevel()
+	: mStream(&mTracker)
+{
+	Clear();
+}
+
+std::uint32_t BVHTwoLevel::AddMesh(const Triangle* triangles, const std::size_t triangleCount)
+{
+	const auto buildBegin = std::chrono::steady_clock::now();
+
+	BVHBuilder builder;
+	builder.Build(triangles, triangleCount, mSettings);
+
+	// the top level is written again after the meshes
+	mStream.resize(mMeshStreamEnd);
+
+	Mesh mesh;
+	mesh.aabb = builder.GetNodes()[0].aabb;
+	mesh.offset = std::int32_t(mMeshStreamEnd);
+	mesh.triangleCount = triangleCount;
+
+	mStream.insert(mStream.end(), builder.GetStream().begin(), builder.GetStream().end());
+
+	// skip offsets are relative, wide child references are not
+	if (mSettings.width != 2)
+	{
+		RebaseWideNode(mStream.data(), mesh.offset, mesh.offset);
+	}
+
+	mMeshStreamEnd = mStream.size();
+
+	assert(mMeshStreamEnd < (std::size_t(1) << 24)); // mesh offsets are stored as float in the instance records
+
+	mMeshes.push_back(mesh);
+
+	const std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - buildBegin;
+
+	mStats.meshCount = mMeshes.size();
+	mStats.triangleCount += triangleCount;
+	mStats.meshBuildTime += buildTime.count();
+
+	return std::uint32_t(mMeshes.size() - 1);
+}
+
+std::uint32_t BVHTwoLevel::AddInstance(const Instance& instance)
+{
+	assert(instance.mesh < mMeshes.size());
+
+	mInstances.push_back(instance);
+
+	return std::uint32_t(mInstances.size() - 1);
+}
+
+void BVHTwoLevel::SetInstanceTransform(const std::uint32_t index, const Matrix34& world)
+{
+	mInstances[index].world = world;
+}
+
+void BVHTwoLevel::BuildTopLevel()
+{
+	assert(!mInstances.empty());
+
+	const auto buildBegin = std::chrono::steady_clock::now();
+
+	const std::size_t instanceCount = mInstances.size();
+
+	BuildVector<AABB> bounds(&mTracker);
+	bounds.reserve(instanceCount);
+
+	for (const Instance& instance : mInstances)
+	{
+		bounds.push_back(instance.world.TransformAABB(mMeshes[instance.mesh].aabb));
+	}
+
+	// one instance per leaf, the record does not hold a count. a binary skip-offset stream, unquantized
+	BuildSettings settings = mSettings;
+	settings.maxLeafSize = 1;
+	settings.width = 2;
+	settings.quantization = 0;
+
+	BVHBuilder topLevel;
+	topLevel.BuildHierarchy(bounds.data(), instanceCount, settings);
+
+	// like the skip-offset stream of a mesh: no root, a record per leaf and the terminating node
+	const std::size_t writtenNodeCount = topLevel.GetNodes()[0].bIsNode ? topLevel.GetStats().nodeCount - 1 : 0;
+	const std::size_t size = writtenNodeCount * sizeof(BVHBuilder::Node) + instanceCount * sizeof(InstanceRecord) + sizeof(BVHBuilder::Node);
+
+	mStream.resize(mMeshStreamEnd + size / sizeof(Float4));
+
+	int dataOffset = int(mMeshStreamEnd);
+	WriteTopLevelNode(topLevel, 0, mStream.data(), dataOffset);
+
+	// terminate tree
+	mStream[dataOffset++] = Float4(0, 0, 0, 0);
+	mStream[dataOffset++] = Float4(0, 0, 0, 0);
+
+	assert(std::size_t(dataOffset) == mStream.size());
+
+	Header& header = *reinterpret_cast<Header*>(mStream.data());
+	header.topLevelOffset = std::int32_t(mMeshStreamEnd);
+	header.meshCount = std::int32_t(mMeshes.size());
+	header.instanceCount = std::int32_t(instanceCount);
+	header.padding = 0;
+
+	const std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - buildBegin;
+
+	mStats.instanceCount = instanceCount;
+	mStats.instancedTriangleCount = 0;
+
+	for (const Instance& instance : mInstances)
+	{
+		mStats.instancedTriangleCount += mMeshes[instance.mesh].triangleCount;
+	}
+
+	mStats.topLevelSize = size;
+	mStats.serializedSize = GetStreamSize();
+	mStats.topLevelBuildTime = buildTime.count();
+}
+
+void BVHTwoLevel::Clear()
+{
+	mMeshes.clear();
+	mInstances.clear();
+
+	mStats = Stats();
+
+	// an empty header until the top level is built
+	mStream = BuildVector<Float4>(&mTracker);
+	mStream.push_back(Float4(0, 0, 0, 0));
+
+	mMeshStreamEnd = mStream.size();
+}
+
+void BVHTwoLevel::RebaseWideNode(Float4* stream, const std::int32_t node, const std::int32_t base) const
+{
+	for (int i = 0; i < mSettings.width; ++i)
+	{
+		std::int32_t& child = BVHBuilder::GetWideChildren(stream + node, i / 4, mSettings.quantization)[i % 4];
+
+		if (child > 0) // node
+		{
+			child += base;
+			RebaseWideNode(stream, child, base);
+		}
+		else if (child < 0) // leaf
+		{
+			const std::int32_t leaf = -child;
+			const std::int32_t offset = (leaf >> 4) + base;
+
+			assert(offset < (1 << 27));
+
+			child = -((offset << 4) | (leaf & 15));
+		}
+	}
+}
+
+void BVHTwoLevel::WriteTopLevelNode(const BVHBuilder& topLevel, const int index, Float4* data, int& dataOffset) const
+{
+	const BVHBuilder::TreeNode& treeNode = topLevel.GetNodes()[index];
+
+	if (treeNode.bIsNode)
+	{
+		int nodeOffset = 0;
+
+		// the root is not written, as in the mesh streams
+		if (index != 0)
+		{
+			nodeOffset = dataOffset;
+
+			data[dataOffset++] = Float4(treeNode.aabb.min, 0.0f);
+			data[dataOffset++] = Float4(treeNode.aabb.max, 0.0f);
+		}
+
+		WriteTopLevelNode(topLevel, treeNode.left, data, dataOffset);
+		WriteTopLevelNode(topLevel, treeNode.right, data, dataOffset);
+
+		if (index != 0)
+		{
+			// float4 elements to skip to leave the subtree
+			data[nodeOffset].w = -float(dataOffset - nodeOffset - 2);
+		}
+	}
+	else // leaf
+	{
+		const std::uint32_t instanceIndex = topLevel.GetTriangles()[treeNode.first].index;
+		const Instance& instance = mInstances[instanceIndex];
+		const Matrix34 worldInv = instance.world.Inverse();
+
+		InstanceRecord& record = *reinterpret_cast<InstanceRecord*>(data + dataOffset);
+
+		record.header = Float4(float(instance.material), float(instanceIndex), 0.0f, float(mMeshes[instance.mesh].offset));
+
+		for (int i = 0; i < 3; ++i)
+		{
+			record.worldInv[i] = worldInv.rows[i];
+			record.world[i] = instance.world.rows[i];
+		}
+
+		dataOffset += sizeof(InstanceRecord) / sizeof(Float4);
+	}
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <vector>
+
+//
+#include "BVHBuilder.h"
+
+// two-level structure, one bottom-level tree per mesh in object space and a top-level tree over the instances.
+// single stream read by RayTraced() when BVH_TWO_LEVEL is set:
+// a header element, the mesh streams back to back, then the top level as a skip-offset stream of instance records
+class BVHTwoLevel
+{
+public:
+
+	using Triangle = BVHBuilder::Triangle;
+	using BuildSettings = BVHBuilder::BuildSettings;
+
+	template <typename T>
+	using BuildVector = BVHBuilder::BuildVector<T>;
+
+	struct Instance
+	{
+		std::uint32_t mesh;
+		std::uint32_t material; // replaces the material of the mesh triangles
+		Matrix34 world;
+	};
+
+	// first element of the stream
+	struct Header
+	{
+		std::int32_t topLevelOffset; // float4 element where the top level starts
+		std::int32_t meshCount;
+		std::int32_t instanceCount;
+		std::int32_t padding;
+	};
+
+	// top-level leaf, read like a Node by the skip-offset traversal: w > 0 marks the leaf
+	struct InstanceRecord
+	{
+		Float4 header; // x material, y instance index, w offset of the mesh stream
+		Float4 worldInv[3]; // world to object space, applied to the ray
+		Float4 world[3]; // object to world space, applied to the hit
+	};
+
+	static_assert(sizeof(Header) == sizeof(Float4), "unexpected Header layout");
+	static_assert(sizeof(InstanceRecord) == 7 * sizeof(Float4), "unexpected InstanceRecord layout");
+
+	struct Stats
+	{
+		std::size_t meshCount = 0;
+		std::size_t instanceCount = 0;
+		std::size_t triangleCount = 0; // unique triangles, in the mesh streams
+		std::size_t instancedTriangleCount = 0; // triangles a flattened build of every instance would hold
+		std::size_t topLevelSize = 0; // bytes
+		std::size_t serializedSize = 0; // bytes
+		double meshBuildTime = 0.0; // ms
+		double topLevelBuildTime = 0.0; // ms
+	};
+
+	BVHTwoLevel();
+
+	BVHTwoLevel(const BVHTwoLevel&) = delete;
+	BVHTwoLevel& operator=(const BVHTwoLevel&) = delete;
+
+	// used by the next AddMesh calls, the top level is always a binary tree with one instance per leaf
+	void SetBuildSettings(const BuildSettings& settings)
+	{
+		mSettings = settings;
+	}
+
+	// builds the mesh tree right away and appends it to the stream, the triangles are only read during the call
+	std::uint32_t AddMesh(const Triangle* triangles, const std::size_t triangleCount);
+
+	std::uint32_t AddInstance(const Instance& instance);
+
+	// takes effect on the next BuildTopLevel
+	void SetInstanceTransform(const std::uint32_t index, const Matrix34& world);
+
+	// rebuilds the top level over the current instances, the mesh streams are not touched
+	void BuildTopLevel();
+
+	void Clear();
+
+	const BuildVector<Float4>& GetStream() const
+	{
+		return mStream;
+	}
+
+	std::size_t GetStreamSize() const // bytes
+	{
+		return mStream.size() * sizeof(Float4);
+	}
+
+	// float4 elements [begin, end) rewritten by the last BuildTopLevel
+	BVHBuilder::StreamRange GetTopLevelRange() const
+	{
+		return { mMeshStreamEnd, mStream.size() };
+	}
+
+	const Stats& GetStats() const
+	{
+		return mStats;
+	}
+
+	BVHBuilder::MemoryTracker& GetMemoryTracker()
+	{
+		return mTracker;
+	}
+
+private:
+
+	struct Mesh
+	{
+		AABB aabb; // object space
+		std::int32_t offset; // float4 element of the mesh stream
+		std::size_t triangleCount;
+	};
+
+	// wide streams hold absolute child offsets, moved by the position of the mesh stream
+	void RebaseWideNode(Float4* stream, const std::int32_t node, const std::int32_t base) const;
+
+	void WriteTopLevelNode(const BVHBuilder& topLevel, const int index, Float4* data, int& dataOffset) const;
+
+	BuildSettings mSettings;
+	Stats mStats;
+
+	BVHBuilder::MemoryTracker mTracker;
+
+	std::vector<Mesh> mMeshes;
+	std::vector<Instance> mInstances;
+
+	BuildVector<Float4> mStream;
+	std::size_t mMeshStreamEnd = 1; // the header comes first
+};
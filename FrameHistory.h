@@ -0,0 +1,128 @@
+#pragma once
+
+// windows
+#include <wrl.h>
+#include <comdef.h>
+using Microsoft::WRL::ComPtr;
+
+// d3d
+#include <d3d11.h>
+#include <directxmath.h>
+
+//
+#include "Utility.h"
+
+using namespace DirectX;
+
+// the lit previous frame and the camera of the current and previous frames. the screen-space reflections run before the
+// main pass lights the current frame, they reflect the previous one reprojected with GetPrevViewProj
+class FrameHistory
+{
+public:
+
+	void Init(const ComPtr<ID3D11Device>& pDevice,
+			  const ComPtr<ID3D11DeviceContext>& pContext)
+	{
+		mDevice = pDevice;
+		mContext = pContext;
+	}
+
+	// once per frame before drawing
+	void Update(const XMFLOAT4X4& viewProjInv,
+				const XMFLOAT3& eyePos)
+	{
+		const XMMATRIX viewProj = XMMatrixInverse(nullptr, XMLoadFloat4x4(&viewProjInv));
+
+		if (mbFirstUpdate)
+		{
+			XMStoreFloat4x4(&mViewProj, viewProj);
+			mbFirstUpdate = false;
+		}
+
+		mPrevViewProj = mViewProj;
+
+		XMStoreFloat4x4(&mViewProj, viewProj);
+		mViewProjInv = viewProjInv;
+		mEyePos = eyePos;
+	}
+
+	// call once the frame is lit, the next frame reflects it
+	void Store(ID3D11RenderTargetView* pBackBufferRTV)
+	{
+		ComPtr<ID3D11Resource> pBackBuffer;
+		pBackBufferRTV->GetResource(&pBackBuffer);
+
+		ComPtr<ID3D11Texture2D> pBackBufferTexture;
+		ThrowIfFailed(pBackBuffer.As(&pBackBufferTexture));
+
+		D3D11_TEXTURE2D_DESC desc;
+		pBackBufferTexture->GetDesc(&desc);
+
+		if (!mHistory || desc.Width != mWidth || desc.Height != mHeight)
+		{
+			mWidth = desc.Width;
+			mHeight = desc.Height;
+
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = 0;
+
+			ThrowIfFailed(mDevice->CreateTexture2D(&desc, nullptr, &mHistory));
+
+			NameResource(mHistory.Get(), "FrameHistory");
+
+			ThrowIfFailed(mDevice->CreateShaderResourceView(mHistory.Get(), nullptr, &mHistorySRV));
+		}
+
+		mContext->CopyResource(mHistory.Get(), pBackBuffer.Get());
+	}
+
+	// false before the first frame is stored and after a resize
+	bool IsValid(const UINT width, const UINT height) const
+	{
+		return mHistory && width == mWidth && height == mHeight;
+	}
+
+	ID3D11ShaderResourceView* GetSRV()
+	{
+		return mHistorySRV.Get();
+	}
+
+	const XMFLOAT4X4& GetViewProj() const
+	{
+		return mViewProj;
+	}
+
+	const XMFLOAT4X4& GetViewProjInv() const
+	{
+		return mViewProjInv;
+	}
+
+	const XMFLOAT4X4& GetPrevViewProj() const
+	{
+		return mPrevViewProj;
+	}
+
+	const XMFLOAT3& GetEyePos() const
+	{
+		return mEyePos;
+	}
+
+private:
+
+	ComPtr<ID3D11Device> mDevice;
+	ComPtr<ID3D11DeviceContext> mContext;
+
+	ComPtr<ID3D11Texture2D> mHistory;
+	ComPtr<ID3D11ShaderResourceView> mHistorySRV;
+
+	UINT mWidth = 0;
+	UINT mHeight = 0;
+
+	XMFLOAT4X4 mViewProj;
+	XMFLOAT4X4 mViewProjInv;
+	XMFLOAT4X4 mPrevViewProj;
+	XMFLOAT3 mEyePos;
+	bool mbFirstUpdate = true;
+};
@@ -0,0 +1,256 @@
+#pragma once
+
+// windows
+#include <wrl.h>
+#include <comdef.h>
+using Microsoft::WRL::ComPtr;
+
+// std
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// d3d
+#include <d3d11.h>
+#include <directxmath.h>
+
+//
+#include "Utility.h"
+#include "FrameHistory.h"
+
+using namespace DirectX;
+
+// min-depth pyramid of the depth buffer (shaders/HiZ.hlsl) and the constants of the hierarchical screen-space march of
+// the RAYTRACED_HIZ permutations of the reflections. the march runs before the BVH, the rays that leave the screen or
+// pass behind the visible surfaces continue in the BVH from where the march gave up. the pyramid is padded to a power of
+// two with the far depth, so that a texel of mip n covers exactly the 2^n x 2^n pixels the march maps to it
+class HiZ
+{
+public:
+
+	void Init(const ComPtr<ID3D11Device>& pDevice,
+			  const ComPtr<ID3D11DeviceContext>& pContext)
+	{
+		mDevice = pDevice;
+		mContext = pContext;
+
+		const std::wstring path = L"shaders/HiZ.hlsl";
+
+		CreateComputeShader(path, "HiZCopyCS", mCopyCS);
+		CreateComputeShader(path, "HiZReduceCS", mReduceCS);
+
+		CreateConstantBuffer(sizeof(BuildCB), "HiZBuildCB", mBuildCB);
+		CreateConstantBuffer(sizeof(MarchCB), "HiZCB", mMarchCB);
+	}
+
+	// call after the depth/gbuffer prepass with nothing bound to the output merger, the pyramid follows the size of the
+	// viewport
+	void Build(const UINT width,
+			   const UINT height,
+			   ID3D11ShaderResourceView* pDepthBufferSRV,
+			   FrameHistory& history)
+	{
+		if (width != mWidth || height != mHeight)
+		{
+			Resize(width, height);
+		}
+
+		MarchCB march;
+		march.viewProj = history.GetViewProj();
+		march.prevViewProj = history.GetPrevViewProj();
+		march.screenSize = XMUINT2(mWidth, mHeight);
+		march.mipCount = UINT(mMipUAVs.size());
+		march.historyValid = history.IsValid(mWidth, mHeight) ? 1 : 0;
+
+		mContext->UpdateSubresource(mMarchCB.Get(), 0, nullptr, &march, 0, 0);
+
+		mContext->CSSetConstantBuffers(0, 1, mBuildCB.GetAddressOf());
+
+		// mip 0 copies the depth buffer into the padded size
+		UINT sourceWidth = mWidth;
+		UINT sourceHeight = mHeight;
+
+		for (UINT mip = 0; mip < mMipUAVs.size(); ++mip)
+		{
+			const UINT width = std::max(mPyramidWidth >> mip, 1u);
+			const UINT height = std::max(mPyramidHeight >> mip, 1u);
+
+			BuildCB buffer;
+			buffer.sourceSize = XMUINT2(sourceWidth, sourceHeight);
+			buffer.destinationSize = XMUINT2(width, height);
+
+			mContext->UpdateSubresource(mBuildCB.Get(), 0, nullptr, &buffer, 0, 0);
+
+			ID3D11ShaderResourceView* pSource = (mip == 0) ? pDepthBufferSRV : mMipSRVs[mip - 1].Get();
+
+			mContext->CSSetShader((mip == 0) ? mCopyCS.Get() : mReduceCS.Get(), nullptr, 0);
+			mContext->CSSetShaderResources(0, 1, &pSource);
+			mContext->CSSetUnorderedAccessViews(0, 1, mMipUAVs[mip].GetAddressOf(), nullptr);
+
+			mContext->Dispatch((width + 7) / 8, (height + 7) / 8, 1);
+
+			// the next level reads this one
+			ID3D11ShaderResourceView* pNullSRV = nullptr;
+			ID3D11UnorderedAccessView* pNullUAV = nullptr;
+			mContext->CSSetUnorderedAccessViews(0, 1, &pNullUAV, nullptr);
+			mContext->CSSetShaderResources(0, 1, &pNullSRV);
+
+			sourceWidth = width;
+			sourceHeight = height;
+		}
+
+		mContext->CSSetShader(nullptr, nullptr, 0);
+	}
+
+	// t14 of the RAYTRACED_HIZ permutations, every mip
+	ID3D11ShaderResourceView* GetSRV()
+	{
+		return mPyramidSRV.Get();
+	}
+
+	// b4 of the RAYTRACED_HIZ permutations
+	ID3D11Buffer* GetCB()
+	{
+		return mMarchCB.Get();
+	}
+
+private:
+
+	void CreateComputeShader(const std::wstring& path,
+							 const char* entryPoint,
+							 ComPtr<ID3D11ComputeShader>& pShader)
+	{
+		ComPtr<ID3DBlob> pCode = CompileShader(path,
+											   nullptr,
+											   entryPoint,
+											   ShaderTarget::CS);
+
+		ThrowIfFailed(mDevice->CreateComputeShader(pCode->GetBufferPointer(),
+												   pCode->GetBufferSize(),
+												   nullptr,
+												   &pShader));
+
+		NameResource(pShader.Get(), entryPoint);
+	}
+
+	void CreateConstantBuffer(const UINT size,
+							  const char* name,
+							  ComPtr<ID3D11Buffer>& pBuffer)
+	{
+		D3D11_BUFFER_DESC desc;
+		desc.ByteWidth = size;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+		desc.StructureByteStride = 0;
+
+		ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &pBuffer));
+
+		NameResource(pBuffer.Get(), name);
+	}
+
+	void Resize(const UINT width, const UINT height)
+	{
+		mWidth = width;
+		mHeight = height;
+
+		mPyramidWidth = 1;
+		mPyramidHeight = 1;
+
+		while (mPyramidWidth < width)
+		{
+			mPyramidWidth *= 2;
+		}
+
+		while (mPyramidHeight < height)
+		{
+			mPyramidHeight *= 2;
+		}
+
+		// down to 1x1
+		UINT mipCount = 1;
+
+		while ((std::max(mPyramidWidth, mPyramidHeight) >> mipCount) > 0)
+		{
+			++mipCount;
+		}
+
+		D3D11_TEXTURE2D_DESC desc;
+		desc.Width = mPyramidWidth;
+		desc.Height = mPyramidHeight;
+		desc.MipLevels = mipCount;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_R32_FLOAT;
+		desc.SampleDesc.Count = 1;
+		desc.SampleDesc.Quality = 0;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+
+		ThrowIfFailed(mDevice->CreateTexture2D(&desc, nullptr, &mPyramid));
+
+		NameResource(mPyramid.Get(), "HiZ");
+
+		ThrowIfFailed(mDevice->CreateShaderResourceView(mPyramid.Get(), nullptr, &mPyramidSRV));
+
+		mMipSRVs.resize(mipCount);
+		mMipUAVs.resize(mipCount);
+
+		for (UINT mip = 0; mip < mipCount; ++mip)
+		{
+			D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+			srvDesc.Format = desc.Format;
+			srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+			srvDesc.Texture2D.MostDetailedMip = mip;
+			srvDesc.Texture2D.MipLevels = 1;
+
+			ThrowIfFailed(mDevice->CreateShaderResourceView(mPyramid.Get(), &srvDesc, mMipSRVs[mip].ReleaseAndGetAddressOf()));
+
+			D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc;
+			uavDesc.Format = desc.Format;
+			uavDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
+			uavDesc.Texture2D.MipSlice = mip;
+
+			ThrowIfFailed(mDevice->CreateUnorderedAccessView(mPyramid.Get(), &uavDesc, mMipUAVs[mip].ReleaseAndGetAddressOf()));
+		}
+	}
+
+	ComPtr<ID3D11Device> mDevice;
+	ComPtr<ID3D11DeviceContext> mContext;
+
+	ComPtr<ID3D11ComputeShader> mCopyCS;
+	ComPtr<ID3D11ComputeShader> mReduceCS;
+	ComPtr<ID3D11Buffer> mBuildCB;
+	ComPtr<ID3D11Buffer> mMarchCB;
+
+	ComPtr<ID3D11Texture2D> mPyramid;
+	ComPtr<ID3D11ShaderResourceView> mPyramidSRV;
+	std::vector<ComPtr<ID3D11ShaderResourceView>> mMipSRVs;
+	std::vector<ComPtr<ID3D11UnorderedAccessView>> mMipUAVs;
+
+	UINT mWidth = 0;
+	UINT mHeight = 0;
+	UINT mPyramidWidth = 0; // powers of two
+	UINT mPyramidHeight = 0;
+
+	struct BuildCB
+	{
+		XMUINT2    sourceSize;
+		XMUINT2    destinationSize;
+	};
+
+	static_assert((sizeof(BuildCB) % 16) == 0, "constant buffer size must be 16-byte aligned");
+
+	struct MarchCB
+	{
+		XMFLOAT4X4 viewProj;
+		XMFLOAT4X4 prevViewProj;
+		XMUINT2    screenSize;
+		UINT       mipCount;
+		UINT       historyValid;
+	};
+
+	static_assert((sizeof(MarchCB) % 16) == 0, "constant buffer size must be 16-byte aligned");
+};
@@ -0,0 +1,118 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+
+#ifdef _WIN32
+	const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	mFile = file;
+
+	LARGE_INTEGER size;
+
+	if (!GetFileSizeEx(file, &size))
+	{
+		Close();
+		return false;
+	}
+
+	// an empty file can not be mapped
+	if (size.QuadPart == 0)
+	{
+		return true;
+	}
+
+	mMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	mData = mMapping ? static_cast<const unsigned char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+	mSize = std::size_t(size.QuadPart);
+#else
+	const int file = open(path.c_str(), O_RDONLY);
+
+	if (file < 0)
+	{
+		return false;
+	}
+
+	struct stat info;
+
+	if (fstat(file, &info) != 0)
+	{
+		close(file);
+		return false;
+	}
+
+	// an empty file can not be mapped
+	if (info.st_size == 0)
+	{
+		close(file);
+		return true;
+	}
+
+	void* data = mmap(nullptr, std::size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+
+	// the mapping keeps the file alive
+	close(file);
+
+	mData = (data != MAP_FAILED) ? static_cast<const unsigned char*>(data) : nullptr;
+	mSize = std::size_t(info.st_size);
+#endif
+
+	if (!mData)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (mData)
+	{
+		UnmapViewOfFile(mData);
+	}
+
+	if (mMapping)
+	{
+		CloseHandle(static_cast<HANDLE>(mMapping));
+	}
+
+	if (mFile)
+	{
+		CloseHandle(static_cast<HANDLE>(mFile));
+	}
+#else
+	if (mData)
+	{
+		munmap(const_cast<unsigned char*>(mData), mSize);
+	}
+#endif
+
+	mData = nullptr;
+	mSize = 0;
+	mFile = nullptr;
+	mMapping = nullptr;
+}
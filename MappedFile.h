@@ -0,0 +1,45 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <string>
+
+// read-only memory mapping of a whole file, the bytes stay valid until Close
+class MappedFile
+{
+public:
+
+	MappedFile() = default;
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// false when the file does not exist or can not be mapped. an empty file is opened with no data
+	bool Open(const std::string& path);
+
+	void Close();
+
+	const unsigned char* GetData() const
+	{
+		return mData;
+	}
+
+	std::size_t GetSize() const // bytes
+	{
+		return mSize;
+	}
+
+private:
+
+	const unsigned char* mData = nullptr;
+	std::size_t mSize = 0;
+
+	// platform handles of the mapping
+	void* mFile = nullptr;
+	void* mMapping = nullptr;
+};
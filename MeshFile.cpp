@@ -0,0 +1,340 @@
+#include "MeshFile.h"
+
+// std
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+//
+#include "BVHCache.h"
+
+namespace
+{
+	std::uint64_t AlignUp(const std::uint64_t offset)
+	{
+		return (offset + MeshFile::kAlignment - 1) / MeshFile::kAlignment * MeshFile::kAlignment;
+	}
+
+	bool WritePadding(std::FILE* file, const std::uint64_t from, const std::uint64_t to)
+	{
+		static const char zeros[MeshFile::kAlignment] = {};
+
+		return std::fwrite(zeros, 1, std::size_t(to - from), file) == std::size_t(to - from);
+	}
+
+	// fields of a CSV row, trimmed of blanks and quotes
+	void SplitRow(const std::string& line, std::vector<std::string>& fields)
+	{
+		fields.clear();
+
+		std::size_t begin = 0;
+
+		while (begin <= line.size())
+		{
+			std::size_t end = line.find(',', begin);
+			end = (end == std::string::npos) ? line.size() : end;
+
+			std::size_t first = begin;
+			std::size_t last = end;
+
+			while (first < last && (std::isspace((unsigned char)line[first]) || line[first] == '"'))
+			{
+				++first;
+			}
+
+			while (last > first && (std::isspace((unsigned char)line[last - 1]) || line[last - 1] == '"'))
+			{
+				--last;
+			}
+
+			fields.emplace_back(line, first, last - first);
+			begin = end + 1;
+		}
+	}
+
+	// float offset of the column in Vertex, -1 for the columns that are not imported
+	int GetVertexColumn(std::string name)
+	{
+		std::transform(name.begin(), name.end(), name.begin(), [](const unsigned char c) { return char(std::toupper(c)); });
+
+		const std::size_t dot = name.rfind('.');
+
+		if (dot == std::string::npos || dot + 2 != name.size())
+		{
+			return -1;
+		}
+
+		const std::string semantic = name.substr(0, dot);
+		const int component = (name[dot + 1] == 'X') ? 0 : (name[dot + 1] == 'Y') ? 1 : (name[dot + 1] == 'Z') ? 2 : -1;
+
+		if (component < 0)
+		{
+			return -1;
+		}
+
+		if (semantic == "POSITION" || semantic == "SV_POSITION")
+		{
+			return int(offsetof(MeshFile::Vertex, position) / sizeof(float)) + component;
+		}
+
+		if (semantic == "NORMAL")
+		{
+			return int(offsetof(MeshFile::Vertex, normal) / sizeof(float)) + component;
+		}
+
+		if (semantic == "TANGENT")
+		{
+			return int(offsetof(MeshFile::Vertex, tangent) / sizeof(float)) + component;
+		}
+
+		if ((semantic == "TEXCOORD" || semantic == "TEXCOORD0") && component < 2)
+		{
+			return int(offsetof(MeshFile::Vertex, u) / sizeof(float)) + component;
+		}
+
+		return -1;
+	}
+}
+
+MeshFile::Status MeshFile::Open(const std::string& path)
+{
+	Close();
+
+	if (!mFile.Open(path))
+	{
+		return Status::Missing;
+	}
+
+	const Status status = Validate();
+
+	if (status != Status::Loaded)
+	{
+		Close();
+	}
+
+	return status;
+}
+
+void MeshFile::Close()
+{
+	mFile.Close();
+	mHeader = {};
+}
+
+bool MeshFile::Write(const std::string& path,
+					 const Vertex* vertices,
+					 const std::size_t vertexCount,
+					 const Index* indices,
+					 const std::size_t indexCount)
+{
+	Header header = {};
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.headerSize = sizeof(Header);
+	header.vertexCount = std::uint32_t(vertexCount);
+	header.indexCount = std::uint32_t(indexCount);
+
+	for (std::size_t i = 0; i < vertexCount; ++i)
+	{
+		header.bounds.Expand(vertices[i].position);
+	}
+
+	const std::size_t verticesSize = vertexCount * sizeof(Vertex);
+	const std::size_t indicesSize = indexCount * sizeof(Index);
+
+	header.vertices = { AlignUp(sizeof(Header)), verticesSize };
+	header.indices = { AlignUp(header.vertices.offset + verticesSize), indicesSize };
+
+	BVHCache::Hasher hasher;
+	hasher.Add(vertices, verticesSize);
+	hasher.Add(indices, indicesSize);
+	header.contentHash = hasher.GetHash();
+
+	const std::string temporaryPath = path + ".tmp";
+
+	std::FILE* file = std::fopen(temporaryPath.c_str(), "wb");
+
+	if (!file)
+	{
+		return false;
+	}
+
+	const bool bWritten = std::fwrite(&header, sizeof(Header), 1, file) == 1 &&
+						  WritePadding(file, sizeof(Header), header.vertices.offset) &&
+						  std::fwrite(vertices, 1, verticesSize, file) == verticesSize &&
+						  WritePadding(file, header.vertices.offset + verticesSize, header.indices.offset) &&
+						  std::fwrite(indices, 1, indicesSize, file) == indicesSize;
+
+	if (std::fclose(file) != 0 || !bWritten)
+	{
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+
+	// rename does not replace an existing file everywhere
+	std::remove(path.c_str());
+
+	return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+bool MeshFile::ImportCsv(const std::string& path, std::vector<Vertex>& vertices, std::vector<Index>& indices)
+{
+	vertices.clear();
+	indices.clear();
+
+	std::ifstream file(path);
+
+	if (!file)
+	{
+		return false;
+	}
+
+	std::string line;
+	std::vector<std::string> fields;
+
+	if (!std::getline(file, line))
+	{
+		return false;
+	}
+
+	SplitRow(line, fields);
+
+	std::vector<int> columns(fields.size());
+	int indexColumn = -1;
+	bool bPosition = false;
+
+	for (std::size_t i = 0; i < fields.size(); ++i)
+	{
+		columns[i] = GetVertexColumn(fields[i]);
+		bPosition |= (columns[i] >= 0 && columns[i] < 3);
+
+		if (fields[i] == "IDX")
+		{
+			indexColumn = int(i);
+		}
+	}
+
+	if (!bPosition)
+	{
+		return false;
+	}
+
+	while (std::getline(file, line))
+	{
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+		{
+			continue;
+		}
+
+		SplitRow(line, fields);
+
+		if (fields.size() < columns.size())
+		{
+			return false;
+		}
+
+		Vertex vertex = {};
+		float* components = &vertex.position.x;
+
+		for (std::size_t i = 0; i < columns.size(); ++i)
+		{
+			if (columns[i] >= 0)
+			{
+				components[columns[i]] = std::strtof(fields[i].c_str(), nullptr);
+			}
+		}
+
+		if (indexColumn < 0)
+		{
+			vertices.push_back(vertex);
+			continue;
+		}
+
+		const Index index = Index(std::strtoul(fields[indexColumn].c_str(), nullptr, 10));
+
+		// rows sharing an index hold the same vertex
+		if (index >= vertices.size())
+		{
+			vertices.resize(std::size_t(index) + 1);
+		}
+
+		vertices[index] = vertex;
+		indices.push_back(index);
+	}
+
+	return (indices.size() % 3 == 0) && (indexColumn >= 0 || vertices.size() % 3 == 0);
+}
+
+const char* MeshFile::GetStatusName(const Status status)
+{
+	switch (status)
+	{
+		case Status::Loaded:
+			return "loaded";
+		case Status::Missing:
+			return "missing";
+		case Status::Stale:
+			return "stale";
+		case Status::Corrupt:
+			return "corrupt";
+	}
+
+	return "unknown";
+}
+
+MeshFile::Status MeshFile::Validate()
+{
+	const std::size_t size = mFile.GetSize();
+
+	if (size < sizeof(Header))
+	{
+		return Status::Corrupt;
+	}
+
+	Header& header = mHeader;
+	std::memcpy(&header, mFile.GetData(), sizeof(Header));
+
+	if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.headerSize != sizeof(Header))
+	{
+		return Status::Corrupt;
+	}
+
+	if (header.version != kVersion)
+	{
+		return Status::Stale;
+	}
+
+	// sections aligned, inside the file and sized by the counts
+	auto IsValid = [size](const Section& section, const std::size_t expectedSize)
+	{
+		return section.offset % kAlignment == 0 &&
+			   section.offset <= size && section.size <= size - section.offset &&
+			   section.size == expectedSize;
+	};
+
+	if (!IsValid(header.vertices, std::size_t(header.vertexCount) * sizeof(Vertex)) ||
+		!IsValid(header.indices, std::size_t(header.indexCount) * sizeof(Index)) ||
+		header.indexCount % 3 != 0 || (header.indexCount == 0 && header.vertexCount % 3 != 0))
+	{
+		return Status::Corrupt;
+	}
+
+	// the index buffer is read straight by the BVH build and the draws
+	const Index* indices = GetIndices();
+	Index maxIndex = 0;
+
+	for (std::size_t i = 0; i < header.indexCount; ++i)
+	{
+		maxIndex = std::max(maxIndex, indices[i]);
+	}
+
+	if (header.indexCount != 0 && maxIndex >= header.vertexCount)
+	{
+		return Status::Corrupt;
+	}
+
+	return Status::Loaded;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//
+#include "BVHMath.h"
+#include "MappedFile.h"
+
+// binary mesh made by MeshConvert out of a CSV vertex dump: a header with the counts and the bounds, then the vertex
+// stream and the index buffer at kAlignment byte offsets. the file is memory-mapped and read in place
+class MeshFile
+{
+public:
+
+	static constexpr std::uint32_t kVersion = 2;
+	static constexpr std::size_t kAlignment = 64;
+
+	// laid out like the VertexData of MeshManager
+	struct Vertex
+	{
+		Float3 position;
+		Float3 normal;
+		Float3 tangent;
+		float u;
+		float v;
+	};
+
+	static_assert(sizeof(Vertex) == 11 * sizeof(float), "unexpected Vertex layout");
+
+	using Index = std::uint32_t;
+
+	enum class Status
+	{
+		Loaded,
+		Missing, // no file, or it could not be mapped
+		Stale, // written by another version, convert it again
+		Corrupt, // bad header, sections out of the file or indices out of the vertices
+	};
+
+	struct Section
+	{
+		std::uint64_t offset; // bytes from the start of the file, a multiple of kAlignment
+		std::uint64_t size; // bytes
+	};
+
+	struct Header
+	{
+		char magic[8]; // kMagic
+		std::uint32_t version;
+		std::uint32_t headerSize;
+		std::uint32_t vertexCount;
+		std::uint32_t indexCount; // 0 for a triangle list without index buffer
+		AABB bounds;
+		Section vertices;
+		Section indices;
+		std::uint64_t contentHash; // of the vertex and index bytes, hashed once by Write
+	};
+
+	// maps the file and validates it, the sections stay readable until Close
+	Status Open(const std::string& path);
+
+	void Close();
+
+	const Vertex* GetVertices() const
+	{
+		return reinterpret_cast<const Vertex*>(mFile.GetData() + mHeader.vertices.offset);
+	}
+
+	std::size_t GetVertexCount() const
+	{
+		return mHeader.vertexCount;
+	}
+
+	const Index* GetIndices() const
+	{
+		return reinterpret_cast<const Index*>(mFile.GetData() + mHeader.indices.offset);
+	}
+
+	std::size_t GetIndexCount() const
+	{
+		return mHeader.indexCount;
+	}
+
+	const AABB& GetBounds() const
+	{
+		return mHeader.bounds;
+	}
+
+	// identifies the contents without reading them, the key of the BVH cache (BVH::SetMeshKey)
+	std::uint64_t GetContentHash() const
+	{
+		return mHeader.contentHash;
+	}
+
+	// writes a temporary file next to path and moves it over path, so that a reader never sees a partial file
+	static bool Write(const std::string& path,
+					  const Vertex* vertices,
+					  const std::size_t vertexCount,
+					  const Index* indices,
+					  const std::size_t indexCount);
+
+	// reads a vertex dump with a header row naming the columns (VTX, IDX, POSITION.x, NORMAL.x, TANGENT.x, TEXCOORD0.x, ...).
+	// with an IDX column every row is an index and the vertices are gathered by index, otherwise every row is a vertex
+	static bool ImportCsv(const std::string& path, std::vector<Vertex>& vertices, std::vector<Index>& indices);
+
+	static const char* GetStatusName(const Status status);
+
+private:
+
+	static constexpr char kMagic[8] = { 'H', 'S', 'S', 'P', 'R', 'M', 'S', 'H' };
+
+	Status Validate();
+
+	MappedFile mFile;
+	Header mHeader = {};
+};
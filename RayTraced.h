@@ -7,6 +7,7 @@ using Microsoft::WRL::ComPtr;
 
 // std
 #include <string>
+#include <vector>
 
 // d3d
 #include <d3d11.h>
@@ -18,6 +19,63 @@ using namespace DirectX;
 
 #define STRUCTURED 1
 
+// children per BVH node: 2 for the skip-offset stream, 4 or 8 for the wide stream
+#define BVH_WIDTH 2
+
+// one tree per mesh in object space and a top-level tree over the object instances
+#define BVH_TWO_LEVEL 0
+
+// bits per child bound of the wide stream nodes, 8 or 16, 0 keeps float bounds
+#define BVH_QUANTIZATION 0
+
+// triangle encoding of the leaves, 0 v0 and edges, 1 Woop transform, 2 Baldwin-Weber transform (BVHBuilder::LeafFormat)
+#define BVH_LEAF_FORMAT 0
+
+// the reflections skip the boxes beyond their closest hit and visit the nearer child first (BVHTraversal bOrdered)
+#define BVH_ORDERED 0
+
+// draws with the BVH_COUNTERS permutations and shows the per-pixel traversal counters as a heatmap (TraversalCounters)
+#define BVH_COUNTERS 0
+
+// the raytraced passes draw only the screen tiles listed by a classification pass (RayTracedTiles), 0 draws them as
+// fullscreen triangles. the compute path, RAYTRACED_SSPR and RAYTRACED_REDUCED build on the tiles and are set with it
+#define RAYTRACED_TILES 0
+
+// the raytraced passes start as compute shaders over the listed tiles instead of drawing them (RayTracedCompute), needs
+// RAYTRACED_TILES. both shader sets are built with the tiles and C switches between them at runtime
+#define RAYTRACED_COMPUTE 0
+
+// the compute passes run a fixed number of groups that take batches of pixels from an atomic work counter
+#define RAYTRACED_PERSISTENT 1
+
+// screen-space planar reflections of the grid resolve the reflections first, the BVH traces the pixels they leave empty
+// (SSPR). needs RAYTRACED_TILES
+#define RAYTRACED_SSPR 0
+
+// the reflection rays march a min-depth pyramid of the depth buffer first, the BVH continues from where the march leaves
+// the screen or passes behind the visible surfaces (HiZ)
+#define RAYTRACED_HIZ 0
+
+// the reflections trace writes the closest hits to a buffer, they are grouped by material and shaded by a compute pass
+// (RayTracedHits)
+#define RAYTRACED_DEFERRED 0
+
+// the reflections of rough surfaces are traced on a checkerboard, at half or at quarter resolution and the pixels in
+// between are reconstructed by a joint bilateral upsample (ReducedReflections). lossy, needs RAYTRACED_TILES
+#define RAYTRACED_REDUCED 0
+
+#if RAYTRACED_COMPUTE && !RAYTRACED_TILES
+#error RAYTRACED_COMPUTE dispatches over the tiles of RAYTRACED_TILES
+#endif
+
+#if RAYTRACED_SSPR && !RAYTRACED_TILES
+#error RAYTRACED_SSPR tests the stencil view of RAYTRACED_TILES
+#endif
+
+#if RAYTRACED_REDUCED && !RAYTRACED_TILES
+#error RAYTRACED_REDUCED tests the stencil view of RAYTRACED_TILES
+#endif
+
 class RayTraced
 {
 public:
@@ -30,71 +88,30 @@ public:
 
 		// pixel shaders
 		{
-			const D3D_SHADER_MACRO defines[] =
-			{
-				"STRUCTURED", STRUCTURED ? "1" : "0",
-				nullptr, nullptr
-			};
-
-			// shadows
-			{
-				std::wstring path = L"shaders/RayTracedShadows.hlsl";
-
-				ComPtr<ID3DBlob> pCode = CompileShader(path,
-													   defines,
-													   "RayTracedShadowsPS",
-													   ShaderTarget::PS);
-
-				ThrowIfFailed(mDevice->CreatePixelShader(pCode->GetBufferPointer(),
-														 pCode->GetBufferSize(),
-														 nullptr,
-														 &mShadowsPS));
-
-				NameResource(mShadowsPS.Get(), "RayTracedShadowsPS");
-			}
-
-			// reflections
-			{
-				std::wstring path = L"shaders/RayTracedReflections.hlsl";
-
-				ComPtr<ID3DBlob> pCode = CompileShader(path,
-													   defines,
-													   "RayTracedReflectionsPS",
-													   ShaderTarget::PS);
-
-				ThrowIfFailed(mDevice->CreatePixelShader(pCode->GetBufferPointer(),
-														 pCode->GetBufferSize(),
-														 nullptr,
-														 &mReflectionsPS));
-
-				NameResource(mReflectionsPS.Get(), "RayTracedReflectionsPS");
-			}
-
-			// reflections unpack normal
-			{
-				std::wstring path = L"shaders/RayTracedReflections.hlsl";
-
-				const D3D_SHADER_MACRO defines[] =
-				{
-					"STRUCTURED", STRUCTURED ? "1" : "0",
-					"UNPACK_NORMAL", "1",
-					nullptr, nullptr
-				};
-
-				ComPtr<ID3DBlob> pCode = CompileShader(path,
-													   defines,
-													   "RayTracedReflectionsPS",
-													   ShaderTarget::PS);
-
-				ThrowIfFailed(mDevice->CreatePixelShader(pCode->GetBufferPointer(),
-														 pCode->GetBufferSize(),
-														 nullptr,
-														 &mReflectionsUnpackNormalPS));
-
-				NameResource(mReflectionsUnpackNormalPS.Get(), "RayTracedReflectionsUnpackNormalPS");
-			}
+			CreatePixelShader(L"shaders/RayTracedShadows.hlsl", "RayTracedShadowsPS", false, false, "RayTracedShadowsPS", mShadowsPS);
+			CreatePixelShader(L"shaders/RayTracedReflections.hlsl", "RayTracedReflectionsPS", false, false, "RayTracedReflectionsPS", mReflectionsPS);
+			CreatePixelShader(L"shaders/RayTracedReflections.hlsl", "RayTracedReflectionsPS", true, false, "RayTracedReflectionsUnpackNormalPS", mReflectionsUnpackNormalPS);
+
+#if BVH_COUNTERS
+			// instrumented permutations, they also write the traversal counters of the pixel to u1 (TraversalCounters)
+			CreatePixelShader(L"shaders/RayTracedShadows.hlsl", "RayTracedShadowsPS", false, true, "RayTracedShadowsCountersPS", mShadowsCountersPS);
+			CreatePixelShader(L"shaders/RayTracedReflections.hlsl", "RayTracedReflectionsPS", false, true, "RayTracedReflectionsCountersPS", mReflectionsCountersPS);
+			CreatePixelShader(L"shaders/RayTracedReflections.hlsl", "RayTracedReflectionsPS", true, true, "RayTracedReflectionsUnpackNormalCountersPS", mReflectionsUnpackNormalCountersPS);
+#endif // BVH_COUNTERS
 		}
 
+#if RAYTRACED_TILES
+		// compute shaders over the listed tiles, instrumented with BVH_COUNTERS
+		{
+			CreateComputeShader(L"shaders/RayTracedShadows.hlsl", false, "RayTracedShadowsCS", mShadowsCS);
+			CreateComputeShader(L"shaders/RayTracedReflections.hlsl", true, "RayTracedReflectionsUnpackNormalCS", mReflectionsUnpackNormalCS);
+		}
+#endif // RAYTRACED_TILES
+
+#if RAYTRACED_DEFERRED
+		CreateHitShadingShader(L"shaders/RayTracedReflections.hlsl", "RayTracedShadeHitsUnpackNormalCS", mShadeHitsUnpackNormalCS);
+#endif // RAYTRACED_DEFERRED
+
 		//// common constant buffer
 		//{
 		//	D3D11_BUFFER_DESC desc;
@@ -216,6 +233,36 @@ public:
 		return mReflectionsUnpackNormalPS.Get();
 	}
 
+	ID3D11PixelShader* GetShadowsCountersPS()
+	{
+		return mShadowsCountersPS.Get();
+	}
+
+	ID3D11PixelShader* GetReflectionsCountersPS()
+	{
+		return mReflectionsCountersPS.Get();
+	}
+
+	ID3D11PixelShader* GetReflectionsUnpackNormalCountersPS()
+	{
+		return mReflectionsUnpackNormalCountersPS.Get();
+	}
+
+	ID3D11ComputeShader* GetShadowsCS()
+	{
+		return mShadowsCS.Get();
+	}
+
+	ID3D11ComputeShader* GetReflectionsUnpackNormalCS()
+	{
+		return mReflectionsUnpackNormalCS.Get();
+	}
+
+	ID3D11ComputeShader* GetShadeHitsUnpackNormalCS()
+	{
+		return mShadeHitsUnpackNormalCS.Get();
+	}
+
 	//ID3D11Buffer* GetCommonCB()
 	//{
 	//	return mCommonCB.Get();
@@ -243,12 +290,118 @@ public:
 
 private:
 
+	// UNPACK_NORMAL and BVH_COUNTERS are defined only when set, the caller adds the terminator
+	std::vector<D3D_SHADER_MACRO> GetDefines(const bool bUnpackNormal,
+											 const bool bCounters)
+	{
+		std::vector<D3D_SHADER_MACRO> defines =
+		{
+			{ "STRUCTURED", STRUCTURED ? "1" : "0" },
+			{ "BVH_WIDTH", (BVH_WIDTH == 8) ? "8" : (BVH_WIDTH == 4) ? "4" : "2" },
+			{ "BVH_TWO_LEVEL", BVH_TWO_LEVEL ? "1" : "0" },
+			{ "BVH_QUANTIZATION", (BVH_QUANTIZATION == 16) ? "16" : (BVH_QUANTIZATION == 8) ? "8" : "0" },
+			{ "BVH_LEAF_FORMAT", (BVH_LEAF_FORMAT == 2) ? "2" : (BVH_LEAF_FORMAT == 1) ? "1" : "0" },
+			{ "BVH_ORDERED", BVH_ORDERED ? "1" : "0" },
+			{ "RAYTRACED_SSPR", RAYTRACED_SSPR ? "1" : "0" },
+			{ "RAYTRACED_HIZ", RAYTRACED_HIZ ? "1" : "0" },
+			{ "RAYTRACED_DEFERRED", RAYTRACED_DEFERRED ? "1" : "0" },
+			{ "RAYTRACED_REDUCED", RAYTRACED_REDUCED ? "1" : "0" },
+		};
+
+		if (bUnpackNormal)
+		{
+			defines.push_back({ "UNPACK_NORMAL", "1" });
+		}
+
+		if (bCounters)
+		{
+			defines.push_back({ "BVH_COUNTERS", "1" });
+		}
+
+		return defines;
+	}
+
+	void CreatePixelShader(const std::wstring& path,
+						   const char* entryPoint,
+						   const bool bUnpackNormal,
+						   const bool bCounters,
+						   const char* name,
+						   ComPtr<ID3D11PixelShader>& pShader)
+	{
+		std::vector<D3D_SHADER_MACRO> defines = GetDefines(bUnpackNormal, bCounters);
+		defines.push_back({ nullptr, nullptr });
+
+		ComPtr<ID3DBlob> pCode = CompileShader(path,
+											   defines.data(),
+											   entryPoint,
+											   ShaderTarget::PS);
+
+		ThrowIfFailed(mDevice->CreatePixelShader(pCode->GetBufferPointer(),
+												 pCode->GetBufferSize(),
+												 nullptr,
+												 &pShader));
+
+		NameResource(pShader.Get(), name);
+	}
+
+	// the RayTracedCS entry of the file
+	void CreateComputeShader(const std::wstring& path,
+							 const bool bUnpackNormal,
+							 const char* name,
+							 ComPtr<ID3D11ComputeShader>& pShader)
+	{
+		std::vector<D3D_SHADER_MACRO> defines = GetDefines(bUnpackNormal, BVH_COUNTERS);
+		defines.push_back({ "RAYTRACED_COMPUTE", "1" });
+		defines.push_back({ "RAYTRACED_PERSISTENT", RAYTRACED_PERSISTENT ? "1" : "0" });
+		defines.push_back({ nullptr, nullptr });
+
+		ComPtr<ID3DBlob> pCode = CompileShader(path,
+											   defines.data(),
+											   "RayTracedCS",
+											   ShaderTarget::CS);
+
+		ThrowIfFailed(mDevice->CreateComputeShader(pCode->GetBufferPointer(),
+												   pCode->GetBufferSize(),
+												   nullptr,
+												   &pShader));
+
+		NameResource(pShader.Get(), name);
+	}
+
+	// the RayTracedShadeHitsCS entry of the reflections, it shades the hit records that the trace wrote
+	void CreateHitShadingShader(const std::wstring& path,
+								const char* name,
+								ComPtr<ID3D11ComputeShader>& pShader)
+	{
+		std::vector<D3D_SHADER_MACRO> defines = GetDefines(true, false);
+		defines.push_back({ "RAYTRACED_HIT_SHADING", "1" });
+		defines.push_back({ nullptr, nullptr });
+
+		ComPtr<ID3DBlob> pCode = CompileShader(path,
+											   defines.data(),
+											   "RayTracedShadeHitsCS",
+											   ShaderTarget::CS);
+
+		ThrowIfFailed(mDevice->CreateComputeShader(pCode->GetBufferPointer(),
+												   pCode->GetBufferSize(),
+												   nullptr,
+												   &pShader));
+
+		NameResource(pShader.Get(), name);
+	}
+
 	ComPtr<ID3D11Device> mDevice;
 	ComPtr<ID3D11DeviceContext> mContext;
 
 	ComPtr<ID3D11PixelShader> mShadowsPS;
 	ComPtr<ID3D11PixelShader> mReflectionsPS;
 	ComPtr<ID3D11PixelShader> mReflectionsUnpackNormalPS;
+	ComPtr<ID3D11PixelShader> mShadowsCountersPS;
+	ComPtr<ID3D11PixelShader> mReflectionsCountersPS;
+	ComPtr<ID3D11PixelShader> mReflectionsUnpackNormalCountersPS;
+	ComPtr<ID3D11ComputeShader> mShadowsCS;
+	ComPtr<ID3D11ComputeShader> mReflectionsUnpackNormalCS;
+	ComPtr<ID3D11ComputeShader> mShadeHitsUnpackNormalCS;
 	//ComPtr<ID3D11Buffer> mCommonCB;
 	ComPtr<ID3D11Buffer> mShadowsCB;
 	ComPtr<ID3D11Buffer> mReflectionsCB;
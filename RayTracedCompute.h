@@ -0,0 +1,169 @@
+#pragma once
+
+// windows
+#include <wrl.h>
+#include <comdef.h>
+using Microsoft::WRL::ComPtr;
+
+// d3d
+#include <d3d11.h>
+
+//
+#include "Utility.h"
+#include "RayTracedTiles.h"
+
+// the compute path of the raytraced passes (RAYTRACED_TILES, AppInst picks it or the pixel path at runtime). the compute
+// shader of a pass sees the bindings its pixel shader would see, writes a UAV copy of the resolve target of the pass and
+// the copy then replaces the resolve target, so that the passes after it do not depend on the path
+class RayTracedCompute
+{
+public:
+
+	void Init(const ComPtr<ID3D11Device>& pDevice,
+			  const ComPtr<ID3D11DeviceContext>& pContext)
+	{
+		mDevice = pDevice;
+		mContext = pContext;
+	}
+
+	// call in place of the draw of the pass, with the pixel shader resources of the pass bound and nothing bound to the
+	// output merger. pCountersUAV is u1 of the BVH_COUNTERS permutations
+	void Dispatch(RayTracedTiles& tiles,
+				  const RayTracedTiles::Pass pass,
+				  ID3D11ComputeShader* pShader,
+				  const bool bPersistent,
+				  ID3D11ShaderResourceView* pResolveSRV,
+				  const float clearColor[4],
+				  ID3D11UnorderedAccessView* pCountersUAV)
+	{
+		Target& target = mTargets[UINT(pass)];
+
+		UpdateTarget(mDevice.Get(), target, pResolveSRV);
+
+		mContext->ClearUnorderedAccessViewFloat(target.uav.Get(), clearColor);
+
+		MirrorPixelShaderBindings(mContext.Get());
+
+		ID3D11UnorderedAccessView* pUAVs[] =
+		{
+			target.uav.Get(),
+			pCountersUAV,
+		};
+
+		mContext->CSSetShader(pShader, nullptr, 0);
+		mContext->CSSetUnorderedAccessViews(0, sizeof(pUAVs) / sizeof(pUAVs[0]), pUAVs, nullptr);
+
+		tiles.Dispatch(pass, bPersistent);
+
+		ID3D11ShaderResourceView* pNullSRVs[kShaderResourceCount] = {};
+		ID3D11UnorderedAccessView* pNullUAVs[] = { nullptr, nullptr };
+		mContext->CSSetShaderResources(0, kShaderResourceCount, pNullSRVs);
+		mContext->CSSetUnorderedAccessViews(0, 2, pNullUAVs, nullptr);
+		mContext->CSSetShader(nullptr, nullptr, 0);
+
+		mContext->CopyResource(target.resolve.Get(), target.texture.Get());
+	}
+
+	// a UAV copy of a resolve target, copied over the resolve target once written
+	struct Target
+	{
+		ComPtr<ID3D11Resource> resolve;
+		ComPtr<ID3D11Texture2D> texture;
+		ComPtr<ID3D11UnorderedAccessView> uav;
+	};
+
+	// recreates the copy when the resolve target changes
+	static void UpdateTarget(ID3D11Device* pDevice,
+							 Target& target,
+							 ID3D11ShaderResourceView* pResolveSRV)
+	{
+		ComPtr<ID3D11Resource> pResolve;
+		pResolveSRV->GetResource(&pResolve);
+
+		if (pResolve != target.resolve)
+		{
+			CreateTarget(pDevice, target, pResolve, pResolveSRV);
+		}
+	}
+
+	// the pixel shader bindings of the pass onto the compute stage
+	static void MirrorPixelShaderBindings(ID3D11DeviceContext* pContext)
+	{
+		// Get adds a reference
+		ID3D11Buffer* pCBs[kConstantBufferCount] = {};
+		ID3D11SamplerState* pSamplers[kSamplerCount] = {};
+		ID3D11ShaderResourceView* pSRVs[kShaderResourceCount] = {};
+
+		pContext->PSGetConstantBuffers(0, kConstantBufferCount, pCBs);
+		pContext->PSGetSamplers(0, kSamplerCount, pSamplers);
+		pContext->PSGetShaderResources(0, kShaderResourceCount, pSRVs);
+
+		pContext->CSSetConstantBuffers(0, kConstantBufferCount, pCBs);
+		pContext->CSSetSamplers(0, kSamplerCount, pSamplers);
+		pContext->CSSetShaderResources(0, kShaderResourceCount, pSRVs);
+
+		Release(pCBs);
+		Release(pSamplers);
+		Release(pSRVs);
+	}
+
+	// b0 to b5 (b4 the hi-z march, b5 the reduced reflections), the tiles constant buffer then replaces b3
+	static const UINT kConstantBufferCount = 6;
+	static const UINT kSamplerCount = D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT;
+
+	// t0 to t15 (t14 and t15 the hi-z march), the tile resources then replace t11 to t13
+	static const UINT kShaderResourceCount = 16;
+
+private:
+
+	static const UINT kPassCount = 2;
+
+	template <typename T, UINT N>
+	static void Release(T* (&pointers)[N])
+	{
+		for (T* p : pointers)
+		{
+			if (p)
+			{
+				p->Release();
+			}
+		}
+	}
+
+	// same size and format as the resolve target so that it can be copied over it, viewed in the format of its SRV
+	static void CreateTarget(ID3D11Device* pDevice,
+							 Target& target,
+							 const ComPtr<ID3D11Resource>& pResolve,
+							 ID3D11ShaderResourceView* pResolveSRV)
+	{
+		ComPtr<ID3D11Texture2D> pResolveTexture;
+		ThrowIfFailed(pResolve.As(&pResolveTexture));
+
+		D3D11_TEXTURE2D_DESC desc;
+		pResolveTexture->GetDesc(&desc);
+
+		desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+		desc.MiscFlags = 0;
+
+		ThrowIfFailed(pDevice->CreateTexture2D(&desc, nullptr, &target.texture));
+
+		NameResource(target.texture.Get(), "RayTracedComputeTarget");
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+		pResolveSRV->GetDesc(&srvDesc);
+
+		D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc;
+		uavDesc.Format = srvDesc.Format;
+		uavDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
+		uavDesc.Texture2D.MipSlice = 0;
+
+		ThrowIfFailed(pDevice->CreateUnorderedAccessView(target.texture.Get(), &uavDesc, &target.uav));
+
+		target.resolve = pResolve;
+	}
+
+	ComPtr<ID3D11Device> mDevice;
+	ComPtr<ID3D11DeviceContext> mContext;
+
+	Target mTargets[kPassCount];
+};
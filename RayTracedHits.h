@@ -0,0 +1,282 @@
+#pragma once
+
+// windows
+#include <wrl.h>
+#include <comdef.h>
+using Microsoft::WRL::ComPtr;
+
+// std
+#include <string>
+
+// d3d
+#include <d3d11.h>
+
+//
+#include "Utility.h"
+#include "RayTracedCompute.h"
+
+// deferred shading of the reflections (RAYTRACED_DEFERRED). the trace appends the closest hit of each ray to a buffer
+// (HitRecord of shaders/RayTracedHitsCommon.hlsl) instead of shading it, the hits are then grouped by material and shaded
+// by a compute pass, so that the threads of a group run the same material instead of the materials their pixels hit
+class RayTracedHits
+{
+public:
+
+	// matches kHitBinCount and kHitGroupSize of the shaders
+	static const UINT kBinCount = 256;
+	static const UINT kGroupSize = 64;
+
+	void Init(const ComPtr<ID3D11Device>& pDevice,
+			  const ComPtr<ID3D11DeviceContext>& pContext)
+	{
+		mDevice = pDevice;
+		mContext = pContext;
+
+		const std::wstring path = L"shaders/RayTracedHits.hlsl";
+
+		CreateComputeShader(path, "RayTracedBinHitsCS", mBinCS);
+		CreateComputeShader(path, "RayTracedScatterHitsCS", mScatterCS);
+
+		// counts buffer
+		{
+			D3D11_BUFFER_DESC desc;
+			desc.ByteWidth = kCountsSize;
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+			desc.StructureByteStride = 0;
+
+			ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &mCounts));
+
+			NameResource(mCounts.Get(), "RayTracedHitCounts");
+
+			CreateRawSRV(mCounts, kCountsSize, mCountsSRV);
+			CreateRawUAV(mCounts, kCountsSize, mCountsUAV);
+		}
+
+		// arguments buffer, apart from the counts so that the indirect dispatches do not read a buffer bound as UAV
+		{
+			D3D11_BUFFER_DESC desc;
+			desc.ByteWidth = kArgsSize;
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS | D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+			desc.StructureByteStride = 0;
+
+			ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &mArgs));
+
+			NameResource(mArgs.Get(), "RayTracedHitArgs");
+
+			CreateRawUAV(mArgs, kArgsSize, mArgsUAV);
+		}
+	}
+
+	// call before the reflections trace, the hit buffers hold one hit per pixel of the viewport
+	void Begin(const UINT width, const UINT height)
+	{
+		if (width * height > mCapacity)
+		{
+			Resize(width * height);
+		}
+
+		const UINT zeros[4] = {};
+		mContext->ClearUnorderedAccessViewUint(mCountsUAV.Get(), zeros);
+	}
+
+	// u3 of the RAYTRACED_DEFERRED reflections trace
+	ID3D11UnorderedAccessView* GetHitsUAV()
+	{
+		return mHitsUAV.Get();
+	}
+
+	// u4 of the RAYTRACED_DEFERRED reflections trace
+	ID3D11UnorderedAccessView* GetCountsUAV()
+	{
+		return mCountsUAV.Get();
+	}
+
+	// call after the trace with its pixel shader resources still bound and nothing bound to the output merger. the hits
+	// are shaded into a copy of the resolve target that keeps what the trace wrote, the copy then replaces it
+	void Shade(ID3D11ComputeShader* pShadeCS,
+			   ID3D11ShaderResourceView* pResolveSRV)
+	{
+		ID3D11ShaderResourceView* pNullSRVs[kShadeSRVSlot + 2] = {};
+		ID3D11UnorderedAccessView* pNullUAVs[3] = {};
+
+		// offsets of the bins and the arguments of the dispatches below
+		{
+			ID3D11UnorderedAccessView* pUAVs[] =
+			{
+				mCountsUAV.Get(),
+				mArgsUAV.Get(),
+			};
+
+			mContext->CSSetShader(mBinCS.Get(), nullptr, 0);
+			mContext->CSSetUnorderedAccessViews(0, sizeof(pUAVs) / sizeof(pUAVs[0]), pUAVs, nullptr);
+
+			mContext->Dispatch(1, 1, 1);
+
+			mContext->CSSetUnorderedAccessViews(0, 2, pNullUAVs, nullptr);
+		}
+
+		// the hits into the ranges of their bins
+		{
+			ID3D11UnorderedAccessView* pUAVs[] =
+			{
+				mCountsUAV.Get(),
+				nullptr,
+				mSortedHitsUAV.Get(),
+			};
+
+			mContext->CSSetShader(mScatterCS.Get(), nullptr, 0);
+			mContext->CSSetShaderResources(0, 1, mHitsSRV.GetAddressOf());
+			mContext->CSSetUnorderedAccessViews(0, sizeof(pUAVs) / sizeof(pUAVs[0]), pUAVs, nullptr);
+
+			mContext->DispatchIndirect(mArgs.Get(), 0);
+
+			mContext->CSSetShaderResources(0, 1, pNullSRVs);
+			mContext->CSSetUnorderedAccessViews(0, 3, pNullUAVs, nullptr);
+		}
+
+		// shading, the compute shader sees the bindings of the trace
+		{
+			RayTracedCompute::UpdateTarget(mDevice.Get(), mTarget, pResolveSRV);
+
+			mContext->CopyResource(mTarget.texture.Get(), mTarget.resolve.Get());
+
+			RayTracedCompute::MirrorPixelShaderBindings(mContext.Get());
+
+			ID3D11ShaderResourceView* pSRVs[] =
+			{
+				mSortedHitsSRV.Get(),
+				mCountsSRV.Get(),
+			};
+
+			mContext->CSSetShader(pShadeCS, nullptr, 0);
+			mContext->CSSetShaderResources(kShadeSRVSlot, sizeof(pSRVs) / sizeof(pSRVs[0]), pSRVs);
+			mContext->CSSetUnorderedAccessViews(0, 1, mTarget.uav.GetAddressOf(), nullptr);
+
+			mContext->DispatchIndirect(mArgs.Get(), 0);
+
+			mContext->CSSetShaderResources(0, sizeof(pNullSRVs) / sizeof(pNullSRVs[0]), pNullSRVs);
+			mContext->CSSetUnorderedAccessViews(0, 1, pNullUAVs, nullptr);
+
+			mContext->CopyResource(mTarget.resolve.Get(), mTarget.texture.Get());
+		}
+
+		mContext->CSSetShader(nullptr, nullptr, 0);
+	}
+
+private:
+
+	// HitRecord
+	static const UINT kHitRecordSize = 7 * sizeof(UINT);
+
+	// the hit count, then the count and the scatter cursor of each bin (kHitCountOffset of the shaders)
+	static const UINT kCountsSize = 16 + 2 * kBinCount * sizeof(UINT);
+
+	// a DispatchIndirect argument set for the scatter and shading passes
+	static const UINT kArgsSize = 4 * sizeof(UINT);
+
+	// t16 and t17 of RayTracedShadeHitsCS, past the mirrored bindings of the trace
+	static const UINT kShadeSRVSlot = 16;
+
+	void CreateComputeShader(const std::wstring& path,
+							 const char* entryPoint,
+							 ComPtr<ID3D11ComputeShader>& pShader)
+	{
+		ComPtr<ID3DBlob> pCode = CompileShader(path,
+											   nullptr,
+											   entryPoint,
+											   ShaderTarget::CS);
+
+		ThrowIfFailed(mDevice->CreateComputeShader(pCode->GetBufferPointer(),
+												   pCode->GetBufferSize(),
+												   nullptr,
+												   &pShader));
+
+		NameResource(pShader.Get(), entryPoint);
+	}
+
+	void CreateRawSRV(const ComPtr<ID3D11Buffer>& pBuffer,
+					  const UINT size,
+					  ComPtr<ID3D11ShaderResourceView>& pSRV)
+	{
+		D3D11_SHADER_RESOURCE_VIEW_DESC desc;
+		desc.Format = DXGI_FORMAT_R32_TYPELESS;
+		desc.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
+		desc.BufferEx.FirstElement = 0;
+		desc.BufferEx.NumElements = size / sizeof(UINT);
+		desc.BufferEx.Flags = D3D11_BUFFEREX_SRV_FLAG_RAW;
+
+		ThrowIfFailed(mDevice->CreateShaderResourceView(pBuffer.Get(), &desc, &pSRV));
+	}
+
+	void CreateRawUAV(const ComPtr<ID3D11Buffer>& pBuffer,
+					  const UINT size,
+					  ComPtr<ID3D11UnorderedAccessView>& pUAV)
+	{
+		D3D11_UNORDERED_ACCESS_VIEW_DESC desc;
+		desc.Format = DXGI_FORMAT_R32_TYPELESS;
+		desc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+		desc.Buffer.FirstElement = 0;
+		desc.Buffer.NumElements = size / sizeof(UINT);
+		desc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+
+		ThrowIfFailed(mDevice->CreateUnorderedAccessView(pBuffer.Get(), &desc, &pUAV));
+	}
+
+	void CreateHitBuffer(const UINT capacity,
+						 const char* name,
+						 ComPtr<ID3D11Buffer>& pBuffer,
+						 ComPtr<ID3D11ShaderResourceView>& pSRV,
+						 ComPtr<ID3D11UnorderedAccessView>& pUAV)
+	{
+		D3D11_BUFFER_DESC desc;
+		desc.ByteWidth = capacity * kHitRecordSize;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		desc.StructureByteStride = kHitRecordSize;
+
+		ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &pBuffer));
+
+		NameResource(pBuffer.Get(), name);
+
+		ThrowIfFailed(mDevice->CreateShaderResourceView(pBuffer.Get(), nullptr, &pSRV));
+		ThrowIfFailed(mDevice->CreateUnorderedAccessView(pBuffer.Get(), nullptr, &pUAV));
+	}
+
+	void Resize(const UINT capacity)
+	{
+		mCapacity = capacity;
+
+		CreateHitBuffer(capacity, "RayTracedHits", mHits, mHitsSRV, mHitsUAV);
+		CreateHitBuffer(capacity, "RayTracedSortedHits", mSortedHits, mSortedHitsSRV, mSortedHitsUAV);
+	}
+
+	ComPtr<ID3D11Device> mDevice;
+	ComPtr<ID3D11DeviceContext> mContext;
+
+	ComPtr<ID3D11ComputeShader> mBinCS;
+	ComPtr<ID3D11ComputeShader> mScatterCS;
+
+	ComPtr<ID3D11Buffer> mHits;
+	ComPtr<ID3D11ShaderResourceView> mHitsSRV;
+	ComPtr<ID3D11UnorderedAccessView> mHitsUAV;
+	ComPtr<ID3D11Buffer> mSortedHits;
+	ComPtr<ID3D11ShaderResourceView> mSortedHitsSRV;
+	ComPtr<ID3D11UnorderedAccessView> mSortedHitsUAV;
+	ComPtr<ID3D11Buffer> mCounts;
+	ComPtr<ID3D11ShaderResourceView> mCountsSRV;
+	ComPtr<ID3D11UnorderedAccessView> mCountsUAV;
+	ComPtr<ID3D11Buffer> mArgs;
+	ComPtr<ID3D11UnorderedAccessView> mArgsUAV;
+
+	RayTracedCompute::Target mTarget;
+
+	UINT mCapacity = 0;
+};
@@ -0,0 +1,358 @@
+#pragma once
+
+// windows
+#include <wrl.h>
+#include <comdef.h>
+using Microsoft::WRL::ComPtr;
+
+// std
+#include <string>
+
+// d3d
+#include <d3d11.h>
+#include <directxmath.h>
+
+//
+#include "Utility.h"
+
+using namespace DirectX;
+
+// lists the screen tiles that need shadow or reflection rays from the depth, the gbuffer, the material roughness and the
+// reflective stencil (shaders/RayTracedTiles.hlsl). the raytraced passes then draw one quad per listed tile with
+// DrawInstancedIndirect instead of a fullscreen triangle, or run one compute group per listed tile (RayTracedCompute).
+// the shaders still reject the pixels of a listed tile one by one
+class RayTracedTiles
+{
+public:
+
+	// tile lists and argument sets
+	enum class Pass
+	{
+		Shadows,
+		Reflections,
+	};
+
+	// matches kTileSize of the shaders
+	static const UINT kTileSize = 8;
+
+	// groups of the persistent threads, enough to fill the GPU
+	static const UINT kPersistentGroupCount = 256;
+
+	void Init(const ComPtr<ID3D11Device>& pDevice,
+			  const ComPtr<ID3D11DeviceContext>& pContext)
+	{
+		mDevice = pDevice;
+		mContext = pContext;
+
+		const std::wstring path = L"shaders/RayTracedTiles.hlsl";
+
+		// classification compute shader
+		{
+			ComPtr<ID3DBlob> pCode = CompileShader(path,
+												   nullptr,
+												   "RayTracedClassifyCS",
+												   ShaderTarget::CS);
+
+			ThrowIfFailed(mDevice->CreateComputeShader(pCode->GetBufferPointer(),
+													   pCode->GetBufferSize(),
+													   nullptr,
+													   &mClassifyCS));
+
+			NameResource(mClassifyCS.Get(), "RayTracedClassifyCS");
+		}
+
+		// tile vertex shader
+		{
+			ComPtr<ID3DBlob> pCode = CompileShader(path,
+												   nullptr,
+												   "RayTracedTileVS",
+												   ShaderTarget::VS);
+
+			ThrowIfFailed(mDevice->CreateVertexShader(pCode->GetBufferPointer(),
+													  pCode->GetBufferSize(),
+													  nullptr,
+													  &mTileVS));
+
+			NameResource(mTileVS.Get(), "RayTracedTileVS");
+		}
+
+		// tiles constant buffer
+		{
+			D3D11_BUFFER_DESC desc;
+			desc.ByteWidth = sizeof(TilesCB);
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = 0;
+			desc.StructureByteStride = 0;
+
+			ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &mTilesCB));
+
+			NameResource(mTilesCB.Get(), "RayTracedTilesCB");
+		}
+
+		// arguments buffer
+		{
+			D3D11_BUFFER_DESC desc;
+			desc.ByteWidth = kArgsSize;
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS | D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+			desc.StructureByteStride = 0;
+
+			ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &mArgs));
+
+			NameResource(mArgs.Get(), "RayTracedTilesArgs");
+
+			// the indirect dispatch reads the tile count through a view that does not alias its arguments with a UAV
+			D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+			srvDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+			srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
+			srvDesc.BufferEx.FirstElement = 0;
+			srvDesc.BufferEx.NumElements = kArgsSize / sizeof(UINT);
+			srvDesc.BufferEx.Flags = D3D11_BUFFEREX_SRV_FLAG_RAW;
+
+			ThrowIfFailed(mDevice->CreateShaderResourceView(mArgs.Get(), &srvDesc, &mArgsSRV));
+
+			D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc;
+			uavDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+			uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+			uavDesc.Buffer.FirstElement = 0;
+			uavDesc.Buffer.NumElements = kArgsSize / sizeof(UINT);
+			uavDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+
+			ThrowIfFailed(mDevice->CreateUnorderedAccessView(mArgs.Get(), &uavDesc, &mArgsUAV));
+		}
+	}
+
+	// call after the depth/gbuffer prepass with nothing bound to the output merger, the tile lists follow the size of
+	// the viewport and the stencil view follows the depth buffer
+	void Classify(const UINT width,
+				  const UINT height,
+				  const XMFLOAT3& lightDir,
+				  ID3D11ShaderResourceView* pDepthBufferSRV,
+				  ID3D11ShaderResourceView* pGBufferSRV,
+				  ID3D11ShaderResourceView* pMaterialBufferSRV)
+	{
+		if (width != mWidth || height != mHeight)
+		{
+			Resize(width, height);
+		}
+
+		ComPtr<ID3D11Resource> pDepthBuffer;
+		pDepthBufferSRV->GetResource(&pDepthBuffer);
+
+		if (pDepthBuffer != mDepthBuffer)
+		{
+			CreateStencilSRV(pDepthBuffer);
+		}
+
+		TilesCB buffer;
+		buffer.lightDir = XMFLOAT3(-lightDir.x, -lightDir.y, -lightDir.z);
+		buffer.padding = 0.0f;
+		buffer.screenSize = XMUINT2(mWidth, mHeight);
+		buffer.tileCount = XMUINT2(mTileCountX, mTileCountY);
+
+		// six vertices per tile instance, tileCount.x groups per dispatch row
+		const UINT clearArgs[kArgsSize / sizeof(UINT)] =
+		{
+			6, 0, 0, 0,
+			6, 0, 0, 0,
+			mTileCountX, 0, 1, 0,
+			mTileCountX, 0, 1, 0,
+		};
+
+		mContext->UpdateSubresource(mTilesCB.Get(), 0, nullptr, &buffer, 0, 0);
+		mContext->UpdateSubresource(mArgs.Get(), 0, nullptr, clearArgs, 0, 0);
+
+		ID3D11ShaderResourceView* pSRVs[] =
+		{
+			pDepthBufferSRV,
+			pGBufferSRV,
+			mStencilSRV.Get(),
+		};
+
+		ID3D11UnorderedAccessView* pUAVs[] =
+		{
+			mTileListUAVs[UINT(Pass::Shadows)].Get(),
+			mTileListUAVs[UINT(Pass::Reflections)].Get(),
+			mArgsUAV.Get(),
+		};
+
+		mContext->CSSetShader(mClassifyCS.Get(), nullptr, 0);
+		mContext->CSSetConstantBuffers(3, 1, mTilesCB.GetAddressOf());
+		mContext->CSSetShaderResources(0, 1, &pMaterialBufferSRV);
+		mContext->CSSetShaderResources(5, sizeof(pSRVs) / sizeof(pSRVs[0]), pSRVs);
+		mContext->CSSetUnorderedAccessViews(0, sizeof(pUAVs) / sizeof(pUAVs[0]), pUAVs, nullptr);
+
+		mContext->Dispatch(mTileCountX, mTileCountY, 1);
+
+		ID3D11ShaderResourceView* pNullSRVs[] = { nullptr, nullptr, nullptr, nullptr };
+		ID3D11UnorderedAccessView* pNullUAVs[] = { nullptr, nullptr, nullptr };
+		mContext->CSSetShaderResources(0, 1, pNullSRVs);
+		mContext->CSSetShaderResources(5, 3, pNullSRVs);
+		mContext->CSSetUnorderedAccessViews(0, 3, pNullUAVs, nullptr);
+		mContext->CSSetShader(nullptr, nullptr, 0);
+	}
+
+	// the listed tiles of the pass over the bound render target, the pixel shader is set by the caller
+	void Draw(const Pass pass)
+	{
+		mContext->IASetInputLayout(nullptr);
+		mContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		mContext->VSSetShader(mTileVS.Get(), nullptr, 0);
+		mContext->VSSetConstantBuffers(3, 1, mTilesCB.GetAddressOf());
+		mContext->VSSetShaderResources(11, 1, mTileListSRVs[UINT(pass)].GetAddressOf());
+
+		mContext->DrawInstancedIndirect(mArgs.Get(), UINT(pass) * kArgsSetSize);
+
+		ID3D11ShaderResourceView* pNullSRV = nullptr;
+		mContext->VSSetShaderResources(11, 1, &pNullSRV);
+	}
+
+	// the listed tiles of the pass with the bound compute shader, one group per tile or kPersistentGroupCount groups
+	// that take batches of pixels from the work counter of the pass. the output and scene resources are bound by the caller
+	void Dispatch(const Pass pass, const bool bPersistent)
+	{
+		ID3D11ShaderResourceView* pSRVs[] =
+		{
+			mTileListSRVs[UINT(pass)].Get(),
+			mStencilSRV.Get(),
+			bPersistent ? nullptr : mArgsSRV.Get(),
+		};
+
+		mContext->CSSetConstantBuffers(3, 1, mTilesCB.GetAddressOf());
+		mContext->CSSetShaderResources(11, sizeof(pSRVs) / sizeof(pSRVs[0]), pSRVs);
+
+		if (bPersistent)
+		{
+			mContext->CSSetUnorderedAccessViews(2, 1, mArgsUAV.GetAddressOf(), nullptr);
+			mContext->Dispatch(kPersistentGroupCount, 1, 1);
+		}
+		else
+		{
+			mContext->DispatchIndirect(mArgs.Get(), (kPassCount + UINT(pass)) * kArgsSetSize);
+		}
+
+		ID3D11ShaderResourceView* pNullSRVs[] = { nullptr, nullptr, nullptr };
+		ID3D11UnorderedAccessView* pNullUAV = nullptr;
+		mContext->CSSetShaderResources(11, 3, pNullSRVs);
+		mContext->CSSetUnorderedAccessViews(2, 1, &pNullUAV, nullptr);
+	}
+
+	// stencil plane of the depth buffer of the last classification, null when it has none
+	ID3D11ShaderResourceView* GetStencilSRV()
+	{
+		return mStencilSRV.Get();
+	}
+
+private:
+
+	static const UINT kPassCount = 2;
+
+	// a D3D11_DRAW_INSTANCED_INDIRECT_ARGS per pass whose instance count is the tile count, then the group counts of a
+	// DispatchIndirect and the work counter of the persistent threads per pass (kDrawArgsOffset of the shaders)
+	static const UINT kArgsSetSize = 4 * sizeof(UINT);
+	static const UINT kArgsSize = 2 * kPassCount * kArgsSetSize;
+
+	void Resize(const UINT width, const UINT height)
+	{
+		mWidth = width;
+		mHeight = height;
+		mTileCountX = (width + kTileSize - 1) / kTileSize;
+		mTileCountY = (height + kTileSize - 1) / kTileSize;
+
+		// one list per pass, long enough for every tile
+		for (UINT i = 0; i < kPassCount; ++i)
+		{
+			D3D11_BUFFER_DESC desc;
+			desc.ByteWidth = mTileCountX * mTileCountY * sizeof(UINT);
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+			desc.StructureByteStride = sizeof(UINT);
+
+			ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &mTileLists[i]));
+
+			NameResource(mTileLists[i].Get(), (i == UINT(Pass::Shadows)) ? "RayTracedShadowTiles" : "RayTracedReflectionTiles");
+
+			ThrowIfFailed(mDevice->CreateShaderResourceView(mTileLists[i].Get(), nullptr, &mTileListSRVs[i]));
+			ThrowIfFailed(mDevice->CreateUnorderedAccessView(mTileLists[i].Get(), nullptr, &mTileListUAVs[i]));
+		}
+	}
+
+	void CreateStencilSRV(const ComPtr<ID3D11Resource>& pDepthBuffer)
+	{
+		mDepthBuffer = pDepthBuffer;
+		mStencilSRV.Reset();
+
+		ComPtr<ID3D11Texture2D> pTexture;
+
+		if (FAILED(pDepthBuffer.As(&pTexture)))
+		{
+			return;
+		}
+
+		D3D11_TEXTURE2D_DESC textureDesc;
+		pTexture->GetDesc(&textureDesc);
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC desc;
+
+		if (textureDesc.Format == DXGI_FORMAT_R24G8_TYPELESS)
+		{
+			desc.Format = DXGI_FORMAT_X24_TYPELESS_G8_UINT;
+		}
+		else if (textureDesc.Format == DXGI_FORMAT_R32G8X24_TYPELESS)
+		{
+			desc.Format = DXGI_FORMAT_X32_TYPELESS_G8X24_UINT;
+		}
+		else
+		{
+			// no stencil, the classification falls back to the material roughness
+			return;
+		}
+
+		desc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		desc.Texture2D.MostDetailedMip = 0;
+		desc.Texture2D.MipLevels = 1;
+
+		ThrowIfFailed(mDevice->CreateShaderResourceView(pTexture.Get(), &desc, &mStencilSRV));
+
+		NameResource(mStencilSRV.Get(), "RayTracedTilesStencilSRV");
+	}
+
+	ComPtr<ID3D11Device> mDevice;
+	ComPtr<ID3D11DeviceContext> mContext;
+
+	ComPtr<ID3D11ComputeShader> mClassifyCS;
+	ComPtr<ID3D11VertexShader> mTileVS;
+	ComPtr<ID3D11Buffer> mTilesCB;
+
+	ComPtr<ID3D11Buffer> mArgs;
+	ComPtr<ID3D11ShaderResourceView> mArgsSRV;
+	ComPtr<ID3D11UnorderedAccessView> mArgsUAV;
+
+	ComPtr<ID3D11Buffer> mTileLists[kPassCount];
+	ComPtr<ID3D11ShaderResourceView> mTileListSRVs[kPassCount];
+	ComPtr<ID3D11UnorderedAccessView> mTileListUAVs[kPassCount];
+
+	ComPtr<ID3D11Resource> mDepthBuffer;
+	ComPtr<ID3D11ShaderResourceView> mStencilSRV;
+
+	UINT mWidth = 0;
+	UINT mHeight = 0;
+	UINT mTileCountX = 0;
+	UINT mTileCountY = 0;
+
+	struct TilesCB
+	{
+		XMFLOAT3   lightDir;
+		float      padding;
+		XMUINT2    screenSize;
+		XMUINT2    tileCount;
+	};
+
+	static_assert((sizeof(TilesCB) % 16) == 0, "constant buffer size must be 16-byte aligned");
+};
@@ -0,0 +1,353 @@
+#pragma once
+
+// windows
+#include <wrl.h>
+#include <comdef.h>
+using Microsoft::WRL::ComPtr;
+
+// std
+#include <cmath>
+#include <cstring>
+#include <string>
+
+// d3d
+#include <d3d11.h>
+#include <directxmath.h>
+
+//
+#include "Utility.h"
+#include "RayTracedCompute.h"
+
+using namespace DirectX;
+
+// reduced reflection tracing of rough surfaces (RAYTRACED_REDUCED, shaders/ReducedReflections.hlsl). the trace skips
+// pixels by material roughness and a joint bilateral upsample guided by the depth and the gbuffer normal fills them from
+// the traced ones. the quality is measured on request against a trace of every pixel
+class ReducedReflections
+{
+public:
+
+	struct Totals
+	{
+		UINT reflectivePixels = 0;
+		UINT tracedPixels = 0;
+		UINT comparedPixels = 0; // of the last measurement
+		UINT squaredError = 0;   // sum over the compared pixels in 1/256
+	};
+
+	// roughness from which one pixel in two, one in each 2x2 and one in each 4x4 block is traced
+	static constexpr float kCheckerboardRoughness = 0.05f;
+	static constexpr float kHalfRoughness = 0.1f;
+	static constexpr float kQuarterRoughness = 0.4f;
+
+	void Init(const ComPtr<ID3D11Device>& pDevice,
+			  const ComPtr<ID3D11DeviceContext>& pContext)
+	{
+		mDevice = pDevice;
+		mContext = pContext;
+
+		const std::wstring path = L"shaders/ReducedReflections.hlsl";
+
+		CreateComputeShader(path, "ReducedReflectionsUpsampleCS", mUpsampleCS);
+		CreateComputeShader(path, "ReducedReflectionsMetricCS", mMetricCS);
+
+		// constant buffer
+		{
+			D3D11_BUFFER_DESC desc;
+			desc.ByteWidth = sizeof(ReducedReflectionsCB);
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = 0;
+			desc.StructureByteStride = 0;
+
+			ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &mReducedCB));
+
+			NameResource(mReducedCB.Get(), "ReducedReflectionsCB");
+		}
+
+		// counters buffer
+		{
+			D3D11_BUFFER_DESC desc;
+			desc.ByteWidth = sizeof(Totals);
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+			desc.StructureByteStride = 0;
+
+			ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &mCounters));
+
+			NameResource(mCounters.Get(), "ReducedReflectionsCounters");
+
+			D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc;
+			uavDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+			uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+			uavDesc.Buffer.FirstElement = 0;
+			uavDesc.Buffer.NumElements = sizeof(Totals) / sizeof(UINT);
+			uavDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+
+			ThrowIfFailed(mDevice->CreateUnorderedAccessView(mCounters.Get(), &uavDesc, &mCountersUAV));
+
+			// read back a few frames late so that the map does not stall
+			desc.Usage = D3D11_USAGE_STAGING;
+			desc.BindFlags = 0;
+			desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+			desc.MiscFlags = 0;
+
+			for (ComPtr<ID3D11Buffer>& pStaging : mCountersStaging)
+			{
+				ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &pStaging));
+
+				NameResource(pStaging.Get(), "ReducedReflectionsCountersStaging");
+			}
+		}
+
+		mCB.reduced = 1;
+		mCB.checkerboardRoughness = kCheckerboardRoughness;
+		mCB.halfRoughness = kHalfRoughness;
+		mCB.quarterRoughness = kQuarterRoughness;
+	}
+
+	// once per frame before drawing
+	void Update(const XMFLOAT4X4& viewProjInv,
+				const XMFLOAT3& eyePos)
+	{
+		mCB.viewProjInv = viewProjInv;
+		mCB.eyePos = eyePos;
+
+		mContext->UpdateSubresource(mReducedCB.Get(), 0, nullptr, &mCB, 0, 0);
+	}
+
+	// false traces every pixel until set again
+	void SetReduced(const bool bReduced)
+	{
+		mCB.reduced = bReduced ? 1 : 0;
+
+		mContext->UpdateSubresource(mReducedCB.Get(), 0, nullptr, &mCB, 0, 0);
+	}
+
+	// b5 of the RAYTRACED_REDUCED permutations of the reflections
+	ID3D11Buffer* GetCB()
+	{
+		return mReducedCB.Get();
+	}
+
+	// keeps the reflections resolve target of a trace of every pixel, the reference of the next Upsample that compares
+	void StoreReference(ID3D11ShaderResourceView* pResolveSRV)
+	{
+		ComPtr<ID3D11Resource> pResolve;
+		pResolveSRV->GetResource(&pResolve);
+
+		ComPtr<ID3D11Texture2D> pResolveTexture;
+		ThrowIfFailed(pResolve.As(&pResolveTexture));
+
+		D3D11_TEXTURE2D_DESC desc;
+		pResolveTexture->GetDesc(&desc);
+
+		if (!mReference || desc.Width != mReferenceWidth || desc.Height != mReferenceHeight)
+		{
+			mReferenceWidth = desc.Width;
+			mReferenceHeight = desc.Height;
+
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = 0;
+
+			ThrowIfFailed(mDevice->CreateTexture2D(&desc, nullptr, &mReference));
+
+			NameResource(mReference.Get(), "ReducedReflectionsReference");
+
+			// viewed like the resolve target, it may be typeless
+			D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+			pResolveSRV->GetDesc(&srvDesc);
+
+			ThrowIfFailed(mDevice->CreateShaderResourceView(mReference.Get(), &srvDesc, &mReferenceSRV));
+		}
+
+		mContext->CopyResource(mReference.Get(), pResolve.Get());
+	}
+
+	// call after the trace with nothing bound to the output merger. the reflections resolve target is upsampled into a
+	// copy that then replaces it, bCompare measures it against the last StoreReference
+	void Upsample(const UINT width,
+				  const UINT height,
+				  ID3D11ShaderResourceView* pDepthBufferSRV,
+				  ID3D11ShaderResourceView* pGBufferSRV,
+				  ID3D11ShaderResourceView* pStencilSRV,
+				  ID3D11ShaderResourceView* pMaterialBufferSRV,
+				  ID3D11ShaderResourceView* pResolveSRV,
+				  const bool bCompare)
+	{
+		mCB.screenSize = XMUINT2(width, height);
+
+		mContext->UpdateSubresource(mReducedCB.Get(), 0, nullptr, &mCB, 0, 0);
+
+		RayTracedCompute::UpdateTarget(mDevice.Get(), mTarget, pResolveSRV);
+
+		const UINT zeros[4] = {};
+		mContext->ClearUnorderedAccessViewUint(mCountersUAV.Get(), zeros);
+
+		ID3D11ShaderResourceView* pSRVs[] =
+		{
+			pDepthBufferSRV,
+			pGBufferSRV,
+			pStencilSRV,
+			pResolveSRV,
+			mReferenceSRV.Get(),
+		};
+
+		ID3D11UnorderedAccessView* pUAVs[] =
+		{
+			mTarget.uav.Get(),
+			mCountersUAV.Get(),
+		};
+
+		mContext->CSSetConstantBuffers(5, 1, mReducedCB.GetAddressOf());
+		mContext->CSSetShaderResources(0, 1, &pMaterialBufferSRV);
+		mContext->CSSetShaderResources(5, sizeof(pSRVs) / sizeof(pSRVs[0]), pSRVs);
+		mContext->CSSetUnorderedAccessViews(0, sizeof(pUAVs) / sizeof(pUAVs[0]), pUAVs, nullptr);
+
+		const UINT groupsX = (width + 7) / 8;
+		const UINT groupsY = (height + 7) / 8;
+
+		mContext->CSSetShader(mUpsampleCS.Get(), nullptr, 0);
+		mContext->Dispatch(groupsX, groupsY, 1);
+
+		// the resolve target is read above, it takes the upsampled copy once unbound
+		ID3D11ShaderResourceView* pNullSRV = nullptr;
+		mContext->CSSetShaderResources(8, 1, &pNullSRV);
+
+		ID3D11UnorderedAccessView* pNullUAV = nullptr;
+		mContext->CSSetUnorderedAccessViews(0, 1, &pNullUAV, nullptr);
+
+		mContext->CopyResource(mTarget.resolve.Get(), mTarget.texture.Get());
+
+		if (bCompare && mReferenceSRV)
+		{
+			mContext->CSSetShaderResources(8, 1, &pResolveSRV);
+
+			mContext->CSSetShader(mMetricCS.Get(), nullptr, 0);
+			mContext->Dispatch(groupsX, groupsY, 1);
+		}
+
+		ID3D11ShaderResourceView* pNullSRVs[] = { nullptr, nullptr, nullptr, nullptr, nullptr };
+		ID3D11UnorderedAccessView* pNullUAVs[] = { nullptr, nullptr };
+		mContext->CSSetShaderResources(0, 1, pNullSRVs);
+		mContext->CSSetShaderResources(5, 5, pNullSRVs);
+		mContext->CSSetUnorderedAccessViews(0, 2, pNullUAVs, nullptr);
+		mContext->CSSetShader(nullptr, nullptr, 0);
+
+		ReadCounters();
+	}
+
+	// read kLatency frames late
+	const Totals& GetTotals() const
+	{
+		return mTotals;
+	}
+
+	// root mean square error of the reflections of the last measurement, per channel in [0, 1]
+	float GetRMSE() const
+	{
+		if (mTotals.comparedPixels == 0)
+		{
+			return 0.0f;
+		}
+
+		return std::sqrt(mTotals.squaredError / 256.0f / mTotals.comparedPixels);
+	}
+
+private:
+
+	static const UINT kLatency = 3;
+
+	void CreateComputeShader(const std::wstring& path,
+							 const char* entryPoint,
+							 ComPtr<ID3D11ComputeShader>& pShader)
+	{
+		ComPtr<ID3DBlob> pCode = CompileShader(path,
+											   nullptr,
+											   entryPoint,
+											   ShaderTarget::CS);
+
+		ThrowIfFailed(mDevice->CreateComputeShader(pCode->GetBufferPointer(),
+												   pCode->GetBufferSize(),
+												   nullptr,
+												   &pShader));
+
+		NameResource(pShader.Get(), entryPoint);
+	}
+
+	void ReadCounters()
+	{
+		mContext->CopyResource(mCountersStaging[mFrame % kLatency].Get(), mCounters.Get());
+
+		++mFrame;
+
+		// the oldest copy, keep the previous totals while it is in flight
+		if (mFrame >= kLatency)
+		{
+			ID3D11Buffer* pStaging = mCountersStaging[mFrame % kLatency].Get();
+
+			D3D11_MAPPED_SUBRESOURCE mapped;
+
+			if (SUCCEEDED(mContext->Map(pStaging, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped)))
+			{
+				Totals totals;
+				std::memcpy(&totals, mapped.pData, sizeof(totals));
+
+				mContext->Unmap(pStaging, 0);
+
+				// the frames in between do not compare
+				if (totals.comparedPixels == 0)
+				{
+					totals.comparedPixels = mTotals.comparedPixels;
+					totals.squaredError = mTotals.squaredError;
+				}
+
+				mTotals = totals;
+			}
+		}
+	}
+
+	ComPtr<ID3D11Device> mDevice;
+	ComPtr<ID3D11DeviceContext> mContext;
+
+	ComPtr<ID3D11ComputeShader> mUpsampleCS;
+	ComPtr<ID3D11ComputeShader> mMetricCS;
+	ComPtr<ID3D11Buffer> mReducedCB;
+
+	RayTracedCompute::Target mTarget;
+
+	ComPtr<ID3D11Texture2D> mReference;
+	ComPtr<ID3D11ShaderResourceView> mReferenceSRV;
+	UINT mReferenceWidth = 0;
+	UINT mReferenceHeight = 0;
+
+	ComPtr<ID3D11Buffer> mCounters;
+	ComPtr<ID3D11UnorderedAccessView> mCountersUAV;
+	ComPtr<ID3D11Buffer> mCountersStaging[kLatency];
+
+	UINT mFrame = 0;
+
+	Totals mTotals;
+
+	struct ReducedReflectionsCB
+	{
+		XMFLOAT4X4 viewProjInv;
+		XMFLOAT3   eyePos;
+		UINT       reduced;
+		float      checkerboardRoughness;
+		float      halfRoughness;
+		float      quarterRoughness;
+		float      padding0;
+		XMUINT2    screenSize;
+		XMUINT2    padding1;
+	};
+
+	static_assert((sizeof(ReducedReflectionsCB) % 16) == 0, "constant buffer size must be 16-byte aligned");
+
+	ReducedReflectionsCB mCB = {};
+};
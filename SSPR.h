@@ -0,0 +1,325 @@
+#pragma once
+
+// windows
+#include <wrl.h>
+#include <comdef.h>
+using Microsoft::WRL::ComPtr;
+
+// std
+#include <cstring>
+#include <string>
+
+// d3d
+#include <d3d11.h>
+#include <directxmath.h>
+
+//
+#include "Utility.h"
+#include "FrameHistory.h"
+
+using namespace DirectX;
+
+// screen-space planar reflections of a horizontal plane (shaders/SSPR.hlsl), resolved before the raytraced reflections so
+// that the BVH only traces the reflective pixels they leave empty. the reflected colour is the previous frame of
+// FrameHistory reprojected
+class SSPR
+{
+public:
+
+	struct Totals
+	{
+		UINT reflectivePixels = 0;
+		UINT fallbackPixels = 0; // left to the raytraced reflections
+	};
+
+	void Init(const ComPtr<ID3D11Device>& pDevice,
+			  const ComPtr<ID3D11DeviceContext>& pContext,
+			  const float planeHeight)
+	{
+		mDevice = pDevice;
+		mContext = pContext;
+		mPlaneHeight = planeHeight;
+
+		const std::wstring path = L"shaders/SSPR.hlsl";
+
+		CreateComputeShader(path, "SSPRProjectCS", mProjectCS);
+		CreateComputeShader(path, "SSPRHashCS", mHashCS);
+		CreateComputeShader(path, "SSPRResolveCS", mResolveCS);
+
+		// constant buffer
+		{
+			D3D11_BUFFER_DESC desc;
+			desc.ByteWidth = sizeof(SSPRCB);
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = 0;
+			desc.StructureByteStride = 0;
+
+			ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &mSSPRCB));
+
+			NameResource(mSSPRCB.Get(), "SSPRCB");
+		}
+
+		// counters buffer
+		{
+			D3D11_BUFFER_DESC desc;
+			desc.ByteWidth = sizeof(Totals);
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+			desc.StructureByteStride = 0;
+
+			ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &mCounters));
+
+			NameResource(mCounters.Get(), "SSPRCounters");
+
+			D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc;
+			uavDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+			uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+			uavDesc.Buffer.FirstElement = 0;
+			uavDesc.Buffer.NumElements = sizeof(Totals) / sizeof(UINT);
+			uavDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+
+			ThrowIfFailed(mDevice->CreateUnorderedAccessView(mCounters.Get(), &uavDesc, &mCountersUAV));
+
+			// read back a few frames late so that the map does not stall
+			desc.Usage = D3D11_USAGE_STAGING;
+			desc.BindFlags = 0;
+			desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+			desc.MiscFlags = 0;
+
+			for (ComPtr<ID3D11Buffer>& pStaging : mCountersStaging)
+			{
+				ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &pStaging));
+
+				NameResource(pStaging.Get(), "SSPRCountersStaging");
+			}
+		}
+	}
+
+	// call after the depth/gbuffer prepass and the tile classification that provides the stencil view, the textures
+	// follow the size of the viewport
+	void Resolve(const UINT width,
+				 const UINT height,
+				 ID3D11ShaderResourceView* pDepthBufferSRV,
+				 ID3D11ShaderResourceView* pGBufferSRV,
+				 ID3D11ShaderResourceView* pStencilSRV,
+				 ID3D11ShaderResourceView* pMaterialBufferSRV,
+				 FrameHistory& history)
+	{
+		if (width != mWidth || height != mHeight)
+		{
+			Resize(width, height);
+		}
+
+		SSPRCB buffer;
+		buffer.viewProj = history.GetViewProj();
+		buffer.viewProjInv = history.GetViewProjInv();
+		buffer.prevViewProj = history.GetPrevViewProj();
+		buffer.eyePos = history.GetEyePos();
+		buffer.planeHeight = mPlaneHeight;
+		buffer.screenSize = XMUINT2(mWidth, mHeight);
+		buffer.historyValid = history.IsValid(mWidth, mHeight) ? 1 : 0;
+		buffer.padding = 0.0f;
+
+		mContext->UpdateSubresource(mSSPRCB.Get(), 0, nullptr, &buffer, 0, 0);
+
+		const UINT empty[4] = { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff };
+		const UINT zeros[4] = {};
+
+		mContext->ClearUnorderedAccessViewUint(mDistancesUAV.Get(), empty);
+		mContext->ClearUnorderedAccessViewUint(mHashUAV.Get(), empty);
+		mContext->ClearUnorderedAccessViewUint(mCountersUAV.Get(), zeros);
+
+		ID3D11ShaderResourceView* pSRVs[] =
+		{
+			pDepthBufferSRV,
+			pGBufferSRV,
+			pStencilSRV,
+		};
+
+		mContext->CSSetConstantBuffers(3, 1, mSSPRCB.GetAddressOf());
+		mContext->CSSetShaderResources(0, 1, &pMaterialBufferSRV);
+		mContext->CSSetShaderResources(5, sizeof(pSRVs) / sizeof(pSRVs[0]), pSRVs);
+
+		const UINT groupsX = (mWidth + 7) / 8;
+		const UINT groupsY = (mHeight + 7) / 8;
+
+		// scatter
+		{
+			ID3D11UnorderedAccessView* pUAVs[] = { mDistancesUAV.Get(), mHashUAV.Get() };
+			mContext->CSSetUnorderedAccessViews(0, 2, pUAVs, nullptr);
+
+			mContext->CSSetShader(mProjectCS.Get(), nullptr, 0);
+			mContext->Dispatch(groupsX, groupsY, 1);
+
+			mContext->CSSetShader(mHashCS.Get(), nullptr, 0);
+			mContext->Dispatch(groupsX, groupsY, 1);
+
+			ID3D11UnorderedAccessView* pNullUAVs[] = { nullptr, nullptr };
+			mContext->CSSetUnorderedAccessViews(0, 2, pNullUAVs, nullptr);
+		}
+
+		// gather
+		{
+			ID3D11ShaderResourceView* pGatherSRVs[] = { mHashSRV.Get(), history.GetSRV() };
+			ID3D11UnorderedAccessView* pUAVs[] = { mReflectionsUAV.Get(), mCountersUAV.Get() };
+			mContext->CSSetShaderResources(8, 2, pGatherSRVs);
+			mContext->CSSetUnorderedAccessViews(2, 2, pUAVs, nullptr);
+
+			mContext->CSSetShader(mResolveCS.Get(), nullptr, 0);
+			mContext->Dispatch(groupsX, groupsY, 1);
+
+			ID3D11UnorderedAccessView* pNullUAVs[] = { nullptr, nullptr };
+			mContext->CSSetUnorderedAccessViews(2, 2, pNullUAVs, nullptr);
+		}
+
+		ID3D11ShaderResourceView* pNullSRVs[] = { nullptr, nullptr, nullptr, nullptr, nullptr };
+		mContext->CSSetShaderResources(0, 1, pNullSRVs);
+		mContext->CSSetShaderResources(5, 5, pNullSRVs);
+		mContext->CSSetShader(nullptr, nullptr, 0);
+
+		ReadCounters();
+	}
+
+	// t4 of the RAYTRACED_SSPR permutations of the reflections, alpha 0 where they trace
+	ID3D11ShaderResourceView* GetReflectionsSRV()
+	{
+		return mReflectionsSRV.Get();
+	}
+
+	// read kLatency frames late
+	const Totals& GetTotals() const
+	{
+		return mTotals;
+	}
+
+private:
+
+	static const UINT kLatency = 3;
+
+	void CreateComputeShader(const std::wstring& path,
+							 const char* entryPoint,
+							 ComPtr<ID3D11ComputeShader>& pShader)
+	{
+		ComPtr<ID3DBlob> pCode = CompileShader(path,
+											   nullptr,
+											   entryPoint,
+											   ShaderTarget::CS);
+
+		ThrowIfFailed(mDevice->CreateComputeShader(pCode->GetBufferPointer(),
+												   pCode->GetBufferSize(),
+												   nullptr,
+												   &pShader));
+
+		NameResource(pShader.Get(), entryPoint);
+	}
+
+	void CreateTexture(const DXGI_FORMAT format,
+					   const char* name,
+					   ComPtr<ID3D11Texture2D>& pTexture,
+					   ComPtr<ID3D11ShaderResourceView>* pSRV,
+					   ComPtr<ID3D11UnorderedAccessView>& pUAV)
+	{
+		D3D11_TEXTURE2D_DESC desc;
+		desc.Width = mWidth;
+		desc.Height = mHeight;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = format;
+		desc.SampleDesc.Count = 1;
+		desc.SampleDesc.Quality = 0;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+
+		ThrowIfFailed(mDevice->CreateTexture2D(&desc, nullptr, &pTexture));
+
+		NameResource(pTexture.Get(), name);
+
+		if (pSRV)
+		{
+			ThrowIfFailed(mDevice->CreateShaderResourceView(pTexture.Get(), nullptr, pSRV->ReleaseAndGetAddressOf()));
+		}
+
+		ThrowIfFailed(mDevice->CreateUnorderedAccessView(pTexture.Get(), nullptr, &pUAV));
+	}
+
+	void Resize(const UINT width, const UINT height)
+	{
+		mWidth = width;
+		mHeight = height;
+
+		CreateTexture(DXGI_FORMAT_R32_UINT, "SSPRDistances", mDistances, nullptr, mDistancesUAV);
+		CreateTexture(DXGI_FORMAT_R32_UINT, "SSPRHash", mHash, &mHashSRV, mHashUAV);
+		CreateTexture(DXGI_FORMAT_R16G16B16A16_FLOAT, "SSPRReflections", mReflections, &mReflectionsSRV, mReflectionsUAV);
+	}
+
+	void ReadCounters()
+	{
+		mContext->CopyResource(mCountersStaging[mFrame % kLatency].Get(), mCounters.Get());
+
+		++mFrame;
+
+		// the oldest copy, keep the previous totals while it is in flight
+		if (mFrame >= kLatency)
+		{
+			ID3D11Buffer* pStaging = mCountersStaging[mFrame % kLatency].Get();
+
+			D3D11_MAPPED_SUBRESOURCE mapped;
+
+			if (SUCCEEDED(mContext->Map(pStaging, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped)))
+			{
+				std::memcpy(&mTotals, mapped.pData, sizeof(mTotals));
+
+				mContext->Unmap(pStaging, 0);
+			}
+		}
+	}
+
+	ComPtr<ID3D11Device> mDevice;
+	ComPtr<ID3D11DeviceContext> mContext;
+
+	ComPtr<ID3D11ComputeShader> mProjectCS;
+	ComPtr<ID3D11ComputeShader> mHashCS;
+	ComPtr<ID3D11ComputeShader> mResolveCS;
+	ComPtr<ID3D11Buffer> mSSPRCB;
+
+	ComPtr<ID3D11Texture2D> mDistances;
+	ComPtr<ID3D11UnorderedAccessView> mDistancesUAV;
+	ComPtr<ID3D11Texture2D> mHash;
+	ComPtr<ID3D11ShaderResourceView> mHashSRV;
+	ComPtr<ID3D11UnorderedAccessView> mHashUAV;
+	ComPtr<ID3D11Texture2D> mReflections;
+	ComPtr<ID3D11ShaderResourceView> mReflectionsSRV;
+	ComPtr<ID3D11UnorderedAccessView> mReflectionsUAV;
+
+	ComPtr<ID3D11Buffer> mCounters;
+	ComPtr<ID3D11UnorderedAccessView> mCountersUAV;
+	ComPtr<ID3D11Buffer> mCountersStaging[kLatency];
+
+	float mPlaneHeight = 0.0f;
+
+	UINT mWidth = 0;
+	UINT mHeight = 0;
+	UINT mFrame = 0;
+
+	Totals mTotals;
+
+	struct SSPRCB
+	{
+		XMFLOAT4X4 viewProj;
+		XMFLOAT4X4 viewProjInv;
+		XMFLOAT4X4 prevViewProj;
+		XMFLOAT3   eyePos;
+		float      planeHeight;
+		XMUINT2    screenSize;
+		UINT       historyValid;
+		float      padding;
+	};
+
+	static_assert((sizeof(SSPRCB) % 16) == 0, "constant buffer size must be 16-byte aligned");
+};
@@ -0,0 +1,211 @@
+#pragma once
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// work-stealing pool, every worker owns a deque: it pushes and pops at the back (LIFO, depth first)
+// and idle workers steal from the front of the others (FIFO, the largest pending subtrees)
+class TaskPool
+{
+public:
+
+	using Task = std::function<void()>;
+
+	// counts the tasks of a group that have not finished yet
+	struct TaskGroup
+	{
+		std::atomic<int> pending = 0;
+	};
+
+	// threadCount includes the calling thread, 0 means one thread per hardware thread
+	explicit TaskPool(unsigned threadCount = 0)
+	{
+		if (threadCount == 0)
+		{
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		for (unsigned i = 0; i < threadCount; ++i)
+		{
+			mQueues.push_back(std::make_unique<Queue>());
+		}
+
+		// queue 0 belongs to the thread that owns the pool
+		for (unsigned i = 1; i < threadCount; ++i)
+		{
+			mThreads.emplace_back(&TaskPool::WorkerMain, this, i);
+		}
+	}
+
+	~TaskPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mWakeMutex);
+			mStop = true;
+		}
+
+		mWake.notify_all();
+
+		for (std::thread& thread : mThreads)
+		{
+			thread.join();
+		}
+	}
+
+	TaskPool(const TaskPool&) = delete;
+	TaskPool& operator=(const TaskPool&) = delete;
+
+	unsigned GetThreadCount() const
+	{
+		return unsigned(mQueues.size());
+	}
+
+	void Submit(TaskGroup& group, Task task)
+	{
+		group.pending++;
+
+		{
+			Queue& queue = *mQueues[GetWorkerIndex()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.entries.push_back({ std::move(task), &group });
+		}
+
+		mQueuedCount++;
+		mWake.notify_one();
+	}
+
+	// runs queued tasks (its own first, then stolen ones) until every task of the group has finished
+	void Wait(TaskGroup& group)
+	{
+		const unsigned index = GetWorkerIndex();
+
+		while (group.pending > 0)
+		{
+			if (!RunOne(index))
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+private:
+
+	struct Entry
+	{
+		Task task;
+		TaskGroup* group;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Entry> entries;
+	};
+
+	unsigned GetWorkerIndex() const
+	{
+		return (sPool == this) ? sWorkerIndex : 0;
+	}
+
+	bool Pop(const unsigned index, Entry& entry)
+	{
+		Queue& queue = *mQueues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (queue.entries.empty())
+		{
+			return false;
+		}
+
+		entry = std::move(queue.entries.back());
+		queue.entries.pop_back();
+
+		return true;
+	}
+
+	bool Steal(const unsigned index, Entry& entry)
+	{
+		const unsigned count = GetThreadCount();
+
+		for (unsigned i = 1; i < count; ++i)
+		{
+			Queue& queue = *mQueues[(index + i) % count];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+
+			if (!queue.entries.empty())
+			{
+				entry = std::move(queue.entries.front());
+				queue.entries.pop_front();
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool RunOne(const unsigned index)
+	{
+		Entry entry;
+
+		if (!Pop(index, entry) && !Steal(index, entry))
+		{
+			return false;
+		}
+
+		mQueuedCount--;
+
+		entry.task();
+		entry.group->pending--;
+
+		return true;
+	}
+
+	void WorkerMain(const unsigned index)
+	{
+		sPool = this;
+		sWorkerIndex = index;
+
+		while (true)
+		{
+			if (RunOne(index))
+			{
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(mWakeMutex);
+
+			if (mStop)
+			{
+				break;
+			}
+
+			// the timeout covers a notification that raced with the check above
+			mWake.wait_for(lock, std::chrono::milliseconds(1), [this] { return mStop || mQueuedCount > 0; });
+		}
+
+		sPool = nullptr;
+	}
+
+	std::vector<std::unique_ptr<Queue>> mQueues;
+	std::vector<std::thread> mThreads;
+
+	std::atomic<int> mQueuedCount = 0;
+
+	std::mutex mWakeMutex;
+	std::condition_variable mWake;
+	bool mStop = false;
+
+	static inline thread_local TaskPool* sPool = nullptr;
+	static inline thread_local unsigned sWorkerIndex = 0;
+};
@@ -0,0 +1,285 @@
+#pragma once
+
+// windows
+#include <wrl.h>
+#include <comdef.h>
+using Microsoft::WRL::ComPtr;
+
+// std
+#include <cstring>
+#include <string>
+
+// d3d
+#include <d3d11.h>
+
+//
+#include "Utility.h"
+
+// the per-pixel box tests, triangle tests and loop iterations written by the BVH_COUNTERS permutation of the raytraced
+// shaders, shown as a heatmap and reduced to frame totals (shaders/TraversalCounters.hlsl). the totals are the sums of
+// BVHTraversal::Counters over the traced pixels, to compare with the CPU reference
+class TraversalCounters
+{
+public:
+
+	// slices of the counters texture
+	enum class Pass
+	{
+		Shadows,
+		Reflections,
+	};
+
+	// components of the counters texture
+	enum class Counter
+	{
+		BoxTests,
+		TriangleTests,
+		Iterations,
+	};
+
+	struct Totals
+	{
+		UINT boxTests = 0;
+		UINT triangleTests = 0;
+		UINT iterations = 0;
+		UINT rays = 0; // traced pixels
+	};
+
+	void Init(const ComPtr<ID3D11Device>& pDevice,
+			  const ComPtr<ID3D11DeviceContext>& pContext)
+	{
+		mDevice = pDevice;
+		mContext = pContext;
+
+		const std::wstring path = L"shaders/TraversalCounters.hlsl";
+
+		// heatmap pixel shader
+		{
+			ComPtr<ID3DBlob> pCode = CompileShader(path,
+												   nullptr,
+												   "TraversalHeatmapPS",
+												   ShaderTarget::PS);
+
+			ThrowIfFailed(mDevice->CreatePixelShader(pCode->GetBufferPointer(),
+													 pCode->GetBufferSize(),
+													 nullptr,
+													 &mHeatmapPS));
+
+			NameResource(mHeatmapPS.Get(), "TraversalHeatmapPS");
+		}
+
+		// reduce compute shader
+		{
+			ComPtr<ID3DBlob> pCode = CompileShader(path,
+												   nullptr,
+												   "TraversalReduceCS",
+												   ShaderTarget::CS);
+
+			ThrowIfFailed(mDevice->CreateComputeShader(pCode->GetBufferPointer(),
+													   pCode->GetBufferSize(),
+													   nullptr,
+													   &mReduceCS));
+
+			NameResource(mReduceCS.Get(), "TraversalReduceCS");
+		}
+
+		// heatmap constant buffer
+		{
+			D3D11_BUFFER_DESC desc;
+			desc.ByteWidth = sizeof(HeatmapCB);
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = 0;
+			desc.StructureByteStride = 0;
+
+			ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &mHeatmapCB));
+
+			NameResource(mHeatmapCB.Get(), "TraversalHeatmapCB");
+		}
+
+		// totals buffer
+		{
+			D3D11_BUFFER_DESC desc;
+			desc.ByteWidth = sizeof(mTotals);
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+			desc.CPUAccessFlags = 0;
+			desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+			desc.StructureByteStride = 0;
+
+			ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &mTotalsBuffer));
+
+			NameResource(mTotalsBuffer.Get(), "TraversalTotals");
+
+			D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc;
+			uavDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+			uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+			uavDesc.Buffer.FirstElement = 0;
+			uavDesc.Buffer.NumElements = sizeof(mTotals) / sizeof(UINT);
+			uavDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+
+			ThrowIfFailed(mDevice->CreateUnorderedAccessView(mTotalsBuffer.Get(), &uavDesc, &mTotalsUAV));
+
+			// read back a few frames late so that the map does not stall
+			desc.Usage = D3D11_USAGE_STAGING;
+			desc.BindFlags = 0;
+			desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+			desc.MiscFlags = 0;
+
+			for (ComPtr<ID3D11Buffer>& pStaging : mTotalsStaging)
+			{
+				ThrowIfFailed(mDevice->CreateBuffer(&desc, nullptr, &pStaging));
+
+				NameResource(pStaging.Get(), "TraversalTotalsStaging");
+			}
+		}
+	}
+
+	// call before the raytraced passes, the counters texture follows the size of the viewport
+	void Clear(const UINT width, const UINT height)
+	{
+		if (width != mWidth || height != mHeight)
+		{
+			Resize(width, height);
+		}
+
+		const UINT zeros[4] = {};
+
+		mContext->ClearUnorderedAccessViewUint(mCountersUAV.Get(), zeros);
+		mContext->ClearUnorderedAccessViewUint(mTotalsUAV.Get(), zeros);
+	}
+
+	// sums the counters of both passes, the totals of this frame are read kLatency frames later
+	void Reduce()
+	{
+		mContext->CSSetShader(mReduceCS.Get(), nullptr, 0);
+		mContext->CSSetShaderResources(5, 1, mCountersSRV.GetAddressOf());
+		mContext->CSSetUnorderedAccessViews(0, 1, mTotalsUAV.GetAddressOf(), nullptr);
+
+		mContext->Dispatch((mWidth + 15) / 16, (mHeight + 15) / 16, kPassCount);
+
+		ID3D11ShaderResourceView* pNullSRV = nullptr;
+		ID3D11UnorderedAccessView* pNullUAV = nullptr;
+		mContext->CSSetShaderResources(5, 1, &pNullSRV);
+		mContext->CSSetUnorderedAccessViews(0, 1, &pNullUAV, nullptr);
+		mContext->CSSetShader(nullptr, nullptr, 0);
+
+		mContext->CopyResource(mTotalsStaging[mFrame % kLatency].Get(), mTotalsBuffer.Get());
+
+		++mFrame;
+
+		// the oldest copy, keep the previous totals while it is in flight
+		if (mFrame >= kLatency)
+		{
+			ID3D11Buffer* pStaging = mTotalsStaging[mFrame % kLatency].Get();
+
+			D3D11_MAPPED_SUBRESOURCE mapped;
+
+			if (SUCCEEDED(mContext->Map(pStaging, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped)))
+			{
+				std::memcpy(mTotals, mapped.pData, sizeof(mTotals));
+
+				mContext->Unmap(pStaging, 0);
+			}
+		}
+	}
+
+	// fullscreen pass over the bound render target, the pixels that were not traced are left as they are.
+	// the fullscreen vertex shader is set by the caller
+	void DrawHeatmap(const Pass pass,
+					 const Counter counter,
+					 const float maxCount)
+	{
+		HeatmapCB buffer;
+		buffer.slice = UINT(pass);
+		buffer.counter = UINT(counter);
+		buffer.maxCount = maxCount;
+
+		mContext->UpdateSubresource(mHeatmapCB.Get(), 0, nullptr, &buffer, 0, 0);
+
+		mContext->IASetInputLayout(nullptr);
+		mContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		mContext->PSSetShader(mHeatmapPS.Get(), nullptr, 0);
+		mContext->PSSetConstantBuffers(1, 1, mHeatmapCB.GetAddressOf());
+		mContext->PSSetShaderResources(5, 1, mCountersSRV.GetAddressOf());
+
+		mContext->Draw(3, 0);
+
+		ID3D11ShaderResourceView* pNullSRV = nullptr;
+		mContext->PSSetShaderResources(5, 1, &pNullSRV);
+	}
+
+	// u1 of the BVH_COUNTERS pixel shaders, next to their render target
+	ID3D11UnorderedAccessView* const* GetAddressOfUAV()
+	{
+		return mCountersUAV.GetAddressOf();
+	}
+
+	const Totals& GetTotals(const Pass pass) const
+	{
+		return mTotals[UINT(pass)];
+	}
+
+private:
+
+	static const UINT kPassCount = 2;
+	static const UINT kLatency = 3;
+
+	void Resize(const UINT width, const UINT height)
+	{
+		mWidth = width;
+		mHeight = height;
+
+		D3D11_TEXTURE2D_DESC desc;
+		desc.Width = width;
+		desc.Height = height;
+		desc.MipLevels = 1;
+		desc.ArraySize = kPassCount;
+		desc.Format = DXGI_FORMAT_R32G32B32A32_UINT;
+		desc.SampleDesc.Count = 1;
+		desc.SampleDesc.Quality = 0;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+
+		ThrowIfFailed(mDevice->CreateTexture2D(&desc, nullptr, &mCounters));
+
+		NameResource(mCounters.Get(), "TraversalCounters");
+
+		ThrowIfFailed(mDevice->CreateShaderResourceView(mCounters.Get(), nullptr, &mCountersSRV));
+		ThrowIfFailed(mDevice->CreateUnorderedAccessView(mCounters.Get(), nullptr, &mCountersUAV));
+	}
+
+	ComPtr<ID3D11Device> mDevice;
+	ComPtr<ID3D11DeviceContext> mContext;
+
+	ComPtr<ID3D11PixelShader> mHeatmapPS;
+	ComPtr<ID3D11ComputeShader> mReduceCS;
+	ComPtr<ID3D11Buffer> mHeatmapCB;
+
+	ComPtr<ID3D11Texture2D> mCounters;
+	ComPtr<ID3D11ShaderResourceView> mCountersSRV;
+	ComPtr<ID3D11UnorderedAccessView> mCountersUAV;
+
+	ComPtr<ID3D11Buffer> mTotalsBuffer;
+	ComPtr<ID3D11UnorderedAccessView> mTotalsUAV;
+	ComPtr<ID3D11Buffer> mTotalsStaging[kLatency];
+
+	UINT mWidth = 0;
+	UINT mHeight = 0;
+	UINT mFrame = 0;
+
+	Totals mTotals[kPassCount];
+
+	struct HeatmapCB
+	{
+		UINT       slice;
+		UINT       counter;
+		float      maxCount;
+		float      padding;
+	};
+
+	static_assert((sizeof(HeatmapCB) % 16) == 0, "constant buffer size must be 16-byte aligned");
+};
@@ -0,0 +1,42 @@
+// min-depth pyramid of the depth buffer, a texel keeps the nearest depth of the texels it covers (HiZ). the screen-space
+// march of the reflections steps over the cells whose nearest depth is still behind the ray
+
+Texture2D<float> Source : register(t0);
+RWTexture2D<float> Destination : register(u0);
+
+cbuffer HiZBuildCB : register(b0)
+{
+    uint2    gSourceSize;
+    uint2    gDestinationSize;
+};
+
+// mip 0, a copy of the depth buffer padded to the power of two size of the pyramid with the far depth
+[numthreads(8, 8, 1)]
+void HiZCopyCS(const uint3 id : SV_DispatchThreadID)
+{
+	if (all(id.xy < gDestinationSize))
+	{
+		Destination[id.xy] = all(id.xy < gSourceSize) ? Source.Load(uint3(id.xy, 0)) : 1;
+	}
+}
+
+// a side that is already 1 texel wide stays 1 texel wide
+float LoadSource(const uint2 texel)
+{
+	return Source.Load(uint3(min(texel, gSourceSize - 1), 0));
+}
+
+// the next mip, the sizes are powers of two and a texel covers exactly the 2x2 texels below it
+[numthreads(8, 8, 1)]
+void HiZReduceCS(const uint3 id : SV_DispatchThreadID)
+{
+	if (any(id.xy >= gDestinationSize))
+	{
+		return;
+	}
+
+	const uint2 texel = 2 * id.xy;
+
+	Destination[id.xy] = min(min(LoadSource(texel), LoadSource(texel + uint2(1, 0))),
+							 min(LoadSource(texel + uint2(0, 1)), LoadSource(texel + uint2(1, 1))));
+}
@@ -13,17 +13,15 @@ ByteAddressBuffer
 BVH : register(t7);
 
 #if RAYTRACED_REFLECTIONS
-#if STRUCTURED
-StructuredBuffer<float4>
-#else
-ByteAddressBuffer
-#endif
-VertexBuffer : register(t8);
+// BVHHitAttributes records: the three vertex records of each triangle, then the packed vertices
+StructuredBuffer<uint3> VertexBuffer : register(t8);
 
 // #define FLT_MAX 3.402823466e+38f
 #define FLT_MAX 1000000000
 #define BACKFACE_CULLING 1
 
+#include "RayTracedHitsCommon.hlsl"
+
 struct HitPoint
 {
     float3 worldPos;
@@ -32,11 +30,138 @@ struct HitPoint
     float3 tangent;
     int materialIndex;
 };
+
+// two snorm16 on the octahedron to a unit vector (BVHHitAttributes::DecodeOctahedral)
+float3 DecodeOctahedral(const uint packed)
+{
+	const float2 f = max(float2(asint(uint2(packed << 16, packed)) >> 16) / 32767.0f, -1.0f);
+
+	float3 n = float3(f, 1 - abs(f.x) - abs(f.y));
+	const float t = saturate(-n.z);
+	n.xy += (n.xy >= 0) ? -t : t;
+
+	return normalize(n);
+}
+
+// octahedral normal and tangent, half uvs
+void LoadHitVertex(const uint record,
+                   out float3 normal,
+                   out float3 tangent,
+                   out float2 uv)
+{
+	const uint3 packed = VertexBuffer[record];
+
+	normal = DecodeOctahedral(packed.x);
+	tangent = DecodeOctahedral(packed.y);
+	uv = f16tof32(uint2(packed.z, packed.z >> 16));
+}
 #endif // RAYTRACED_REFLECTIONS
 
 #define kEpsilon 0.00001f
 #define kSelfShadowOffset 0.005f
 
+#ifndef BVH_TWO_LEVEL
+#define BVH_TWO_LEVEL 0
+#endif
+
+#ifndef BVH_WIDTH
+#define BVH_WIDTH 2
+#endif
+
+#ifndef BVH_QUANTIZATION
+#define BVH_QUANTIZATION 0
+#endif
+
+// BVHBuilder::LeafFormat: 0 v0, e1, e2, 1 Woop transform, 2 Baldwin-Weber transform
+#ifndef BVH_LEAF_FORMAT
+#define BVH_LEAF_FORMAT 0
+#endif
+
+// counts the box tests, triangle tests and node loop iterations of the pixel into TraversalCounters, the way
+// BVHTraversal::Counters counts them on the CPU
+#ifndef BVH_COUNTERS
+#define BVH_COUNTERS 0
+#endif
+
+#if BVH_COUNTERS
+// one slice per pass, shadows then reflections (TraversalCounters.h)
+RWTexture2DArray<uint4> TraversalCounters : register(u1);
+
+static uint gBoxTests = 0;
+static uint gTriangleTests = 0;
+static uint gIterations = 0;
+
+#define BVH_COUNT(counter, n) counter += (n)
+#else
+#define BVH_COUNT(counter, n)
+#endif // BVH_COUNTERS
+
+#if BVH_LEAF_FORMAT == 1
+#define kLeafSize 4
+#else
+#define kLeafSize 3
+#endif
+
+#if BVH_WIDTH > 2
+// a wide node is BVH_WIDTH / 4 groups of four children: min x/y/z, max x/y/z and the child references.
+// quantized nodes start with the frame of the node, then each group holds the references and the quantized bounds
+#define kWideGroupCount (BVH_WIDTH / 4)
+#if BVH_QUANTIZATION == 8
+#define kWideGroupBase 1
+#define kWideGroupSize 3
+#elif BVH_QUANTIZATION == 16
+#define kWideGroupBase 1
+#define kWideGroupSize 4
+#else
+#define kWideGroupBase 0
+#define kWideGroupSize 7
+#endif // BVH_QUANTIZATION
+#endif // BVH_WIDTH
+
+// wide nodes and ordered closest-hit traversal, BVHBuilder::kMaxStackSize. the builder bounds the depth of the tree so
+// that a traversal never pushes more (BVHBuilder::GetMaxDepth): 63 binary levels for the ordered skip-offset stream,
+// 42 at width 4 and 27 at width 8. not to be raised, gStack and gStackDist of the compute path take the 32KB of a group
+#define kStackSize 64
+
+#ifndef RAYTRACED_COMPUTE
+#define RAYTRACED_COMPUTE 0
+#endif
+
+#if RAYTRACED_COMPUTE
+#include "RayTracedTilesCommon.hlsl"
+
+// the stacks of the threads of a group interleaved in groupshared memory instead of indexed registers, 16KB for the
+// 8x8 threads of a tile. gStackThread is set by the compute entry (RayTracedCompute.hlsl)
+groupshared int gStack[kStackSize * kTileSize * kTileSize];
+static uint gStackThread = 0;
+
+// the reflective stencil of RayTracedTiles, the compute reflections test it in place of the depth stencil state
+Texture2D<uint2> Stencil : register(t12);
+
+#define STACK_DECLARATION
+#define STACK(i) gStack[(i) * (kTileSize * kTileSize) + gStackThread]
+
+// the distances at which the ray enters the children on the stack of the ordered wide traversal (BVH_ORDERED), another
+// 16KB next to gStack, the 32KB a group may hold
+#if RAYTRACED_REFLECTIONS && BVH_ORDERED && BVH_WIDTH > 2
+groupshared float gStackDist[kStackSize * kTileSize * kTileSize];
+#endif
+
+#define STACK_DIST_DECLARATION
+#define STACK_DIST(i) gStackDist[(i) * (kTileSize * kTileSize) + gStackThread]
+#else
+#define STACK_DECLARATION int stack[kStackSize]
+#define STACK(i) stack[i]
+
+#define STACK_DIST_DECLARATION float stackDist[kStackSize]
+#define STACK_DIST(i) stackDist[i]
+#endif // RAYTRACED_COMPUTE
+
+// the closest-hit traversal of the reflections skips the boxes beyond the closest hit and visits the nearer child first
+#ifndef BVH_ORDERED
+#define BVH_ORDERED 0
+#endif
+
 float3 GetWorldPos(const float2 uv, const float depth)
 {
     float4 clipPos = float4(2 * uv - 1, depth, 1);
@@ -65,6 +190,118 @@ bool RayBoxIntersect(const float3 origin,
 	return a1 >= a0;
 }
 
+// the same test clipped to the closest hit so far, tNear is where the ray enters the box
+bool RayBoxIntersect(const float3 origin,
+                     const float3 dirInv,
+                     const float3 aabbMin,
+                     const float3 aabbMax,
+                     const float maxDist,
+                     out float tNear)
+{
+	const float3 t0 = (aabbMin - origin) * dirInv;
+	const float3 t1 = (aabbMax - origin) * dirInv;
+
+	const float3 tmin = min(t0, t1);
+	const float3 tmax = max(t0, t1);
+
+	tNear = max(max(0.0f, tmin.x), max(tmin.y, tmin.z));
+	const float a1 = min(tmax.x, min(tmax.y, tmax.z));
+
+	return a1 >= tNear && tNear <= maxDist;
+}
+
+#if BVH_WIDTH > 2
+// bounds: min x/y/z, max x/y/z of the four children
+bool4 RayBoxIntersect4(const float3 origin,
+                       const float3 dirInv,
+                       const float4 bounds[6])
+{
+	const float4 t0x = (bounds[0] - origin.x) * dirInv.x;
+	const float4 t0y = (bounds[1] - origin.y) * dirInv.y;
+	const float4 t0z = (bounds[2] - origin.z) * dirInv.z;
+	const float4 t1x = (bounds[3] - origin.x) * dirInv.x;
+	const float4 t1y = (bounds[4] - origin.y) * dirInv.y;
+	const float4 t1z = (bounds[5] - origin.z) * dirInv.z;
+
+	const float4 a0 = max(max(0.0f, min(t0x, t1x)), max(min(t0y, t1y), min(t0z, t1z)));
+	const float4 a1 = min(max(t0x, t1x), min(max(t0y, t1y), max(t0z, t1z)));
+
+	return a1 >= a0;
+}
+
+// the same test clipped to the closest hit so far, tNear is where the ray enters the boxes
+bool4 RayBoxIntersect4(const float3 origin,
+                       const float3 dirInv,
+                       const float4 bounds[6],
+                       const float maxDist,
+                       out float4 tNear)
+{
+	const float4 t0x = (bounds[0] - origin.x) * dirInv.x;
+	const float4 t0y = (bounds[1] - origin.y) * dirInv.y;
+	const float4 t0z = (bounds[2] - origin.z) * dirInv.z;
+	const float4 t1x = (bounds[3] - origin.x) * dirInv.x;
+	const float4 t1y = (bounds[4] - origin.y) * dirInv.y;
+	const float4 t1z = (bounds[5] - origin.z) * dirInv.z;
+
+	tNear = max(max(0.0f, min(t0x, t1x)), max(min(t0y, t1y), min(t0z, t1z)));
+	const float4 a1 = min(max(t0x, t1x), min(max(t0y, t1y), max(t0z, t1z)));
+
+	return a1 >= tNear && tNear <= maxDist;
+}
+
+// reads group g of the wide node at nodeOffset, quantized bounds decode to origin + q * scale (BVHBuilder::DecodeQuantizedGroup)
+void LoadWideGroup(const int nodeOffset,
+                   const int g,
+                   out float4 bounds[6],
+                   out int4 children)
+{
+	const int groupOffset = nodeOffset + kWideGroupBase + g * kWideGroupSize;
+
+#if BVH_QUANTIZATION
+	const float4 frame = BVH[nodeOffset];
+
+	// power of two scales from their biased exponents
+	const uint exponents = asuint(frame.w);
+	const float3 scale = asfloat(uint3(exponents & 0xff, (exponents >> 8) & 0xff, (exponents >> 16) & 0xff) << 23);
+
+	children = asint(BVH[groupOffset]);
+
+#if BVH_QUANTIZATION == 8
+	const uint4 q0 = asuint(BVH[groupOffset + 1]);
+	const uint4 q1 = asuint(BVH[groupOffset + 2]);
+	const uint rows[6] = { q0.x, q0.y, q0.z, q0.w, q1.x, q1.y };
+
+	[unroll]
+	for (int i = 0; i < 6; ++i)
+	{
+		const float4 q = float4(rows[i] & 0xff, (rows[i] >> 8) & 0xff, (rows[i] >> 16) & 0xff, rows[i] >> 24);
+		bounds[i] = frame[i % 3] + q * scale[i % 3];
+	}
+#else
+	const uint4 q0 = asuint(BVH[groupOffset + 1]);
+	const uint4 q1 = asuint(BVH[groupOffset + 2]);
+	const uint4 q2 = asuint(BVH[groupOffset + 3]);
+	const uint rows[12] = { q0.x, q0.y, q0.z, q0.w, q1.x, q1.y, q1.z, q1.w, q2.x, q2.y, q2.z, q2.w };
+
+	[unroll]
+	for (int i = 0; i < 6; ++i)
+	{
+		const float4 q = float4(rows[2 * i] & 0xffff, rows[2 * i] >> 16, rows[2 * i + 1] & 0xffff, rows[2 * i + 1] >> 16);
+		bounds[i] = frame[i % 3] + q * scale[i % 3];
+	}
+#endif // BVH_QUANTIZATION
+#else
+	[unroll]
+	for (int i = 0; i < 6; ++i)
+	{
+		bounds[i] = BVH[groupOffset + i];
+	}
+
+	children = asint(BVH[groupOffset + 6]);
+#endif // BVH_QUANTIZATION
+}
+#endif // BVH_WIDTH
+
 bool RayTriIntersect(const float3 origin,
                      const float3 dir,
                      const float3 v0,
@@ -95,25 +332,365 @@ bool RayTriIntersect(const float3 origin,
 	}
 }
 
-bool RayTraced(const float3 worldPos,
-			   const float3 rayDir,
-			   const float3 rayDirInv
+// rows of the world to triangle space transform (BVHBuilder::WoopLeaf), the ray crosses the triangle where z = 0
+// and x, y are its barycentrics there
+bool RayTriIntersectWoop(const float3 origin,
+                         const float3 dir,
+                         const float4 row0,
+                         const float4 row1,
+                         const float4 row2,
+                         inout float t,
+                         inout float2 bc)
+{
+	const float oz = dot(row2.xyz, origin) + row2.w;
+	const float dz = dot(row2.xyz, dir);
+	t = -oz / dz;
+
+	const float3 p = origin + t * dir;
+	bc = float2(dot(row0.xyz, p) + row0.w, dot(row1.xyz, p) + row1.w);
+
+	return !(
+#ifdef BACKFACE_CULLING
+		dz > 0 ||
+#endif // BACKFACE_CULLING
+		bc.x < 0.0 || bc.x > 1.0 || bc.y < 0.0 || (bc.x + bc.y) > 1.0 || t < 0.0 || t > 1e9);
+}
+
+// BVHBuilder::BaldwinWeberLeaf, the same transform without its fixed column: the axis in the low bits of row2.w
+// is taken as is, each row weights the two other axes and adds its translation
+bool RayTriIntersectBaldwinWeber(const float3 origin,
+                                 const float3 dir,
+                                 const float4 row0,
+                                 const float4 row1,
+                                 const float4 row2,
+                                 inout float t,
+                                 inout float2 bc)
+{
+	const int bits = int(row2.w);
+	const int axis = bits & 3;
+
+	// the free axes in x, y and the fixed one in z
+	const float3 o = (axis == 0) ? origin.yzx : (axis == 1) ? origin.zxy : origin;
+	const float3 d = (axis == 0) ? dir.yzx : (axis == 1) ? dir.zxy : dir;
+
+	const float oz = o.z + dot(row2.xy, o.xy) + row2.z;
+	const float dz = d.z + dot(row2.xy, d.xy);
+	t = -oz / dz;
+
+	const float2 p = o.xy + t * d.xy;
+	bc = float2(dot(row0.xy, p) + row0.z, dot(row1.xy, p) + row1.z);
+
+	return !(
+#ifdef BACKFACE_CULLING
+		((bits & 4) ? -dz : dz) > 0 ||
+#endif // BACKFACE_CULLING
+		bc.x < 0.0 || bc.x > 1.0 || bc.y < 0.0 || (bc.x + bc.y) > 1.0 || t < 0.0 || t > 1e9);
+}
+
+// intersects the triangles of a leaf, stored back to back from dataOffset
+bool RayTracedLeaf(const float3 worldPos,
+				   const float3 rayDir,
+				   int dataOffset,
+				   const int triangleCount
 #if RAYTRACED_REFLECTIONS
-			   , inout HitPoint hitPoint
+				   , inout float minDist
+				   , inout bool hit
+				   , inout HitRecord hitRecord
 #endif // RAYTRACED_REFLECTIONS
 )
 {
 	bool collision = false;
-    int dataOffset = 0;
-	int offsetToNextNode = 1;
-	
+
 	float t = 0;
 	float2 bc = 0; // barycentric coords
 
+    [loop]
+    for (int i = 0; i < triangleCount; ++i)
+    {
+        BVH_COUNT(gTriangleTests, 1);
+
+        const float4 triangle0 = BVH[dataOffset++];
+        const float4 triangle1 = BVH[dataOffset++];
+        const float4 triangle2 = BVH[dataOffset++];
+
+        // check for intersection with leaf triangle
+#if BVH_LEAF_FORMAT == 1
+        const float4 triangle3 = BVH[dataOffset++];
+
+        collision = RayTriIntersectWoop(worldPos, rayDir, triangle1, triangle2, triangle3, t, bc);
+#elif BVH_LEAF_FORMAT == 2
+        collision = RayTriIntersectBaldwinWeber(worldPos, rayDir, triangle0, triangle1, triangle2, t, bc);
+#else
+        collision = RayTriIntersect(worldPos, rayDir, triangle0.xyz, triangle1.xyz, triangle2.xyz, t, bc);
+#endif // BVH_LEAF_FORMAT
+
+#if RAYTRACED_SHADOWS
+        if (collision)
+        {
+            break;
+        }
+#elif RAYTRACED_REFLECTIONS
+        if (collision && t < minDist)
+        {
+            minDist = t;
+            hit = true;
+
+#if BVH_LEAF_FORMAT == 1
+            const int offset = triangle0.x;
+            const int materialIndex = triangle0.y;
+#elif BVH_LEAF_FORMAT == 2
+            const int offset = triangle1.w;
+            const int materialIndex = int(triangle2.w) >> 3;
+#else
+            const int offset = triangle1.w;
+            const int materialIndex = triangle2.w;
+#endif // BVH_LEAF_FORMAT
+
+            // the attributes are loaded once for the closest hit (GetHitPoint)
+            hitRecord.triangle = offset;
+            hitRecord.barycentrics = bc;
+            hitRecord.material = materialIndex;
+            hitRecord.distance = t;
+        }
+#endif // RAYTRACED_SHADOWS + RAYTRACED_REFLECTIONS
+    }
+
+	return collision;
+}
+
+// walks one mesh stream from the element holding its root, minDist and hit are shared by the meshes of a two-level stream
+#if RAYTRACED_REFLECTIONS && BVH_ORDERED
+// the axis along which the centers of two sibling boxes are the furthest apart, | 4 when the first one lies above the second
+// (BVHBuilder::GetChildOrder). the skip-offset stream keeps it in the max.w of every written node
+int GetChildOrder(const float3 firstMin,
+                  const float3 firstMax,
+                  const float3 secondMin,
+                  const float3 secondMax)
+{
+	const float3 d = (secondMin + secondMax) - (firstMin + firstMax);
+
+	int axis = (abs(d.x) > abs(d.y)) ? 0 : 1;
+	axis = (abs(d.z) > abs(d[axis])) ? 2 : axis;
+
+	return axis | ((d[axis] < 0) ? 4 : 0);
+}
+
+// the second child is the near one when the ray goes down the axis and the first child lies below, or the other way around
+bool IsSecondChildFirst(const float3 dir, const int order)
+{
+	return (dir[order & 3] < 0) != ((order & 4) != 0);
+}
+
+#if BVH_WIDTH == 2
+// float4 elements of a node and its subtree or of a leaf
+int GetEntrySize(const int offset)
+{
+	const int w = int(BVH[offset].w);
+
+	return (w < 0) ? 2 - w : (w > 0) ? kLeafSize * w : 2;
+}
+
+// the near child is visited next and the far one waits on a stack instead of walking the stream in order
+bool RayTracedMesh(const float3 worldPos,
+				   const float3 rayDir,
+				   const float3 rayDirInv,
+				   const int rootOffset,
+				   inout float minDist,
+				   inout bool hit,
+				   inout HitRecord hitRecord)
+{
+	STACK_DECLARATION;
+	int stackSize = 0;
+
+	int dataOffset = rootOffset;
+
+	// the root is not written, its children are the first entry and the one that follows it.
+	// they are ordered like the children of any node when both have bounds, a leaf root is followed by the terminator
+	{
+		int first = rootOffset;
+		int second = rootOffset + GetEntrySize(rootOffset);
+
+		const float4 first0 = BVH[first];
+		const float4 second0 = BVH[second];
+
+		if (int(second0.w) != 0)
+		{
+			if (int(first0.w) < 0 && int(second0.w) < 0 &&
+				IsSecondChildFirst(rayDir, GetChildOrder(first0.xyz, BVH[first + 1].xyz, second0.xyz, BVH[second + 1].xyz)))
+			{
+				const int nearChild = second;
+				second = first;
+				first = nearChild;
+			}
+
+			STACK(stackSize++) = second;
+			dataOffset = first;
+		}
+	}
+
+    [loop]
+    while (true)
+    {
+        const float4 element0 = BVH[dataOffset];
+        const float4 element1 = BVH[dataOffset + 1];
+
+        const int offsetToNextNode = int(element0.w);
+
+        BVH_COUNT(gIterations, 1);
+
+        if (offsetToNextNode < 0) // node
+        {
+            BVH_COUNT(gBoxTests, 1);
+
+            float tNear;
+
+            // the boxes entered beyond the closest hit are skipped
+            if (RayBoxIntersect(worldPos, rayDirInv, element0.xyz, element1.xyz, minDist, tNear))
+            {
+                int first = dataOffset + 2;
+                int second = first + GetEntrySize(first);
+
+                if (IsSecondChildFirst(rayDir, int(element1.w)))
+                {
+                    const int nearChild = second;
+                    second = first;
+                    first = nearChild;
+                }
+
+                // the stack never fills on a tree of BVHBuilder, the test keeps another stream from writing past it
+                if (stackSize < kStackSize)
+                {
+                    STACK(stackSize++) = second;
+                }
+
+                dataOffset = first;
+                continue;
+            }
+        }
+        else if (offsetToNextNode > 0) // leaf
+        {
+            RayTracedLeaf(worldPos, rayDir, dataOffset, offsetToNextNode, minDist, hit, hitRecord);
+        }
+
+        if (stackSize == 0)
+        {
+            break;
+        }
+
+        dataOffset = STACK(--stackSize);
+    }
+
+	return hit;
+}
+#else
+// the children that are hit go on the stack with the distance at which the ray enters them, the nearest on top
+bool RayTracedMesh(const float3 worldPos,
+				   const float3 rayDir,
+				   const float3 rayDirInv,
+				   const int rootOffset,
+				   inout float minDist,
+				   inout bool hit,
+				   inout HitRecord hitRecord)
+{
+	STACK_DECLARATION;
+	STACK_DIST_DECLARATION;
+	int stackSize = 0;
+
+	int child = rootOffset;
+	float childDist = 0;
+
+    [loop]
+    while (true)
+    {
+        BVH_COUNT(gIterations, 1);
+
+        if (childDist > minDist)
+        {
+            // a closer hit was found since the child was pushed
+        }
+        else if (child >= 0) // node
+        {
+            BVH_COUNT(gBoxTests, 4 * kWideGroupCount);
+
+            const int base = stackSize;
+
+            // pushed last first, the sort keeps the tree order between equal distances
+            [unroll]
+            for (int g = kWideGroupCount - 1; g >= 0; --g)
+            {
+                float4 bounds[6];
+                int4 children;
+
+                LoadWideGroup(child, g, bounds, children);
+
+                float4 tNear;
+                const bool4 collision = RayBoxIntersect4(worldPos, rayDirInv, bounds, minDist, tNear);
+
+                // the stack never fills on a tree of BVHBuilder, the test keeps another stream from writing past it
+                [unroll]
+                for (int i = 3; i >= 0; --i)
+                {
+                    if (collision[i] && children[i] != 0 && stackSize < kStackSize)
+                    {
+                        STACK(stackSize) = children[i];
+                        STACK_DIST(stackSize) = tNear[i];
+                        stackSize++;
+                    }
+                }
+            }
+
+            [loop]
+            for (int k = base + 1; k < stackSize; ++k)
+            {
+                const int pushed = STACK(k);
+                const float pushedDist = STACK_DIST(k);
+
+                int j = k;
+
+                [loop]
+                for (; j > base && STACK_DIST(j - 1) < pushedDist; --j)
+                {
+                    STACK(j) = STACK(j - 1);
+                    STACK_DIST(j) = STACK_DIST(j - 1);
+                }
+
+                STACK(j) = pushed;
+                STACK_DIST(j) = pushedDist;
+            }
+        }
+        else // leaf
+        {
+            RayTracedLeaf(worldPos, rayDir, (-child) >> 4, (-child) & 15, minDist, hit, hitRecord);
+        }
+
+        if (stackSize == 0)
+        {
+            break;
+        }
+
+        stackSize--;
+        child = STACK(stackSize);
+        childDist = STACK_DIST(stackSize);
+    }
+
+	return hit;
+}
+#endif // BVH_WIDTH
+#elif BVH_WIDTH == 2
+bool RayTracedMesh(const float3 worldPos,
+				   const float3 rayDir,
+				   const float3 rayDirInv,
+				   const int rootOffset
 #if RAYTRACED_REFLECTIONS
-	float minDist = FLT_MAX;
-	bool hit = false;
+				   , inout float minDist
+				   , inout bool hit
+				   , inout HitRecord hitRecord
 #endif // RAYTRACED_REFLECTIONS
+)
+{
+	bool collision = false;
+    int dataOffset = rootOffset;
+	int offsetToNextNode = 1;
 
     [loop]
     while (offsetToNextNode != 0)
@@ -125,8 +702,12 @@ bool RayTraced(const float3 worldPos,
 
         collision = false;
 
+        BVH_COUNT(gIterations, 1);
+
         if (offsetToNextNode < 0) // node
         {
+            BVH_COUNT(gBoxTests, 1);
+
             // check for intersection with node AABB
             collision = RayBoxIntersect(worldPos, rayDirInv, element0.xyz, element1.xyz);
 
@@ -139,57 +720,21 @@ bool RayTraced(const float3 worldPos,
         }
         else if (offsetToNextNode > 0) // leaf
         {
-            const float4 element2 = BVH[dataOffset++];
-
-            // check for intersection with leaf triangle
-            collision = RayTriIntersect(worldPos, rayDir, element0.xyz, element1.xyz, element2.xyz, t, bc);
+            // the leaf triangles are stored back to back, the first one holds the size of the list
+            const int triangleCount = offsetToNextNode;
 
 #if RAYTRACED_SHADOWS
+            collision = RayTracedLeaf(worldPos, rayDir, dataOffset - 2, triangleCount);
+
             if (collision)
             {
                 break;
             }
 #elif RAYTRACED_REFLECTIONS
-            if (collision && t < minDist)
-            {
-				minDist = t;
-				hit = true;
-
-                const float3 v0 = element0.xyz;
-                const float3 v1 = element1.xyz + v0;
-                const float3 v2 = element2.xyz + v0;
-
-                // triangle index
-                int offset = element1.w;
-                
-                float4 e0 = VertexBuffer[offset++];
-                float4 e1 = VertexBuffer[offset++];
-
-                const float3 n0 = e0.xyz;
-                const float3 t0 = e1.xyz;
-                const float2 u0 = float2(e0.w, e1.w);
-                
-                e0 = VertexBuffer[offset++];
-                e1 = VertexBuffer[offset++];
-
-                const float3 n1 = e0.xyz;
-                const float3 t1 = e1.xyz;
-                const float2 u1 = float2(e0.w, e1.w);
-                
-                e0 = VertexBuffer[offset++];
-                e1 = VertexBuffer[offset++];
-
-                const float3 n2 = e0.xyz;
-                const float3 t2 = e1.xyz;
-                const float2 u2 = float2(e0.w, e1.w);
-
-                hitPoint.worldPos = v0 * (1 - bc.x - bc.y) + v1 * bc.x + v2 * bc.y;
-                hitPoint.normal   = n0 * (1 - bc.x - bc.y) + n1 * bc.x + n2 * bc.y;
-                hitPoint.uv       = u0 * (1 - bc.x - bc.y) + u1 * bc.x + u2 * bc.y;
-                hitPoint.tangent  = t0 * (1 - bc.x - bc.y) + t1 * bc.x + t2 * bc.y;
-				hitPoint.materialIndex = element2.w;
-            }
+            RayTracedLeaf(worldPos, rayDir, dataOffset - 2, triangleCount, minDist, hit, hitRecord);
 #endif // RAYTRACED_SHADOWS + RAYTRACED_REFLECTIONS
+
+            dataOffset += kLeafSize * triangleCount - 2;
         }
     }
 
@@ -198,4 +743,229 @@ bool RayTraced(const float3 worldPos,
 #elif RAYTRACED_REFLECTIONS
 	return hit; // TODO: can we use collision also for reflections?
 #endif // RAYTRACED_SHADOWS + RAYTRACED_REFLECTIONS
-}
\ No newline at end of file
+}
+#else
+bool RayTracedMesh(const float3 worldPos,
+				   const float3 rayDir,
+				   const float3 rayDirInv,
+				   const int rootOffset
+#if RAYTRACED_REFLECTIONS
+				   , inout float minDist
+				   , inout bool hit
+				   , inout HitRecord hitRecord
+#endif // RAYTRACED_REFLECTIONS
+)
+{
+	STACK_DECLARATION;
+	int stackSize = 0;
+
+	// > 0 node, < 0 leaf -(offset << 4 | triangle count), the root of a single-level stream sits at 0
+	int child = rootOffset;
+
+    [loop]
+    while (true)
+    {
+        BVH_COUNT(gIterations, 1);
+
+        if (child >= 0) // node
+        {
+            BVH_COUNT(gBoxTests, 4 * kWideGroupCount);
+
+            // one fetch per group tests four children, the hit ones are pushed last first to be visited in tree order
+            [unroll]
+            for (int g = kWideGroupCount - 1; g >= 0; --g)
+            {
+                float4 bounds[6];
+                int4 children;
+
+                LoadWideGroup(child, g, bounds, children);
+
+                const bool4 collision = RayBoxIntersect4(worldPos, rayDirInv, bounds);
+
+                // the stack never fills on a tree of BVHBuilder, the test keeps another stream from writing past it
+                [unroll]
+                for (int i = 3; i >= 0; --i)
+                {
+                    if (collision[i] && children[i] != 0 && stackSize < kStackSize)
+                    {
+                        STACK(stackSize++) = children[i];
+                    }
+                }
+            }
+        }
+        else // leaf
+        {
+#if RAYTRACED_SHADOWS
+            if (RayTracedLeaf(worldPos, rayDir, (-child) >> 4, (-child) & 15))
+            {
+                return true;
+            }
+#elif RAYTRACED_REFLECTIONS
+            RayTracedLeaf(worldPos, rayDir, (-child) >> 4, (-child) & 15, minDist, hit, hitRecord);
+#endif // RAYTRACED_SHADOWS + RAYTRACED_REFLECTIONS
+        }
+
+        if (stackSize == 0)
+        {
+            break;
+        }
+
+        child = STACK(--stackSize);
+    }
+
+#if RAYTRACED_SHADOWS
+	return false;
+#elif RAYTRACED_REFLECTIONS
+	return hit;
+#endif // RAYTRACED_SHADOWS + RAYTRACED_REFLECTIONS
+}
+#endif // BVH_WIDTH
+
+#if BVH_TWO_LEVEL
+// the first element holds the offset of the top level, a skip-offset stream whose leaves are 7 element instance records:
+// x material, y instance index, w offset of the mesh stream, then the world to object and object to world rows
+bool RayTraced(const float3 worldPos,
+			   const float3 rayDir,
+			   const float3 rayDirInv
+#if RAYTRACED_REFLECTIONS
+			   , inout HitRecord hitRecord
+#endif // RAYTRACED_REFLECTIONS
+)
+{
+    int dataOffset = asint(BVH[0].x);
+	int offsetToNextNode = 1;
+
+#if RAYTRACED_REFLECTIONS
+	float minDist = FLT_MAX;
+	bool hit = false;
+#endif // RAYTRACED_REFLECTIONS
+
+    [loop]
+    while (offsetToNextNode != 0)
+    {
+        const float4 element0 = BVH[dataOffset++];
+        const float4 element1 = BVH[dataOffset++];
+
+        offsetToNextNode = int(element0.w);
+
+        BVH_COUNT(gIterations, 1);
+
+        if (offsetToNextNode < 0) // node
+        {
+            BVH_COUNT(gBoxTests, 1);
+
+#if RAYTRACED_REFLECTIONS && BVH_ORDERED
+            float tNear;
+
+            // the instances behind the closest hit are skipped
+            if (!RayBoxIntersect(worldPos, rayDirInv, element0.xyz, element1.xyz, minDist, tNear))
+#else
+            if (!RayBoxIntersect(worldPos, rayDirInv, element0.xyz, element1.xyz))
+#endif // RAYTRACED_REFLECTIONS + BVH_ORDERED
+            {
+                dataOffset += abs(offsetToNextNode);
+            }
+        }
+        else if (offsetToNextNode > 0) // instance
+        {
+            const float3x4 worldInv = float3x4(element1, BVH[dataOffset], BVH[dataOffset + 1]);
+
+            // the direction is not normalized so that t is the same in object and world space
+            const float3 objectPos = mul(worldInv, float4(worldPos, 1));
+            const float3 objectDir = mul((float3x3)worldInv, rayDir);
+
+#if RAYTRACED_SHADOWS
+            if (RayTracedMesh(objectPos, objectDir, 1 / objectDir, offsetToNextNode))
+            {
+                return true;
+            }
+#elif RAYTRACED_REFLECTIONS
+            const float instanceMinDist = minDist;
+
+            RayTracedMesh(objectPos, objectDir, 1 / objectDir, offsetToNextNode, minDist, hit, hitRecord);
+
+            if (minDist < instanceMinDist)
+            {
+                hitRecord.material = element0.x;
+                hitRecord.instance = dataOffset - 1;
+            }
+#endif // RAYTRACED_SHADOWS + RAYTRACED_REFLECTIONS
+
+            dataOffset += 5;
+        }
+    }
+
+#if RAYTRACED_SHADOWS
+	return false;
+#elif RAYTRACED_REFLECTIONS
+	return hit;
+#endif // RAYTRACED_SHADOWS + RAYTRACED_REFLECTIONS
+}
+#else
+bool RayTraced(const float3 worldPos,
+			   const float3 rayDir,
+			   const float3 rayDirInv
+#if RAYTRACED_REFLECTIONS
+			   , inout HitRecord hitRecord
+#endif // RAYTRACED_REFLECTIONS
+)
+{
+#if RAYTRACED_SHADOWS
+	return RayTracedMesh(worldPos, rayDir, rayDirInv, 0);
+#elif RAYTRACED_REFLECTIONS
+	float minDist = FLT_MAX;
+	bool hit = false;
+
+	RayTracedMesh(worldPos, rayDir, rayDirInv, 0, minDist, hit, hitRecord);
+
+	return hit;
+#endif // RAYTRACED_SHADOWS + RAYTRACED_REFLECTIONS
+}
+#endif // BVH_TWO_LEVEL
+
+#if RAYTRACED_REFLECTIONS
+// the attributes of a closest hit of the ray worldPos + t * rayDir, in world space
+HitPoint GetHitPoint(const HitRecord hitRecord,
+                     const float3 worldPos,
+                     const float3 rayDir)
+{
+    // triangle record, it holds the records of the three vertices
+    const uint3 vertices = VertexBuffer[hitRecord.triangle];
+
+    float3 n0, n1, n2;
+    float3 t0, t1, t2;
+    float2 u0, u1, u2;
+
+    LoadHitVertex(vertices.x, n0, t0, u0);
+    LoadHitVertex(vertices.y, n1, t1, u1);
+    LoadHitVertex(vertices.z, n2, t2, u2);
+
+    const float2 bc = hitRecord.barycentrics;
+
+    HitPoint hitPoint;
+    hitPoint.worldPos = worldPos + hitRecord.distance * rayDir;
+    hitPoint.normal   = n0 * (1 - bc.x - bc.y) + n1 * bc.x + n2 * bc.y;
+    hitPoint.uv       = u0 * (1 - bc.x - bc.y) + u1 * bc.x + u2 * bc.y;
+    hitPoint.tangent  = t0 * (1 - bc.x - bc.y) + t1 * bc.x + t2 * bc.y;
+    hitPoint.materialIndex = hitRecord.material;
+
+#if BVH_TWO_LEVEL
+    const float3x4 worldInv = float3x4(BVH[hitRecord.instance], BVH[hitRecord.instance + 1], BVH[hitRecord.instance + 2]);
+    const float3x4 world = float3x4(BVH[hitRecord.instance + 3], BVH[hitRecord.instance + 4], BVH[hitRecord.instance + 5]);
+
+    // normals go through the inverse transpose
+    hitPoint.normal = mul(hitPoint.normal, (float3x3)worldInv);
+    hitPoint.tangent = mul((float3x3)world, hitPoint.tangent);
+#endif // BVH_TWO_LEVEL
+
+    return hitPoint;
+}
+#endif // RAYTRACED_REFLECTIONS
+
+#if BVH_COUNTERS
+// x box tests, y triangle tests, z iterations and w 1 for a traced pixel, the pixels that are not traced keep the clear value
+void WriteTraversalCounters(const float2 position)
+{
+	TraversalCounters[uint3(position, RAYTRACED_SHADOWS ? 0 : 1)] = uint4(gBoxTests, gTriangleTests, gIterations, 1);
+}
+#endif // BVH_COUNTERS
\ No newline at end of file
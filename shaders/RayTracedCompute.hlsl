@@ -0,0 +1,70 @@
+// compute entry of the raytraced passes over the tiles listed by RayTracedTiles, included at the end of
+// RayTracedShadows.hlsl and RayTracedReflections.hlsl once they define RayTracedPixel
+
+#define kTilePass (RAYTRACED_SHADOWS ? 0 : 1)
+#define kTilePixelCount (kTileSize * kTileSize)
+
+#ifndef RAYTRACED_PERSISTENT
+#define RAYTRACED_PERSISTENT 0
+#endif
+
+#if RAYTRACED_PERSISTENT
+RWByteAddressBuffer TileArgs : register(u2);
+
+// pixels taken from the tile lists per atomic, one row of a tile
+#define kRayBatchSize kTileSize
+
+// a fixed number of groups whose threads take batches of pixels from the work counter of the pass until the listed
+// tiles run out, so that the threads that finish early keep tracing instead of waiting for the slowest ray of their tile
+[numthreads(kTileSize, kTileSize, 1)]
+void RayTracedCS(const uint index : SV_GroupIndex)
+{
+	gStackThread = index;
+
+	const uint rayCount = TileArgs.Load(kDrawArgsOffset(kTilePass) + 4) * kTilePixelCount;
+
+	[loop]
+	while (true)
+	{
+		uint batch;
+		TileArgs.InterlockedAdd(kWorkCounterOffset(kTilePass), 1, batch);
+
+		const uint first = batch * kRayBatchSize;
+
+		if (first >= rayCount)
+		{
+			break;
+		}
+
+		[loop]
+		for (uint i = 0; i < kRayBatchSize; ++i)
+		{
+			const uint ray = first + i;
+			const uint thread = ray % kTilePixelCount;
+
+			RayTracedPixel(GetTilePixel(Tiles[ray / kTilePixelCount], uint2(thread % kTileSize, thread / kTileSize)));
+		}
+	}
+}
+#else
+ByteAddressBuffer TileArgs : register(t13);
+
+// one group per listed tile, dispatched indirectly over rows of tileCount.x groups
+[numthreads(kTileSize, kTileSize, 1)]
+void RayTracedCS(const uint3 groupId : SV_GroupID,
+                 const uint3 threadId : SV_GroupThreadID,
+                 const uint index : SV_GroupIndex)
+{
+	gStackThread = index;
+
+	const uint tileIndex = groupId.y * tileCount.x + groupId.x;
+
+	// the last row is not full
+	if (tileIndex >= TileArgs.Load(kDrawArgsOffset(kTilePass) + 4))
+	{
+		return;
+	}
+
+	RayTracedPixel(GetTilePixel(Tiles[tileIndex], threadId.xy));
+}
+#endif // RAYTRACED_PERSISTENT
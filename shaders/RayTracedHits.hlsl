@@ -0,0 +1,66 @@
+// the hit records of the reflections (RAYTRACED_DEFERRED) grouped by material. RayTracedBinHitsCS turns the hit counts
+// of the bins into the start of their ranges, RayTracedScatterHitsCS copies each record into the range of its bin, so
+// that the groups of the shading pass (RayTracedShadeHitsCS) mostly shade one material
+
+#include "RayTracedHitsCommon.hlsl"
+
+StructuredBuffer<HitRecord> Hits : register(t0);
+
+RWByteAddressBuffer HitCounts : register(u0);
+
+// RayTracedBinHitsCS, the DispatchIndirect arguments of the scatter and shading passes
+RWByteAddressBuffer HitArgs : register(u1);
+
+// RayTracedScatterHitsCS
+RWStructuredBuffer<HitRecord> SortedHits : register(u2);
+
+groupshared uint gBinOffsets[kHitBinCount];
+
+// one group, one thread per bin
+[numthreads(kHitBinCount, 1, 1)]
+void RayTracedBinHitsCS(const uint index : SV_GroupIndex)
+{
+	const uint count = HitCounts.Load(kHitBinCountOffset(index));
+
+	gBinOffsets[index] = count;
+
+	GroupMemoryBarrierWithGroupSync();
+
+	// inclusive prefix sum of the bin counts
+	[unroll]
+	for (uint stride = 1; stride < kHitBinCount; stride *= 2)
+	{
+		const uint sum = (index >= stride) ? gBinOffsets[index - stride] : 0;
+
+		GroupMemoryBarrierWithGroupSync();
+
+		gBinOffsets[index] += sum;
+
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	HitCounts.Store(kHitBinCursorOffset(index), gBinOffsets[index] - count);
+
+	if (index == 0)
+	{
+		const uint hitCount = HitCounts.Load(kHitCountOffset);
+
+		HitArgs.Store3(0, uint3((hitCount + kHitGroupSize - 1) / kHitGroupSize, 1, 1));
+	}
+}
+
+[numthreads(kHitGroupSize, 1, 1)]
+void RayTracedScatterHitsCS(const uint3 id : SV_DispatchThreadID)
+{
+	if (id.x >= HitCounts.Load(kHitCountOffset))
+	{
+		return;
+	}
+
+	const HitRecord record = Hits[id.x];
+
+	uint slot;
+	HitCounts.InterlockedAdd(kHitBinCursorOffset(GetHitBin(record.material)), 1, slot);
+
+	SortedHits[slot] = record;
+}
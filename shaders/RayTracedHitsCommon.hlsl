@@ -0,0 +1,29 @@
+// closest hit of a reflection ray. the trace fills it, GetHitPoint turns it into the attributes of the hit for shading.
+// RayTracedHits::kHitRecordSize
+struct HitRecord
+{
+    uint   pixel;        // x | y << 16, set by the caller of the trace
+    uint   triangle;     // VertexBuffer record of the triangle
+    float2 barycentrics;
+    uint   material;
+    float  distance;     // along the unnormalized ray from the pixel
+    uint   instance;     // BVH element of the world to object rows of the instance (BVH_TWO_LEVEL)
+};
+
+// material bins of the deferred shading (RAYTRACED_DEFERRED), the materials from kHitBinCount - 1 on share the last bin.
+// RayTracedHits::kBinCount
+#define kHitBinCount 256
+
+// threads per group of the scatter and shading dispatches, RayTracedHits::kGroupSize
+#define kHitGroupSize 64
+
+// byte offsets in the counts buffer of RayTracedHits: the hit count, then the hit count of each bin, then the cursor of
+// each bin that the scatter advances from the start of its range
+#define kHitCountOffset 0
+#define kHitBinCountOffset(bin) (16 + 4 * (bin))
+#define kHitBinCursorOffset(bin) (16 + 4 * (kHitBinCount + (bin)))
+
+uint GetHitBin(const uint material)
+{
+	return min(material, kHitBinCount - 1);
+}
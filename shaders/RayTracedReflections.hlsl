@@ -2,42 +2,223 @@
 #define RAYTRACED_REFLECTIONS 1
 #include "RayTracedCommon.hlsl"
 
+#ifndef RAYTRACED_DEFERRED
+#define RAYTRACED_DEFERRED 0
+#endif
+
+#ifndef RAYTRACED_HIT_SHADING
+#define RAYTRACED_HIT_SHADING 0
+#endif
+
+#if RAYTRACED_COMPUTE || RAYTRACED_HIT_SHADING
+// no derivatives in a compute shader, the hits are shaded from the top mip
+#define Sample(s, uv) SampleLevel(s, uv, 0)
+#endif // RAYTRACED_COMPUTE + RAYTRACED_HIT_SHADING
+
 #define FIXME 1
 #define SHADOW_MAPPING 0
 #include "../RenderToyD3D11/shaders/Default.hlsl"
 
-float4 RayTracedReflectionsPS(const VertexOut pin) : SV_Target
+#ifndef RAYTRACED_SSPR
+#define RAYTRACED_SSPR 0
+#endif
+
+#if RAYTRACED_SSPR
+// the screen-space planar reflections, alpha 0 where they found nothing (SSPR)
+Texture2D<float4> SSPRReflections : register(t4);
+#endif // RAYTRACED_SSPR
+
+#ifndef RAYTRACED_REDUCED
+#define RAYTRACED_REDUCED 0
+#endif
+
+#if RAYTRACED_REDUCED
+#include "ReducedReflectionsCommon.hlsl"
+#endif // RAYTRACED_REDUCED
+
+#ifndef RAYTRACED_HIZ
+#define RAYTRACED_HIZ 0
+#endif
+
+#if RAYTRACED_HIZ
+// min-depth pyramid of the depth buffer and the lit previous frame (HiZ, FrameHistory)
+Texture2D<float> HiZ : register(t14);
+Texture2D<float4> HiZHistory : register(t15);
+
+cbuffer HiZCB : register(b4)
 {
-    const float depth = DepthBuffer.Load(uint3(pin.position.xy, 0));
-    const float4 gbuffer = GBuffer.Load(uint3(pin.position.xy, 0));
+    float4x4 gHiZViewProj;
+    float4x4 gHiZPrevViewProj;
+    uint2    gHiZScreenSize;
+    uint     gHiZMipCount;
+    uint     gHiZHistoryValid;
+};
 
-    const float3 normal = gbuffer.xyz;
-    const int materialIndex = gbuffer.w;
+#define kHiZMaxIterations 64
 
-    const MaterialData material = gMaterialBuffer[materialIndex];
+// world distance between where the march stops and the visible surface for a hit, beyond it the ray passes behind the
+// surface. the BVH also restarts this far before where the march gave up
+#define kHiZThickness 0.25
 
-    if ((depth == 1) || (material.roughness == 1))
+// uv of a clip position with its depth
+float3 GetScreenPos(const float4 clipPos)
+{
+    return float3(float2(clipPos.x, -clipPos.y) / clipPos.w * 0.5 + 0.5, clipPos.z / clipPos.w);
+}
+
+// cells of the level across the screen, a cell is 2^level pixels wide. the pyramid is padded to a power of two, the
+// texel of a cell holds the nearest depth of exactly its pixels, or of more once a side of the mip is 1 texel wide
+float2 GetCellCount(const uint level)
+{
+    return float2(gHiZScreenSize) / float(1u << level);
+}
+
+// the point where the screen ray o + d * z leaves its cell, just across the boundary
+float3 IntersectCellBoundary(const float3 o,
+                             const float3 d,
+                             const float2 cell,
+                             const float2 cellCount,
+                             const float2 crossStep,
+                             const float2 crossOffset)
+{
+    const float2 boundary = (cell + crossStep) / cellCount + crossOffset;
+    const float2 z = (boundary - o.xy) / d.xy;
+
+    return o + d * min(z.x, z.y);
+}
+
+// hierarchical march of the screen ray of a reflection ray away from the eye, it steps over the cells whose nearest depth
+// is behind the ray. true when it stops on the visible surface, with the colour of that surface in the previous frame.
+// otherwise the ray is free of visible surfaces up to worldPos + rayDir * marchedT
+bool HiZMarch(const float3 worldPos,
+              const float3 rayDir,
+              out float4 color,
+              out float marchedT)
+{
+    color = 0;
+    marchedT = 0;
+
+    const float4 startClip = mul(gHiZViewProj, float4(worldPos, 1));
+    const float4 endClip = mul(gHiZViewProj, float4(worldPos + rayDir, 1));
+
+    if (endClip.w <= 0)
     {
-        // do not raytrace sky pixels
-        // do not raytrace rough surfaces
-        discard;
+        // crosses the eye plane, left to the BVH
+        return false;
+    }
+
+    const float3 start = GetScreenPos(startClip);
+    float3 d = GetScreenPos(endClip) - start;
+
+    if (d.z <= 0)
+    {
+        // toward the eye, left to the BVH
+        return false;
     }
-    
-    float3 worldPos = GetWorldPos(pin.uv, depth);
 
-    // offset to avoid self shadows
-    worldPos += kSelfShadowOffset * normal;
+    // one unit per unit of depth, o at depth 0
+    d /= d.z;
+    const float3 o = start - d * start.z;
 
-    const float3 rayDir = reflect(worldPos - gEyePosition, normal);
-    const float3 rayDirInv = 1 / rayDir;
+    const float2 crossStep = float2(d.x >= 0 ? 1 : 0, d.y >= 0 ? 1 : 0);
+    const float2 crossOffset = (2 * crossStep - 1) * 0.00001;
 
-    HitPoint hitPoint;
-    
-    if (!RayTraced(worldPos, rayDir, rayDirInv, hitPoint))
+    // out of the cell of the pixel so that its own surface does not stop the ray
+    float2 cellCount = GetCellCount(0);
+    float3 ray = IntersectCellBoundary(o, d, floor(start.xy * cellCount), cellCount, crossStep, crossOffset);
+
+    int level = 0;
+    uint iterations = 0;
+
+    [loop]
+    while (level >= 0 && iterations < kHiZMaxIterations)
     {
-        discard;
+        if (any(ray.xy < 0) || any(ray.xy >= 1) || ray.z >= 1)
+        {
+            // off screen or beyond the far plane
+            break;
+        }
+
+        cellCount = GetCellCount(level);
+
+        const float2 cell = floor(ray.xy * cellCount);
+        const float minZ = HiZ.Load(int3(cell, level));
+
+        // down to the nearest surface of the cell
+        float3 next = (minZ > ray.z) ? o + d * minZ : ray;
+
+        if (any(floor(next.xy * cellCount) != cell))
+        {
+            // the cell is empty along the ray, past it and up two levels, the decrement below makes it one
+            next = IntersectCellBoundary(o, d, cell, cellCount, crossStep, crossOffset);
+            level = min(level + 2, int(gHiZMipCount) - 1);
+        }
+
+        ray = next;
+
+        --level;
+        ++iterations;
+    }
+
+    const float3 marched = GetWorldPos(ray.xy, ray.z);
+
+    marchedT = max(dot(marched - worldPos, rayDir) / dot(rayDir, rayDir) - kHiZThickness / length(rayDir), 0);
+
+    if (level >= 0)
+    {
+        // left the screen or ran out of iterations
+        return false;
+    }
+
+    const uint2 pixel = min(uint2(ray.xy * gHiZScreenSize), gHiZScreenSize - 1);
+    const float depth = DepthBuffer.Load(uint3(pixel, 0));
+
+    if (depth == 1)
+    {
+        return false;
     }
 
+    const float3 surface = GetWorldPos((pixel + 0.5) / gHiZScreenSize, depth);
+
+    if (distance(surface, marched) > kHiZThickness || !gHiZHistoryValid)
+    {
+        // behind the visible surface
+        return false;
+    }
+
+    // where the surface was in the previous frame
+    const float4 prevClip = mul(gHiZPrevViewProj, float4(surface, 1));
+    const float3 prev = GetScreenPos(prevClip);
+
+    if (prevClip.w <= 0 || any(prev.xy < 0) || any(prev.xy >= 1))
+    {
+        return false;
+    }
+
+    color = float4(HiZHistory.Load(uint3(prev.xy * gHiZScreenSize, 0)).rgb, 1);
+
+    return true;
+}
+#endif // RAYTRACED_HIZ
+
+// the reflection ray of a pixel, offset along the normal to avoid self shadows
+void GetReflectionRay(const float2 uv,
+                      const float depth,
+                      const float3 normal,
+                      out float3 worldPos,
+                      out float3 rayDir)
+{
+    worldPos = GetWorldPos(uv, depth) + kSelfShadowOffset * normal;
+    rayDir = reflect(worldPos - gEyePosition, normal);
+}
+
+// the colour of a closest hit of the reflection ray worldPos + t * rayDir
+float4 ShadeHit(const HitRecord hitRecord,
+                const float3 worldPos,
+                const float3 rayDir)
+{
+    const HitPoint hitPoint = GetHitPoint(hitRecord, worldPos, rayDir);
+
     DefaultVSOut pixel;
 	pixel.position = 0; // don't care
 	pixel.world    = hitPoint.worldPos;
@@ -54,4 +235,177 @@ float4 RayTracedReflectionsPS(const VertexOut pin) : SV_Target
     const float4 result = DefaultImpl(pixel, hitPoint.materialIndex);
 
     return float4(result.rgb, result.a /** material.roughness*/); // TODO: alpha based on roughness
-}
\ No newline at end of file
+}
+
+#if RAYTRACED_DEFERRED
+// the hit records of the frame and the counts of RayTracedHits, u3 and u4 so that they follow the UAVs of the compute path
+RWStructuredBuffer<HitRecord> Hits : register(u3);
+RWByteAddressBuffer HitCounts : register(u4);
+
+void AppendHit(const HitRecord hitRecord)
+{
+    uint index;
+    HitCounts.InterlockedAdd(kHitCountOffset, 1, index);
+    HitCounts.InterlockedAdd(kHitBinCountOffset(GetHitBin(hitRecord.material)), 1);
+
+    Hits[index] = hitRecord;
+}
+#endif // RAYTRACED_DEFERRED
+
+// false for the pixels that are not traced or whose ray misses, sky pixels and rough surfaces are not traced
+bool TraceReflection(const uint2 position,
+                     const float2 uv,
+                     out float4 color)
+{
+    const float depth = DepthBuffer.Load(uint3(position, 0));
+    const float4 gbuffer = GBuffer.Load(uint3(position, 0));
+
+    const float3 normal = gbuffer.xyz;
+    const int materialIndex = gbuffer.w;
+
+    const MaterialData material = gMaterialBuffer[materialIndex];
+
+    color = 0;
+
+    if ((depth == 1) || (material.roughness == 1))
+    {
+        // do not raytrace sky pixels
+        // do not raytrace rough surfaces
+        return false;
+    }
+    
+#if RAYTRACED_SSPR
+    const float4 sspr = SSPRReflections.Load(uint3(position, 0));
+
+    if (sspr.a > 0)
+    {
+        // resolved in screen space, no ray
+        color = sspr;
+        return true;
+    }
+#endif // RAYTRACED_SSPR
+
+#if RAYTRACED_REDUCED
+    if (!IsTracedPixel(position, material.roughness))
+    {
+        // reconstructed from the traced pixels around it (ReducedReflectionsUpsampleCS)
+        return false;
+    }
+#endif // RAYTRACED_REDUCED
+
+    float3 worldPos;
+    float3 rayDir;
+
+    GetReflectionRay(uv, depth, normal, worldPos, rayDir);
+
+    float3 rayOrigin = worldPos;
+
+#if RAYTRACED_HIZ
+    float marchedT;
+
+    if (HiZMarch(worldPos, rayDir, color, marchedT))
+    {
+        // resolved in screen space, no ray
+        return true;
+    }
+
+    // the BVH continues from where the march gave up
+    rayOrigin += marchedT * rayDir;
+#endif // RAYTRACED_HIZ
+
+    HitRecord hitRecord;
+    
+    const bool hit = RayTraced(rayOrigin, rayDir, 1 / rayDir, hitRecord);
+
+#if BVH_COUNTERS
+    // before the return of the missed pixels
+    WriteTraversalCounters(position);
+#endif // BVH_COUNTERS
+
+    if (!hit)
+    {
+        return false;
+    }
+
+#if RAYTRACED_HIZ
+    hitRecord.distance += marchedT;
+#endif // RAYTRACED_HIZ
+
+    hitRecord.pixel = position.x | (position.y << 16);
+
+#if RAYTRACED_DEFERRED
+    // shaded with the other hits of its material (RayTracedShadeHitsCS)
+    AppendHit(hitRecord);
+
+    return false;
+#else
+    color = ShadeHit(hitRecord, worldPos, rayDir);
+
+    return true;
+#endif // RAYTRACED_DEFERRED
+}
+
+float4 RayTracedReflectionsPS(const VertexOut pin) : SV_Target
+{
+    float4 color;
+
+    if (!TraceReflection(pin.position.xy, pin.uv, color))
+    {
+        discard;
+    }
+
+    return color;
+}
+
+#if RAYTRACED_COMPUTE
+// a copy of the reflections resolve target cleared to transparent
+RWTexture2D<float4> Reflections : register(u0);
+
+void RayTracedPixel(const uint2 pixel)
+{
+    float4 color;
+
+    // the stencil test of the pixel shader draw
+    if (all(pixel < screenSize) && Stencil.Load(uint3(pixel, 0)).y == 0 && TraceReflection(pixel, (pixel + 0.5) / screenSize, color))
+    {
+        Reflections[pixel] = color;
+    }
+}
+
+#include "RayTracedCompute.hlsl"
+#endif // RAYTRACED_COMPUTE
+
+#if RAYTRACED_HIT_SHADING
+// the hit records sorted by material (RayTracedHits), consecutive threads shade the hits of the same material
+StructuredBuffer<HitRecord> SortedHits : register(t16);
+ByteAddressBuffer SortedHitCounts : register(t17);
+
+// a copy of the reflections resolve target that keeps the screen-space reflections
+RWTexture2D<float4> Reflections : register(u0);
+
+[numthreads(kHitGroupSize, 1, 1)]
+void RayTracedShadeHitsCS(const uint3 id : SV_DispatchThreadID)
+{
+    if (id.x >= SortedHitCounts.Load(kHitCountOffset))
+    {
+        return;
+    }
+
+    const HitRecord hitRecord = SortedHits[id.x];
+    const uint2 position = uint2(hitRecord.pixel & 0xffff, hitRecord.pixel >> 16);
+
+    uint width, height;
+    DepthBuffer.GetDimensions(width, height);
+
+    const float depth = DepthBuffer.Load(uint3(position, 0));
+    const float3 normal = GBuffer.Load(uint3(position, 0)).xyz;
+
+    // the ray of the trace
+    float3 worldPos;
+    float3 rayDir;
+
+    GetReflectionRay((position + 0.5) / float2(width, height), depth, normal, worldPos, rayDir);
+
+    Reflections[position] = ShadeHit(hitRecord, worldPos, rayDir);
+}
+#endif // RAYTRACED_HIT_SHADING
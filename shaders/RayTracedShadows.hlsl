@@ -10,32 +10,68 @@ cbuffer RayTracedShadowsCB : register(b1)
     float    padding1x;
 };
 
-float RayTracedShadowsPS(const VertexOut pin) : SV_Target
+// false for the pixels that are not traced, sky pixels and surfaces that point away from the light
+bool TraceShadow(const uint2 position,
+                 const float2 uv,
+                 out bool shadowed)
 {
-    const float depth = DepthBuffer.Load(uint3(pin.position.xy, 0));
-    const float4 gbuffer = GBuffer.Load(uint3(pin.position.xy, 0));
+    const float depth = DepthBuffer.Load(uint3(position, 0));
+    const float4 gbuffer = GBuffer.Load(uint3(position, 0));
 
     const float3 normal = gbuffer.xyz;
     const int materialIndex = gbuffer.w;
 
 	const float NdotL = dot(normal, lightDir);
 
+    shadowed = false;
+
     if ((depth == 1) || (NdotL <= 0))
     {
         // do not raytrace sky pixels
         // do not raytrace surfaces that point away from the light
-        discard;
+        return false;
     }
     
-    float3 worldPos = GetWorldPos(pin.uv, depth);
+    float3 worldPos = GetWorldPos(uv, depth);
 
     // offset to avoid self shadows
     worldPos += kSelfShadowOffset * normal;
 
-    if (!RayTraced(worldPos, lightDir, lightDirInv))
+    shadowed = RayTraced(worldPos, lightDir, lightDirInv);
+
+#if BVH_COUNTERS
+    WriteTraversalCounters(position);
+#endif // BVH_COUNTERS
+
+    return true;
+}
+
+float RayTracedShadowsPS(const VertexOut pin) : SV_Target
+{
+    bool shadowed;
+
+    if (!TraceShadow(pin.position.xy, pin.uv, shadowed) || !shadowed)
     {
+        // the lit pixels keep the clear value
         discard;
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+#if RAYTRACED_COMPUTE
+// a copy of the shadows resolve target cleared to white
+RWTexture2D<float> Shadows : register(u0);
+
+void RayTracedPixel(const uint2 pixel)
+{
+    bool shadowed;
+
+    if (all(pixel < screenSize) && TraceShadow(pixel, (pixel + 0.5) / screenSize, shadowed) && shadowed)
+    {
+        Shadows[pixel] = 0;
+    }
+}
+
+#include "RayTracedCompute.hlsl"
+#endif // RAYTRACED_COMPUTE
@@ -0,0 +1,115 @@
+#define FIXME 1
+#include "../RenderToyD3D11/shaders/Common.hlsl"
+#include "../RenderToyD3D11/shaders/Fullscreen.hlsl"
+
+#define SHADOW_MAPPING 0
+#include "../RenderToyD3D11/shaders/Default.hlsl"
+
+#include "RayTracedTilesCommon.hlsl"
+
+Texture2D<float> DepthBuffer : register(t5);
+Texture2D<float4> GBuffer : register(t6);
+
+// 0 on the reflective surfaces, a depth buffer without stencil leaves the view null and every pixel reads 0
+Texture2D<uint2> Stencil : register(t7);
+
+RWStructuredBuffer<uint> ShadowTiles : register(u0);
+RWStructuredBuffer<uint> ReflectionTiles : register(u1);
+
+// the draw and dispatch arguments, kDrawArgsOffset and kDispatchArgsOffset
+RWByteAddressBuffer TileArgs : register(u2);
+
+groupshared uint gTileRays;
+
+// counts the tile into the draw and dispatch arguments of the pass, the dispatch grid grows by a row every tileCount.x tiles
+void AppendTile(const uint pass, const uint tile)
+{
+	uint slot;
+	TileArgs.InterlockedAdd(kDrawArgsOffset(pass) + 4, 1, slot);
+	TileArgs.InterlockedMax(kDispatchArgsOffset(pass) + 4, slot / tileCount.x + 1);
+
+	if (pass == 0)
+	{
+		ShadowTiles[slot] = tile;
+	}
+	else
+	{
+		ReflectionTiles[slot] = tile;
+	}
+}
+
+// one group per tile, a tile is listed for a pass when one of its pixels would not be discarded by the pass
+[numthreads(kTileSize, kTileSize, 1)]
+void RayTracedClassifyCS(const uint3 groupId : SV_GroupID,
+                         const uint3 id : SV_DispatchThreadID,
+                         const uint index : SV_GroupIndex)
+{
+	if (index == 0)
+	{
+		gTileRays = 0;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if (id.x < screenSize.x && id.y < screenSize.y)
+	{
+		const float depth = DepthBuffer.Load(uint3(id.xy, 0));
+		const float4 gbuffer = GBuffer.Load(uint3(id.xy, 0));
+		const uint stencil = Stencil.Load(uint3(id.xy, 0)).y;
+
+		const float3 normal = gbuffer.xyz;
+		const int materialIndex = gbuffer.w;
+
+		uint rays = 0;
+
+		// the discards of RayTracedShadowsPS
+		if (depth != 1 && dot(normal, tilesLightDir) > 0)
+		{
+			rays |= 1;
+		}
+
+		// the discards of RayTracedReflectionsPS and the stencil test of its draw
+		if (depth != 1 && stencil == 0 && gMaterialBuffer[materialIndex].roughness != 1)
+		{
+			rays |= 2;
+		}
+
+		if (rays != 0)
+		{
+			InterlockedOr(gTileRays, rays);
+		}
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if (index == 0)
+	{
+		const uint tile = groupId.x | (groupId.y << 16);
+
+		if (gTileRays & 1)
+		{
+			AppendTile(0, tile);
+		}
+
+		if (gTileRays & 2)
+		{
+			AppendTile(1, tile);
+		}
+	}
+}
+
+// one instance per listed tile, two triangles over the tile with the vertex output of the fullscreen triangle
+VertexOut RayTracedTileVS(const uint vertexId : SV_VertexID,
+                          const uint instanceId : SV_InstanceID)
+{
+	const uint2 corners[6] = { uint2(0, 0), uint2(1, 0), uint2(0, 1), uint2(0, 1), uint2(1, 0), uint2(1, 1) };
+
+	const uint2 pixel = min(GetTilePixel(Tiles[instanceId], corners[vertexId] * kTileSize), screenSize);
+	const float2 uv = float2(pixel) / float2(screenSize);
+
+	VertexOut vout = (VertexOut)0;
+	vout.position = float4(2 * uv.x - 1, 1 - 2 * uv.y, 0, 1);
+	vout.uv = uv;
+
+	return vout;
+}
@@ -0,0 +1,26 @@
+// pixels per tile side, RayTracedTiles::kTileSize
+#define kTileSize 8
+
+// byte offsets in the arguments buffer of RayTracedTiles. per pass a DrawInstancedIndirect argument set whose instance
+// count is the tile count, then per pass the tileCount.x wide group grid of a DispatchIndirect and the work counter of
+// the persistent threads
+#define kDrawArgsOffset(pass) (16 * (pass))
+#define kDispatchArgsOffset(pass) (32 + 16 * (pass))
+#define kWorkCounterOffset(pass) (44 + 16 * (pass))
+
+// tiles packed x | y << 16, one list per pass
+StructuredBuffer<uint> Tiles : register(t11);
+
+cbuffer RayTracedTilesCB : register(b3)
+{
+    float3   tilesLightDir;
+    float    tilesPadding;
+    uint2    screenSize;
+    uint2    tileCount;
+};
+
+// pixel of a thread of a kTileSize x kTileSize group over a listed tile
+uint2 GetTilePixel(const uint tile, const uint2 thread)
+{
+	return uint2(tile & 0xffff, tile >> 16) * kTileSize + thread;
+}
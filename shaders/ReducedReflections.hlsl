@@ -0,0 +1,213 @@
+#define FIXME 1
+#include "../RenderToyD3D11/shaders/Common.hlsl"
+
+#define SHADOW_MAPPING 0
+#include "../RenderToyD3D11/shaders/Default.hlsl"
+
+#include "ReducedReflectionsCommon.hlsl"
+
+// reconstruction of the reflections of the pixels that RAYTRACED_REDUCED does not trace (ReducedReflectionsUpsampleCS)
+// and its error against a trace of every pixel (ReducedReflectionsMetricCS)
+
+Texture2D<float> DepthBuffer : register(t5);
+Texture2D<float4> GBuffer : register(t6);
+
+// 0 on the reflective surfaces (RayTracedTiles)
+Texture2D<uint2> Stencil : register(t7);
+
+// the reflections resolve target
+Texture2D<float4> Reflections : register(t8);
+
+// the reflections resolve target of a trace of every pixel
+Texture2D<float4> Reference : register(t9);
+
+// a copy of the reflections resolve target
+RWTexture2D<float4> Output : register(u0);
+
+// x reflective pixels, y traced ones, z compared pixels, w their squared error in 1/256 (ReducedReflections::Totals)
+RWByteAddressBuffer Counters : register(u1);
+
+// view distance ratio at which the weight of a neighbour falls to 1/e, the normal weight is the dot product to this power
+#define kDepthSigma 0.02
+#define kNormalPower 32
+
+// per-pixel squared error in 1/65536 within a group, the group sum is added in 1/256
+#define kErrorScale 65536
+
+struct ReducedPixel
+{
+    float3 worldPos;
+    float3 normal;
+    float  roughness;
+    bool   bReflective;
+};
+
+ReducedPixel LoadPixel(const uint2 pixel)
+{
+	const float depth = DepthBuffer.Load(uint3(pixel, 0));
+	const float4 gbuffer = GBuffer.Load(uint3(pixel, 0));
+	const uint stencil = Stencil.Load(uint3(pixel, 0)).y;
+
+	const int materialIndex = gbuffer.w;
+
+	const float2 uv = (pixel + 0.5) / gReducedScreenSize;
+	const float4 worldPos = mul(gReducedViewProjInv, float4(2 * uv.x - 1, 1 - 2 * uv.y, depth, 1));
+
+	ReducedPixel result;
+	result.worldPos = worldPos.xyz / worldPos.w;
+	result.normal = gbuffer.xyz;
+	result.roughness = gMaterialBuffer[materialIndex].roughness;
+
+	// the pixels of the raytraced reflections, the discards of RayTracedReflectionsPS and its stencil test
+	result.bReflective = depth != 1 && stencil == 0 && result.roughness != 1;
+
+	return result;
+}
+
+groupshared uint gReflectivePixels;
+groupshared uint gTracedPixels;
+
+// the traced pixels of the lattice of the mode of a pixel around it, weighted by distance, view distance and normal
+[numthreads(8, 8, 1)]
+void ReducedReflectionsUpsampleCS(const uint3 id : SV_DispatchThreadID,
+                                  const uint index : SV_GroupIndex)
+{
+	if (index == 0)
+	{
+		gReflectivePixels = 0;
+		gTracedPixels = 0;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if (all(id.xy < gReducedScreenSize))
+	{
+		const ReducedPixel pixel = LoadPixel(id.xy);
+
+		float4 color = Reflections.Load(uint3(id.xy, 0));
+
+		const bool bTraced = IsTracedPixel(id.xy, pixel.roughness);
+
+		// alpha 0, not resolved in screen space either
+		if (pixel.bReflective && !bTraced && color.a == 0)
+		{
+			const uint mode = GetReducedMode(pixel.roughness);
+
+			// the checkerboard takes the four edge neighbours, the blocks the corners of their cell
+			const int step = (mode == kReducedQuarter) ? 4 : 2;
+			const int2 base = int2(id.xy) & ~(step - 1);
+
+			int2 neighbours[4];
+
+			if (mode == kReducedCheckerboard)
+			{
+				neighbours[0] = int2(id.xy) + int2(-1, 0);
+				neighbours[1] = int2(id.xy) + int2(1, 0);
+				neighbours[2] = int2(id.xy) + int2(0, -1);
+				neighbours[3] = int2(id.xy) + int2(0, 1);
+			}
+			else
+			{
+				neighbours[0] = base;
+				neighbours[1] = base + int2(step, 0);
+				neighbours[2] = base + int2(0, step);
+				neighbours[3] = base + int2(step, step);
+			}
+
+			const float viewDistance = distance(pixel.worldPos, gReducedEyePos);
+
+			float4 sum = 0;
+			float weightSum = 0;
+
+			[unroll]
+			for (int i = 0; i < 4; ++i)
+			{
+				const int2 q = neighbours[i];
+
+				if (any(q < 0) || any(q >= int2(gReducedScreenSize)))
+				{
+					continue;
+				}
+
+				const ReducedPixel neighbour = LoadPixel(q);
+
+				if (!neighbour.bReflective || !IsTracedPixel(q, neighbour.roughness))
+				{
+					continue;
+				}
+
+				// bilinear over the cell, equal for the checkerboard
+				const float2 offset = abs(float2(q - int2(id.xy))) / step;
+				const float spatialWeight = (mode == kReducedCheckerboard) ? 1 : (1 - offset.x) * (1 - offset.y);
+
+				const float depthWeight = exp(-abs(distance(neighbour.worldPos, gReducedEyePos) - viewDistance) / (kDepthSigma * viewDistance));
+				const float normalWeight = pow(saturate(dot(pixel.normal, neighbour.normal)), kNormalPower);
+
+				const float weight = spatialWeight * depthWeight * normalWeight;
+
+				sum += weight * Reflections.Load(uint3(q, 0));
+				weightSum += weight;
+			}
+
+			// no neighbour on the same surface, the pixel keeps no reflection
+			if (weightSum > 0.0001)
+			{
+				color = sum / weightSum;
+			}
+		}
+
+		if (pixel.bReflective)
+		{
+			InterlockedAdd(gReflectivePixels, 1);
+
+			if (bTraced)
+			{
+				InterlockedAdd(gTracedPixels, 1);
+			}
+		}
+
+		Output[id.xy] = color;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	// one atomic per group and counter
+	if (index == 0)
+	{
+		Counters.InterlockedAdd(0, gReflectivePixels);
+		Counters.InterlockedAdd(4, gTracedPixels);
+	}
+}
+
+groupshared uint gComparedPixels;
+groupshared uint gSquaredError;
+
+// mean squared error of the reconstructed reflections over the reflective pixels, after ReducedReflectionsUpsampleCS
+[numthreads(8, 8, 1)]
+void ReducedReflectionsMetricCS(const uint3 id : SV_DispatchThreadID,
+                                const uint index : SV_GroupIndex)
+{
+	if (index == 0)
+	{
+		gComparedPixels = 0;
+		gSquaredError = 0;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if (all(id.xy < gReducedScreenSize) && LoadPixel(id.xy).bReflective)
+	{
+		const float4 difference = saturate(Reflections.Load(uint3(id.xy, 0))) - saturate(Reference.Load(uint3(id.xy, 0)));
+
+		InterlockedAdd(gComparedPixels, 1);
+		InterlockedAdd(gSquaredError, uint(dot(difference, difference) / 4 * kErrorScale));
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if (index == 0)
+	{
+		Counters.InterlockedAdd(8, gComparedPixels);
+		Counters.InterlockedAdd(12, gSquaredError / (kErrorScale / 256));
+	}
+}
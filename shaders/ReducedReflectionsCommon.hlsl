@@ -0,0 +1,46 @@
+// the pixels whose reflection rays are traced (RAYTRACED_REDUCED). from gCheckerboardRoughness on one pixel in two is
+// traced, from gHalfRoughness one in each 2x2 block and from gQuarterRoughness one in each 4x4 block, the others are
+// reconstructed by ReducedReflectionsUpsampleCS
+
+cbuffer ReducedReflectionsCB : register(b5)
+{
+    float4x4 gReducedViewProjInv;
+    float3   gReducedEyePos;
+    uint     gReduced;               // 0 traces every pixel, the reference of the quality metric
+    float    gCheckerboardRoughness;
+    float    gHalfRoughness;
+    float    gQuarterRoughness;
+    float    gReducedPadding;
+    uint2    gReducedScreenSize;
+    uint2    gReducedPadding2;
+};
+
+#define kReducedFull 0
+#define kReducedCheckerboard 1
+#define kReducedHalf 2
+#define kReducedQuarter 3
+
+uint GetReducedMode(const float roughness)
+{
+	if (!gReduced || roughness < gCheckerboardRoughness)
+	{
+		return kReducedFull;
+	}
+
+	return (roughness >= gQuarterRoughness) ? kReducedQuarter : (roughness >= gHalfRoughness) ? kReducedHalf : kReducedCheckerboard;
+}
+
+bool IsTracedPixel(const uint2 pixel, const float roughness)
+{
+	switch (GetReducedMode(roughness))
+	{
+	case kReducedCheckerboard:
+		return ((pixel.x + pixel.y) & 1) == 0;
+	case kReducedHalf:
+		return all((pixel & 1) == 0);
+	case kReducedQuarter:
+		return all((pixel & 3) == 0);
+	default:
+		return true;
+	}
+}
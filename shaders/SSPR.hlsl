@@ -0,0 +1,216 @@
+#define FIXME 1
+#include "../RenderToyD3D11/shaders/Common.hlsl"
+
+#define SHADOW_MAPPING 0
+#include "../RenderToyD3D11/shaders/Default.hlsl"
+
+// screen-space planar reflections of the plane y = gPlaneHeight. the pixels above the plane scatter the pixel of their
+// mirror image (SSPRProjectCS, SSPRHashCS) and the reflective pixels gather the colour of the pixel that landed on them
+// (SSPRResolveCS). the colour is the previous frame reprojected, the current one is not lit yet
+
+Texture2D<float> DepthBuffer : register(t5);
+Texture2D<float4> GBuffer : register(t6);
+
+// 0 on the reflective surfaces (RayTracedTiles)
+Texture2D<uint2> Stencil : register(t7);
+
+Texture2D<uint> Hash : register(t8);
+Texture2D<float4> History : register(t9);
+
+// asuint of the distance from the eye to the mirror image, the nearest one wins
+RWTexture2D<uint> Distances : register(u0);
+
+// source pixel x | y << 16 of the mirror image, kEmptyHash when nothing landed
+RWTexture2D<uint> HashUAV : register(u1);
+
+// alpha 0 where the raytraced reflections take over
+RWTexture2D<float4> Reflections : register(u2);
+
+// x reflective pixels, y reflective pixels left to the raytraced reflections
+RWByteAddressBuffer Counters : register(u3);
+
+cbuffer SSPRCB : register(b3)
+{
+    float4x4 gSSPRViewProj;
+    float4x4 gSSPRViewProjInv;
+    float4x4 gSSPRPrevViewProj;
+    float3   gSSPREyePos;
+    float    gPlaneHeight;
+    uint2    gSSPRScreenSize;
+    uint     gHistoryValid;
+    float    gSSPRPadding;
+};
+
+#define kEmptyHash 0xffffffff
+
+float3 GetPixelWorldPos(const uint2 pixel, const float depth)
+{
+	const float2 uv = (pixel + 0.5) / gSSPRScreenSize;
+	const float4 worldPos = mul(gSSPRViewProjInv, float4(2 * uv.x - 1, 1 - 2 * uv.y, depth, 1));
+
+	return worldPos.xyz / worldPos.w;
+}
+
+// uv of a world position, false behind the eye or off screen
+bool GetScreenUV(const float4x4 viewProj, const float3 worldPos, out float2 uv)
+{
+	const float4 clipPos = mul(viewProj, float4(worldPos, 1));
+
+	uv = float2(clipPos.x, -clipPos.y) / clipPos.w * 0.5 + 0.5;
+
+	return clipPos.w > 0 && all(uv >= 0) && all(uv < 1);
+}
+
+// the pixel on which the mirror image of a source pixel above the plane lands
+bool GetMirrorPixel(const uint2 source, out uint2 target, out uint distance)
+{
+	target = 0;
+	distance = 0;
+
+	if (any(source >= gSSPRScreenSize))
+	{
+		return false;
+	}
+
+	const float depth = DepthBuffer.Load(uint3(source, 0));
+
+	if (depth == 1)
+	{
+		return false;
+	}
+
+	const float3 worldPos = GetPixelWorldPos(source, depth);
+
+	if (worldPos.y <= gPlaneHeight)
+	{
+		return false;
+	}
+
+	const float3 mirrored = float3(worldPos.x, 2 * gPlaneHeight - worldPos.y, worldPos.z);
+
+	float2 uv;
+
+	if (!GetScreenUV(gSSPRViewProj, mirrored, uv))
+	{
+		return false;
+	}
+
+	target = uint2(uv * gSSPRScreenSize);
+	distance = asuint(length(mirrored - gSSPREyePos));
+
+	return true;
+}
+
+[numthreads(8, 8, 1)]
+void SSPRProjectCS(const uint3 id : SV_DispatchThreadID)
+{
+	uint2 target;
+	uint distance;
+
+	if (GetMirrorPixel(id.xy, target, distance))
+	{
+		InterlockedMin(Distances[target], distance);
+	}
+}
+
+// run after SSPRProjectCS, the source nearest to the eye writes its pixel
+[numthreads(8, 8, 1)]
+void SSPRHashCS(const uint3 id : SV_DispatchThreadID)
+{
+	uint2 target;
+	uint distance;
+
+	if (GetMirrorPixel(id.xy, target, distance) && Distances[target] == distance)
+	{
+		HashUAV[target] = id.x | (id.y << 16);
+	}
+}
+
+// the scatter leaves holes where the mirror image is magnified, they take the source of a neighbour
+uint GetHash(const int2 pixel)
+{
+	const int2 offsets[5] = { int2(0, 0), int2(0, -1), int2(0, 1), int2(-1, 0), int2(1, 0) };
+
+	[unroll]
+	for (int i = 0; i < 5; ++i)
+	{
+		const int2 neighbour = pixel + offsets[i];
+
+		if (all(neighbour >= 0) && all(neighbour < int2(gSSPRScreenSize)))
+		{
+			const uint hash = Hash.Load(int3(neighbour, 0));
+
+			if (hash != kEmptyHash)
+			{
+				return hash;
+			}
+		}
+	}
+
+	return kEmptyHash;
+}
+
+groupshared uint gReflectivePixels;
+groupshared uint gFallbackPixels;
+
+[numthreads(8, 8, 1)]
+void SSPRResolveCS(const uint3 id : SV_DispatchThreadID,
+                   const uint index : SV_GroupIndex)
+{
+	if (index == 0)
+	{
+		gReflectivePixels = 0;
+		gFallbackPixels = 0;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if (all(id.xy < gSSPRScreenSize))
+	{
+		const float depth = DepthBuffer.Load(uint3(id.xy, 0));
+		const float4 gbuffer = GBuffer.Load(uint3(id.xy, 0));
+		const uint stencil = Stencil.Load(uint3(id.xy, 0)).y;
+
+		const int materialIndex = gbuffer.w;
+
+		float4 color = 0;
+
+		// the pixels of the raytraced reflections, the discards of RayTracedReflectionsPS and its stencil test
+		if (depth != 1 && stencil == 0 && gMaterialBuffer[materialIndex].roughness != 1)
+		{
+			const uint hash = GetHash(id.xy);
+
+			if (gHistoryValid && hash != kEmptyHash)
+			{
+				const uint2 source = uint2(hash & 0xffff, hash >> 16);
+				const float3 worldPos = GetPixelWorldPos(source, DepthBuffer.Load(uint3(source, 0)));
+
+				// where the source was in the previous frame
+				float2 uv;
+
+				if (GetScreenUV(gSSPRPrevViewProj, worldPos, uv))
+				{
+					color = float4(History.Load(uint3(uv * gSSPRScreenSize, 0)).rgb, 1);
+				}
+			}
+
+			InterlockedAdd(gReflectivePixels, 1);
+
+			if (color.a == 0)
+			{
+				InterlockedAdd(gFallbackPixels, 1);
+			}
+		}
+
+		Reflections[id.xy] = color;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	// one atomic per group and counter
+	if (index == 0)
+	{
+		Counters.InterlockedAdd(0, gReflectivePixels);
+		Counters.InterlockedAdd(4, gFallbackPixels);
+	}
+}
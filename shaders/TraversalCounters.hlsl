@@ -0,0 +1,73 @@
+#define FIXME 1
+#include "../RenderToyD3D11/shaders/Common.hlsl"
+#include "../RenderToyD3D11/shaders/Fullscreen.hlsl"
+
+// per-pixel counters of the BVH_COUNTERS permutation of the raytraced shaders (RayTracedCommon.hlsl):
+// x box tests, y triangle tests, z iterations, w 1 for a traced pixel. slice 0 shadows, slice 1 reflections
+Texture2DArray<uint4> Counters : register(t5);
+
+// frame totals, one uint4 per slice
+RWByteAddressBuffer Totals : register(u0);
+
+cbuffer TraversalHeatmapCB : register(b1)
+{
+    uint     gSlice;
+    uint     gCounter; // component of the counters shown
+    float    gMaxCount; // count at the red end of the ramp
+    float    padding;
+};
+
+// blue, cyan, green, yellow, red
+float3 Heatmap(const float x)
+{
+	return saturate(1.5 - abs(4 * x - float3(3, 2, 1)));
+}
+
+float4 TraversalHeatmapPS(const VertexOut pin) : SV_Target
+{
+    const uint4 counters = Counters.Load(int4(pin.position.xy, gSlice, 0));
+
+    if (counters.w == 0)
+    {
+        // keep the scene under the pixels that were not traced
+        discard;
+    }
+
+    return float4(Heatmap(counters[gCounter] / gMaxCount), 1);
+}
+
+groupshared uint gGroupTotals[4];
+
+// dispatched with one group per 16x16 tile and one layer per slice, the totals wrap past 2^32
+[numthreads(16, 16, 1)]
+void TraversalReduceCS(const uint3 id : SV_DispatchThreadID,
+                       const uint index : SV_GroupIndex)
+{
+	if (index < 4)
+	{
+		gGroupTotals[index] = 0;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	uint width, height, slices;
+	Counters.GetDimensions(width, height, slices);
+
+	if (id.x < width && id.y < height)
+	{
+		const uint4 counters = Counters.Load(int4(id, 0));
+
+		InterlockedAdd(gGroupTotals[0], counters.x);
+		InterlockedAdd(gGroupTotals[1], counters.y);
+		InterlockedAdd(gGroupTotals[2], counters.z);
+		InterlockedAdd(gGroupTotals[3], counters.w);
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	// one atomic per group and component
+	if (index < 4)
+	{
+		Totals.InterlockedAdd(16 * id.z + 4 * index, gGroupTotals[index]);
+	}
+}
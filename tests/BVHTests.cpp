@@ -0,0 +1,1679 @@
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+
+//
+#include "BVHBuilder.h"
+#include "BVHCache.h"
+#include "BVHHitAttributes.h"
+#include "BVHPacketTraversal.h"
+#include "BVHTraversal.h"
+#include "BVHTreeStats.h"
+#include "BVHTwoLevel.h"
+#include "MeshFile.h"
+
+static int sFailures = 0;
+
+#define CHECK(condition)                                                               \
+	do                                                                                 \
+	{                                                                                  \
+		if (!(condition))                                                              \
+		{                                                                              \
+			std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			sFailures++;                                                               \
+		}                                                                              \
+	} while (0)
+
+namespace
+{
+	// small triangles scattered in a 20 units cube, offsets laid out like BVH::BuildBVH does
+	std::vector<BVHBuilder::Triangle> CreateRandomTriangles(const std::size_t count, const unsigned seed)
+	{
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+		std::uniform_real_distribution<float> edge(-1.0f, 1.0f);
+
+		std::vector<BVHBuilder::Triangle> triangles(count);
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			const Float3 center(position(rng), position(rng), position(rng));
+
+			BVHBuilder::Triangle& triangle = triangles[i];
+			triangle.v0 = center + Float3(edge(rng), edge(rng), edge(rng));
+			triangle.v1 = center + Float3(edge(rng), edge(rng), edge(rng));
+			triangle.v2 = center + Float3(edge(rng), edge(rng), edge(rng));
+			triangle.offset = std::uint32_t(i);
+			triangle.material = std::uint32_t(i % 3);
+		}
+
+		return triangles;
+	}
+
+	std::vector<BVHTraversal::Ray> CreateRandomRays(const std::size_t count, const unsigned seed)
+	{
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+		std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+
+		std::vector<BVHTraversal::Ray> rays;
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			const Float3 origin(position(rng), position(rng), position(rng));
+			const Float3 dir(direction(rng), direction(rng), direction(rng));
+
+			rays.emplace_back(origin, dir);
+		}
+
+		return rays;
+	}
+
+	// tests every triangle with the same intersection routine and the same edge vectors as the stream
+	bool TraceBruteForce(const std::vector<BVHBuilder::Triangle>& triangles, const BVHTraversal::Ray& ray, const bool bClosestHit, BVHTraversal::Hit& hit)
+	{
+		float minDist = BVHTraversal::kMaxDistance;
+		bool bHit = false;
+
+		for (const BVHBuilder::Triangle& triangle : triangles)
+		{
+			float t, u, v;
+
+			if (BVHTraversal::RayTriIntersect(ray.origin, ray.dir, triangle.v0, triangle.v1 - triangle.v0, triangle.v2 - triangle.v0, bClosestHit, t, u, v))
+			{
+				if (!bClosestHit)
+				{
+					return true;
+				}
+
+				if (t < minDist)
+				{
+					minDist = t;
+					bHit = true;
+
+					hit.t = t;
+					hit.offset = int(triangle.offset);
+					hit.material = int(triangle.material);
+				}
+			}
+		}
+
+		return bHit;
+	}
+
+	// parses a subtree and returns the element that follows it
+	int CheckSubtree(const BVHBuilder::BuildVector<Float4>& stream, const int offset, std::vector<int>& offsets)
+	{
+		const int offsetToNextNode = int(stream[offset].w);
+
+		if (offsetToNextNode < 0) // node
+		{
+			const int left = offset + 2;
+			const int right = CheckSubtree(stream, left, offsets);
+			const int end = CheckSubtree(stream, right, offsets);
+
+			CHECK(end == left - offsetToNextNode);
+
+			return end;
+		}
+
+		// leaf
+		CHECK(offsetToNextNode > 0 && offsetToNextNode <= BVHBuilder::kMaxLeafSize);
+
+		for (int i = 0; i < offsetToNextNode; ++i)
+		{
+			const int element = offset + 3 * i;
+
+			CHECK(int(stream[element].w) == offsetToNextNode - i);
+			offsets.push_back(int(stream[element + 1].w));
+		}
+
+		return offset + 3 * offsetToNextNode;
+	}
+
+	void TestStreamLayout()
+	{
+		const std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(1000, 1);
+
+		BVHBuilder::BuildSettings settings;
+		settings.threadCount = 1;
+
+		BVHBuilder builder;
+		builder.Build(triangles, settings);
+
+		const BVHBuilder::BuildVector<Float4>& stream = builder.GetStream();
+		std::vector<int> offsets;
+
+		// the root is not written, its two subtrees are followed by the terminating node
+		int end = CheckSubtree(stream, 0, offsets);
+
+		if (builder.GetNodes()[0].bIsNode)
+		{
+			end = CheckSubtree(stream, end, offsets);
+		}
+
+		CHECK(stream[end].w == 0.0f);
+		CHECK(std::size_t(end + 2) == stream.size());
+		CHECK(builder.GetStreamSize() == builder.GetStats().serializedSize);
+
+		// every triangle is referenced by exactly one leaf
+		std::vector<int> counts(triangles.size(), 0);
+
+		for (const int offset : offsets)
+		{
+			CHECK(offset >= 0 && offset < int(triangles.size()));
+			counts[offset]++;
+		}
+
+		for (const int count : counts)
+		{
+			CHECK(count == 1);
+		}
+	}
+
+	// parses a wide node and the subtrees that follow it, returns the element after them
+	int CheckWideSubtree(const BVHBuilder::BuildVector<Float4>& stream, const int offset, const int width, std::vector<int>& offsets)
+	{
+		const BVHBuilder::WideGroup* groups = reinterpret_cast<const BVHBuilder::WideGroup*>(stream.data() + offset);
+
+		int end = offset + (width / 4) * int(sizeof(BVHBuilder::WideGroup) / sizeof(Float4));
+		int childCount = 0;
+
+		for (int i = 0; i < width; ++i)
+		{
+			const std::int32_t child = groups[i / 4].children[i % 4];
+
+			if (child == 0)
+			{
+				continue;
+			}
+
+			childCount++;
+
+			// children are written right after their parent, in order
+			if (child > 0)
+			{
+				CHECK(child == end);
+				end = CheckWideSubtree(stream, child, width, offsets);
+			}
+			else
+			{
+				const int leafOffset = (-child) >> 4;
+				const int triangleCount = (-child) & 15;
+
+				CHECK(leafOffset == end);
+				CHECK(int(stream[leafOffset].w) == triangleCount);
+
+				for (int j = 0; j < triangleCount; ++j)
+				{
+					offsets.push_back(int(stream[leafOffset + 3 * j + 1].w));
+				}
+
+				end = leafOffset + 3 * triangleCount;
+			}
+		}
+
+		CHECK(childCount >= 1);
+
+		return end;
+	}
+
+	void TestWideStreamLayout()
+	{
+		const std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(2000, 9);
+
+		for (const int width : { 4, 8 })
+		{
+			BVHBuilder::BuildSettings settings;
+			settings.threadCount = 1;
+			settings.width = width;
+
+			BVHBuilder builder;
+			builder.Build(triangles, settings);
+
+			const BVHBuilder::BuildVector<Float4>& stream = builder.GetStream();
+			std::vector<int> offsets;
+
+			CHECK(std::size_t(CheckWideSubtree(stream, 0, width, offsets)) == stream.size());
+			CHECK(builder.GetStreamSize() == builder.GetStats().serializedSize);
+
+			// every wide node replaces at least one binary node
+			CHECK(builder.GetStats().wideNodeCount > 0 && builder.GetStats().wideNodeCount < builder.GetStats().nodeCount);
+
+			std::sort(offsets.begin(), offsets.end());
+
+			CHECK(offsets.size() == triangles.size());
+
+			for (std::size_t i = 0; i < offsets.size(); ++i)
+			{
+				CHECK(offsets[i] == int(i));
+			}
+		}
+	}
+
+	void TestSingleTriangle()
+	{
+		const std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(1, 2);
+
+		BVHBuilder builder;
+		builder.Build(triangles, BVHBuilder::BuildSettings());
+
+		// a lone leaf and the terminator
+		CHECK(builder.GetStream().size() == 3 + 2);
+		CHECK(builder.GetStream()[0].w == 1.0f);
+		CHECK(builder.GetStream()[3].w == 0.0f);
+	}
+
+	void TestTraversalMatchesBruteForce()
+	{
+		const std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(3000, 3);
+		const std::vector<BVHTraversal::Ray> rays = CreateRandomRays(1000, 4);
+
+		for (const BVHBuilder::BuildMode mode : { BVHBuilder::BuildMode::Sweep, BVHBuilder::BuildMode::Binned })
+		{
+			for (const int maxLeafSize : { 1, 4, 8 })
+			for (const int width : { 2, 4, 8 })
+			{
+				BVHBuilder::BuildSettings settings;
+				settings.mode = mode;
+				settings.maxLeafSize = maxLeafSize;
+				settings.threadCount = 1;
+				settings.width = width;
+
+				BVHBuilder builder;
+				builder.Build(triangles, settings);
+
+				const BVHTraversal traversal(builder.GetStream().data(), width);
+
+				for (const BVHTraversal::Ray& ray : rays)
+				{
+					BVHTraversal::Hit expected;
+					BVHTraversal::Hit hit;
+
+					const bool bExpected = TraceBruteForce(triangles, ray, true, expected);
+
+					CHECK(traversal.TraceReflection(ray, hit) == bExpected);
+
+					if (bExpected)
+					{
+						CHECK(hit.t == expected.t);
+						CHECK(hit.offset == expected.offset);
+						CHECK(hit.material == expected.material);
+					}
+
+					CHECK(traversal.TraceShadow(ray) == TraceBruteForce(triangles, ray, false, expected));
+				}
+			}
+		}
+	}
+
+	void TestPacketTraversalMatchesScalar()
+	{
+		const std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(3000, 7);
+
+		// not a multiple of the packet size, the last packet is partial
+		const std::vector<BVHTraversal::Ray> rays = CreateRandomRays(4001, 8);
+
+		BVHBuilder::BuildSettings settings;
+		settings.threadCount = 1;
+
+		BVHBuilder builder;
+		builder.Build(triangles, settings);
+
+		const BVHTraversal traversal(builder.GetStream().data());
+		BVHPacketTraversal packetTraversal(builder.GetStream().data());
+
+		std::vector<BVHTraversal::Hit> hits(rays.size());
+		std::unique_ptr<bool[]> results(new bool[rays.size()]);
+		std::unique_ptr<bool[]> occluded(new bool[rays.size()]);
+
+		packetTraversal.TraceReflections(rays.data(), rays.size(), hits.data(), results.get());
+		packetTraversal.TraceShadows(rays.data(), rays.size(), occluded.get());
+
+		for (std::size_t i = 0; i < rays.size(); ++i)
+		{
+			BVHTraversal::Hit expected;
+
+			CHECK(results[i] == traversal.TraceReflection(rays[i], expected));
+
+			if (results[i])
+			{
+				CHECK(hits[i].t == expected.t);
+				CHECK(hits[i].u == expected.u);
+				CHECK(hits[i].v == expected.v);
+				CHECK(hits[i].offset == expected.offset);
+				CHECK(hits[i].material == expected.material);
+			}
+
+			CHECK(occluded[i] == traversal.TraceShadow(rays[i]));
+		}
+
+		const BVHPacketTraversal::TraceStats& stats = packetTraversal.GetStats();
+
+		CHECK(stats.rayCount == 2 * rays.size());
+		CHECK(stats.packetCount == 2 * ((rays.size() + BVHPacketTraversal::kPacketSize - 1) / BVHPacketTraversal::kPacketSize));
+
+		std::printf("packet traversal (%s, %d lanes): %.2f Mrays/s\n", BVHPacketTraversal::GetInstructionSet(), BVHPacketTraversal::kPacketSize, stats.GetRaysPerSecond() * 1e-6);
+	}
+
+	void TestRefit()
+	{
+		std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(3000, 10);
+		const std::vector<BVHTraversal::Ray> rays = CreateRandomRays(500, 11);
+
+		for (const int width : { 2, 4 })
+		{
+			BVHBuilder::BuildSettings settings;
+			settings.threadCount = 1;
+			settings.width = width;
+
+			BVHBuilder builder;
+			builder.Build(triangles, settings);
+
+			const std::vector<Float4> before(builder.GetStream().begin(), builder.GetStream().end());
+
+			// a small move of one object worth of triangles keeps the tree usable
+			std::vector<BVHBuilder::Triangle> moved = triangles;
+			std::vector<std::uint32_t> changed;
+
+			for (std::uint32_t i = 0; i < 100; ++i)
+			{
+				const std::uint32_t index = i * 17;
+				const Float3 offset(0.5f, -0.25f, 0.1f);
+
+				moved[index].v0 = moved[index].v0 + offset;
+				moved[index].v1 = moved[index].v1 + offset;
+				moved[index].v2 = moved[index].v2 + offset;
+
+				changed.push_back(index);
+			}
+
+			CHECK(builder.Refit(moved.data(), changed.data(), changed.size()));
+
+			const BVHBuilder::BuildVector<Float4>& stream = builder.GetStream();
+			const BVHBuilder::BuildVector<BVHBuilder::StreamRange>& ranges = builder.GetDirtyRanges();
+
+			CHECK(builder.GetRefitStats().triangleCount == changed.size());
+			CHECK(builder.GetRefitStats().rangeCount == ranges.size());
+			CHECK(builder.GetRefitStats().dirtySize < builder.GetStreamSize());
+
+			// the stream only changed inside the reported ranges
+			std::vector<bool> dirty(stream.size(), false);
+
+			for (const BVHBuilder::StreamRange& range : ranges)
+			{
+				CHECK(range.begin < range.end && range.end <= stream.size());
+
+				for (std::size_t i = range.begin; i < range.end; ++i)
+				{
+					dirty[i] = true;
+				}
+			}
+
+			for (std::size_t i = 0; i < stream.size(); ++i)
+			{
+				if (!dirty[i])
+				{
+					CHECK(std::memcmp(&stream[i], &before[i], sizeof(Float4)) == 0);
+				}
+			}
+
+			const BVHTraversal traversal(stream.data(), width);
+
+			for (const BVHTraversal::Ray& ray : rays)
+			{
+				BVHTraversal::Hit expected;
+				BVHTraversal::Hit hit;
+
+				const bool bExpected = TraceBruteForce(moved, ray, true, expected);
+
+				CHECK(traversal.TraceReflection(ray, hit) == bExpected);
+				CHECK(!bExpected || (hit.t == expected.t && hit.offset == expected.offset));
+				CHECK(traversal.TraceShadow(ray) == TraceBruteForce(moved, ray, false, expected));
+			}
+
+			// scattering every triangle across the scene degrades the tree past the rebuild threshold
+			std::vector<std::uint32_t> all(triangles.size());
+
+			for (std::uint32_t i = 0; i < all.size(); ++i)
+			{
+				all[i] = i;
+			}
+
+			const std::vector<BVHBuilder::Triangle> scattered = CreateRandomTriangles(triangles.size(), 12);
+
+			CHECK(!builder.Refit(scattered.data(), all.data(), all.size()));
+			CHECK(builder.GetRefitStats().sahCost > builder.GetStats().sahCost);
+		}
+
+		// a small triangle moving along a tall one keeps the bounds of their parent but flips the order of its children
+		{
+			auto MakeTriangle = [](const Float3& p, const float height)
+			{
+				BVHBuilder::Triangle triangle;
+				triangle.v0 = p;
+				triangle.v1 = p + Float3(0.5f, height, 0.0f);
+				triangle.v2 = p + Float3(0.0f, height, 0.5f);
+
+				return triangle;
+			};
+
+			std::vector<BVHBuilder::Triangle> pairs =
+			{
+				MakeTriangle(Float3(0.0f, 0.0f, 0.0f), 10.0f),
+				MakeTriangle(Float3(0.0f, 8.0f, 0.0f), 0.0f),
+				MakeTriangle(Float3(100.0f, 0.0f, 0.0f), 10.0f),
+				MakeTriangle(Float3(100.0f, 8.0f, 0.0f), 0.0f),
+			};
+
+			BVHBuilder::BuildSettings settings;
+			settings.threadCount = 1;
+			settings.maxLeafSize = 1;
+
+			BVHBuilder builder;
+			builder.Build(pairs, settings);
+
+			pairs[1] = MakeTriangle(Float3(0.0f, 2.0f, 0.0f), 0.0f);
+
+			const std::uint32_t changed = 1;
+
+			CHECK(builder.Refit(pairs.data(), &changed, 1));
+
+			const BVHBuilder::BuildVector<BVHBuilder::TreeNode>& nodes = builder.GetNodes();
+			const BVHBuilder::BuildVector<Float4>& stream = builder.GetStream();
+
+			int orderCount = 0;
+
+			for (const BVHBuilder::TreeNode& node : nodes)
+			{
+				if (node.bIsNode && node.boundsOffset >= 0)
+				{
+					const BVHBuilder::Node& written = reinterpret_cast<const BVHBuilder::Node&>(stream[node.boundsOffset]);
+
+					CHECK(written.max.w == float(BVHBuilder::GetChildOrder(nodes[node.left].aabb, nodes[node.right].aabb)));
+
+					orderCount++;
+				}
+			}
+
+			CHECK(orderCount == 2);
+		}
+	}
+
+	void TestTwoLevel()
+	{
+		const std::vector<BVHTraversal::Ray> rays = CreateRandomRays(2000, 13);
+
+		// two meshes, small enough to be placed a few times around the scene
+		std::vector<BVHBuilder::Triangle> meshes[2] = { CreateRandomTriangles(300, 14), CreateRandomTriangles(100, 15) };
+
+		for (BVHBuilder::Triangle& triangle : meshes[1])
+		{
+			triangle.offset += std::uint32_t(meshes[0].size());
+		}
+
+		std::mt19937 rng(16);
+		std::uniform_real_distribution<float> angle(0.0f, 6.28f);
+		std::uniform_real_distribution<float> position(-15.0f, 15.0f);
+
+		std::vector<BVHTwoLevel::Instance> instances;
+
+		for (std::uint32_t i = 0; i < 7; ++i)
+		{
+			const float a = angle(rng);
+			const float c = std::cos(a);
+			const float s = std::sin(a);
+
+			// a rotation around y, a scale on the mesh 1 instances and a translation
+			const float scale = (i % 2) ? 0.5f : 1.0f;
+
+			BVHTwoLevel::Instance instance;
+			instance.mesh = i % 2;
+			instance.material = 10 + i;
+			instance.world.rows[0] = Float4(c * scale, 0.0f, s * scale, position(rng));
+			instance.world.rows[1] = Float4(0.0f, scale, 0.0f, position(rng));
+			instance.world.rows[2] = Float4(-s * scale, 0.0f, c * scale, position(rng));
+
+			instances.push_back(instance);
+		}
+
+		for (const int width : { 2, 4 })
+		{
+			BVHTwoLevel::BuildSettings settings;
+			settings.width = width;
+			settings.threadCount = 1;
+
+			BVHTwoLevel twoLevel;
+			twoLevel.SetBuildSettings(settings);
+
+			for (const std::vector<BVHBuilder::Triangle>& mesh : meshes)
+			{
+				twoLevel.AddMesh(mesh.data(), mesh.size());
+			}
+
+			for (const BVHTwoLevel::Instance& instance : instances)
+			{
+				twoLevel.AddInstance(instance);
+			}
+
+			twoLevel.BuildTopLevel();
+
+			const BVHTwoLevel::Stats& stats = twoLevel.GetStats();
+
+			CHECK(stats.meshCount == 2 && stats.instanceCount == instances.size());
+			CHECK(stats.triangleCount == meshes[0].size() + meshes[1].size());
+			CHECK(stats.instancedTriangleCount == 4 * meshes[0].size() + 3 * meshes[1].size());
+			CHECK(stats.serializedSize == twoLevel.GetStreamSize());
+
+			// the flattened scene the instanced one must match, materials replaced by the instance ones
+			std::vector<BVHBuilder::Triangle> world;
+			std::vector<std::uint32_t> worldInstances;
+
+			for (std::uint32_t i = 0; i < instances.size(); ++i)
+			{
+				for (BVHBuilder::Triangle triangle : meshes[instances[i].mesh])
+				{
+					triangle.v0 = instances[i].world.TransformPoint(triangle.v0);
+					triangle.v1 = instances[i].world.TransformPoint(triangle.v1);
+					triangle.v2 = instances[i].world.TransformPoint(triangle.v2);
+					triangle.material = instances[i].material;
+
+					world.push_back(triangle);
+					worldInstances.push_back(i);
+				}
+			}
+
+			auto checkTraversal = [&]()
+			{
+				const BVHTraversal traversal(twoLevel.GetStream().data(), width, true);
+				const BVHTraversal ordered(twoLevel.GetStream().data(), width, true, 0, BVHTraversal::LeafFormat::Edges, true);
+
+				// the ray is transformed instead of the triangles, grazing hits may differ by rounding
+				std::size_t mismatches = 0;
+
+				for (const BVHTraversal::Ray& ray : rays)
+				{
+					BVHTraversal::Hit expected;
+					BVHTraversal::Hit hit;
+
+					const bool bExpected = TraceBruteForce(world, ray, true, expected);
+					const bool bHit = traversal.TraceReflection(ray, hit);
+
+					if (bHit != bExpected || traversal.TraceShadow(ray) != TraceBruteForce(world, ray, false, expected))
+					{
+						mismatches++;
+					}
+					else if (bHit && hit.offset == expected.offset)
+					{
+						CHECK(std::abs(hit.t - expected.t) <= 1e-3f * std::max(1.0f, expected.t));
+						CHECK(hit.material == expected.material);
+						CHECK(hit.instance >= 0 && instances[hit.instance].material == std::uint32_t(hit.material));
+					}
+
+					// the ordered closest hit prunes the instances and the nodes behind the hit, not the hit
+					BVHTraversal::Hit orderedHit;
+					CHECK(ordered.TraceReflection(ray, orderedHit) == bHit);
+					CHECK(!bHit || (orderedHit.t == hit.t && orderedHit.instance == hit.instance));
+				}
+
+				CHECK(mismatches <= rays.size() / 200);
+			};
+
+			checkTraversal();
+
+			// moving an instance only rewrites the top level
+			const BVHTwoLevel::BuildVector<Float4> before = twoLevel.GetStream();
+			const BVHBuilder::StreamRange topLevel = twoLevel.GetTopLevelRange();
+
+			instances[3].world.rows[1].w += 5.0f;
+			twoLevel.SetInstanceTransform(3, instances[3].world);
+			twoLevel.BuildTopLevel();
+
+			CHECK(twoLevel.GetTopLevelRange().begin == topLevel.begin);
+			CHECK(std::memcmp(twoLevel.GetStream().data() + 1, before.data() + 1, (topLevel.begin - 1) * sizeof(Float4)) == 0);
+
+			for (std::size_t i = 0; i < world.size(); ++i)
+			{
+				if (worldInstances[i] == 3)
+				{
+					world[i].v0.y += 5.0f;
+					world[i].v1.y += 5.0f;
+					world[i].v2.y += 5.0f;
+				}
+			}
+
+			checkTraversal();
+
+			instances[3].world.rows[1].w -= 5.0f;
+		}
+	}
+
+	void TestSpatialSplits()
+	{
+		// long diagonal beams over a few large ground triangles, the case spatial splits are meant for
+		std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(2000, 17);
+
+		std::mt19937 rng(18);
+		std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+
+		for (std::size_t i = 0; i < 500; ++i)
+		{
+			const Float3 a(position(rng), position(rng), position(rng));
+			const Float3 b(position(rng), position(rng), position(rng));
+
+			BVHBuilder::Triangle beam;
+			beam.v0 = a;
+			beam.v1 = b;
+			beam.v2 = b + Float3(0.05f, 0.05f, 0.0f);
+			beam.offset = std::uint32_t(triangles.size());
+			beam.material = 3;
+
+			triangles.push_back(beam);
+		}
+
+		for (const float z : { -10.0f, 10.0f })
+		{
+			BVHBuilder::Triangle ground;
+			ground.v0 = Float3(-10.0f, -10.0f, z);
+			ground.v1 = Float3(10.0f, -10.0f, z);
+			ground.v2 = Float3(-10.0f, 10.0f, z);
+			ground.offset = std::uint32_t(triangles.size());
+			ground.material = 4;
+
+			triangles.push_back(ground);
+		}
+
+		const std::vector<BVHTraversal::Ray> rays = CreateRandomRays(1000, 19);
+
+		BVHBuilder::BuildSettings settings;
+		settings.threadCount = 1;
+
+		BVHBuilder binned;
+		binned.Build(triangles, settings);
+
+		for (const int width : { 2, 4 })
+		{
+			settings.mode = BVHBuilder::BuildMode::Spatial;
+			settings.width = width;
+
+			BVHBuilder builder;
+			builder.Build(triangles, settings);
+
+			const BVHBuilder::BuildStats& stats = builder.GetStats();
+
+			CHECK(stats.triangleCount == triangles.size());
+			CHECK(stats.spatialSplitCount > 0);
+			CHECK(stats.referenceCount > stats.triangleCount);
+			CHECK(stats.referenceCount <= stats.triangleCount + std::size_t(float(stats.triangleCount) * settings.spatialSplitBudget));
+			CHECK(stats.leafCount == stats.nodeCount + 1);
+			CHECK(stats.sahCost < binned.GetStats().sahCost);
+
+			// duplicated references still point at the original triangle offset and material
+			const BVHTraversal traversal(builder.GetStream().data(), width);
+
+			for (const BVHTraversal::Ray& ray : rays)
+			{
+				BVHTraversal::Hit expected;
+				BVHTraversal::Hit hit;
+
+				const bool bExpected = TraceBruteForce(triangles, ray, true, expected);
+
+				CHECK(traversal.TraceReflection(ray, hit) == bExpected);
+				CHECK(!bExpected || (hit.t == expected.t && hit.offset == expected.offset && hit.material == expected.material));
+				CHECK(traversal.TraceShadow(ray) == TraceBruteForce(triangles, ray, false, expected));
+			}
+
+			// clipped references are not refitted
+			const std::uint32_t changed = 0;
+			CHECK(!builder.Refit(triangles.data(), &changed, 1));
+		}
+
+		// without a budget the spatial mode only makes object splits
+		settings.spatialSplitBudget = 0.0f;
+		settings.width = 2;
+
+		BVHBuilder builder;
+		builder.Build(triangles, settings);
+
+		CHECK(builder.GetStats().referenceCount == triangles.size());
+		CHECK(builder.GetStats().spatialSplitCount == 0);
+	}
+
+	void TestQuantizedNodes()
+	{
+		const std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(5000, 20);
+		const std::vector<BVHTraversal::Ray> rays = CreateRandomRays(1000, 21);
+
+		for (const int width : { 4, 8 })
+		{
+			BVHBuilder::BuildSettings settings;
+			settings.width = width;
+			settings.threadCount = 1;
+
+			BVHBuilder reference;
+			reference.Build(triangles, settings);
+
+			const BVHTraversal referenceTraversal(reference.GetStream().data(), width);
+
+			for (const int quantization : { 8, 16 })
+			{
+				settings.quantization = quantization;
+
+				BVHBuilder builder;
+				builder.Build(triangles, settings);
+
+				const BVHBuilder::BuildStats& stats = builder.GetStats();
+
+				CHECK(stats.wideNodeCount == reference.GetStats().wideNodeCount);
+				CHECK(stats.nodeSize < reference.GetStats().nodeSize);
+				CHECK(stats.uncompressedSize == reference.GetStats().serializedSize);
+				CHECK(stats.serializedSize < stats.uncompressedSize);
+
+				// the decoded bounds contain the exact ones
+				for (const BVHBuilder::TreeNode& node : builder.GetNodes())
+				{
+					if (node.boundsOffset < 0)
+					{
+						continue;
+					}
+
+					BVHBuilder::WideGroup decoded;
+					BVHBuilder::DecodeQuantizedGroup(builder.GetStream().data() + node.boundsOffset, node.boundsSlot / 4, quantization, decoded);
+
+					const int i = node.boundsSlot % 4;
+
+					CHECK((&decoded.minX.x)[i] <= node.aabb.min.x && (&decoded.maxX.x)[i] >= node.aabb.max.x);
+					CHECK((&decoded.minY.x)[i] <= node.aabb.min.y && (&decoded.maxY.x)[i] >= node.aabb.max.y);
+					CHECK((&decoded.minZ.x)[i] <= node.aabb.min.z && (&decoded.maxZ.x)[i] >= node.aabb.max.z);
+				}
+
+				// looser boxes only cost extra tests, the hits are the ones of the float stream
+				const BVHTraversal traversal(builder.GetStream().data(), width, false, quantization);
+
+				for (const BVHTraversal::Ray& ray : rays)
+				{
+					BVHTraversal::Hit expected;
+					BVHTraversal::Hit hit;
+
+					const bool bExpected = referenceTraversal.TraceReflection(ray, expected);
+
+					CHECK(traversal.TraceReflection(ray, hit) == bExpected);
+					CHECK(!bExpected || (hit.t == expected.t && hit.offset == expected.offset));
+					CHECK(traversal.TraceShadow(ray) == referenceTraversal.TraceShadow(ray));
+				}
+
+				// a triangle that shrinks stays in the frame of its node, one moved out of the scene does not
+				std::vector<BVHBuilder::Triangle> moved = triangles;
+				const std::uint32_t changed = 7;
+
+				moved[changed].v1 = moved[changed].v0;
+
+				CHECK(builder.Refit(moved.data(), &changed, 1));
+				CHECK(builder.GetRefitStats().overflowCount == 0);
+
+				moved[changed].v2 = moved[changed].v2 + Float3(100.0f, 0.0f, 0.0f);
+
+				CHECK(!builder.Refit(moved.data(), &changed, 1));
+				CHECK(builder.GetRefitStats().overflowCount > 0);
+			}
+		}
+
+		// mesh streams keep their references valid once they are moved into a two-level stream
+		BVHTwoLevel::BuildSettings settings;
+		settings.width = 4;
+		settings.quantization = 16;
+		settings.threadCount = 1;
+
+		BVHTwoLevel twoLevel;
+		twoLevel.SetBuildSettings(settings);
+		twoLevel.AddMesh(triangles.data(), triangles.size());
+		twoLevel.AddMesh(triangles.data(), triangles.size());
+		twoLevel.AddInstance({ 1, 0, Matrix34::Identity() });
+		twoLevel.BuildTopLevel();
+
+		const BVHTraversal traversal(twoLevel.GetStream().data(), 4, true, 16);
+
+		for (const BVHTraversal::Ray& ray : rays)
+		{
+			BVHTraversal::Hit expected;
+			BVHTraversal::Hit hit;
+
+			const bool bExpected = TraceBruteForce(triangles, ray, true, expected);
+
+			CHECK(traversal.TraceReflection(ray, hit) == bExpected);
+			CHECK(!bExpected || (hit.t == expected.t && hit.offset == expected.offset));
+		}
+	}
+
+	void TestLeafFormats()
+	{
+		using LeafFormat = BVHBuilder::LeafFormat;
+
+		std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(3000, 22);
+		const std::vector<BVHTraversal::Ray> rays = CreateRandomRays(1000, 23);
+
+		const LeafFormat formats[] = { LeafFormat::Edges, LeafFormat::Woop, LeafFormat::BaldwinWeber };
+		const char* names[] = { "edges", "Woop", "Baldwin-Weber" };
+
+		// the precomputed transforms round differently, only rays grazing an edge may disagree with the edge test
+		auto countMismatches = [&](const BVHTraversal& traversal, const std::vector<BVHBuilder::Triangle>& reference)
+		{
+			int mismatches = 0;
+
+			for (const BVHTraversal::Ray& ray : rays)
+			{
+				BVHTraversal::Hit expected;
+				BVHTraversal::Hit hit;
+
+				const bool bExpected = TraceBruteForce(reference, ray, true, expected);
+				const bool bHit = traversal.TraceReflection(ray, hit);
+
+				if (bHit != bExpected || (bHit && (hit.offset != expected.offset || hit.material != expected.material || std::abs(hit.t - expected.t) > 1e-3f * expected.t)))
+				{
+					mismatches++;
+				}
+
+				if (traversal.TraceShadow(ray) != TraceBruteForce(reference, ray, false, expected))
+				{
+					mismatches++;
+				}
+			}
+
+			return mismatches;
+		};
+
+		for (int f = 0; f < 3; ++f)
+		{
+			for (const int width : { 2, 4 })
+			{
+				BVHBuilder::BuildSettings settings;
+				settings.threadCount = 1;
+				settings.width = width;
+				settings.leafFormat = formats[f];
+
+				BVHBuilder builder;
+				builder.Build(triangles, settings);
+
+				const BVHBuilder::BuildStats& stats = builder.GetStats();
+
+				CHECK(stats.leafSize == std::size_t(BVHBuilder::GetLeafSize(formats[f])) * sizeof(Float4));
+				CHECK(builder.GetStreamSize() == stats.serializedSize);
+
+				const BVHTraversal traversal(builder.GetStream().data(), width, false, 0, formats[f]);
+
+				CHECK(countMismatches(traversal, triangles) <= (f == 0 ? 0 : 2));
+
+				// refits rewrite the transforms of the moved triangles
+				std::vector<BVHBuilder::Triangle> moved = triangles;
+				std::vector<std::uint32_t> changed;
+
+				for (std::uint32_t i = 0; i < 100; ++i)
+				{
+					const std::uint32_t index = i * 29;
+
+					moved[index].v1 = moved[index].v1 + Float3(0.3f, 0.2f, -0.1f);
+					changed.push_back(index);
+				}
+
+				CHECK(builder.Refit(moved.data(), changed.data(), changed.size()));
+				CHECK(countMismatches(traversal, moved) <= (f == 0 ? 0 : 2));
+			}
+		}
+
+		// triangle tests per second against bytes per triangle
+		std::vector<Float4> leaves[3];
+
+		for (int f = 0; f < 3; ++f)
+		{
+			const int leafSize = BVHBuilder::GetLeafSize(formats[f]);
+
+			leaves[f].resize(triangles.size() * leafSize);
+
+			for (std::size_t i = 0; i < triangles.size(); ++i)
+			{
+				BVHBuilder::WriteLeafTriangle(leaves[f].data() + i * leafSize, triangles[i], 1, formats[f]);
+			}
+
+			int hits = 0;
+
+			const auto start = std::chrono::steady_clock::now();
+
+			for (std::size_t r = 0; r < 100; ++r)
+			{
+				const BVHTraversal::Ray& ray = rays[r];
+
+				for (std::size_t i = 0; i < triangles.size(); ++i)
+				{
+					const Float4* leaf = leaves[f].data() + i * leafSize;
+
+					float t, u, v;
+					bool bHit = false;
+
+					if (formats[f] == LeafFormat::Edges)
+					{
+						bHit = BVHTraversal::RayTriIntersect(ray.origin, ray.dir, leaf[0].xyz(), leaf[1].xyz(), leaf[2].xyz(), true, t, u, v);
+					}
+					else if (formats[f] == LeafFormat::Woop)
+					{
+						bHit = BVHTraversal::RayTriIntersectWoop(ray.origin, ray.dir, leaf + 1, true, t, u, v);
+					}
+					else
+					{
+						bHit = BVHTraversal::RayTriIntersect(ray.origin, ray.dir, leaf, true, t, u, v);
+					}
+
+					hits += bHit ? 1 : 0;
+				}
+			}
+
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			std::printf("leaf format %s: %d bytes per triangle, %.1f M triangle tests/s (%d hits)\n",
+						names[f], int(leafSize * sizeof(Float4)), 100.0 * triangles.size() / seconds * 1e-6, hits);
+		}
+	}
+
+	void TestHitAttributes()
+	{
+		// octahedral vectors keep their direction within the snorm16 precision
+		std::mt19937 rng(21);
+		std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+
+		for (int i = 0; i < 10000; ++i)
+		{
+			Float3 n(direction(rng), direction(rng), direction(rng));
+			n = (1.0f / std::sqrt(Dot(n, n))) * n;
+
+			CHECK(Dot(BVHHitAttributes::DecodeOctahedral(BVHHitAttributes::EncodeOctahedral(n)), n) > 0.99999f);
+		}
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			for (const float sign : { -1.0f, 1.0f })
+			{
+				Float3 n(0.0f);
+				n[axis] = sign;
+
+				CHECK(Dot(BVHHitAttributes::DecodeOctahedral(BVHHitAttributes::EncodeOctahedral(n)), n) == 1.0f);
+			}
+		}
+
+		CHECK(BVHHitAttributes::DecodeOctahedral(BVHHitAttributes::EncodeOctahedral(Float3(0.0f))).z == 1.0f);
+
+		// halves are exact where representable, rounded to nearest even otherwise
+		for (const float f : { 0.0f, 1.0f, -2.0f, 0.5f, 65504.0f, std::ldexp(1.0f, -24), -std::ldexp(3.0f, -20) })
+		{
+			CHECK(BVHHitAttributes::HalfToFloat(BVHHitAttributes::FloatToHalf(f)) == f);
+		}
+
+		CHECK(BVHHitAttributes::HalfToFloat(BVHHitAttributes::FloatToHalf(1.0f + std::ldexp(1.0f, -11))) == 1.0f);
+		CHECK(BVHHitAttributes::HalfToFloat(BVHHitAttributes::FloatToHalf(1.0f + std::ldexp(3.0f, -11))) == 1.0f + std::ldexp(1.0f, -9));
+		CHECK(std::isinf(BVHHitAttributes::HalfToFloat(BVHHitAttributes::FloatToHalf(65520.0f))));
+
+		std::uniform_real_distribution<float> uv(0.0f, 1.0f);
+
+		for (int i = 0; i < 10000; ++i)
+		{
+			const float f = uv(rng);
+
+			CHECK(std::abs(BVHHitAttributes::HalfToFloat(BVHHitAttributes::FloatToHalf(f)) - f) <= std::max(f, std::ldexp(1.0f, -14)) * std::ldexp(1.0f, -11));
+		}
+
+		// a grid whose triangles share their corners, every corner is stored once
+		const int n = 16;
+		const std::size_t triangleCount = 2 * (n - 1) * (n - 1);
+
+		auto gridVertex = [&](const int x, const int y, const float tilt)
+		{
+			BVHHitAttributes::Vertex vertex;
+			vertex.normal = Float3(tilt, 0.0f, 1.0f);
+			vertex.tangent = Float3(1.0f, 0.0f, -tilt);
+			vertex.u = float(x) / (n - 1);
+			vertex.v = float(y) / (n - 1);
+
+			return vertex;
+		};
+
+		auto writeGrid = [&](BVHHitAttributes& attributes, const std::size_t first, const float tilt)
+		{
+			attributes.BeginObject(first);
+
+			std::size_t triangle = 0;
+
+			for (int y = 0; y < n - 1; ++y)
+			{
+				for (int x = 0; x < n - 1; ++x)
+				{
+					std::uint32_t corners[4];
+
+					for (int k = 0; k < 4; ++k)
+					{
+						corners[k] = attributes.AddVertex(gridVertex(x + (k & 1), y + (k >> 1), 0.0f), gridVertex(x + (k & 1), y + (k >> 1), tilt));
+					}
+
+					attributes.SetTriangle(triangle++, corners[0], corners[1], corners[2]);
+					attributes.SetTriangle(triangle++, corners[1], corners[3], corners[2]);
+				}
+			}
+
+			return attributes.EndObject();
+		};
+
+		BVHBuilder::MemoryTracker tracker;
+		BVHHitAttributes attributes(&tracker);
+		attributes.Reset(triangleCount);
+
+		const BVHBuilder::StreamRange range = writeGrid(attributes, attributes.GetSize(), 0.0f);
+
+		CHECK(range.begin == triangleCount && range.end == attributes.GetSize());
+		CHECK(attributes.GetVertexCount() == std::size_t(n * n));
+		CHECK(attributes.GetSize() * sizeof(BVHHitAttributes::Record) * 4 < triangleCount * 96);
+
+		for (std::size_t i = 0; i < triangleCount; ++i)
+		{
+			const BVHHitAttributes::Record& record = attributes.GetRecords()[i];
+
+			CHECK(record.x >= range.begin && record.x < range.end);
+			CHECK(record.y >= range.begin && record.y < range.end);
+			CHECK(record.z >= range.begin && record.z < range.end);
+		}
+
+		const BVHHitAttributes::Vertex corner = BVHHitAttributes::UnpackVertex(attributes.GetRecords()[attributes.GetRecords()[triangleCount - 1].y]);
+		CHECK(corner.u == 1.0f && corner.v == 1.0f && corner.normal.z == 1.0f);
+
+		// writing the object again with other attributes keeps the records and rewrites the vertices in place
+		const std::vector<BVHHitAttributes::Record> records(attributes.GetRecords().begin(), attributes.GetRecords().begin() + triangleCount);
+		const BVHBuilder::StreamRange rewritten = writeGrid(attributes, range.begin, 1.0f);
+
+		CHECK(rewritten.begin == range.begin && rewritten.end == range.end);
+		CHECK(std::memcmp(records.data(), attributes.GetRecords().data(), triangleCount * sizeof(BVHHitAttributes::Record)) == 0);
+
+		const BVHHitAttributes::Vertex tilted = BVHHitAttributes::UnpackVertex(attributes.GetRecords()[range.begin]);
+		CHECK(std::abs(tilted.normal.x - std::sqrt(0.5f)) < 1e-4f && std::abs(tilted.tangent.z + std::sqrt(0.5f)) < 1e-4f);
+	}
+
+	void TestCache()
+	{
+		const std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(2000, 7);
+
+		BVHBuilder::BuildSettings settings;
+
+		BVHBuilder builder;
+		builder.Build(triangles, settings);
+
+		const BVHBuilder::BuildVector<Float4>& stream = builder.GetStream();
+		const std::vector<BVHHitAttributes::Record> attributes(1001, BVHHitAttributes::Record{ 1, 2, 3 });
+
+		BVHCache::Hasher hasher;
+		hasher.Add(settings);
+		const std::uint64_t key = hasher.GetHash();
+
+		// the key follows the settings that change the stream
+		{
+			BVHBuilder::BuildSettings wide = settings;
+			wide.width = 4;
+
+			BVHCache::Hasher other;
+			other.Add(wide);
+			CHECK(other.GetHash() != key);
+		}
+
+		const std::string path = (std::filesystem::temp_directory_path() / "hsspr_bvh_test.cache").string();
+
+		CHECK(BVHCache::Write(path, key, stream.data(), stream.size() * sizeof(Float4), attributes.data(), attributes.size() * sizeof(BVHHitAttributes::Record)));
+
+		{
+			BVHCache cache;
+			CHECK(cache.Open(path, key) == BVHCache::Status::Loaded);
+			CHECK(reinterpret_cast<std::uintptr_t>(cache.GetTree()) % BVHCache::kAlignment == 0);
+			CHECK(reinterpret_cast<std::uintptr_t>(cache.GetAttributes()) % BVHCache::kAlignment == 0);
+			CHECK(cache.GetTreeSize() == stream.size() * sizeof(Float4) && std::memcmp(cache.GetTree(), stream.data(), cache.GetTreeSize()) == 0);
+			CHECK(cache.GetAttributesSize() == attributes.size() * sizeof(BVHHitAttributes::Record) &&
+				  std::memcmp(cache.GetAttributes(), attributes.data(), cache.GetAttributesSize()) == 0);
+
+			// the mapped tree is traversed in place
+			const BVHTraversal built(stream.data());
+			const BVHTraversal mapped(cache.GetTree());
+
+			for (const BVHTraversal::Ray& ray : CreateRandomRays(200, 8))
+			{
+				BVHTraversal::Hit a, b;
+				const bool bHitA = built.TraceReflection(ray, a);
+				const bool bHitB = mapped.TraceReflection(ray, b);
+
+				CHECK(bHitA == bHitB);
+				CHECK(!bHitA || (a.t == b.t && a.offset == b.offset));
+			}
+
+			CHECK(cache.Open(path, key + 1) == BVHCache::Status::Stale);
+		}
+
+		const auto size = std::filesystem::file_size(path);
+
+		auto rewrite = [&](const std::uint64_t offset, const std::uint64_t newSize)
+		{
+			CHECK(BVHCache::Write(path, key, stream.data(), stream.size() * sizeof(Float4), attributes.data(), attributes.size() * sizeof(BVHHitAttributes::Record)));
+
+			if (offset < size)
+			{
+				std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+				file.seekp(std::streamoff(offset));
+				file.put(char(0x5a));
+			}
+
+			std::filesystem::resize_file(path, newSize);
+		};
+
+		BVHCache cache;
+
+		// a changed payload byte fails the checksum, which only the verified open reads
+		rewrite(size - 1, size);
+		CHECK(cache.Open(path, key, true) == BVHCache::Status::Corrupt);
+		CHECK(cache.Open(path, key, false) == BVHCache::Status::Loaded);
+
+		// a truncated section, a truncated header, either way
+		for (const bool bVerifyChecksum : { true, false })
+		{
+			rewrite(size, size - 12);
+			CHECK(cache.Open(path, key, bVerifyChecksum) == BVHCache::Status::Corrupt);
+
+			rewrite(size, sizeof(BVHCache::Header) / 2);
+			CHECK(cache.Open(path, key, bVerifyChecksum) == BVHCache::Status::Corrupt);
+		}
+
+		std::filesystem::remove(path);
+		CHECK(cache.Open(path, key) == BVHCache::Status::Missing);
+	}
+
+	void TestMeshFile()
+	{
+		const std::filesystem::path directory = std::filesystem::temp_directory_path();
+		const std::string csvPath = (directory / "hsspr_mesh_test.csv").string();
+		const std::string meshPath = (directory / "hsspr_mesh_test.mesh").string();
+
+		// a quad in index buffer order, the rows of a shared index repeat its vertex
+		{
+			std::ofstream csv(csvPath);
+			csv << "VTX, IDX, POSITION.x, POSITION.y, POSITION.z, NORMAL.x, NORMAL.y, NORMAL.z, TEXCOORD0.x, TEXCOORD0.y\n";
+
+			const int quad[6] = { 0, 1, 2, 2, 1, 3 };
+
+			for (int i = 0; i < 6; ++i)
+			{
+				const int index = quad[i];
+				csv << i << ", " << index << ", " << (index & 1) << ", " << (index >> 1) << ", 0.5, 0, 0, -1, " << (index & 1) << ", " << 0.25f * (index >> 1) << "\n";
+			}
+		}
+
+		std::vector<MeshFile::Vertex> vertices;
+		std::vector<MeshFile::Index> indices;
+
+		CHECK(MeshFile::ImportCsv(csvPath, vertices, indices));
+		CHECK(vertices.size() == 4);
+		CHECK(indices == std::vector<MeshFile::Index>({ 0, 1, 2, 2, 1, 3 }));
+		CHECK(vertices.size() == 4 && vertices[3].position.x == 1.0f && vertices[3].position.y == 1.0f && vertices[3].position.z == 0.5f);
+		CHECK(vertices.size() == 4 && vertices[3].normal.z == -1.0f && vertices[3].tangent.x == 0.0f && vertices[3].v == 0.25f);
+
+		CHECK(MeshFile::Write(meshPath, vertices.data(), vertices.size(), indices.data(), indices.size()));
+
+		{
+			MeshFile mesh;
+			CHECK(mesh.Open(meshPath) == MeshFile::Status::Loaded);
+			CHECK(reinterpret_cast<std::uintptr_t>(mesh.GetVertices()) % MeshFile::kAlignment == 0);
+			CHECK(reinterpret_cast<std::uintptr_t>(mesh.GetIndices()) % MeshFile::kAlignment == 0);
+			CHECK(mesh.GetVertexCount() == 4 && std::memcmp(mesh.GetVertices(), vertices.data(), 4 * sizeof(MeshFile::Vertex)) == 0);
+			CHECK(mesh.GetIndexCount() == 6 && std::memcmp(mesh.GetIndices(), indices.data(), 6 * sizeof(MeshFile::Index)) == 0);
+			CHECK(mesh.GetBounds().min.x == 0.0f && mesh.GetBounds().max.y == 1.0f && mesh.GetBounds().max.z == 0.5f);
+
+			// the content hash follows the vertices and the indices
+			const std::uint64_t contentHash = mesh.GetContentHash();
+			mesh.Close();
+
+			CHECK(MeshFile::Write(meshPath, vertices.data(), vertices.size(), indices.data(), indices.size()));
+			CHECK(mesh.Open(meshPath) == MeshFile::Status::Loaded && mesh.GetContentHash() == contentHash);
+
+			std::vector<MeshFile::Vertex> moved = vertices;
+			moved[3].position.z += 1.0f;
+			mesh.Close();
+
+			CHECK(MeshFile::Write(meshPath, moved.data(), moved.size(), indices.data(), indices.size()));
+			CHECK(mesh.Open(meshPath) == MeshFile::Status::Loaded && mesh.GetContentHash() != contentHash);
+		}
+
+		// rows in vertex buffer order, no index buffer
+		{
+			std::ofstream csv(csvPath);
+			csv << "VTX,POSITION.x,POSITION.y,POSITION.z\n0,1,2,3\n1,4,5,6\n2,7,8,9\n";
+		}
+
+		CHECK(MeshFile::ImportCsv(csvPath, vertices, indices));
+		CHECK(vertices.size() == 3 && indices.empty() && vertices[2].position.z == 9.0f);
+
+		// an index out of the vertices
+		indices = { 0, 1, 3 };
+		CHECK(MeshFile::Write(meshPath, vertices.data(), vertices.size(), indices.data(), indices.size()));
+
+		MeshFile mesh;
+		CHECK(mesh.Open(meshPath) == MeshFile::Status::Corrupt);
+
+		// another version
+		indices = { 0, 1, 2 };
+		CHECK(MeshFile::Write(meshPath, vertices.data(), vertices.size(), indices.data(), indices.size()));
+
+		{
+			std::fstream file(meshPath, std::ios::in | std::ios::out | std::ios::binary);
+			const std::uint32_t version = MeshFile::kVersion + 1;
+			file.seekp(std::streamoff(offsetof(MeshFile::Header, version)));
+			file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+		}
+
+		CHECK(mesh.Open(meshPath) == MeshFile::Status::Stale);
+
+		std::filesystem::remove(meshPath);
+		std::filesystem::remove(csvPath);
+		CHECK(mesh.Open(meshPath) == MeshFile::Status::Missing);
+		CHECK(!MeshFile::ImportCsv(csvPath, vertices, indices));
+	}
+
+	void TestTreeStats()
+	{
+		const std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(3000, 10);
+
+		for (const int width : { 2, 4, 8 })
+		{
+			BVHBuilder::BuildSettings settings;
+			settings.threadCount = 1;
+			settings.width = width;
+
+			BVHBuilder builder;
+			builder.Build(triangles, settings);
+
+			const BVHBuilder::BuildStats& buildStats = builder.GetStats();
+			const BVHTreeStats stats = BVHTreeStats::Compute(builder, triangles.data());
+
+			CHECK(std::abs(stats.sahCost - buildStats.sahCost) <= 1e-4f * buildStats.sahCost);
+			CHECK(stats.epo > 0.0f && stats.overlap > 0.0f);
+			CHECK(stats.depthHistogram.size() == stats.maxDepth + 1);
+
+			std::size_t leafCount = 0;
+			std::size_t triangleCount = 0;
+
+			for (std::size_t i = 0; i < stats.leafSizeHistogram.size(); ++i)
+			{
+				leafCount += stats.leafSizeHistogram[i];
+				triangleCount += i * stats.leafSizeHistogram[i];
+			}
+
+			CHECK(leafCount == buildStats.leafCount && triangleCount == triangles.size());
+
+			// the levels account for the whole stream but the terminator of the skip-offset stream
+			std::size_t size = 0;
+			std::size_t levelTriangleCount = 0;
+
+			for (const BVHTreeStats::Level& level : stats.levels)
+			{
+				size += level.nodeSize + level.leafSize;
+				levelTriangleCount += level.triangleCount;
+			}
+
+			CHECK(size + ((width == 2) ? sizeof(BVHBuilder::Node) : 0) == buildStats.serializedSize);
+			CHECK(levelTriangleCount == triangles.size());
+			CHECK(width != 2 || (stats.levels[0].nodeCount == 1 && stats.levels[0].nodeSize == 0));
+
+			std::stringstream json;
+			stats.WriteJson(json);
+			CHECK(json.str().find("\"epo\"") != std::string::npos && json.str().find("\"levels\"") != std::string::npos);
+		}
+
+		// triangles in separate cells of a row, no node holds a triangle it does not reference
+		std::vector<BVHBuilder::Triangle> row(64);
+
+		for (std::size_t i = 0; i < row.size(); ++i)
+		{
+			row[i].v0 = Float3(float(2 * i), 0.0f, 0.0f);
+			row[i].v1 = Float3(float(2 * i + 1), 0.0f, 0.0f);
+			row[i].v2 = Float3(float(2 * i), 1.0f, 0.0f);
+			row[i].offset = std::uint32_t(i);
+			row[i].material = 0;
+		}
+
+		BVHBuilder builder;
+		builder.Build(row, BVHBuilder::BuildSettings());
+
+		const BVHTreeStats stats = BVHTreeStats::Compute(builder, row.data());
+		CHECK(stats.epo == 0.0f && stats.overlap == 0.0f);
+	}
+
+	void TestTraversalCounters()
+	{
+		const std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(3000, 17);
+		const std::vector<BVHTraversal::Ray> rays = CreateRandomRays(1000, 18);
+
+		double iterationsPerRay[2] = {};
+
+		for (const int width : { 2, 4 })
+		{
+			BVHBuilder::BuildSettings settings;
+			settings.threadCount = 1;
+			settings.width = width;
+
+			BVHBuilder builder;
+			builder.Build(triangles, settings);
+
+			const BVHTraversal traversal(builder.GetStream().data(), width);
+
+			BVHTraversal::Counters shadowTotals;
+			BVHTraversal::Counters reflectionTotals;
+			BVHTraversal::Counters sum;
+
+			for (const BVHTraversal::Ray& ray : rays)
+			{
+				BVHTraversal::Counters shadow;
+				BVHTraversal::Counters reflection;
+				BVHTraversal::Hit hit;
+				BVHTraversal::Hit countedHit;
+
+				// counting does not change the result
+				const bool bShadow = traversal.TraceShadow(ray, shadow);
+				const bool bReflection = traversal.TraceReflection(ray, countedHit, reflection);
+
+				CHECK(bShadow == traversal.TraceShadow(ray));
+				CHECK(bReflection == traversal.TraceReflection(ray, hit) && hit.offset == countedHit.offset);
+
+				CHECK(shadow.iterations > 0 && reflection.iterations > 0);
+				CHECK(!bShadow || shadow.triangleTests > 0);
+				CHECK(width == 2 || (shadow.boxTests % 4 == 0 && reflection.boxTests % 4 == 0));
+
+				// the same counts on a second pass, and accumulated by the overloads
+				BVHTraversal::Counters again;
+				traversal.TraceShadow(ray, again);
+				CHECK(again.boxTests == shadow.boxTests && again.triangleTests == shadow.triangleTests && again.iterations == shadow.iterations);
+
+				traversal.TraceShadow(ray, shadowTotals);
+				traversal.TraceReflection(ray, hit, reflectionTotals);
+
+				sum += shadow;
+				sum += reflection;
+			}
+
+			CHECK(sum.boxTests == shadowTotals.boxTests + reflectionTotals.boxTests);
+			CHECK(sum.triangleTests == shadowTotals.triangleTests + reflectionTotals.triangleTests);
+			CHECK(sum.iterations == shadowTotals.iterations + reflectionTotals.iterations);
+
+			iterationsPerRay[width / 4] = double(reflectionTotals.iterations) / rays.size();
+		}
+
+		// the wide nodes take fewer steps
+		CHECK(iterationsPerRay[1] < iterationsPerRay[0]);
+
+		// a ray that misses the scene: the two children of the unwritten root and the terminator, or the wide root
+		const BVHTraversal::Ray miss(Float3(0.0f, 100.0f, 0.0f), Float3(0.0f, 1.0f, 0.0f));
+
+		for (const int width : { 2, 4, 8 })
+		{
+			BVHBuilder::BuildSettings settings;
+			settings.threadCount = 1;
+			settings.width = width;
+
+			BVHBuilder builder;
+			builder.Build(triangles, settings);
+
+			BVHTraversal::Counters counters;
+			CHECK(!BVHTraversal(builder.GetStream().data(), width).TraceShadow(miss, counters));
+
+			CHECK(counters.triangleTests == 0);
+			CHECK((width == 2) ? (counters.boxTests == 2 && counters.iterations == 3) : (counters.boxTests == std::uint64_t(width) && counters.iterations == 1));
+		}
+	}
+
+	void TestOrderedClosestHit()
+	{
+		const std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(5000, 19);
+		const std::vector<BVHTraversal::Ray> rays = CreateRandomRays(2000, 20);
+
+		for (const int width : { 2, 4, 8 })
+		{
+			for (const int quantization : { 0, 8 })
+			{
+				if (width == 2 && quantization != 0)
+				{
+					continue;
+				}
+
+				BVHBuilder::BuildSettings settings;
+				settings.threadCount = 1;
+				settings.width = width;
+				settings.quantization = quantization;
+
+				BVHBuilder builder;
+				builder.Build(triangles, settings);
+
+				const BVHTraversal traversal(builder.GetStream().data(), width, false, quantization);
+				const BVHTraversal ordered(builder.GetStream().data(), width, false, quantization, BVHTraversal::LeafFormat::Edges, true);
+
+				BVHTraversal::Counters before;
+				BVHTraversal::Counters after;
+				std::size_t mismatches = 0;
+
+				for (const BVHTraversal::Ray& ray : rays)
+				{
+					BVHTraversal::Hit expected;
+					BVHTraversal::Hit hit;
+
+					const bool bExpected = traversal.TraceReflection(ray, expected, before);
+					const bool bHit = ordered.TraceReflection(ray, hit, after);
+
+					// the same closest hit, another triangle only at the same distance
+					if (bHit != bExpected || (bHit && hit.t != expected.t))
+					{
+						mismatches++;
+					}
+
+					CHECK(ordered.TraceShadow(ray) == traversal.TraceShadow(ray));
+				}
+
+				CHECK(mismatches == 0);
+
+				// fewer nodes and triangles once the first hit clips the boxes behind it
+				CHECK(after.iterations < before.iterations);
+				CHECK(after.triangleTests < before.triangleTests);
+			}
+		}
+
+		// the children of the skip-offset nodes keep their order along the axis they are the furthest apart
+		AABB low;
+		low.min = Float3(0.0f, 0.0f, 0.0f);
+		low.max = Float3(1.0f, 1.0f, 1.0f);
+
+		AABB high;
+		high.min = Float3(0.0f, 5.0f, 0.0f);
+		high.max = Float3(1.0f, 6.0f, 1.0f);
+
+		CHECK(BVHBuilder::GetChildOrder(low, high) == 1);
+		CHECK(BVHBuilder::GetChildOrder(high, low) == (1 | 4));
+	}
+
+	void TestDeepTree()
+	{
+		// slivers along x sharing the same bounds: every split costs the same and the sweep peels one triangle per level,
+		// a chain as deep as the triangle count unless the build bounds it
+		std::vector<BVHBuilder::Triangle> triangles(300);
+
+		for (std::size_t i = 0; i < triangles.size(); ++i)
+		{
+			const float u = float(i) / float(triangles.size());
+
+			BVHBuilder::Triangle& triangle = triangles[i];
+			triangle.v0 = Float3(0.0f, u, 0.0f);
+			triangle.v1 = Float3(10.0f, 0.0f, 1.0f);
+			triangle.v2 = Float3(10.0f * u, 1.0f, u);
+			triangle.offset = std::uint32_t(i);
+			triangle.material = std::uint32_t(i % 3);
+		}
+
+		// rays along the slivers cross the boxes of the whole chain, and scattered ones
+		std::vector<BVHTraversal::Ray> rays = CreateRandomRays(500, 23);
+
+		std::mt19937 rng(24);
+		std::uniform_real_distribution<float> offset(0.0f, 1.0f);
+
+		for (int i = 0; i < 500; ++i)
+		{
+			rays.emplace_back(Float3(-1.0f, offset(rng), offset(rng)), Float3(1.0f, offset(rng) - 0.5f, offset(rng) - 0.5f));
+		}
+
+		for (const int maxLeafSize : { 1, 4 })
+		for (const int width : { 2, 4, 8 })
+		{
+			BVHBuilder::BuildSettings settings;
+			settings.mode = BVHBuilder::BuildMode::Sweep;
+			settings.maxLeafSize = maxLeafSize;
+			settings.threadCount = 1;
+			settings.width = width;
+
+			BVHBuilder builder;
+			builder.Build(triangles, settings);
+
+			// the chain is cut at the bound, and the wide levels stay within the stack
+			const BVHTreeStats stats = BVHTreeStats::Compute(builder);
+			const int maxDepth = BVHBuilder::GetMaxDepth(width);
+
+			CHECK(stats.maxDepth == std::size_t(maxDepth));
+
+			const int levels = (width == 8) ? 3 : (width == 4) ? 2 : 1;
+			std::size_t nodeLevelCount = 0;
+
+			for (const BVHTreeStats::Level& level : stats.levels)
+			{
+				nodeLevelCount += (level.nodeCount > 0) ? 1 : 0;
+			}
+
+			CHECK(nodeLevelCount <= std::size_t((maxDepth - 1) / levels + 1));
+
+			const BVHTraversal traversal(builder.GetStream().data(), width);
+			const BVHTraversal ordered(builder.GetStream().data(), width, false, 0, BVHTraversal::LeafFormat::Edges, true);
+
+			std::size_t mismatches = 0;
+
+			for (const BVHTraversal::Ray& ray : rays)
+			{
+				BVHTraversal::Hit expected;
+				const bool bExpected = TraceBruteForce(triangles, ray, true, expected);
+				const bool bExpectedShadow = TraceBruteForce(triangles, ray, false, expected);
+
+				for (const BVHTraversal* trace : { &traversal, &ordered })
+				{
+					BVHTraversal::Hit hit;
+					const bool bHit = trace->TraceReflection(ray, hit);
+
+					if (bHit != bExpected || (bHit && hit.t != expected.t) || trace->TraceShadow(ray) != bExpectedShadow)
+					{
+						mismatches++;
+					}
+				}
+			}
+
+			CHECK(mismatches == 0);
+		}
+	}
+
+	void TestParallelBuildIsDeterministic()
+	{
+		const std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(20000, 5);
+
+		for (const BVHBuilder::BuildMode mode : { BVHBuilder::BuildMode::Sweep, BVHBuilder::BuildMode::Binned })
+		{
+			BVHBuilder::BuildSettings settings;
+			settings.mode = mode;
+			settings.threadCount = 1;
+
+			BVHBuilder serial;
+			serial.Build(triangles, settings);
+
+			// small thresholds so that both subtree tasks and chunked splits are exercised
+			settings.threadCount = 4;
+			settings.parallelThreshold = 64;
+			settings.parallelSplitThreshold = 1024;
+
+			BVHBuilder parallel;
+			parallel.Build(triangles, settings);
+
+			const BVHBuilder::BuildVector<Float4>& a = serial.GetStream();
+			const BVHBuilder::BuildVector<Float4>& b = parallel.GetStream();
+
+			CHECK(a.size() == b.size());
+			CHECK(a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(Float4)) == 0);
+		}
+	}
+
+	void TestBuildStats()
+	{
+		const std::vector<BVHBuilder::Triangle> triangles = CreateRandomTriangles(5000, 6);
+
+		BVHBuilder::BuildSettings settings;
+		settings.threadCount = 1;
+
+		BVHBuilder builder;
+		builder.Build(triangles, settings);
+
+		const BVHBuilder::BuildStats& stats = builder.GetStats();
+
+		CHECK(stats.triangleCount == triangles.size());
+		CHECK(stats.leafCount == stats.nodeCount + 1);
+		CHECK(stats.serializedSize == ((stats.nodeCount - 1) * sizeof(BVHBuilder::Node) + triangles.size() * sizeof(BVHBuilder::Leaf) + sizeof(BVHBuilder::Node)));
+		CHECK(stats.peakMemory >= stats.serializedSize);
+		CHECK(stats.allocationCount > 0);
+	}
+}
+
+int main()
+{
+	struct Test
+	{
+		const char* name;
+		void (*function)();
+	};
+
+	const Test tests[] =
+	{
+		{ "StreamLayout", TestStreamLayout },
+		{ "WideStreamLayout", TestWideStreamLayout },
+		{ "SingleTriangle", TestSingleTriangle },
+		{ "TraversalMatchesBruteForce", TestTraversalMatchesBruteForce },
+		{ "PacketTraversalMatchesScalar", TestPacketTraversalMatchesScalar },
+		{ "Refit", TestRefit },
+		{ "TwoLevel", TestTwoLevel },
+		{ "SpatialSplits", TestSpatialSplits },
+		{ "QuantizedNodes", TestQuantizedNodes },
+		{ "LeafFormats", TestLeafFormats },
+		{ "HitAttributes", TestHitAttributes },
+		{ "Cache", TestCache },
+		{ "MeshFile", TestMeshFile },
+		{ "ParallelBuildIsDeterministic", TestParallelBuildIsDeterministic },
+		{ "BuildStats", TestBuildStats },
+		{ "TreeStats", TestTreeStats },
+		{ "TraversalCounters", TestTraversalCounters },
+		{ "OrderedClosestHit", TestOrderedClosestHit },
+		{ "DeepTree", TestDeepTree },
+	};
+
+	for (const Test& test : tests)
+	{
+		const int failures = sFailures;
+
+		test.function();
+
+		std::printf("%s: %s\n", test.name, (sFailures == failures) ? "passed" : "FAILED");
+	}
+
+	return sFailures ? 1 : 0;
+}
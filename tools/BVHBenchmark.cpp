@@ -0,0 +1,759 @@
+// builds and traces BVHs over the bridge mesh, the procedural grid and random triangle soups and writes one record per
+// scene and build configuration as JSON or CSV, to compare the numbers across commits
+// usage: BVHBenchmark [--mesh models/bridge_ib_order.mesh] [--grid 256] [--sizes 10000,100000,1000000,10000000]
+//                     [--modes binned,sweep,spatial] [--widths 2,4,8] [--quantization 0] [--leaf edges,woop,bw]
+//                     [--rays 100000] [--repeat 3] [--threads 0] [--tree-stats 0|1] [--counters 0|1] [--ordered 0|1] [--format json|csv] [--output file] [--label text]
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//
+#include "BVHBuilder.h"
+#include "BVHTraversal.h"
+#include "BVHTreeStats.h"
+#include "MeshFile.h"
+
+namespace
+{
+	using Triangle = BVHBuilder::Triangle;
+
+	struct Options
+	{
+		std::string mesh = "models/bridge_ib_order.mesh";
+		int gridSize = 256; // vertices per side, 0 skips the grid
+		std::vector<std::size_t> sizes = { 10000, 100000, 1000000, 10000000 };
+		std::vector<BVHBuilder::BuildMode> modes = { BVHBuilder::BuildMode::Binned };
+		std::vector<int> widths = { 2 };
+		std::vector<int> quantizations = { 0 };
+		std::vector<BVHBuilder::LeafFormat> leafFormats = { BVHBuilder::LeafFormat::Edges };
+		std::size_t rayCount = 100000;
+		int repeat = 3;
+		unsigned threadCount = 0;
+		bool bTreeStats = false; // EPO, overlap and depth, the EPO clips every triangle against the nodes around it
+		bool bCounters = false; // box tests, triangle tests and iterations per ray, one more untimed pass over the rays
+		bool bOrdered = true; // BVH_ORDERED closest-hit traversal for the reflection rays
+		bool bCsv = false;
+		std::string output;
+		std::string label;
+	};
+
+	struct Scene
+	{
+		std::string name;
+		std::vector<Triangle> triangles;
+	};
+
+	struct Result
+	{
+		std::string scene;
+		std::size_t triangleCount = 0;
+		BVHBuilder::BuildSettings settings;
+		BVHBuilder::BuildStats stats;
+		BVHTreeStats treeStats;
+		double buildTime = 0.0; // ms, best of the repeats
+		double shadowRaysPerSecond = 0.0;
+		double reflectionRaysPerSecond = 0.0;
+		double shadowHitRate = 0.0;
+		double reflectionHitRate = 0.0;
+
+		// per ray
+		double shadowBoxTests = 0.0;
+		double shadowTriangleTests = 0.0;
+		double shadowIterations = 0.0;
+		double reflectionBoxTests = 0.0;
+		double reflectionTriangleTests = 0.0;
+		double reflectionIterations = 0.0;
+	};
+
+	const char* GetModeName(const BVHBuilder::BuildMode mode)
+	{
+		switch (mode)
+		{
+			case BVHBuilder::BuildMode::Sweep:
+				return "sweep";
+			case BVHBuilder::BuildMode::Binned:
+				return "binned";
+			case BVHBuilder::BuildMode::Spatial:
+				return "spatial";
+		}
+
+		return "unknown";
+	}
+
+	const char* GetLeafFormatName(const BVHBuilder::LeafFormat format)
+	{
+		switch (format)
+		{
+			case BVHBuilder::LeafFormat::Edges:
+				return "edges";
+			case BVHBuilder::LeafFormat::Woop:
+				return "woop";
+			case BVHBuilder::LeafFormat::BaldwinWeber:
+				return "bw";
+		}
+
+		return "unknown";
+	}
+
+	std::vector<std::string> Split(const std::string& list)
+	{
+		std::vector<std::string> items;
+		std::stringstream ss(list);
+		std::string item;
+
+		while (std::getline(ss, item, ','))
+		{
+			if (!item.empty())
+			{
+				items.push_back(item);
+			}
+		}
+
+		return items;
+	}
+
+	bool ParseOptions(const int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			const std::string option = argv[i];
+
+			if (i + 1 >= argc)
+			{
+				std::fprintf(stderr, "missing value of %s\n", option.c_str());
+				return false;
+			}
+
+			const std::string value = argv[++i];
+
+			if (option == "--mesh")
+			{
+				options.mesh = value;
+			}
+			else if (option == "--grid")
+			{
+				options.gridSize = std::atoi(value.c_str());
+			}
+			else if (option == "--sizes")
+			{
+				options.sizes.clear();
+
+				for (const std::string& size : Split(value))
+				{
+					options.sizes.push_back(std::size_t(std::strtoull(size.c_str(), nullptr, 10)));
+				}
+			}
+			else if (option == "--modes")
+			{
+				options.modes.clear();
+
+				for (const std::string& mode : Split(value))
+				{
+					if (mode == "sweep")
+					{
+						options.modes.push_back(BVHBuilder::BuildMode::Sweep);
+					}
+					else if (mode == "binned")
+					{
+						options.modes.push_back(BVHBuilder::BuildMode::Binned);
+					}
+					else if (mode == "spatial")
+					{
+						options.modes.push_back(BVHBuilder::BuildMode::Spatial);
+					}
+					else
+					{
+						std::fprintf(stderr, "unknown build mode %s\n", mode.c_str());
+						return false;
+					}
+				}
+			}
+			else if (option == "--widths" || option == "--quantization")
+			{
+				std::vector<int>& values = (option == "--widths") ? options.widths : options.quantizations;
+				values.clear();
+
+				for (const std::string& item : Split(value))
+				{
+					values.push_back(std::atoi(item.c_str()));
+				}
+			}
+			else if (option == "--leaf")
+			{
+				options.leafFormats.clear();
+
+				for (const std::string& format : Split(value))
+				{
+					if (format == "edges")
+					{
+						options.leafFormats.push_back(BVHBuilder::LeafFormat::Edges);
+					}
+					else if (format == "woop")
+					{
+						options.leafFormats.push_back(BVHBuilder::LeafFormat::Woop);
+					}
+					else if (format == "bw")
+					{
+						options.leafFormats.push_back(BVHBuilder::LeafFormat::BaldwinWeber);
+					}
+					else
+					{
+						std::fprintf(stderr, "unknown leaf format %s\n", format.c_str());
+						return false;
+					}
+				}
+			}
+			else if (option == "--rays")
+			{
+				options.rayCount = std::size_t(std::strtoull(value.c_str(), nullptr, 10));
+			}
+			else if (option == "--repeat")
+			{
+				options.repeat = std::max(1, std::atoi(value.c_str()));
+			}
+			else if (option == "--threads")
+			{
+				options.threadCount = unsigned(std::atoi(value.c_str()));
+			}
+			else if (option == "--tree-stats")
+			{
+				options.bTreeStats = (value != "0");
+			}
+			else if (option == "--counters")
+			{
+				options.bCounters = (value != "0");
+			}
+			else if (option == "--ordered")
+			{
+				options.bOrdered = (value != "0");
+			}
+			else if (option == "--format")
+			{
+				options.bCsv = (value == "csv");
+			}
+			else if (option == "--output")
+			{
+				options.output = value;
+			}
+			else if (option == "--label")
+			{
+				options.label = value;
+			}
+			else
+			{
+				std::fprintf(stderr, "unknown option %s\n", option.c_str());
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// the binary mesh, or the CSV capture it is converted from
+	bool LoadMesh(const std::string& path, Scene& scene)
+	{
+		std::vector<MeshFile::Vertex> vertices;
+		std::vector<MeshFile::Index> indices;
+
+		MeshFile file;
+
+		if (file.Open(path) == MeshFile::Status::Loaded)
+		{
+			vertices.assign(file.GetVertices(), file.GetVertices() + file.GetVertexCount());
+			indices.assign(file.GetIndices(), file.GetIndices() + file.GetIndexCount());
+		}
+		else if (!MeshFile::ImportCsv(path.substr(0, path.rfind('.')) + ".csv", vertices, indices))
+		{
+			return false;
+		}
+
+		const std::size_t indexCount = indices.empty() ? vertices.size() : indices.size();
+
+		for (std::size_t i = 0; i < indexCount; i += 3)
+		{
+			Triangle triangle;
+			triangle.v0 = vertices[indices.empty() ? i + 0 : indices[i + 0]].position;
+			triangle.v1 = vertices[indices.empty() ? i + 1 : indices[i + 1]].position;
+			triangle.v2 = vertices[indices.empty() ? i + 2 : indices[i + 2]].position;
+			triangle.offset = std::uint32_t(i / 3);
+			triangle.material = 0;
+
+			scene.triangles.push_back(triangle);
+		}
+
+		scene.name = "bridge";
+
+		return true;
+	}
+
+	// an axis aligned box without its bottom face, two triangles per side
+	void AddBox(Scene& scene, const Float3& min, const Float3& max)
+	{
+		auto corner = [&](const int i)
+		{
+			return Float3((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+		};
+
+		// corners a, b, c, d around a face
+		auto quad = [&](const int a, const int b, const int c, const int d)
+		{
+			Triangle triangle;
+			triangle.material = 0;
+
+			triangle.v0 = corner(a);
+			triangle.v1 = corner(b);
+			triangle.v2 = corner(c);
+			triangle.offset = std::uint32_t(scene.triangles.size());
+			scene.triangles.push_back(triangle);
+
+			triangle.v0 = corner(a);
+			triangle.v1 = corner(c);
+			triangle.v2 = corner(d);
+			triangle.offset = std::uint32_t(scene.triangles.size());
+			scene.triangles.push_back(triangle);
+		};
+
+		quad(0, 1, 3, 2); // -z
+		quad(4, 6, 7, 5); // +z
+		quad(0, 2, 6, 4); // -x
+		quad(1, 5, 7, 3); // +x
+		quad(2, 3, 7, 6); // +y
+	}
+
+	// the layout of MeshManager::CreateGrid: m x n vertices over width x depth in the xz plane, two triangles per cell.
+	// boxes of several heights stand on it like the bridge stands over the grid of the application, so that the shadow
+	// rays toward the light and the reflection rays leaving the plane have something to hit
+	Scene CreateGrid(const float width, const float depth, const int m, const int n)
+	{
+		Scene scene;
+		scene.name = "grid" + std::to_string(m) + "x" + std::to_string(n);
+
+		const float dx = width / (n - 1);
+		const float dz = depth / (m - 1);
+
+		auto vertex = [&](const int i, const int j)
+		{
+			return Float3(-0.5f * width + j * dx, 0.0f, 0.5f * depth - i * dz);
+		};
+
+		for (int i = 0; i < m - 1; ++i)
+		{
+			for (int j = 0; j < n - 1; ++j)
+			{
+				Triangle triangle;
+				triangle.material = 0;
+
+				triangle.v0 = vertex(i, j);
+				triangle.v1 = vertex(i, j + 1);
+				triangle.v2 = vertex(i + 1, j);
+				triangle.offset = std::uint32_t(scene.triangles.size());
+				scene.triangles.push_back(triangle);
+
+				triangle.v0 = vertex(i + 1, j);
+				triangle.v1 = vertex(i, j + 1);
+				triangle.v2 = vertex(i + 1, j + 1);
+				triangle.offset = std::uint32_t(scene.triangles.size());
+				scene.triangles.push_back(triangle);
+			}
+		}
+
+		// 8 x 8 boxes, a quarter of their spacing wide
+		const int boxCount = 8;
+		const float spacingX = width / boxCount;
+		const float spacingZ = depth / boxCount;
+
+		for (int i = 0; i < boxCount; ++i)
+		{
+			for (int j = 0; j < boxCount; ++j)
+			{
+				const float x = -0.5f * width + (j + 0.5f) * spacingX;
+				const float z = -0.5f * depth + (i + 0.5f) * spacingZ;
+				const float height = 0.5f * spacingX * (1 + (i * 3 + j * 5) % 4);
+
+				AddBox(scene, Float3(x - 0.125f * spacingX, 0.0f, z - 0.125f * spacingZ), Float3(x + 0.125f * spacingX, height, z + 0.125f * spacingZ));
+			}
+		}
+
+		return scene;
+	}
+
+	// triangles scattered in a 100 units cube, their vertices within half the mean spacing of the centers so that
+	// the overlap is the same at every count
+	Scene CreateSoup(const std::size_t count, const unsigned seed)
+	{
+		Scene scene;
+		scene.name = "soup" + std::to_string(count);
+
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+
+		const float spacing = 100.0f / std::cbrt(float(count));
+		std::uniform_real_distribution<float> edge(-0.5f * spacing, 0.5f * spacing);
+
+		scene.triangles.resize(count);
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			const Float3 center(position(rng), position(rng), position(rng));
+
+			Triangle& triangle = scene.triangles[i];
+			triangle.v0 = center + Float3(edge(rng), edge(rng), edge(rng));
+			triangle.v1 = center + Float3(edge(rng), edge(rng), edge(rng));
+			triangle.v2 = center + Float3(edge(rng), edge(rng), edge(rng));
+			triangle.offset = std::uint32_t(i);
+			triangle.material = 0;
+		}
+
+		return scene;
+	}
+
+	Float3 Normalize(const Float3& v)
+	{
+		return (1.0f / std::sqrt(Dot(v, v))) * v;
+	}
+
+	// rays leave random points of the surfaces like the rays of the shadow and reflection passes:
+	// shadow rays toward a directional light, reflection rays mirror the direction from a camera above the scene
+	void CreateRays(const Scene& scene, const std::size_t count, std::vector<BVHTraversal::Ray>& shadowRays, std::vector<BVHTraversal::Ray>& reflectionRays)
+	{
+		AABB bounds;
+
+		for (const Triangle& triangle : scene.triangles)
+		{
+			bounds.Expand(triangle.v0);
+			bounds.Expand(triangle.v1);
+			bounds.Expand(triangle.v2);
+		}
+
+		const Float3 extents = bounds.max - bounds.min;
+		const float offset = 1e-4f * std::max(extents.x, std::max(extents.y, extents.z));
+		const Float3 camera = bounds.GetCentroid() + Float3(0.3f * extents.x, 0.8f * extents.y + 1.0f, -1.5f * extents.z - 1.0f);
+		const Float3 light = Normalize(Float3(0.3f, 1.0f, 0.2f));
+
+		std::mt19937 rng(17);
+		std::uniform_int_distribution<std::size_t> pick(0, scene.triangles.size() - 1);
+		std::uniform_real_distribution<float> barycentric(0.0f, 1.0f);
+
+		shadowRays.clear();
+		reflectionRays.clear();
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			const Triangle& triangle = scene.triangles[pick(rng)];
+
+			float u = barycentric(rng);
+			float v = barycentric(rng);
+
+			if (u + v > 1.0f)
+			{
+				u = 1.0f - u;
+				v = 1.0f - v;
+			}
+
+			const Float3 e1 = triangle.v1 - triangle.v0;
+			const Float3 e2 = triangle.v2 - triangle.v0;
+			const Float3 point = triangle.v0 + u * e1 + v * e2;
+			const Float3 cross = Cross(e1, e2);
+
+			if (!(Dot(cross, cross) > 0.0f))
+			{
+				--i;
+				continue;
+			}
+
+			// the side facing the camera
+			const Float3 view = Normalize(point - camera);
+			Float3 normal = Normalize(cross);
+			normal = (Dot(normal, view) > 0.0f) ? -1.0f * normal : normal;
+
+			const Float3 lightSide = (Dot(normal, light) >= 0.0f) ? normal : -1.0f * normal;
+			shadowRays.emplace_back(point + offset * lightSide, light);
+
+			const Float3 reflected = view - (2.0f * Dot(view, normal)) * normal;
+			reflectionRays.emplace_back(point + offset * normal, reflected);
+		}
+	}
+
+	void Run(const Scene& scene, const Options& options, std::vector<Result>& results)
+	{
+		std::vector<BVHTraversal::Ray> shadowRays;
+		std::vector<BVHTraversal::Ray> reflectionRays;
+		CreateRays(scene, options.rayCount, shadowRays, reflectionRays);
+
+		for (const BVHBuilder::BuildMode mode : options.modes)
+		{
+			for (const int width : options.widths)
+			{
+				for (const int quantization : options.quantizations)
+				{
+					// quantized bounds exist in the wide stream only
+					if (quantization != 0 && width == 2)
+					{
+						continue;
+					}
+
+					for (const BVHBuilder::LeafFormat leafFormat : options.leafFormats)
+					{
+						Result result;
+						result.scene = scene.name;
+						result.triangleCount = scene.triangles.size();
+						result.settings.mode = mode;
+						result.settings.width = width;
+						result.settings.quantization = quantization;
+						result.settings.leafFormat = leafFormat;
+						result.settings.threadCount = options.threadCount;
+
+						BVHBuilder builder;
+						result.buildTime = 1e30;
+
+						for (int r = 0; r < options.repeat; ++r)
+						{
+							builder.Build(scene.triangles, result.settings);
+							result.buildTime = std::min(result.buildTime, builder.GetStats().buildTime);
+						}
+
+						result.stats = builder.GetStats();
+
+						if (options.bTreeStats)
+						{
+							result.treeStats = BVHTreeStats::Compute(builder, scene.triangles.data());
+						}
+
+						const BVHTraversal traversal(builder.GetStream().data(), width, false, quantization, leafFormat, options.bOrdered);
+
+						// single threaded, best of the repeats
+						double shadowTime = 1e30;
+						double reflectionTime = 1e30;
+						std::size_t shadowHits = 0;
+						std::size_t reflectionHits = 0;
+
+						for (int r = 0; r < options.repeat; ++r)
+						{
+							shadowHits = 0;
+							reflectionHits = 0;
+
+							const auto shadowBegin = std::chrono::steady_clock::now();
+
+							for (const BVHTraversal::Ray& ray : shadowRays)
+							{
+								shadowHits += traversal.TraceShadow(ray) ? 1 : 0;
+							}
+
+							const auto reflectionBegin = std::chrono::steady_clock::now();
+
+							for (const BVHTraversal::Ray& ray : reflectionRays)
+							{
+								BVHTraversal::Hit hit;
+								reflectionHits += traversal.TraceReflection(ray, hit) ? 1 : 0;
+							}
+
+							const auto reflectionEnd = std::chrono::steady_clock::now();
+
+							shadowTime = std::min(shadowTime, std::chrono::duration<double>(reflectionBegin - shadowBegin).count());
+							reflectionTime = std::min(reflectionTime, std::chrono::duration<double>(reflectionEnd - reflectionBegin).count());
+						}
+
+						const double rayCount = double(std::max<std::size_t>(shadowRays.size(), 1));
+
+						result.shadowRaysPerSecond = shadowRays.size() / std::max(shadowTime, 1e-9);
+						result.reflectionRaysPerSecond = reflectionRays.size() / std::max(reflectionTime, 1e-9);
+						result.shadowHitRate = shadowHits / rayCount;
+						result.reflectionHitRate = reflectionHits / rayCount;
+
+						if (options.bCounters)
+						{
+							BVHTraversal::Counters shadowCounters;
+							BVHTraversal::Counters reflectionCounters;
+
+							for (const BVHTraversal::Ray& ray : shadowRays)
+							{
+								traversal.TraceShadow(ray, shadowCounters);
+							}
+
+							for (const BVHTraversal::Ray& ray : reflectionRays)
+							{
+								BVHTraversal::Hit hit;
+								traversal.TraceReflection(ray, hit, reflectionCounters);
+							}
+
+							result.shadowBoxTests = shadowCounters.boxTests / rayCount;
+							result.shadowTriangleTests = shadowCounters.triangleTests / rayCount;
+							result.shadowIterations = shadowCounters.iterations / rayCount;
+							result.reflectionBoxTests = reflectionCounters.boxTests / rayCount;
+							result.reflectionTriangleTests = reflectionCounters.triangleTests / rayCount;
+							result.reflectionIterations = reflectionCounters.iterations / rayCount;
+						}
+
+						std::fprintf(stderr, "%s %s width %d: %zu triangles built in %.1f ms, %.2f M shadow rays/s, %.2f M reflection rays/s\n",
+									 scene.name.c_str(), GetModeName(mode), width, result.triangleCount, result.buildTime,
+									 1e-6 * result.shadowRaysPerSecond, 1e-6 * result.reflectionRaysPerSecond);
+
+						results.push_back(result);
+					}
+				}
+			}
+		}
+	}
+
+	std::string Escape(const std::string& text)
+	{
+		std::string escaped;
+
+		for (const char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				escaped += '\\';
+			}
+
+			escaped += c;
+		}
+
+		return escaped;
+	}
+
+	// a figure of --tree-stats or --counters, missing rather than 0 when it was not computed. missing is null in JSON
+	// and an empty cell in CSV
+	template <typename T>
+	std::string FormatOptional(const bool bComputed, const T value, const char* missing)
+	{
+		if (!bComputed)
+		{
+			return missing;
+		}
+
+		std::ostringstream ss;
+		ss.precision(6);
+		ss << value;
+
+		return ss.str();
+	}
+
+	void WriteJson(std::ostream& stream, const Options& options, const std::vector<Result>& results)
+	{
+		stream << "{\n  \"label\": \"" << Escape(options.label) << "\",\n  \"rays\": " << options.rayCount << ",\n  \"ordered\": " << (options.bOrdered ? 1 : 0)
+			   << ",\n  \"results\": [\n";
+
+		for (std::size_t i = 0; i < results.size(); ++i)
+		{
+			const Result& result = results[i];
+			const BVHBuilder::BuildStats& stats = result.stats;
+
+			auto tree = [&](const auto value) { return FormatOptional(options.bTreeStats, value, "null"); };
+			auto counter = [&](const double value) { return FormatOptional(options.bCounters, value, "null"); };
+
+			stream << "    { \"scene\": \"" << Escape(result.scene) << "\", \"triangles\": " << result.triangleCount
+				   << ", \"mode\": \"" << GetModeName(result.settings.mode) << "\", \"width\": " << result.settings.width
+				   << ", \"quantization\": " << result.settings.quantization << ", \"leafFormat\": \"" << GetLeafFormatName(result.settings.leafFormat) << "\""
+				   << ", \"threads\": " << stats.threadCount << ", \"buildMs\": " << result.buildTime << ", \"peakMemory\": " << stats.peakMemory
+				   << ", \"nodes\": " << stats.nodeCount << ", \"leaves\": " << stats.leafCount << ", \"references\": " << stats.referenceCount
+				   << ", \"serializedBytes\": " << stats.serializedSize << ", \"sahCost\": " << stats.sahCost
+				   << ", \"epo\": " << tree(result.treeStats.epo) << ", \"overlap\": " << tree(result.treeStats.overlap) << ", \"maxDepth\": " << tree(result.treeStats.maxDepth)
+				   << ", \"shadowRaysPerSec\": " << result.shadowRaysPerSecond << ", \"reflectionRaysPerSec\": " << result.reflectionRaysPerSecond
+				   << ", \"shadowHitRate\": " << result.shadowHitRate << ", \"reflectionHitRate\": " << result.reflectionHitRate
+				   << ", \"shadowBoxTests\": " << counter(result.shadowBoxTests) << ", \"shadowTriangleTests\": " << counter(result.shadowTriangleTests)
+				   << ", \"shadowIterations\": " << counter(result.shadowIterations) << ", \"reflectionBoxTests\": " << counter(result.reflectionBoxTests)
+				   << ", \"reflectionTriangleTests\": " << counter(result.reflectionTriangleTests) << ", \"reflectionIterations\": " << counter(result.reflectionIterations) << " }"
+				   << ((i + 1 < results.size()) ? ",\n" : "\n");
+		}
+
+		stream << "  ]\n}\n";
+	}
+
+	void WriteCsv(std::ostream& stream, const Options& options, const std::vector<Result>& results)
+	{
+		stream << "label,ordered,scene,triangles,mode,width,quantization,leafFormat,threads,buildMs,peakMemory,nodes,leaves,references,"
+				  "serializedBytes,sahCost,epo,overlap,maxDepth,shadowRaysPerSec,reflectionRaysPerSec,shadowHitRate,reflectionHitRate,"
+				  "shadowBoxTests,shadowTriangleTests,shadowIterations,reflectionBoxTests,reflectionTriangleTests,reflectionIterations\n";
+
+		for (const Result& result : results)
+		{
+			const BVHBuilder::BuildStats& stats = result.stats;
+
+			auto tree = [&](const auto value) { return FormatOptional(options.bTreeStats, value, ""); };
+			auto counter = [&](const double value) { return FormatOptional(options.bCounters, value, ""); };
+
+			stream << options.label << "," << (options.bOrdered ? 1 : 0) << "," << result.scene << "," << result.triangleCount << "," << GetModeName(result.settings.mode) << ","
+				   << result.settings.width << "," << result.settings.quantization << "," << GetLeafFormatName(result.settings.leafFormat) << ","
+				   << stats.threadCount << "," << result.buildTime << "," << stats.peakMemory << "," << stats.nodeCount << "," << stats.leafCount << ","
+				   << stats.referenceCount << "," << stats.serializedSize << "," << stats.sahCost << "," << tree(result.treeStats.epo) << ","
+				   << tree(result.treeStats.overlap) << "," << tree(result.treeStats.maxDepth) << "," << result.shadowRaysPerSecond << ","
+				   << result.reflectionRaysPerSecond << "," << result.shadowHitRate << "," << result.reflectionHitRate << ","
+				   << counter(result.shadowBoxTests) << "," << counter(result.shadowTriangleTests) << "," << counter(result.shadowIterations) << ","
+				   << counter(result.reflectionBoxTests) << "," << counter(result.reflectionTriangleTests) << "," << counter(result.reflectionIterations) << "\n";
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		return 2;
+	}
+
+	std::vector<Result> results;
+
+	{
+		Scene bridge;
+
+		if (!options.mesh.empty() && LoadMesh(options.mesh, bridge))
+		{
+			Run(bridge, options, results);
+		}
+		else if (!options.mesh.empty())
+		{
+			std::fprintf(stderr, "%s not found, skipping the bridge\n", options.mesh.c_str());
+		}
+	}
+
+	// the extent of the reflective grid of the application, at a higher resolution
+	if (options.gridSize > 1)
+	{
+		Run(CreateGrid(50.0f, 50.0f, options.gridSize, options.gridSize), options, results);
+	}
+
+	for (const std::size_t size : options.sizes)
+	{
+		Run(CreateSoup(size, 1), options, results);
+	}
+
+	std::ofstream file;
+
+	if (!options.output.empty())
+	{
+		file.open(options.output);
+
+		if (!file)
+		{
+			std::fprintf(stderr, "could not write %s\n", options.output.c_str());
+			return 1;
+		}
+	}
+
+	std::ostream& stream = options.output.empty() ? std::cout : file;
+	stream.precision(6);
+
+	if (options.bCsv)
+	{
+		WriteCsv(stream, options, results);
+	}
+	else
+	{
+		WriteJson(stream, options, results);
+	}
+
+	return 0;
+}
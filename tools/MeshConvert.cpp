@@ -0,0 +1,65 @@
+// converts a CSV vertex dump to the binary mesh read by MeshFile
+// usage: MeshConvert models/bridge_ib_order.csv [models/bridge_ib_order.mesh]
+
+// std
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+//
+#include "MeshFile.h"
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::printf("usage: %s input.csv [output.mesh]\n", argv[0]);
+		return 2;
+	}
+
+	const std::string input = argv[1];
+	const std::string output = (argc > 2) ? std::string(argv[2]) : input.substr(0, input.rfind('.')) + ".mesh";
+
+	const auto importBegin = std::chrono::steady_clock::now();
+
+	std::vector<MeshFile::Vertex> vertices;
+	std::vector<MeshFile::Index> indices;
+
+	if (!MeshFile::ImportCsv(input, vertices, indices))
+	{
+		std::printf("could not import %s\n", input.c_str());
+		return 1;
+	}
+
+	const std::chrono::duration<double, std::milli> importTime = std::chrono::steady_clock::now() - importBegin;
+
+	if (!MeshFile::Write(output, vertices.data(), vertices.size(), indices.data(), indices.size()))
+	{
+		std::printf("could not write %s\n", output.c_str());
+		return 1;
+	}
+
+	// time the load the application does
+	const auto loadBegin = std::chrono::steady_clock::now();
+
+	MeshFile mesh;
+	const MeshFile::Status status = mesh.Open(output);
+
+	const std::chrono::duration<double, std::milli> loadTime = std::chrono::steady_clock::now() - loadBegin;
+
+	if (status != MeshFile::Status::Loaded)
+	{
+		std::printf("%s is %s\n", output.c_str(), MeshFile::GetStatusName(status));
+		return 1;
+	}
+
+	const AABB& bounds = mesh.GetBounds();
+
+	std::printf("%s: %zu vertices, %zu indices, bounds (%g %g %g) (%g %g %g), imported in %.2f ms, loads in %.2f ms\n",
+				output.c_str(), mesh.GetVertexCount(), mesh.GetIndexCount(),
+				bounds.min.x, bounds.min.y, bounds.min.z, bounds.max.x, bounds.max.y, bounds.max.z,
+				importTime.count(), loadTime.count());
+
+	return 0;
+}